@@ -28,6 +28,59 @@
 
 static char mem_buf [MAX_MEM_SIZE];
 
+// ================================================================
+// Symbol table of the last ELF file read, sorted by name.
+
+typedef struct {
+    char      *name;
+    uint64_t   value;
+} Elf_Symbol;
+
+static Elf_Symbol *symbols      = NULL;
+static size_t      n_symbols    = 0;
+static size_t      symbols_size = 0;
+
+static
+void symbols_clear (void)
+{
+    for (size_t j = 0; j < n_symbols; j++)
+	free (symbols [j].name);
+    n_symbols = 0;
+}
+
+static
+void symbols_add (const char *name, uint64_t value)
+{
+    if (n_symbols == symbols_size) {
+	size_t      new_size = ((symbols_size == 0) ? 1024 : (2 * symbols_size));
+	Elf_Symbol *p        = (Elf_Symbol *) realloc (symbols, new_size * sizeof (Elf_Symbol));
+	if (p == NULL) return;
+	symbols      = p;
+	symbols_size = new_size;
+    }
+    char *s = strdup (name);
+    if (s == NULL) return;
+    symbols [n_symbols].name  = s;
+    symbols [n_symbols].value = value;
+    n_symbols++;
+}
+
+static
+int symbol_cmp (const void *a, const void *b)
+{
+    return strcmp (((const Elf_Symbol *) a)->name, ((const Elf_Symbol *) b)->name);
+}
+
+int elf_symbol_lookup (const char *name, uint64_t *p_value)
+{
+    Elf_Symbol  key = { (char *) name, 0 };
+    Elf_Symbol *p   = (Elf_Symbol *) bsearch (& key, symbols, n_symbols, sizeof (Elf_Symbol), symbol_cmp);
+    if (p == NULL)
+	return 0;
+    *p_value = p->value;
+    return 1;
+}
+
 // ================================================================
 // Load an ELF file.
 // Return 1 on success, 0 on failure
@@ -164,6 +217,7 @@ int c_mem_load_elf (FILE          *logfile_fp,
     p_features->pc_start    = 0xFFFFFFFFFFFFFFFFllu;
     p_features->pc_exit     = 0xFFFFFFFFFFFFFFFFllu;
     p_features->tohost_addr = 0xFFFFFFFFFFFFFFFFllu;
+    p_features->n_writable  = 0;
 
     while ((scn = elf_nextscn (e,scn)) != NULL) {
         // get the header information for this section
@@ -206,6 +260,24 @@ int c_mem_load_elf (FILE          *logfile_fp,
 	    if (shdr.sh_type != SHT_NOBITS) {
 		memcpy (& (mem_buf [shdr.sh_addr]), data->d_buf, data->d_size);
 	    }
+
+	    // Remember sections the program may modify
+	    if ((shdr.sh_flags & SHF_WRITE) && (data->d_size != 0)) {
+		uint32_t j = p_features->n_writable;
+		if (j < ELF_WRITABLE_MAX) {
+		    p_features->writable [j].addr = shdr.sh_addr;
+		    p_features->writable [j].size = data->d_size;
+		    p_features->n_writable++;
+		}
+		else {
+		    Elf_Range *r   = & (p_features->writable [ELF_WRITABLE_MAX - 1]);
+		    uint64_t   lo  = ((shdr.sh_addr < r->addr) ? shdr.sh_addr : r->addr);
+		    uint64_t   hi1 = r->addr + r->size;
+		    uint64_t   hi2 = shdr.sh_addr + data->d_size;
+		    r->addr = lo;
+		    r->size = ((hi1 > hi2) ? hi1 : hi2) - lo;
+		}
+	    }
 	    if (logfile_fp != NULL) {
 		fprintf (logfile_fp, "addr %16" PRIx64 " to addr %16" PRIx64 "; size 0x%8lx (= %0ld) bytes\n",
 			 shdr.sh_addr, shdr.sh_addr + data->d_size, data->d_size, data->d_size);
@@ -237,6 +309,12 @@ int c_mem_load_elf (FILE          *logfile_fp,
 		// get the name of the symbol
 		char *name = elf_strptr (e, shdr.sh_link, sym.st_name);
 
+		// Remember all defined, named symbols (for elf_symbol_lookup)
+		if ((name != NULL) && (name [0] != 0) && (sym.st_shndx != SHN_UNDEF)
+		    && (GELF_ST_TYPE (sym.st_info) != STT_SECTION)
+		    && (GELF_ST_TYPE (sym.st_info) != STT_FILE))
+		    symbols_add (name, sym.st_value);
+
 		// Look for, and remember PC of the start symbol
 		if (strcmp (name, start_symbol) == 0) {
 		    p_features->pc_start = sym.st_value;
@@ -289,6 +367,8 @@ int c_mem_load_elf (FILE          *logfile_fp,
 
     elf_end (e);
 
+    qsort (symbols, n_symbols, sizeof (Elf_Symbol), symbol_cmp);
+
     p_features->mem_buf = & (mem_buf [0]);
 
     if (logfile_fp != NULL) {
@@ -321,6 +401,7 @@ int elf_readfile (FILE          *logfile_fp,
 {
     // Zero out the memory buffer before loading the ELF file
     bzero (mem_buf, MAX_MEM_SIZE);
+    symbols_clear ();
 
     int result = c_mem_load_elf (logfile_fp, elf_filename, "_start", "exit", "tohost", p_features);
     if (result == 0)
@@ -6,6 +6,17 @@
 // ================================================================
 // Features of the ELF binary
 
+// Loaded sections that the program may write (.data, .bss, ...).
+// If there are more than ELF_WRITABLE_MAX of them, the last range is
+// widened to cover the rest.
+
+#define ELF_WRITABLE_MAX  32
+
+typedef struct {
+    uint64_t  addr;
+    uint64_t  size;
+} Elf_Range;
+
 typedef struct {
     char     *mem_buf;
     uint8_t   bitwidth;
@@ -15,6 +26,9 @@ typedef struct {
     uint64_t  pc_start;       // Addr of label  '_start'
     uint64_t  pc_exit;        // Addr of label  'exit'
     uint64_t  tohost_addr;    // Addr of label  'tohost'
+
+    uint32_t  n_writable;
+    Elf_Range writable [ELF_WRITABLE_MAX];
 } Elf_Features;
 
 // ================================================================
@@ -27,3 +41,10 @@ int elf_readfile (FILE          *logfile_fp,
 		  Elf_Features  *p_features);
 
 // ================================================================
+// Look up a symbol in the symbol table of the last ELF file read
+// Return 1 if found (with its value in *p_value), 0 otherwise
+
+extern
+int elf_symbol_lookup (const char *name, uint64_t *p_value);
+
+// ================================================================
@@ -44,6 +44,7 @@ const uint16_t dm_addr_devtreeaddr0 = 0x19;
 const uint16_t dm_addr_authdata     = 0x30;
 const uint16_t dm_addr_haltregion0  = 0x40;
 const uint16_t dm_addr_haltregion31 = 0x5F;
+const uint16_t dm_addr_haltsum0     = 0x40;        // spec 0.13 (replaces haltregion0)
 const uint16_t dm_addr_verbosity    = 0x60;        // NON-STANDARD
 
 // ----------------
@@ -149,6 +150,13 @@ const uint16_t csr_addr_dpc         = 0x7B1;    // Debug PC
 const uint16_t csr_addr_dscratch0   = 0x7B2;    // Debug scratch0
 const uint16_t csr_addr_dscratch1   = 0x7B2;    // Debug scratch1
 
+// ----------------------------------------------------------------
+// Trigger CSR addresses
+
+const uint16_t csr_addr_tselect     = 0x7A0;    // Trigger select
+const uint16_t csr_addr_tdata1      = 0x7A1;    // Trigger data 1
+const uint16_t csr_addr_tdata2      = 0x7A2;    // Trigger data 2
+
 // ================================================================
 // Run Control DM register fields
 
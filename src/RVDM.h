@@ -30,6 +30,7 @@ extern const uint16_t dm_addr_devtreeaddr0;
 extern const uint16_t dm_addr_authdata;
 extern const uint16_t dm_addr_haltregion0;
 extern const uint16_t dm_addr_haltregion31;
+extern const uint16_t dm_addr_haltsum0;         // spec 0.13 (replaces haltregion0)
 extern const uint16_t dm_addr_verbosity;        // NON-STANDARD
 
 // ----------------
@@ -80,6 +81,13 @@ extern const uint16_t csr_addr_dpc;          // Debug PC
 extern const uint16_t csr_addr_dscratch0;    // Debug scratch
 extern const uint16_t csr_addr_dscratch1;    // Debug scratch
 
+// ----------------------------------------------------------------
+// Trigger CSR addresses
+
+extern const uint16_t csr_addr_tselect;      // Trigger select
+extern const uint16_t csr_addr_tdata1;       // Trigger data 1 (type and configuration)
+extern const uint16_t csr_addr_tdata2;       // Trigger data 2 (match address)
+
 // ================================================================
 // Run Control DM register fields
 
@@ -22,6 +22,12 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 
 // ----------------
 // Local includes
@@ -36,6 +42,9 @@ static Gdbstub_FE_Params gdbstub_params;
 static pthread_t         gdbstub_thread;
 static int               gdbstub_stop_pipe [2];
 
+// Our own open fd on the slave side of a PTY (see gdbstub_start_pty)
+static int               gdbstub_pty_slave_fd = -1;
+
 // ================================================================
 // Common helper to set up pipe and thread.
 
@@ -212,6 +221,147 @@ int gdbstub_start_tcp (FILE *logfile, unsigned short port)
     return ntohs (sa.sin_port);
 }
 
+// ================================================================
+// Serial and PTY links: raw mode, and a read () returns as soon as
+// there is a byte (VMIN 1, VTIME 0), with all the bytes available.
+// Serial ports on Linux are also set to ASYNC_LOW_LATENCY, so the
+// driver passes received bytes on at once instead of batching them.
+
+static const struct {
+    unsigned baud;
+    speed_t  speed;
+} tty_speeds [] = {
+    {   9600,   B9600 },
+    {  19200,  B19200 },
+    {  38400,  B38400 },
+    {  57600,  B57600 },
+    { 115200, B115200 },
+    { 230400, B230400 },
+#ifdef B460800
+    { 460800, B460800 },
+#endif
+#ifdef B921600
+    { 921600, B921600 },
+#endif
+#ifdef B1000000
+    { 1000000, B1000000 },
+#endif
+#ifdef B2000000
+    { 2000000, B2000000 },
+#endif
+#ifdef B3000000
+    { 3000000, B3000000 },
+#endif
+#ifdef B4000000
+    { 4000000, B4000000 },
+#endif
+};
+
+static
+int tty_configure (int fd, unsigned baud)
+{
+    struct termios tio;
+
+    if (tcgetattr (fd, & tio) < 0) {
+	fprintf (stderr, "ERROR: Failed to get terminal attributes: %s\n", strerror (errno));
+	return -1;
+    }
+
+    cfmakeraw (& tio);
+    tio.c_cflag |= (CLOCAL | CREAD);
+#ifdef CRTSCTS
+    tio.c_cflag &= ~CRTSCTS;
+#endif
+    tio.c_cc [VMIN]  = 1;
+    tio.c_cc [VTIME] = 0;
+
+    if (baud != 0) {
+	size_t j;
+	for (j = 0; j < (sizeof (tty_speeds) / sizeof (tty_speeds [0])); j++)
+	    if (tty_speeds [j].baud == baud)
+		break;
+	if (j == (sizeof (tty_speeds) / sizeof (tty_speeds [0]))) {
+	    fprintf (stderr, "ERROR: Unsupported baud rate %u\n", baud);
+	    return -1;
+	}
+	cfsetispeed (& tio, tty_speeds [j].speed);
+	cfsetospeed (& tio, tty_speeds [j].speed);
+    }
+
+    if (tcsetattr (fd, TCSANOW, & tio) < 0) {
+	fprintf (stderr, "ERROR: Failed to set terminal attributes: %s\n", strerror (errno));
+	return -1;
+    }
+
+#if defined (__linux__) && defined (ASYNC_LOW_LATENCY)
+    // Not an error if unsupported (e.g., on a PTY)
+    struct serial_struct ss;
+    if (ioctl (fd, TIOCGSERIAL, & ss) == 0) {
+	ss.flags |= ASYNC_LOW_LATENCY;
+	ioctl (fd, TIOCSSERIAL, & ss);
+    }
+#endif
+
+    tcflush (fd, TCIOFLUSH);
+    return 0;
+}
+
+// ================================================================
+// Spawn a new thread for main_gdbstub on a new pseudo-terminal.
+// We keep the slave side open ourselves, so that reads on the master
+// wait for GDB instead of failing while GDB has not opened it (yet, or
+// again after disconnecting).
+
+int gdbstub_start_pty (FILE *logfile, char *slave_name, size_t slave_name_size)
+{
+    int master_fd = posix_openpt (O_RDWR | O_NOCTTY);
+    if (master_fd < 0) {
+	fprintf (stderr, "ERROR: Failed to open a PTY: %s\n", strerror (errno));
+	return -1;
+    }
+
+    if ((grantpt (master_fd) < 0)
+	|| (unlockpt (master_fd) < 0)
+	|| (ptsname_r (master_fd, slave_name, slave_name_size) != 0)) {
+	fprintf (stderr, "ERROR: Failed to set up the PTY: %s\n", strerror (errno));
+	close (master_fd);
+	return -1;
+    }
+
+    gdbstub_pty_slave_fd = open (slave_name, O_RDWR | O_NOCTTY);
+    if ((gdbstub_pty_slave_fd < 0) || (tty_configure (master_fd, 0) < 0)) {
+	fprintf (stderr, "ERROR: Failed to configure PTY %s\n", slave_name);
+	if (gdbstub_pty_slave_fd >= 0)
+	    close (gdbstub_pty_slave_fd);
+	gdbstub_pty_slave_fd = -1;
+	close (master_fd);
+	return -1;
+    }
+
+    gdbstub_start_fd (logfile, master_fd);
+    return 0;
+}
+
+// ================================================================
+// Spawn a new thread for main_gdbstub on a serial port
+
+int gdbstub_start_serial (FILE *logfile, const char *device, unsigned baud)
+{
+    int fd = open (device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+	fprintf (stderr, "ERROR: Failed to open %s: %s\n", device, strerror (errno));
+	return -1;
+    }
+
+    if (tty_configure (fd, baud) < 0) {
+	close (fd);
+	return -1;
+    }
+
+    gdbstub_start_fd (logfile, fd);
+    return 0;
+}
+
 // ================================================================
 // Stop the gdbstub thread.
 
@@ -228,6 +378,11 @@ void gdbstub_stop (void)
 void gdbstub_join (void)
 {
     pthread_join (gdbstub_thread, NULL);
+
+    if (gdbstub_pty_slave_fd >= 0) {
+	close (gdbstub_pty_slave_fd);
+	gdbstub_pty_slave_fd = -1;
+    }
 }
 
 // ================================================================
@@ -11,8 +11,13 @@
 // ****************************************************************
 // ****************************************************************
 
+// XLEN (32 or 64) of the harts; 64 unless set, or read from an ELF file
+
+extern
+uint8_t gdbstub_be_xlen (void);
+
 extern
-uint8_t gdbstub_be_xlen;
+uint32_t gdbstub_be_set_xlen (const uint8_t xlen);
 
 // ================================================================
 // Spawn a new thread for main_gdbstub with a pipe set up for later
@@ -30,6 +35,22 @@ void gdbstub_start_fd (FILE *logfile, int gdb_fd);
 extern
 int gdbstub_start_tcp (FILE *logfile, unsigned short port);
 
+// ================================================================
+// Spawn a new thread for main_gdbstub on a new pseudo-terminal, for
+// GDB's 'target remote /dev/pts/N'.  The slave's name is returned in
+// slave_name.  Returns 0, or -1 on error.
+
+extern
+int gdbstub_start_pty (FILE *logfile, char *slave_name, size_t slave_name_size);
+
+// ================================================================
+// Spawn a new thread for main_gdbstub on a serial port (e.g.,
+// "/dev/ttyUSB0"), set to raw mode at 'baud' (0: leave as is).
+// Returns 0, or -1 on error.
+
+extern
+int gdbstub_start_serial (FILE *logfile, const char *device, unsigned baud);
+
 // ================================================================
 // Stop the gdbstub thread.
 
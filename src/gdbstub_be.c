@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <time.h>
+#include <sys/stat.h>
 
 // ----------------
 // Local includes
@@ -43,6 +44,10 @@
 
 #define min(x,y)  (((x)<(y)) ? (x) : (y))
 
+// RISC-V ebreak and c.ebreak encodings
+#define INSTR_EBREAK    0x00100073
+#define INSTR_C_EBREAK  0x9002
+
 // In mem_read/mem_write: logging of data bytes transferred
 //     verbosity =  0: no logging of data
 //     verbosity =  1: log up to first 64 bytes
@@ -59,6 +64,138 @@ static bool autoclose_logfile = false;
 
 static uint32_t orig_dcsr;
 
+// ----------------
+// Write stream (see gdbstub_be_mem_write_stream): while open, sbcs is
+// set up for 32-bit autoincrement writes and sbaddress is the word
+// containing wstream_next, the next byte expected; the first
+// (wstream_next & 3) bytes of that word wait in wstream_tail.
+// A Debug Module recovery closes the stream (it rewrites sbcs), and
+// the next flush reports the writes that were lost (wstream_lost).
+
+static bool     wstream_open      = false;
+static bool     wstream_lost      = false;
+static uint64_t wstream_next      = 0;
+static uint8_t  wstream_tail [4];
+static uint64_t wstream_n_writes  = 0;
+static uint64_t wstream_n_streams = 0;
+static uint64_t wstream_n_errors  = 0;
+
+// ----------------
+// Snapshot of GPRs and PC (dpc) while the hart is halted, so that each
+// is read from the Debug Module at most once per stop.
+// Bit j of regs_snapshot_valid: regs_snapshot [j] is valid (x0..x31, 32 = PC)
+// Invalidated whenever the hart may run or be reset.
+
+static uint64_t regs_snapshot_valid = 0;
+static uint64_t regs_snapshot [33];
+
+static
+void regs_snapshot_invalidate (void)
+{
+    regs_snapshot_valid = 0;
+}
+
+// Index into regs_snapshot for a DM register number, or -1 if not cached
+static
+int32_t regs_snapshot_index (uint16_t dm_regnum)
+{
+    if ((dm_regnum >= dm_command_access_reg_regno_gpr_0)
+	&& (dm_regnum < (dm_command_access_reg_regno_gpr_0 + 32)))
+	return (dm_regnum - dm_command_access_reg_regno_gpr_0);
+    else if (dm_regnum == csr_addr_dpc)
+	return 32;
+    else
+	return -1;
+}
+
+// ----------------
+// The selected hart (dmcontrol.hartsel): register accesses, step,
+// continue and stop act on it.  See 'Harts' below.
+
+static uint32_t be_hartsel = 0;
+
+// We use only the first hart array window, so at most BE_HARTS_MAX harts
+#define BE_HARTS_MAX  32
+
+#define BE_HARTSELLO  ((uint16_t) (be_hartsel & 0x3FF))
+#define BE_HARTSELHI  ((uint16_t) ((be_hartsel >> 10) & 0x3FF))
+
+// Harts resumed together with the hart array mask (0 if none are running so)
+static uint32_t group_mask = 0;
+
+// hawindow as we last wrote it (hawindowsel is always 0).
+// The DM clears it when dmactive is cleared.
+static uint32_t hawindow_cache       = 0;
+static bool     hawindow_cache_valid = false;
+
+// Bit h: dcsr.step of hart h is known to be clear.
+// Forgotten on resets and on writes to dcsr from outside.
+static uint32_t dcsr_step_clear = 0;
+
+// Interrupts while stepping: see 'dcsr.stepie policy' below.
+// Bit h of stepie_saved: dcsr.stepie of hart h was changed for
+// stepping, and is to be restored to bit h of stepie_orig on continue.
+static BE_Stepie stepie_policy = BE_STEPIE_KEEP;
+static uint32_t  stepie_saved  = 0;
+static uint32_t  stepie_orig   = 0;
+static uint64_t  stepie_n_steps;      // steps with stepie changed by us
+static uint64_t  stepie_n_masked;     // ... of which an interrupt was pending and enabled
+
+// dcsr.cause at the last halt reported by gdbstub_be_get_stop_reason
+static DM_DCSR_Cause last_halt_cause = DM_DCSR_CAUSE_RESERVED0;
+
+// ----------------
+// Debug Module capabilities: the static properties of the DM, read once
+// (on first use) and kept until the DM is reset (dmactive cleared).
+// See 'Debug Module capabilities' below.
+
+typedef struct {
+    bool      valid;
+    // dmstatus
+    uint8_t   version;             // 2: 0.13, 3: 1.0
+    bool      authenticated;
+    bool      impebreak;
+    bool      hasresethaltreq;
+    bool      confstrptrvalid;
+    // dmcontrol
+    uint8_t   hartsellen;          // implemented bits of hartsel
+    bool      hasel;               // hart array mask (hasel, hawindow) implemented
+    uint32_t  n_harts;             // harts 0 .. n_harts-1 exist (at most BE_HARTS_MAX)
+    // hartinfo (of the hart selected at discovery)
+    uint32_t  hartinfo_hart;
+    uint8_t   nscratch;
+    bool      dataaccess;
+    uint8_t   datasize;
+    uint16_t  dataaddr;
+    // abstractcs
+    uint8_t   datacount;
+    uint8_t   progbufsize;
+    bool      quick_probed;        // quick_access is known (see quick_probe)
+    bool      quick_access;        // abstract command type 1
+    // sbcs
+    uint8_t   sbversion;
+    uint8_t   sbasize;             // 0: no System Bus Access
+    uint8_t   sbaccess_mask;       // bit j: sbaccess j (8 << j bits) supported
+} DM_Caps;
+
+static DM_Caps dm_caps_cache = { .valid = false };
+
+// The CSR read by the Quick Access program now in progbuf (-1: none),
+// and CSR sampling statistics.  See 'Sampling CSRs of a running hart' below.
+static int32_t  quick_prog_csr       = -1;
+static uint64_t sample_n_quick       = 0;
+static uint64_t sample_t_quick       = 0;    // usecs
+static uint64_t sample_n_haltresume  = 0;
+static uint64_t sample_t_haltresume  = 0;
+static uint64_t sample_n_halted      = 0;    // hart was already halted: plain reads
+
+static
+void dm_caps_invalidate (void)
+{
+    dm_caps_cache.valid = false;
+    quick_prog_csr      = -1;
+}
+
 // ================================================================
 // Run-mode
 
@@ -72,9 +209,240 @@ static Run_Mode run_mode = PAUSED;
 static uint32_t numHaltChecks = 0;
 static uint32_t CPU_TIMEOUT = (~ ((uint32_t) 0));
 
+// ================================================================
+// Real-time clock, in microseconds (see gdbstub_be.h)
+
+uint64_t usecs_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (((uint64_t) ts.tv_sec) * 1000000) + (((uint64_t) ts.tv_nsec) / 1000);
+}
+
+// ================================================================
+// Debug Module health
+// Failures of the Debug Module itself (as opposed to the hart) are
+// classified, counted, and recovered from with an escalating sequence,
+// each step bounded in time:
+//   1. clear abstractcs.cmderr, sbcs.sberror and sbcs.sbbusyerror
+//   2. toggle dmcontrol.dmactive (resets the DM, but not the hart)
+//   3. pulse dmcontrol.ndmreset (resets the hart!), only if permitted
+// Recovery is attempted when a DM poll times out.  After a failed
+// recovery, further attempts are held off for a while, so that a dead
+// DM does not multiply the cost of every access.
+
+typedef enum { DM_FAULT_ABSTRACT_BUSY,      // abstractcs.busy stuck
+	       DM_FAULT_SB_BUSY,            // sbcs.sbbusy stuck
+	       DM_FAULT_DMACTIVE_LOST,      // dmcontrol.dmactive reads 0
+	       DM_FAULT_MANUAL,             // 'monitor dm_recover'
+	       DM_FAULT_N
+} DM_Fault;
+
+static const char *dm_fault_names [DM_FAULT_N] = { "abstractcs.busy stuck",
+						   "sbcs.sbbusy stuck",
+						   "dmactive dropped",
+						   "manual" };
+
+#define DM_RECOVER_STEPS           3
+#define DM_RECOVER_STEP_USECS      100000
+#define DM_RECOVER_SETTLE_USECS     10000    // for busy bits to clear after a step
+#define DM_RECOVER_HOLDOFF_USECS  2000000
+
+static const char *dm_recover_step_names [DM_RECOVER_STEPS] = { "clear errors",
+								"dmactive toggle",
+								"ndmreset" };
+
+static bool     dm_ndmreset_allowed = false;
+static bool     dm_in_recovery      = false;
+static uint64_t dm_t_failed         = 0;    // usecs; 0 if last recovery succeeded
+
+// Invalidation hooks (see gdbstub_be_register_invalidate)
+#define DM_INVALIDATE_HOOKS_MAX  16
+
+static BE_Invalidate_Fn dm_invalidate_hooks [DM_INVALIDATE_HOOKS_MAX];
+static uint32_t         dm_n_invalidate_hooks = 0;
+
+// Metrics
+static uint64_t dm_n_faults [DM_FAULT_N];
+static uint64_t dm_n_recovered [DM_RECOVER_STEPS];
+static uint64_t dm_n_unrecovered   = 0;
+static uint64_t dm_n_held_off      = 0;
+static uint64_t dm_t_recover_last  = 0;     // usecs
+static uint64_t dm_t_recover_max   = 0;
+static uint64_t dm_t_recover_total = 0;
+
+// Is the DM idle and error-free?  Waits (up to deadline) for busy bits to clear.
+static
+bool dm_healthy (uint64_t deadline)
+{
+    while (true) {
+	uint32_t dmcontrol  = dmi_read (dm_addr_dmcontrol);
+	uint32_t abstractcs = dmi_read (dm_addr_abstractcs);
+	uint32_t sbcs       = dmi_read (dm_addr_sbcs);
+	if (fn_dmcontrol_dmactive (dmcontrol)
+	    && (! fn_abstractcs_busy (abstractcs))
+	    && (fn_abstractcs_cmderr (abstractcs) == 0)
+	    && (! fn_sbcs_sbbusy (sbcs))
+	    && (! fn_sbcs_sbbusyerror (sbcs))
+	    && (fn_sbcs_sberror (sbcs) == DM_SBERROR_NONE))
+	    return true;
+	if (usecs_now () >= deadline)
+	    return false;
+	usleep (1);
+    }
+}
+
+// Write dmcontrol.dmactive and wait for it to read back
+static
+bool dm_set_dmactive (bool dmactive, uint64_t deadline)
+{
+    uint32_t dmcontrol = fn_mk_dmcontrol (false,          // haltreq
+					  false,          // resumereq
+					  false,          // hartreset
+					  false,          // ackhavereset
+					  false,          // hasel
+					  BE_HARTSELLO,   // hartsello
+					  BE_HARTSELHI,   // hartselhi
+					  false,          // setresethaltreq
+					  false,          // clrresethaltreq
+					  false,          // ndmreset
+					  dmactive);      // dmactive
+    dmi_write (dm_addr_dmcontrol, dmcontrol);
+    if (! dmactive) {
+	hawindow_cache_valid = false;
+	dm_caps_invalidate ();
+    }
+    while (fn_dmcontrol_dmactive (dmi_read (dm_addr_dmcontrol)) != dmactive) {
+	if (usecs_now () >= deadline)
+	    return false;
+	usleep (1);
+    }
+    return true;
+}
+
+// Forget everything cached about the hart here, then in each module
+// that registered a hook
+static
+void dm_invalidate (bool hart_reset)
+{
+    regs_snapshot_invalidate ();
+    dcsr_step_clear = 0;
+    stepie_saved    = 0;
+    if (hart_reset)
+	group_mask = 0;
+    if (wstream_open) {
+	wstream_open = false;
+	wstream_lost = true;
+    }
+
+    for (uint32_t j = 0; j < dm_n_invalidate_hooks; j++)
+	dm_invalidate_hooks [j] (gdbstub_be_xlen (), hart_reset);
+}
+
+static
+uint32_t dm_recover (DM_Fault fault)
+{
+    uint64_t t0         = usecs_now ();
+    int      step       = 0;
+    bool     ok         = false;
+    bool     hart_reset = false;
+
+    dm_in_recovery = true;
+    regs_snapshot_invalidate ();
+
+    for (step = 0; (step < DM_RECOVER_STEPS) && (! ok); step++) {
+	uint64_t deadline = usecs_now () + DM_RECOVER_STEP_USECS;
+	if (step == 0) {
+	    dmi_write (dm_addr_abstractcs, fn_mk_abstractcs (DM_ABSTRACTCS_CMDERR_OTHER));
+	    dmi_write (dm_addr_sbcs, fn_mk_sbcs (true,                      // sbbusyerror (W1C)
+						 false,                     // sbreadonaddr
+						 DM_SBACCESS_32_BIT,        // sbaccess
+						 false,                     // sbautoincrement
+						 false,                     // sbreadondata
+						 DM_SBERROR_UNDEF7_W1C));   // Clear sberror
+	}
+	else if (step == 1) {
+	    if (! dm_set_dmactive (false, deadline))
+		continue;
+	    if (! dm_set_dmactive (true, deadline))
+		continue;
+	}
+	else {
+	    if (! dm_ndmreset_allowed) {
+		if (logfile_fp != NULL)
+		    fprintf (logfile_fp, "    dm_recover: ndmreset not permitted ('monitor dm_recover_ndmreset on')\n");
+		continue;
+	    }
+	    gdbstub_be_ndm_reset (gdbstub_be_xlen (), true);
+	    hart_reset = true;
+	}
+	ok = dm_healthy (usecs_now () + DM_RECOVER_SETTLE_USECS);
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp, "    dm_recover: %s: %s\n",
+		     dm_recover_step_names [step], (ok ? "recovered" : "not recovered"));
+    }
+
+    // Everything cached about the hart may be stale now.  The hooks run
+    // while dm_in_recovery is still set, so that their own DM faults
+    // do not start another recovery.
+    dm_invalidate (hart_reset);
+    dm_in_recovery = false;
+
+    uint64_t usecs = usecs_now () - t0;
+    dm_t_recover_last   = usecs;
+    dm_t_recover_total += usecs;
+    if (usecs > dm_t_recover_max)
+	dm_t_recover_max = usecs;
+    if (ok) {
+	dm_n_recovered [step - 1]++;
+	dm_t_failed = 0;
+    }
+    else {
+	dm_n_unrecovered++;
+	dm_t_failed = usecs_now ();
+    }
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "dm_recover (%s): %s in %0" PRId64 " usecs\n",
+		 dm_fault_names [fault], (ok ? "recovered" : "FAILED"), usecs);
+	fflush (logfile_fp);
+    }
+    return (ok ? status_ok : status_err);
+}
+
+// Called when a DM poll times out.  A dropped dmactive explains any
+// other symptom, so it is checked first.  Returns status_ok if the DM
+// was recovered (the failed access itself is not retried).
+
+static
+uint32_t dm_fault (char *dbg_string, DM_Fault fault)
+{
+    if (dm_in_recovery)
+	return status_err;
+
+    if (! fn_dmcontrol_dmactive (dmi_read (dm_addr_dmcontrol)))
+	fault = DM_FAULT_DMACTIVE_LOST;
+    dm_n_faults [fault]++;
+
+    if (logfile_fp != NULL)
+	fprintf (logfile_fp, "    %s: Debug Module fault: %s\n", dbg_string, dm_fault_names [fault]);
+
+    if ((dm_t_failed != 0) && ((usecs_now () - dm_t_failed) < DM_RECOVER_HOLDOFF_USECS)) {
+	dm_n_held_off++;
+	return status_err;
+    }
+    return dm_recover (fault);
+}
+
 // ================================================================
 // Poll dmstatus until ((dmstatus & mask) == value)
 // Return status, and dmstatus value.
+// The timeout is a real-time deadline.  The first few polls are made
+// back-to-back (a DMI read is itself slow on most transports, and most
+// conditions are met immediately); after that we sleep between polls.
+
+#define POLL_DMSTATUS_TIMEOUT_USECS  1000000
+#define POLL_DMSTATUS_SPINS          8
 
 static
 uint32_t poll_dmstatus (char      *dbg_string,
@@ -83,93 +451,109 @@ uint32_t poll_dmstatus (char      *dbg_string,
 			uint32_t  *p_dmstatus,
 			bool       commands_preempt)
 {
-    uint32_t usecs = 0;
+    uint64_t t0    = usecs_now ();
+    uint64_t usecs = 0;
+    uint32_t n     = 0;
 
     while (true) {
+	*p_dmstatus = dmi_read (dm_addr_dmstatus);
+
+	if ((*p_dmstatus & mask) == value) {
+	    return status_ok;
+	}
+
+	usecs = usecs_now () - t0;
+
 	// Timeout
-	if (usecs >= 1000000) {
+	if (usecs >= POLL_DMSTATUS_TIMEOUT_USECS) {
 	    if (logfile_fp != NULL) {
 	      fprintf (logfile_fp,
-		       "    %s: polled dmstatus %0d usecs; mask 0x%0x, value 0x%0x; timeout\n",
+		       "    %s: polled dmstatus %0" PRId64 " usecs; mask 0x%0x, value 0x%0x; timeout\n",
 		       dbg_string, usecs, mask, value);
 	    }
+	    // A hart that does not halt/resume/reset is not a DM fault; a dead DM is
+	    if ((! dm_in_recovery) && (! fn_dmcontrol_dmactive (dmi_read (dm_addr_dmcontrol))))
+		dm_fault (dbg_string, DM_FAULT_DMACTIVE_LOST);
 	    return status_err;
 	}
-	*p_dmstatus = dmi_read (dm_addr_dmstatus);
-
-	if ((*p_dmstatus & mask) == value) {
-	    return status_ok;
-	}
 
 	if (verbosity == 2)
 	    if (logfile_fp != NULL) {
 		fprintf (logfile_fp,
-			 "    %s: polling dmstatus: busy (%d usecs)\n",
+			 "    %s: polling dmstatus: busy (%" PRId64 " usecs)\n",
 			 dbg_string, usecs);
 	    }
 
 	if (gdbstub_be_poll_preempt (commands_preempt)) {
 	    if (logfile_fp != NULL) {
 	      fprintf (logfile_fp,
-		       "    %s: polled dmstatus %0d usecs; mask 0x%0x, value 0x%0x; preempted\n",
+		       "    %s: polled dmstatus %0" PRId64 " usecs; mask 0x%0x, value 0x%0x; preempted\n",
 		       dbg_string, usecs, mask, value);
 	    }
 	    return status_err;
 	}
 
-	usleep (1);
-	usecs += 1;
+	if (n >= POLL_DMSTATUS_SPINS)
+	    usleep (1);
+	else
+	    n++;
     }
 }
 
 // ================================================================
 // Poll abstractcs until not-busy or error.
 // Return status, and abstractcs value.
+// The timeout is a real-time deadline; on timeout, DM recovery is attempted.
+
+#define POLL_ABSTRACTCS_TIMEOUT_USECS  1000000
 
 static
 uint32_t poll_abstractcs_until_notbusy (char      *dbg_string,
 					uint32_t  *p_abstractcs)
 {
-    uint32_t usecs = 0;
+    uint64_t t0    = usecs_now ();
+    uint64_t usecs = 0;
 
     // Assuming abstractcs.cmderr == 0 in the HW
     while (true) {
+	*p_abstractcs = dmi_read (dm_addr_abstractcs);
+
+	if (! fn_abstractcs_busy (*p_abstractcs)) {
+	    return status_ok;
+	}
+
+	usecs = usecs_now () - t0;
+
 	// Timeout condition
-	if (usecs > 1000000) {
+	if (usecs >= POLL_ABSTRACTCS_TIMEOUT_USECS) {
 	    if (logfile_fp != NULL) {
 		fprintf (logfile_fp,
-			 "    %s: polling abstractcs: busy for > 1 sec\n",
-			 dbg_string);
+			 "    %s: polling abstractcs: busy for %0" PRId64 " usecs\n",
+			 dbg_string, usecs);
 		fprintf (logfile_fp,
 			 "    timeout\n");
 	    }
+	    dm_fault (dbg_string, DM_FAULT_ABSTRACT_BUSY);
 	    return status_err;
 	}
 
-	*p_abstractcs = dmi_read (dm_addr_abstractcs);
-
-	if (! fn_abstractcs_busy (*p_abstractcs)) {
-	    return status_ok;
-	}
-
 	if (verbosity == 2)
 	    if (logfile_fp != NULL) {
 		fprintf (logfile_fp,
-			 "    %s: polling abstractcs: busy (%d usecs)\n",
+			 "    %s: polling abstractcs: busy (%" PRId64 " usecs)\n",
 			 dbg_string, usecs);
 	    }
 
 	if (gdbstub_be_poll_preempt (false)) {
 	    if (logfile_fp != NULL) {
 		fprintf (logfile_fp,
-			 "    %s: polling abstractcs: preempted (%d usecs)\n",
+			 "    %s: polling abstractcs: preempted (%" PRId64 " usecs)\n",
 			 dbg_string, usecs);
 	    }
 	    return status_err;
 	}
 
 	usleep (1);
-	usecs += 1;
     }
 }
 
@@ -202,6 +586,84 @@ uint8_t check_abstractcs_error (char* dbg_string, uint32_t abstractcs)
     return cmderr;
 }
 
+// ================================================================
+// Optimistic abstract commands
+
+// Most DMs complete an abstract register access within one DMI round
+// trip, so polling abstractcs after every command mostly costs a DMI
+// read.  Inside an optimistic batch (abs_batch_begin/abs_batch_end),
+// register reads take data0/data1 right after writing the command, and
+// register writes do not wait for their command to finish.  The batch
+// is checked once, at the end, with a single abstractcs poll.
+
+// An overrun (data0 accessed, or a command written, while the DM is
+// still busy) sets the sticky abstractcs.cmderr to 'busy', and the DM
+// ignores further commands until it is cleared.  So if cmderr is
+// non-zero at the end of the batch, we clear it, and the caller redoes
+// the whole batch with polling (which also reports any real error).
+// If overruns are frequent on this target, optimistic batches are
+// turned off for the rest of the session.
+
+#define ABS_OPT_MIN_BATCHES   16    // before judging the overrun rate
+#define ABS_OPT_MAX_RATIO      8    // off if more than 1 in this many batches overrun
+
+static bool     abs_opt_allowed  = true;     // 'monitor abstract_optimistic on|off'
+static bool     abs_opt_off      = false;    // turned off by overruns
+static bool     abs_in_batch     = false;
+static uint64_t abs_n_batches    = 0;
+static uint64_t abs_n_overruns   = 0;
+static uint64_t abs_n_errors     = 0;        // other non-zero cmderr at the end of a batch
+
+// Start a batch; returns true if it is optimistic (else, the caller
+// does its accesses with polling as usual)
+static
+bool abs_batch_begin (void)
+{
+    abs_in_batch = (abs_opt_allowed && (! abs_opt_off));
+    return abs_in_batch;
+}
+
+// End an optimistic batch: status_ok if all its accesses succeeded,
+// status_err if the caller must redo them with polling.
+static
+uint32_t abs_batch_end (char *dbg_string)
+{
+    abs_in_batch = false;
+    abs_n_batches++;
+
+    uint32_t abstractcs;
+    uint32_t status = poll_abstractcs_until_notbusy (dbg_string, & abstractcs);
+    if (status != status_ok)
+	return status_err;
+
+    uint8_t cmderr = fn_abstractcs_cmderr (abstractcs);
+    if (cmderr == 0)
+	return status_ok;
+
+    dmi_write (dm_addr_abstractcs, fn_mk_abstractcs (DM_ABSTRACTCS_CMDERR_OTHER));
+    if (cmderr == DM_ABSTRACTCS_CMDERR_BUSY)
+	abs_n_overruns++;
+    else
+	abs_n_errors++;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "    %s: optimistic batch", dbg_string);
+	fprint_abstractcs_cmderr (logfile_fp, ": abstractcs.cmderr: ", cmderr, "; redo with polling\n");
+    }
+
+    if ((abs_n_batches >= ABS_OPT_MIN_BATCHES)
+	&& ((abs_n_overruns * ABS_OPT_MAX_RATIO) > abs_n_batches)) {
+	abs_opt_off = true;
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp,
+		     "    %s: %0" PRId64 " overruns in %0" PRId64 " optimistic batches; turned off\n",
+		     dbg_string, abs_n_overruns, abs_n_batches);
+    }
+    if (logfile_fp != NULL)
+	fflush (logfile_fp);
+    return status_err;
+}
+
 // ================================================================
 // For System Bus access commands, wait until non-busy
 
@@ -212,7 +674,9 @@ uint32_t  gdbstub_be_wait_for_sb_nonbusy (uint32_t  *p_sbcs)
 {
     uint32_t sbcs;
     bool     sbbusy;
-    uint32_t usecs = 0;
+    uint64_t t0    = usecs_now ();
+    uint64_t usecs = 0;
+    uint32_t n     = 0;
     if (logfile_fp != NULL) {
 	fprintf (logfile_fp, "gdbstub_be_wait_for_sb_nonbusy\n");
     }
@@ -221,36 +685,81 @@ uint32_t  gdbstub_be_wait_for_sb_nonbusy (uint32_t  *p_sbcs)
 	sbbusy  = fn_sbcs_sbbusy (sbcs);
 	if (! sbbusy) break;
 
+	usecs = usecs_now () - t0;
 	if (usecs > SB_TIMEOUT_USECS) {
 	    if (logfile_fp != NULL) {
 		fprintf (logfile_fp,
-			 "gdbstub_be_wait_for_sb_nonbusy: TIMEOUT (> %0d usecs)\n", usecs);
+			 "gdbstub_be_wait_for_sb_nonbusy: TIMEOUT (%0" PRId64 " usecs)\n", usecs);
 	    }
+	    dm_fault ("gdbstub_be_wait_for_sb_nonbusy", DM_FAULT_SB_BUSY);
 	    return status_err;
 	}
 
 	if (gdbstub_be_poll_preempt (false)) {
 	    if (logfile_fp != NULL) {
 		fprintf (logfile_fp,
-			 "gdbstub_be_wait_for_sb_nonbusy: preempted (%0d usecs)\n", usecs);
+			 "gdbstub_be_wait_for_sb_nonbusy: preempted (%0" PRId64 " usecs)\n", usecs);
 	    }
 	    return status_err;
 	}
 
 	usleep (1);
-	usecs += 1;
+	n++;
     }
-    if (usecs > 100)
+    if (n > 100)
 	if (logfile_fp != NULL) {
 	    fprintf (logfile_fp,
-		     "INFO: gdbstub_be_wait_for_sb_nonbusy: %0d polls (extend usleep time?)\n",
-		     usecs);
+		     "INFO: gdbstub_be_wait_for_sb_nonbusy: %0d polls, %0" PRId64 " usecs\n",
+		     n, usecs);
 	}
 
     if (p_sbcs != NULL) *p_sbcs = sbcs;
     return status_ok;
 }
 
+// ================================================================
+// XLEN-specialized register and System Bus paths
+// (gdbstub_be_xlen_template.h, instantiated here for RV32 and RV64)
+
+static inline uint32_t byte_src_word (BE_Byte_Src *src);
+
+#define XLEN 32
+#include "gdbstub_be_xlen_template.h"
+#undef XLEN
+
+#define XLEN 64
+#include "gdbstub_be_xlen_template.h"
+#undef XLEN
+
+typedef struct {
+    uint8_t    xlen;
+    uint32_t (*reg_read)        (uint16_t dm_regnum, uint64_t *p_regval, uint8_t *p_cmderr);
+    uint32_t (*reg_write)       (uint16_t dm_regnum, uint64_t regval, uint8_t *p_cmderr);
+    void     (*sbaddress_write) (const uint64_t addr);
+    uint32_t (*sba_write_setup) (const uint64_t addr4);
+    uint32_t (*mem_read_words)  (const uint64_t addr, char *data, const size_t len);
+    uint32_t (*mem_write_words) (uint64_t addr4, const uint64_t addr_lim4, BE_Byte_Src *src);
+} BE_Xlen_Ops;
+
+static const BE_Xlen_Ops be_xlen_ops_rv32 = { 32, reg_read_rv32, reg_write_rv32, sbaddress_write_rv32,
+					      sba_write_setup_rv32, mem_read_words_rv32, mem_write_words_rv32 };
+static const BE_Xlen_Ops be_xlen_ops_rv64 = { 64, reg_read_rv64, reg_write_rv64, sbaddress_write_rv64,
+					      sba_write_setup_rv64, mem_read_words_rv64, mem_write_words_rv64 };
+
+// Each hart's table, set by gdbstub_be_set_xlen/gdbstub_be_set_hart_xlen,
+// and the selected hart's (hart_ops [be_hartsel]), which is the one used.
+// be_ops changes only with be_hartsel (see hart_select), so the paths
+// below never look at XLEN.
+static const BE_Xlen_Ops *hart_ops [BE_HARTS_MAX] = { [0 ... (BE_HARTS_MAX - 1)] = & be_xlen_ops_rv64 };
+static const BE_Xlen_Ops *be_ops = & be_xlen_ops_rv64;
+
+static inline
+void hart_select (const uint32_t hart)
+{
+    be_hartsel = hart;
+    be_ops     = hart_ops [hart];
+}
+
 // ================================================================
 // gdbstub_be_reg_read is shared by the functions for reading GPR/CSR/FPR
 // dm_regnum for CSR x is:    x
@@ -258,58 +767,9 @@ uint32_t  gdbstub_be_wait_for_sb_nonbusy (uint32_t  *p_sbcs)
 //           for FPR x is:    x + 0x1020
 
 static
-uint32_t gdbstub_be_reg_read (const uint8_t xlen, uint16_t dm_regnum, uint64_t *p_regval, uint8_t *p_cmderr)
+uint32_t gdbstub_be_reg_read (uint16_t dm_regnum, uint64_t *p_regval, uint8_t *p_cmderr)
 {
-    // Assuming abstractcs.cmderr == 0 in the HW
-    uint32_t abstractcs;
-    uint64_t data0 = 0;
-    uint64_t data1 = 0;
-
-    // Send command to do a register read
-    if (verbosity == 2)
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp,
-		     "    gdbstub_be_reg_read (0x%0x): read command\n",
-		     dm_regnum);
-	    fflush (logfile_fp);
-	}
-
-    uint32_t command = fn_mk_command_access_reg (((xlen == 32)
-						  ? DM_COMMAND_ACCESS_REG_SIZE_LOWER32
-						  : DM_COMMAND_ACCESS_REG_SIZE_LOWER64),    // aarsize
-						 false,    // aarpostincrement
-						 false,    // postexec
-						 true,     // transfer
-						 false,    // write
-						 dm_regnum);
-    dmi_write (dm_addr_command, command);
-
-    // Poll abstractcs until not busy
-    poll_abstractcs_until_notbusy ("gdbstub_be_reg_read", & abstractcs);
-
-    *p_cmderr = check_abstractcs_error ("gdbstub_be_reg_read", abstractcs);
-
-    if (*p_cmderr == 0) {
-	// Read data0 register
-	data0 = dmi_read (dm_addr_data0);
-	if (xlen == 64) {
-	    // Read upper 32 bits from data1
-	    data1 = dmi_read (dm_addr_data1);
-	    data1 = data1 << 32;
-	}
-	*p_regval = data1 | data0;
-	if (verbosity == 2)
-	    if (logfile_fp != NULL) {
-		fprintf (logfile_fp,
-			 "    gdbstub_be_reg_read (0x%0x) => 0x%0" PRIx64 "\n",
-			 dm_regnum, *p_regval);
-		fflush (logfile_fp);
-	    }
-	return  status_ok;
-    }
-    else {
-	return  status_err;
-    }
+    return be_ops->reg_read (dm_regnum, p_regval, p_cmderr);
 }
 
 // ================================================================
@@ -319,49 +779,13 @@ uint32_t gdbstub_be_reg_read (const uint8_t xlen, uint16_t dm_regnum, uint64_t *
 //           for FPR x is:    x + 0x1020
 
 static
-uint32_t  gdbstub_be_reg_write (const uint8_t xlen, uint16_t dm_regnum, uint64_t regval, uint8_t *p_cmderr)
+uint32_t  gdbstub_be_reg_write (uint16_t dm_regnum, uint64_t regval, uint8_t *p_cmderr)
 {
-    if (verbosity == 2)
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp,
-		     "    gdbstub_be_reg_write (0x%0x, 0x%0" PRIx64 ")\n",
-		     dm_regnum, regval);
-	    fflush (logfile_fp);
-	}
-
-    // Assuming abstractcs.cmderr == 0
-    uint32_t abstractcs;
-
-    // Write regval to dm_data0 register
-    dmi_write (dm_addr_data0, (uint32_t) regval);
-
-    if (xlen == 64) {
-	// Write upper bits of regval to dm_data1 register
-	dmi_write (dm_addr_data1, (uint32_t) (regval >> 32));
-    }
-
-    // Send command to do a register write
-    uint32_t command = fn_mk_command_access_reg (((xlen == 32)
-						  ? DM_COMMAND_ACCESS_REG_SIZE_LOWER32
-						  : DM_COMMAND_ACCESS_REG_SIZE_LOWER64),    // aarsize
-						 false,    // postincrement
-						 false,    // postexec
-						 true,     // transfer
-						 true,     // write
-						 dm_regnum);
-    dmi_write (dm_addr_command, command);
-
-    // Poll abstractcs until not busy
-    poll_abstractcs_until_notbusy ("gdbstub_be_reg_write", & abstractcs);
-
-    *p_cmderr = check_abstractcs_error ("gdbstub_be_reg_write", abstractcs);
-
-    if (*p_cmderr == 0) {
-	return status_ok;
-    }
-    else {
-	return status_ok;
+    if (dm_regnum == csr_addr_dcsr) {
+	dcsr_step_clear &= (~ (1u << be_hartsel));
+	stepie_saved    &= (~ (1u << be_hartsel));
     }
+    return be_ops->reg_write (dm_regnum, regval, p_cmderr);
 }
 
 // ================================================================
@@ -369,11 +793,8 @@ uint32_t  gdbstub_be_reg_write (const uint8_t xlen, uint16_t dm_regnum, uint64_t
 // Used in gdbstub_be_mem_write for read-modify-writes at unaligned edges of addr range.
 
 static
-uint32_t  gdbstub_be_mem32_read (const char *context,
-				 const uint8_t xlen, const uint64_t addr, uint32_t *p_data)
+uint32_t  gdbstub_be_mem32_read (const char *context, const uint64_t addr, uint32_t *p_data)
 {
-    uint32_t addr0  = (uint32_t) addr;
-    uint32_t addr1  = (uint32_t) (addr >> 32);
     uint32_t status = 0;
 
     // Assert that the address is aligned
@@ -402,18 +823,7 @@ uint32_t  gdbstub_be_mem32_read (const char *context,
     dmi_write (dm_addr_sbcs, sbcs);
 
     // Write the address to sbaddress1/0
-    if (xlen == 64) {
-	// Write upper 64b of address to sbaddress1
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    Write to sbaddress1: 0x%08x\n", addr1);
-	}
-	dmi_write (dm_addr_sbaddress1, addr1);
-    }
-    // Write lower 64b of the address to sbaddress0 (which will start a bus read)
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "    Write to sbaddress0: 0x%08x\n", addr0);
-    }
-    dmi_write (dm_addr_sbaddress0, addr0);
+    be_ops->sbaddress_write (addr);
 
     // Read sbdata0
     status = gdbstub_be_wait_for_sb_nonbusy (NULL);
@@ -436,11 +846,8 @@ uint32_t  gdbstub_be_mem32_read (const char *context,
 // Used in gdbstub_be_mem_write for read-modify-writes at unaligned edges of addr range.
 
 static
-uint32_t  gdbstub_be_mem32_write (const char *context,
-				  const uint8_t xlen, const uint64_t addr, const uint32_t data)
+uint32_t  gdbstub_be_mem32_write (const char *context, const uint64_t addr, const uint32_t data)
 {
-    uint32_t addr0  = (uint32_t) addr;
-    uint32_t addr1  = (uint32_t) (addr >> 32);
     uint32_t status = 0;
 
     // Assert that the address is aligned
@@ -467,18 +874,7 @@ uint32_t  gdbstub_be_mem32_write (const char *context,
     // Write the address to sbaddress1/0
     status = gdbstub_be_wait_for_sb_nonbusy (NULL);
     if (status == status_err) return status;
-    if (xlen == 64) {
-	// Write upper 64b of address to sbaddress1
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    Write to sbaddress1: 0x%08x\n", addr1);
-	}
-	dmi_write (dm_addr_sbaddress1, addr1);
-    }
-    // Write lower 64b of the address to sbaddress0 (which will start a bus read)
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "    Write to sbaddress0: 0x%08x\n", addr0);
-    }
-    dmi_write (dm_addr_sbaddress0, addr0);
+    be_ops->sbaddress_write (addr);
 
     // Write data to sbdata0 (which writes through to mem)
     status = gdbstub_be_wait_for_sb_nonbusy (NULL);
@@ -529,12 +925,38 @@ void fprint_mem_data (FILE *fp, const int verbosity, const char *data, const siz
 // Public definitions
 
 // ================================================================
-// Word bitwidth (32 for RV32, 64 for RV64)
+// Word bitwidth (32 for RV32, 64 for RV64) of the selected hart
 // (Important: affects format of data strings in RSP communication with GDB)
 // This defaults to 64 (for RV64), but can be set to 32.
 // If gdbstub_be_elf_load() is invoked, it'll be picked up from the ELF file.
 
-uint8_t gdbstub_be_xlen = 64;
+uint8_t gdbstub_be_xlen (void)
+{
+    return be_ops->xlen;
+}
+
+// ================================================================
+// Set XLEN of all harts, or of one, and select the XLEN-specialized
+// paths for it
+
+uint32_t gdbstub_be_set_xlen (const uint8_t xlen)
+{
+    if ((xlen != 32) && (xlen != 64))
+	return status_err;
+    for (uint32_t h = 0; h < BE_HARTS_MAX; h++)
+	hart_ops [h] = ((xlen == 32) ? (& be_xlen_ops_rv32) : (& be_xlen_ops_rv64));
+    be_ops = hart_ops [be_hartsel];
+    return status_ok;
+}
+
+uint32_t gdbstub_be_set_hart_xlen (const uint32_t hart, const uint8_t xlen)
+{
+    if (((xlen != 32) && (xlen != 64)) || (hart >= BE_HARTS_MAX))
+	return status_err;
+    hart_ops [hart] = ((xlen == 32) ? (& be_xlen_ops_rv32) : (& be_xlen_ops_rv64));
+    be_ops = hart_ops [be_hartsel];
+    return status_ok;
+}
 
 // ================================================================
 // Help
@@ -546,11 +968,61 @@ const char *gdbstub_be_help (void)
     const char *help_msg =
 	"monitor help                       Print this help message\n"
 	"monitor verbosity n                Set verbosity of HW simulation to n\n"
-	"monitor xlen n                     Set XLEN to n (32 or 64 only)\n"
+	"monitor xlen n [hart]              Set XLEN to n (32 or 64 only), of all harts or of one\n"
 	"monitor reset_dm                   Perform Debug Module DM_RESET\n"
 	"monitor reset_ndm                  Perform Debug Module NDM_RESET\n"
 	"monitor reset_hart                 Perform Debug Module HART_RESET\n"
+	"monitor dm_info                    Show Debug Module capabilities (version, hartinfo, abstract, SBA)\n"
+	"monitor abstract_optimistic on|off  Batch abstract commands without polling (default on)\n"
+	"monitor write_combine on|off       Stream consecutive 'X' writes through SBA (default on)\n"
+	"monitor dm_health                  Show Debug Module faults, recoveries and times to recover\n"
+	"monitor dm_recover                 Run the Debug Module recovery sequence now\n"
+	"monitor dm_recover_ndmreset on|off  Allow recovery to use ndmreset (resets the hart)\n"
 	"elf_load filename                  Load ELF file into RISC-V memory\n"
+	"monitor run_to symbol|addr         Run until symbol (of the loaded ELF file) or addr\n"
+	"monitor wait_mem addr mask value timeout_ms [halt]  Wait (error on timeout) until mem[addr] & mask == value\n"
+	"monitor mem_gather [-merge] sym|addr[:width] ...  Read scattered locations, each with an access of its width (-merge: RAM only, in a few SBA bursts)\n"
+	"monitor walk [*]sym|addr next_off node_size [max]  Read the nodes of a linked list (*: head is a pointer)\n"
+	"monitor watch                      Show hardware/emulated watchpoints\n"
+	"monitor watch_mode auto|hw|emulated  Use triggers and/or SBA polling for watchpoints\n"
+	"monitor watch_period usecs         Polling period of emulated watchpoints\n"
+	"monitor watch_match addr [value]   Emulated watchpoint at addr halts only when == value\n"
+	"monitor sample                     Show sampling channels and statistics\n"
+	"monitor sample_add sym|addr width [name]  Add a channel (width 1, 2, 4 or 8 bytes)\n"
+	"monitor sample_csr pc|mcycle|minstret|csr [name]  Add a CSR channel (Quick Access if the DM has it)\n"
+	"monitor sample_clear               Remove all sampling channels\n"
+	"monitor sample_rate hz             Set the sampling rate\n"
+	"monitor sample_merge on|off        Read nearby channels in one burst (on), or each at its width (off, for MMIO)\n"
+	"monitor sample_output csv|bin file, or gdb  Write samples to a file, or to GDB's console\n"
+	"monitor sample_start               Start sampling (the hart keeps running)\n"
+	"monitor sample_stop                Stop sampling\n"
+	"monitor rtt                        Show RTT channels and statistics\n"
+	"monitor rtt_setup sym|addr [len]   RTT control block is at sym/addr, or within [addr, addr+len)\n"
+	"monitor rtt_output chan none|gdb|file name|tcp port  Destination of RTT up-buffer chan\n"
+	"monitor rtt_poll min max           Adaptive RTT polling period bounds, in usecs\n"
+	"monitor rtt_start                  Find the RTT control block and start polling\n"
+	"monitor rtt_stop                   Stop RTT polling\n"
+	"monitor rtt_write chan text        Write text and a newline to RTT down-buffer chan\n"
+	"monitor record                     Show execution recording (reverse-step/continue) status\n"
+	"monitor record_start [bytes]       Record execution in the stub, for reverse-step/continue\n"
+	"monitor record_stop                Stop recording, and discard the recorded history\n"
+	"monitor etrace                     Show E-Trace buffer, decoder parameters and statistics\n"
+	"monitor etrace_buffer sym|addr size  The trace buffer in target memory\n"
+	"monitor etrace_control addr start stop  Encoder control register, and the values to start/stop it\n"
+	"monitor etrace_wp addr [wrap_mask]  Encoder write pointer register, and its 'wrapped' bit(s)\n"
+	"monitor etrace_param name value    Set an encoder parameter (see 'monitor etrace')\n"
+	"monitor etrace_start               Start the trace encoder\n"
+	"monitor etrace_stop                Stop the trace encoder\n"
+	"monitor etrace_download [file]     Download the trace buffer (and save it to file)\n"
+	"monitor etrace_decode [file]       Decode the downloaded trace, or a raw trace file\n"
+	"monitor etrace_clear               Clear decoded PC counts and statistics\n"
+	"monitor etrace_hist file [n]       Write a PC histogram (CSV, the n most frequent)\n"
+	"monitor etrace_coverage file       Write executed address ranges (CSV)\n"
+	"monitor stepie [keep|off|on]       Interrupts while stepping: as is, masked, enabled; show counts\n"
+	"monitor dmi_read addr              Read a Debug Module register\n"
+	"monitor dmi_write addr data        Write a Debug Module register\n"
+	"monitor source file                Run the monitor commands in file, stopping at the first failure\n"
+	"monitor batch cmd ; cmd ; ...      Run monitor commands, stopping at the first failure ('\\;' or \"...;...\" for a ';' in one)\n"
 	;
 
     fprintf (logfile_fp, "gdbstub_be_help ()\n");
@@ -558,6 +1030,182 @@ const char *gdbstub_be_help (void)
     return help_msg;
 }
 
+// ================================================================
+// Write dmcontrol selecting one hart, with optional halt/resume request
+
+static
+void dmcontrol_hart_write (const uint32_t hart, const bool haltreq, const bool resumereq)
+{
+    uint32_t dmcontrol = fn_mk_dmcontrol (haltreq,                          // haltreq
+					  resumereq,                        // resumereq
+					  false,                            // hartreset
+					  false,                            // ackhavereset
+					  false,                            // hasel
+					  (uint16_t) (hart & 0x3FF),        // hartsello
+					  (uint16_t) ((hart >> 10) & 0x3FF), // hartselhi
+					  false,                            // setresethaltreq
+					  false,                            // clrresethaltreq
+					  false,                            // ndmreset
+					  true);                            // dmactive
+    dmi_write (dm_addr_dmcontrol, dmcontrol);
+}
+
+// ================================================================
+// Debug Module capabilities
+
+// The static properties of the DM (dmstatus version and feature bits,
+// hartinfo, abstractcs.datacount/progbufsize, the System Bus Access
+// sizes) are read once and cached in dm_caps_cache, rather than
+// re-read by every operation that depends on them.  The cache is
+// invalidated whenever dmactive is cleared (gdbstub_be_dm_reset, DM
+// recovery), and re-read on the next use.
+
+static
+const DM_Caps *dm_caps (void)
+{
+    if (dm_caps_cache.valid)
+	return & dm_caps_cache;
+
+    DM_Caps *c = & dm_caps_cache;
+
+    uint32_t dmstatus   = dmi_read (dm_addr_dmstatus);
+    uint32_t hartinfo   = dmi_read (dm_addr_hartinfo);
+    uint32_t abstractcs = dmi_read (dm_addr_abstractcs);
+    uint32_t sbcs       = dmi_read (dm_addr_sbcs);
+
+    c->version         = (dmstatus & DMSTATUS_VERSION);
+    c->authenticated   = ((dmstatus & DMSTATUS_AUTHENTICATED) != 0);
+    c->impebreak       = ((dmstatus & DMSTATUS_IMPEBREAK) != 0);
+    c->hasresethaltreq = ((dmstatus & DMSTATUS_HASRESETHALTREQ) != 0);
+    c->confstrptrvalid = ((dmstatus & DMSTATUS_CONFSTRPTRVALID) != 0);
+
+    // HARTSELLEN and hasel: write all ones to hartsel and to hasel, and
+    // read back what sticks.  Then count the harts, selecting 0, 1, ...
+    // (up to 2^HARTSELLEN, since higher hartsel bits are not stored and
+    // would wrap around) until dmstatus.anynonexistent.
+    uint32_t dmcontrol = fn_mk_dmcontrol (false, false, false, false,
+					  true,      // hasel
+					  0x3FF,     // hartsello
+					  0x3FF,     // hartselhi
+					  false, false, false,
+					  true);     // dmactive
+    dmi_write (dm_addr_dmcontrol, dmcontrol);
+    dmcontrol = dmi_read (dm_addr_dmcontrol);
+    uint32_t hartsel_max = (  ((uint32_t) fn_dmcontrol_hartsello (dmcontrol))
+			    | (((uint32_t) fn_dmcontrol_hartselhi (dmcontrol)) << 10));
+    c->hasel      = fn_dmcontrol_hasel (dmcontrol);
+    c->hartsellen = 0;
+    while ((c->hartsellen < 20) && ((hartsel_max >> c->hartsellen) & 1))
+	c->hartsellen++;
+
+    uint32_t n_sel = (1u << c->hartsellen);
+    for (c->n_harts = 0; (c->n_harts < n_sel) && (c->n_harts < BE_HARTS_MAX); c->n_harts++) {
+	dmcontrol_hart_write (c->n_harts, false, false);
+	if (dmi_read (dm_addr_dmstatus) & DMSTATUS_ANYNONEXISTENT)
+	    break;
+    }
+    if (c->n_harts == 0)
+	c->n_harts = 1;
+    dmcontrol_hart_write (be_hartsel, false, false);
+
+    c->hartinfo_hart   = be_hartsel;
+    c->nscratch        = ((hartinfo >> 20) & 0xF);
+    c->dataaccess      = (((hartinfo >> 16) & 0x1) != 0);
+    c->datasize        = ((hartinfo >> 12) & 0xF);
+    c->dataaddr        = (hartinfo & 0xFFF);
+
+    c->datacount       = fn_abstractcs_datacount (abstractcs);
+    c->progbufsize     = fn_abstractcs_progbufsize (abstractcs);
+
+    // Quick Access is probed later, while the hart is halted (quick_probe)
+    c->quick_probed    = false;
+    c->quick_access    = false;
+
+    c->sbversion       = fn_sbcs_sbversion (sbcs);
+    c->sbasize         = fn_sbcs_sbasize (sbcs);
+    c->sbaccess_mask   = (  (fn_sbcs_sbaccess8   (sbcs) ? (1 << DM_SBACCESS_8_BIT)   : 0)
+			  | (fn_sbcs_sbaccess16  (sbcs) ? (1 << DM_SBACCESS_16_BIT)  : 0)
+			  | (fn_sbcs_sbaccess32  (sbcs) ? (1 << DM_SBACCESS_32_BIT)  : 0)
+			  | (fn_sbcs_sbaccess64  (sbcs) ? (1 << DM_SBACCESS_64_BIT)  : 0)
+			  | (fn_sbcs_sbaccess128 (sbcs) ? (1 << DM_SBACCESS_128_BIT) : 0));
+    c->valid = true;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp,
+		 "dm_caps: dmstatus 0x%08x hartinfo 0x%08x abstractcs 0x%08x sbcs 0x%08x\n",
+		 dmstatus, hartinfo, abstractcs, sbcs);
+	fprintf (logfile_fp, "    hartsellen %0d, hasel %0d, harts %0d\n",
+		 c->hartsellen, c->hasel, c->n_harts);
+	if (! c->authenticated)
+	    fprintf (logfile_fp, "    WARNING: dm_caps: debugger is not authenticated (dmstatus.authenticated = 0)\n");
+	if (c->sbasize == 0)
+	    fprintf (logfile_fp, "    WARNING: dm_caps: no System Bus Access (sbcs.sbasize = 0)\n");
+	fflush (logfile_fp);
+    }
+    return c;
+}
+
+// Is System Bus Access of this size (DM_SBACCESS_xx_BIT) supported?
+static
+bool dm_caps_sbaccess (DM_sbaccess sbaccess)
+{
+    return ((dm_caps ()->sbaccess_mask & (1 << sbaccess)) != 0);
+}
+
+static const char *dm_version_names [16] = { "none", "0.11", "0.13", "1.0",
+					     "4?", "5?", "6?", "7?", "8?", "9?", "10?",
+					     "11?", "12?", "13?", "14?", "unknown" };
+
+void  gdbstub_be_abstract_optimistic (bool allowed)
+{
+    abs_opt_allowed = allowed;
+    abs_opt_off     = false;
+}
+
+void  gdbstub_be_dm_info (char *buf, const size_t buf_size)
+{
+    if (! initialized) {
+	snprintf (buf, buf_size, "Not connected to a Debug Module\n");
+	return;
+    }
+
+    const DM_Caps *c      = dm_caps ();
+    uint32_t       nharts = gdbstub_be_num_harts ();
+
+    char sizes [64] = "";
+    size_t n = 0;
+    for (int j = DM_SBACCESS_8_BIT; j <= DM_SBACCESS_128_BIT; j++)
+	if (c->sbaccess_mask & (1 << j))
+	    n += (size_t) snprintf (& (sizes [n]), sizeof (sizes) - n, " %0d", 8 << j);
+
+    snprintf (buf, buf_size,
+	      "Debug Module: version %s, %s, harts %0d (hartsellen %0d, hasel %0d)\n"
+	      "  dmstatus: impebreak %0d, hasresethaltreq %0d, confstrptrvalid %0d\n"
+	      "  hartinfo (hart %0d): nscratch %0d, dataaccess %0d, datasize %0d, dataaddr 0x%03x\n"
+	      "  abstractcs: datacount %0d, progbufsize %0d, Quick Access %s\n"
+	      "  System Bus Access: %s%0d-bit addresses, sizes%s (sbversion %0d)\n"
+	      "Optimistic abstract commands: %s; %0" PRId64 " batches, %0" PRId64 " overruns, %0" PRId64 " errors\n"
+	      "CSR samples: %0" PRId64 " by Quick Access (mean %0" PRId64 " usecs),"
+	      " %0" PRId64 " by halt/read/resume (mean %0" PRId64 " usecs), %0" PRId64 " while halted\n"
+	      "Write streams: %0" PRId64 " writes in %0" PRId64 " streams, %0" PRId64 " errors\n",
+	      dm_version_names [c->version & 0xF],
+	      (c->authenticated ? "authenticated" : "NOT authenticated"),
+	      nharts, c->hartsellen, c->hasel,
+	      c->impebreak, c->hasresethaltreq, c->confstrptrvalid,
+	      c->hartinfo_hart, c->nscratch, c->dataaccess, c->datasize, c->dataaddr,
+	      c->datacount, c->progbufsize,
+	      ((! c->quick_probed) ? "not probed yet" : (c->quick_access ? "yes" : "no")),
+	      ((c->sbasize == 0) ? "NONE, " : ""), c->sbasize,
+	      ((n == 0) ? " none" : sizes), c->sbversion,
+	      ((! abs_opt_allowed) ? "off" : (abs_opt_off ? "off (too many overruns)" : "on")),
+	      abs_n_batches, abs_n_overruns, abs_n_errors,
+	      sample_n_quick, ((sample_n_quick == 0) ? 0 : (sample_t_quick / sample_n_quick)),
+	      sample_n_haltresume,
+	      ((sample_n_haltresume == 0) ? 0 : (sample_t_haltresume / sample_n_haltresume)),
+	      sample_n_halted,
+	      wstream_n_writes, wstream_n_streams, wstream_n_errors);
+}
+
 // ================================================================
 // Initialize gdbstub_be
 
@@ -569,13 +1217,27 @@ uint32_t  gdbstub_be_init (FILE *logfile, bool autoclose)
     autoclose_logfile = autoclose;
 
     initialized = true;
-
-    uint32_t status = gdbstub_be_stop (gdbstub_be_xlen);
+    regs_snapshot_invalidate ();
+
+    dm_caps_invalidate ();
+    dm_caps ();
+    abs_opt_off    = false;
+    abs_n_batches  = 0;
+    abs_n_overruns = 0;
+    abs_n_errors   = 0;
+
+    wstream_open      = false;
+    wstream_lost      = false;
+    wstream_n_writes  = 0;
+    wstream_n_streams = 0;
+    wstream_n_errors  = 0;
+
+    uint32_t status = gdbstub_be_stop (gdbstub_be_xlen ());
     if (status != status_ok) goto err;
 
     uint64_t dcsr64;
     uint8_t  cmderr;
-    status = gdbstub_be_reg_read (gdbstub_be_xlen, csr_addr_dcsr, & dcsr64, & cmderr);
+    status = gdbstub_be_reg_read (csr_addr_dcsr, & dcsr64, & cmderr);
     if (status != status_ok) goto err;
 
     // Set ebreakm/ebreaks/ebreaku
@@ -594,7 +1256,7 @@ uint32_t  gdbstub_be_init (FILE *logfile, bool autoclose)
 		       fn_dcsr_step (dcsr),
 		       fn_dcsr_prv (dcsr));
 
-    status = gdbstub_be_reg_write (gdbstub_be_xlen, csr_addr_dcsr, dcsr, & cmderr);
+    status = gdbstub_be_reg_write (csr_addr_dcsr, dcsr, & cmderr);
     if (status != status_ok) goto err;
 
     return status_ok;
@@ -622,7 +1284,7 @@ uint32_t  gdbstub_be_final (const uint8_t xlen)
 
     uint64_t dcsr64;
     uint8_t  cmderr;
-    uint32_t status = gdbstub_be_reg_read (xlen, csr_addr_dcsr, & dcsr64, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (csr_addr_dcsr, & dcsr64, & cmderr);
     if (status != status_ok) goto err;
 
     // Restore ebreakm/ebreaks/ebreaku
@@ -641,7 +1303,7 @@ uint32_t  gdbstub_be_final (const uint8_t xlen)
 		       fn_dcsr_step (dcsr),
 		       fn_dcsr_prv (dcsr));
 
-    status = gdbstub_be_reg_write (xlen, csr_addr_dcsr, dcsr, & cmderr);
+    status = gdbstub_be_reg_write (csr_addr_dcsr, dcsr, & cmderr);
     if (status != status_ok) goto err;
 
     // Success and error paths both ultimately need to close the file.
@@ -653,11 +1315,106 @@ err:
 }
 
 // ================================================================
-// Reset the Debug Module
+// Halt-on-reset, for gdbstub_be_ndm_reset and gdbstub_be_hart_reset.
 
-uint32_t  gdbstub_be_dm_reset (const uint8_t xlen)
+// If the DM supports it (dmstatus.hasresethaltreq), we set the hart's
+// halt-on-reset request before the reset, so that the hart halts before
+// executing its first instruction after reset; this is both faster and
+// reproducible.  Otherwise, haltreq is asserted along with the reset,
+// and the hart may run some boot code before it halts.
+// Returns true if halt-on-reset was requested.
+
+static
+bool reset_arm_resethaltreq (char *dbg_string)
 {
-    if (! initialized) return status_ok;
+    if (! dm_caps ()->hasresethaltreq)
+	return false;
+
+    uint32_t dmcontrol = fn_mk_dmcontrol (false,    // haltreq
+					  false,    // resumereq
+					  false,    // hartreset
+					  false,    // ackhavereset
+					  false,    // hasel
+					  BE_HARTSELLO, // hartsello
+					  BE_HARTSELHI, // hartselhi
+					  true,     // setresethaltreq
+					  false,    // clrresethaltreq
+					  false,    // ndmreset
+					  true);    // dmactive_N
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "%s: ", dbg_string);
+	fprint_dmcontrol (logfile_fp, "write ", dmcontrol, "\n");
+	fflush (logfile_fp);
+    }
+    dmi_write (dm_addr_dmcontrol, dmcontrol);
+    return true;
+}
+
+// After the reset has been released: wait until the hart has come out
+// of reset (and has halted, if requested), then acknowledge havereset
+// and clear the halt-on-reset request.
+
+static
+uint32_t reset_complete (char *dbg_string, bool haltreq, bool resethaltreq)
+{
+    uint32_t dmstatus;
+    uint32_t status;
+
+    if (resethaltreq) {
+	// DMs with halt-on-reset implement havereset: wait for it
+	status = poll_dmstatus (dbg_string,
+				DMSTATUS_ALLHAVERESET | DMSTATUS_ANYUNAVAIL,
+				DMSTATUS_ALLHAVERESET,
+				& dmstatus, false);
+    }
+    else {
+	// Poll dmstatus until '(! anyunavail)'
+	status = poll_dmstatus (dbg_string, DMSTATUS_ANYUNAVAIL, 0, & dmstatus, false);
+    }
+
+    if ((status == status_ok) && haltreq)
+	status = poll_dmstatus (dbg_string, DMSTATUS_ALLHALTED, DMSTATUS_ALLHALTED, & dmstatus, false);
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp,"    %s: dmstatus = 0x%0x\n", dbg_string, dmstatus);
+	fflush (logfile_fp);
+    }
+
+    // Acknowledge havereset, and disarm halt-on-reset
+    uint32_t dmcontrol = fn_mk_dmcontrol (haltreq && (! resethaltreq),
+					  false,           // resumereq
+					  false,           // hartreset
+					  true,            // ackhavereset
+					  false,           // hasel
+					  BE_HARTSELLO,    // hartsello
+					  BE_HARTSELHI,    // hartselhi
+					  false,           // setresethaltreq
+					  resethaltreq,    // clrresethaltreq
+					  false,           // ndmreset
+					  true);           // dmactive_N
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "%s: ", dbg_string);
+	fprint_dmcontrol (logfile_fp, "write ", dmcontrol, "\n");
+	fflush (logfile_fp);
+    }
+    dmi_write (dm_addr_dmcontrol, dmcontrol);
+
+    if (haltreq && (status == status_ok))
+	run_mode = PAUSED;
+    group_mask      = 0;
+    dcsr_step_clear = 0;
+    stepie_saved    = 0;
+    return status;
+}
+
+// ================================================================
+// Reset the Debug Module
+
+uint32_t  gdbstub_be_dm_reset (const uint8_t xlen)
+{
+    if (! initialized) return status_ok;
+
+    regs_snapshot_invalidate ();
 
     if (logfile_fp != NULL) {
 	fprintf (logfile_fp,
@@ -671,8 +1428,8 @@ uint32_t  gdbstub_be_dm_reset (const uint8_t xlen)
 					  false,          // hartreset
 					  false,          // ackhavereset
 					  false,          // hasel
-					  0,              // hartsello
-					  0,              // hartselhi
+					  BE_HARTSELLO,   // hartsello
+					  BE_HARTSELHI,   // hartselhi
 					  false,          // setresethaltreq
 					  false,          // clrresethaltreq
 					  false,          // ndmreset
@@ -683,6 +1440,8 @@ uint32_t  gdbstub_be_dm_reset (const uint8_t xlen)
 	fflush (logfile_fp);
     }
     dmi_write (dm_addr_dmcontrol, dmcontrol);
+    hawindow_cache_valid = false;
+    dm_caps_invalidate ();
 
     // Poll abstractcs until not busy, check for errors
     uint32_t abstractcs;
@@ -741,6 +1500,8 @@ uint32_t  gdbstub_be_ndm_reset (const uint8_t xlen, bool haltreq)
 {
     if (! initialized) return status_ok;
 
+    regs_snapshot_invalidate ();
+
     uint32_t dmcontrol;
 
     if (logfile_fp != NULL) {
@@ -750,14 +1511,16 @@ uint32_t  gdbstub_be_ndm_reset (const uint8_t xlen, bool haltreq)
 	fflush (logfile_fp);
     }
 
+    bool resethaltreq = (haltreq && reset_arm_resethaltreq ("gdbstub_be_ndm_reset"));
+
     // Assert dmcontrol.ndmreset
-    dmcontrol = fn_mk_dmcontrol (haltreq,
+    dmcontrol = fn_mk_dmcontrol (haltreq && (! resethaltreq),
 				 false,          // resumereq
 				 false,          // hartreset
 				 false,          // ackhavereset
 				 false,          // hasel
-				 0,              // hartsello
-				 0,              // hartselhi
+				 BE_HARTSELLO,   // hartsello
+				 BE_HARTSELHI,   // hartselhi
 				 false,          // setresethaltreq
 				 false,          // clrresethaltreq
 				 true,           // ndmreset
@@ -770,13 +1533,13 @@ uint32_t  gdbstub_be_ndm_reset (const uint8_t xlen, bool haltreq)
     dmi_write (dm_addr_dmcontrol, dmcontrol);
 
     // Deassert dmcontrol.ndmreset
-    dmcontrol = fn_mk_dmcontrol (haltreq,
+    dmcontrol = fn_mk_dmcontrol (haltreq && (! resethaltreq),
 				 false,          // resumereq
 				 false,          // hartreset
 				 false,          // ackhavereset
 				 false,          // hasel
-				 0,              // hartsello
-				 0,              // hartselhi
+				 BE_HARTSELLO,   // hartsello
+				 BE_HARTSELHI,   // hartselhi
 				 false,          // setresethaltreq
 				 false,          // clrresethaltreq
 				 false,          // ndmreset
@@ -788,16 +1551,7 @@ uint32_t  gdbstub_be_ndm_reset (const uint8_t xlen, bool haltreq)
     }
     dmi_write (dm_addr_dmcontrol, dmcontrol);
 
-    // Poll dmstatus until '(! anyunavail)'
-    uint32_t dmstatus;
-    poll_dmstatus ("gdbstub_be_ndm_reset", DMSTATUS_ANYUNAVAIL, 0, & dmstatus, false);
-
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp,"    gdbstub_be_ndm_reset: dmstatus = 0x%0x\n", dmstatus);
-	fflush (logfile_fp);
-    }
-
-    return status_ok;
+    return reset_complete ("gdbstub_be_ndm_reset", haltreq, resethaltreq);
 }
 
 // ================================================================
@@ -807,6 +1561,8 @@ uint32_t  gdbstub_be_hart_reset (const uint8_t xlen, bool haltreq)
 {
     if (! initialized) return status_ok;
 
+    regs_snapshot_invalidate ();
+
     if (logfile_fp != NULL) {
 	fprintf (logfile_fp,
 		 "gdbstub_be_hart_reset (haltreq = %0d)\n", haltreq);
@@ -815,30 +1571,82 @@ uint32_t  gdbstub_be_hart_reset (const uint8_t xlen, bool haltreq)
 
     // Assuming abstractcs.cmderr == 0 in the HW
 
-    // Reset the HART
-    uint32_t dmcontrol = fn_mk_dmcontrol (haltreq,
-					  false,    // resumereq
-					  true,     // hartreset
-					  false,    // ackhavereset
-					  false,    // hasel
-					  0,        // hartsello
-					  0,        // hartselhi
-					  false,    // setresethaltreq
-					  false,    // clrresethaltreq
-					  false,    // ndmreset
-					  true);    // dmactive_N
-    if (logfile_fp != NULL) {
-	fprint_dmcontrol (logfile_fp,
-			  "gdbstub_be_hart_reset: write ", dmcontrol, "\n");
-	fflush (logfile_fp);
+    bool resethaltreq = (haltreq && reset_arm_resethaltreq ("gdbstub_be_hart_reset"));
+
+    // Reset the HART: pulse dmcontrol.hartreset
+    for (int j = 0; j < 2; j++) {
+	bool hartreset = (j == 0);
+	uint32_t dmcontrol = fn_mk_dmcontrol (haltreq && (! resethaltreq),
+					      false,        // resumereq
+					      hartreset,    // hartreset
+					      false,        // ackhavereset
+					      false,        // hasel
+					      BE_HARTSELLO, // hartsello
+					      BE_HARTSELHI, // hartselhi
+					      false,        // setresethaltreq
+					      false,        // clrresethaltreq
+					      false,        // ndmreset
+					      true);        // dmactive_N
+	if (logfile_fp != NULL) {
+	    fprint_dmcontrol (logfile_fp,
+			      "gdbstub_be_hart_reset: write ", dmcontrol, "\n");
+	    fflush (logfile_fp);
+	}
+	dmi_write (dm_addr_dmcontrol, dmcontrol);
     }
-    dmi_write (dm_addr_dmcontrol, dmcontrol);
 
-    // Poll dmstatus until '(! anyhavereset)'
-    uint32_t dmstatus;
-    poll_dmstatus ("gdbstub_be_hart_reset", DMSTATUS_ANYHAVERESET, 0, & dmstatus, false);
+    return reset_complete ("gdbstub_be_hart_reset", haltreq, resethaltreq);
+}
 
-    return status_ok;
+// ================================================================
+// Debug Module health (see dm_recover)
+
+uint32_t  gdbstub_be_dm_recover (void)
+{
+    if (! initialized) return status_ok;
+
+    dm_n_faults [DM_FAULT_MANUAL]++;
+    return dm_recover (DM_FAULT_MANUAL);
+}
+
+void  gdbstub_be_dm_recover_ndmreset (bool allowed)
+{
+    dm_ndmreset_allowed = allowed;
+}
+
+void  gdbstub_be_register_invalidate (BE_Invalidate_Fn fn)
+{
+    // Modules register from their init functions, which may run again
+    for (uint32_t j = 0; j < dm_n_invalidate_hooks; j++)
+	if (dm_invalidate_hooks [j] == fn)
+	    return;
+    if (dm_n_invalidate_hooks < DM_INVALIDATE_HOOKS_MAX)
+	dm_invalidate_hooks [dm_n_invalidate_hooks++] = fn;
+}
+
+void  gdbstub_be_dm_health (char *buf, const size_t buf_size)
+{
+    uint64_t n_recovered = 0;
+    for (int j = 0; j < DM_RECOVER_STEPS; j++)
+	n_recovered += dm_n_recovered [j];
+
+    size_t n = (size_t) snprintf (buf, buf_size, "Debug Module faults:");
+    for (int j = 0; (j < DM_FAULT_N) && (n < buf_size); j++)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "%s %s %0" PRId64,
+				((j == 0) ? "" : ","), dm_fault_names [j], dm_n_faults [j]);
+    if (n < buf_size)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "\nRecovered by:");
+    for (int j = 0; (j < DM_RECOVER_STEPS) && (n < buf_size); j++)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "%s %s %0" PRId64,
+				((j == 0) ? "" : ","), dm_recover_step_names [j], dm_n_recovered [j]);
+    if (n < buf_size)
+	snprintf (& (buf [n]), buf_size - n,
+		  "\nNot recovered %0" PRId64 ", held off %0" PRId64 " (ndmreset %s)\n"
+		  "Time to recover: last %0" PRId64 ", max %0" PRId64 ", mean %0" PRId64 " usecs\n",
+		  dm_n_unrecovered, dm_n_held_off, (dm_ndmreset_allowed ? "allowed" : "not allowed"),
+		  dm_t_recover_last, dm_t_recover_max,
+		  (((n_recovered + dm_n_unrecovered) == 0)
+		   ? 0 : (dm_t_recover_total / (n_recovered + dm_n_unrecovered))));
 }
 
 // ================================================================
@@ -883,7 +1691,7 @@ uint32_t gdbstub_be_verbosity (uint32_t n)
 // The mem-write command below could be done using DMA, possibly
 // providing faster ELF-loading.
 
-// Note: the ELF file specifies XLEN; we record it here in gdbstub_be_xlen
+// Note: the ELF file specifies XLEN; we record it with gdbstub_be_set_xlen
 
 #ifdef GDBSTUB_NO_ELF_LOAD
 uint32_t gdbstub_be_elf_load (const char *elf_filename)
@@ -895,6 +1703,119 @@ uint32_t gdbstub_be_elf_load (const char *elf_filename)
     return status_err;
 }
 #else
+
+// ----------------
+// Incremental reload support (see gdbstub_be_restart).
+// We remember the last ELF file loaded (name, size and mtime) and a
+// hash of each ELF_BLOCK_SIZE block of its memory image.  On reload,
+// only blocks whose contents have changed, or which overlap a writable
+// section (the program may have modified those since), are written
+// to memory; read-only sections are assumed to be intact in memory.
+
+#define ELF_BLOCK_SIZE     4096
+#define ELF_FILENAME_MAX   1024
+
+static bool          last_elf_valid = false;
+static char          last_elf_filename [ELF_FILENAME_MAX];
+static struct stat   last_elf_stat;
+static Elf_Features  last_elf_features;
+static uint64_t     *last_elf_hashes   = NULL;
+static uint64_t      last_elf_n_blocks = 0;
+
+// FNV-1a
+static
+uint64_t elf_block_hash (const char *p, const size_t n)
+{
+    uint64_t h = 0xcbf29ce484222325llu;
+    for (size_t j = 0; j < n; j++) {
+	h ^= (uint8_t) p [j];
+	h *= 0x100000001b3llu;
+    }
+    return h;
+}
+
+static
+bool elf_overlaps_writable (const Elf_Features *p_features, const uint64_t lo, const uint64_t hi)
+{
+    for (uint32_t j = 0; j < p_features->n_writable; j++) {
+	const Elf_Range *r = & (p_features->writable [j]);
+	if ((lo < (r->addr + r->size)) && (r->addr < hi))
+	    return true;
+    }
+    return false;
+}
+
+// Write the memory image in *p_features to memory.
+// If 'incremental', skip blocks that match the last image loaded and
+// are not writable.  The number of bytes written is returned in *p_n_bytes.
+
+static
+uint32_t elf_image_write (const Elf_Features *p_features, const bool incremental, uint64_t *p_n_bytes)
+{
+    uint64_t  min_addr = p_features->min_addr;
+    uint64_t  n_bytes  = p_features->max_addr - min_addr + 1;
+    uint64_t  n_blocks = (n_bytes + ELF_BLOCK_SIZE - 1) / ELF_BLOCK_SIZE;
+
+    uint64_t *hashes = (uint64_t *) malloc (n_blocks * sizeof (uint64_t));
+    if (hashes == NULL) return status_err;
+
+    bool same_layout = (incremental
+			&& last_elf_valid
+			&& (last_elf_features.min_addr == min_addr)
+			&& (last_elf_n_blocks == n_blocks));
+
+    uint32_t status = status_ok;
+    uint64_t written = 0;
+    uint64_t run_start = 0, run_len = 0;    // run of dirty blocks, as byte offsets
+    for (uint64_t b = 0; b <= n_blocks; b++) {
+	bool dirty = false;
+	if (b < n_blocks) {
+	    uint64_t off = b * ELF_BLOCK_SIZE;
+	    uint64_t len = (((n_bytes - off) < ELF_BLOCK_SIZE) ? (n_bytes - off) : ELF_BLOCK_SIZE);
+	    hashes [b] = elf_block_hash (& (p_features->mem_buf [min_addr + off]), len);
+	    dirty = ((! same_layout)
+		     || (hashes [b] != last_elf_hashes [b])
+		     || elf_overlaps_writable (p_features, min_addr + off, min_addr + off + len));
+	    if (dirty) {
+		if (run_len == 0) run_start = off;
+		run_len += len;
+	    }
+	}
+	// Write out a run when it ends
+	if ((! dirty) && (run_len != 0)) {
+	    if (status == status_ok)
+		status = gdbstub_be_mem_write (p_features->bitwidth,
+					       min_addr + run_start,
+					       & (p_features->mem_buf [min_addr + run_start]),
+					       run_len);
+	    written += run_len;
+	    run_len  = 0;
+	}
+    }
+
+    free (last_elf_hashes);
+    last_elf_hashes   = hashes;
+    last_elf_n_blocks = n_blocks;
+    // If the write failed, memory contents are unknown
+    last_elf_valid    = (status == status_ok);
+
+    *p_n_bytes = written;
+    return status;
+}
+
+// Remember the name and stat of the file just loaded
+static
+void elf_remember_file (const char *elf_filename, const Elf_Features *p_features)
+{
+    if ((strlen (elf_filename) >= ELF_FILENAME_MAX)
+	|| (stat (elf_filename, & last_elf_stat) != 0)) {
+	last_elf_valid = false;
+	return;
+    }
+    strcpy (last_elf_filename, elf_filename);
+    last_elf_features = *p_features;
+}
+
 uint32_t gdbstub_be_elf_load (const char *elf_filename)
 {
     struct timespec timespec1, timespec2;
@@ -914,7 +1835,7 @@ uint32_t gdbstub_be_elf_load (const char *elf_filename)
     int ret = elf_readfile (logfile_fp, elf_filename, & features);
     if (ret == 0) return status_err;
 
-    gdbstub_be_xlen = features.bitwidth;
+    gdbstub_be_set_xlen (features.bitwidth);
     if (logfile_fp != NULL) {
 	fprintf (logfile_fp, "    xlen %0d\n", features.bitwidth);
 	fflush (logfile_fp);
@@ -936,11 +1857,10 @@ uint32_t gdbstub_be_elf_load (const char *elf_filename)
     // Note: this could be done using DMA
     clock_gettime (CLOCK_REALTIME, & timespec1);
     in_elf_load = true;
-    uint32_t status = gdbstub_be_mem_write (gdbstub_be_xlen,
-					    features.min_addr,
-					    & (features.mem_buf [features.min_addr]),
-					    n_bytes);
+    uint32_t status = elf_image_write (& features, false, & n_bytes);
     in_elf_load = false;
+    if (status == status_ok)
+	elf_remember_file (elf_filename, & features);
     clock_gettime (CLOCK_REALTIME, & timespec2);
     uint64_t time1 = ((uint64_t) timespec1.tv_sec) * 1000000000 + ((uint64_t) timespec1.tv_nsec);
     uint64_t time2 = ((uint64_t) timespec2.tv_sec) * 1000000000 + ((uint64_t) timespec2.tv_nsec);
@@ -959,62 +1879,371 @@ uint32_t gdbstub_be_elf_load (const char *elf_filename)
     fprintf (stdout,     "    ELF file loaded\n");
     return status;
 }
+
+// Reload for gdbstub_be_restart: re-read the file only if it has
+// changed on disk, then write only what differs from memory.
+
+static
+uint32_t elf_reload (const char *elf_filename, Elf_Features *p_features)
+{
+    if ((elf_filename == NULL) || (elf_filename [0] == 0)) {
+	if (! last_elf_valid) {
+	    // Nothing was loaded by us (e.g., GDB loaded the program itself)
+	    p_features->pc_start = 0xFFFFFFFFFFFFFFFFllu;
+	    return status_ok;
+	}
+	elf_filename = last_elf_filename;
+    }
+
+    struct stat st;
+    if (stat (elf_filename, & st) != 0) {
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "    elf_reload: cannot stat '%s'\n", elf_filename);
+	    fflush (logfile_fp);
+	}
+	return status_err;
+    }
+
+    bool unchanged = (last_elf_valid
+		      && (strcmp (elf_filename, last_elf_filename) == 0)
+		      && (st.st_size == last_elf_stat.st_size)
+		      && (st.st_mtim.tv_sec  == last_elf_stat.st_mtim.tv_sec)
+		      && (st.st_mtim.tv_nsec == last_elf_stat.st_mtim.tv_nsec));
+    if (unchanged) {
+	// The image is still in Elf_read's buffer
+	*p_features = last_elf_features;
+    }
+    else {
+	// Copy: elf_filename may point at last_elf_filename
+	char filename [ELF_FILENAME_MAX];
+	snprintf (filename, ELF_FILENAME_MAX, "%s", elf_filename);
+	int ret = elf_readfile (logfile_fp, filename, p_features);
+	if (ret == 0) {
+	    last_elf_valid = false;
+	    return status_err;
+	}
+	elf_filename = filename;
+	gdbstub_be_set_xlen (p_features->bitwidth);
+    }
+
+    uint64_t n_bytes;
+    in_elf_load = true;
+    uint32_t status = elf_image_write (p_features, true, & n_bytes);
+    in_elf_load = false;
+    if (status == status_ok)
+	elf_remember_file (elf_filename, p_features);
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp,
+		 "    elf_reload: %s; wrote 0x%0" PRIx64 " of 0x%0" PRIx64 " bytes\n",
+		 (unchanged ? "file unchanged" : "file re-read"),
+		 n_bytes, p_features->max_addr - p_features->min_addr + 1);
+	fflush (logfile_fp);
+    }
+    return status;
+}
 #endif
 
 // ================================================================
-// Continue the HW execution at given PC
+// Restart the program (vRun, R): ndmreset with the hart held halted,
+// reload the ELF file (the last one loaded if elf_filename is NULL or
+// empty), and set the PC to its '_start'.
 
-uint32_t gdbstub_be_continue (const uint8_t xlen)
+uint32_t gdbstub_be_restart (const uint8_t xlen, const char *elf_filename)
+{
+    if (! initialized) return status_ok;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_restart (%s)\n",
+		 (((elf_filename == NULL) || (elf_filename [0] == 0)) ? "last ELF file" : elf_filename));
+	fflush (logfile_fp);
+    }
+
+    uint32_t status = gdbstub_be_ndm_reset (xlen, true);
+    if (status != status_ok) return status;
+
+    // Make sure the hart is halted (and run_mode is PAUSED)
+    status = gdbstub_be_stop (xlen);
+    if (status != status_ok) return status;
+
+#ifdef GDBSTUB_NO_ELF_LOAD
+    if ((elf_filename != NULL) && (elf_filename [0] != 0)) {
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "gdbstub_be_restart: ELF loading compiled out; returning error\n");
+	}
+	return status_err;
+    }
+#else
+    Elf_Features  features;
+    status = elf_reload (elf_filename, & features);
+    if (status != status_ok) return status;
+
+    if ((~ features.pc_start) != 0) {
+	status = gdbstub_be_PC_write (gdbstub_be_xlen (), features.pc_start);
+	if (status != status_ok) return status;
+    }
+#endif
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_restart => ok\n");
+	fflush (logfile_fp);
+    }
+    return status_ok;
+}
+
+// ================================================================
+// Harts
+// Register accesses, step, continue and stop act on the selected hart.
+// gdbstub_be_harts_resume resumes several harts with a single dmcontrol
+// write, using the hart array mask (dmcontrol.hasel and hawindow); they
+// then run as a group, and when any of them halts, the others are
+// halted too (all-stop), again with one dmcontrol write.
+// We use only the first hart array window, so at most BE_HARTS_MAX harts.
+
+
+static
+void hawindow_write (uint32_t mask)
+{
+    if (! hawindow_cache_valid)
+	dmi_write (dm_addr_hawindowsel, 0);
+    if ((! hawindow_cache_valid) || (hawindow_cache != mask))
+	dmi_write (dm_addr_hawindow, mask);
+    hawindow_cache       = mask;
+    hawindow_cache_valid = true;
+}
+
+// Write dmcontrol with hartsel = be_hartsel (and no requests)
+static
+void hartsel_write (void)
+{
+    dmcontrol_hart_write (be_hartsel, false, false);
+}
+
+// Number of harts (counted by dm_caps)
+uint32_t gdbstub_be_num_harts (void)
+{
+    if (! initialized) return 1;
+    return dm_caps ()->n_harts;
+}
+
+// Without the hart array mask (dmcontrol.hasel not implemented), a
+// group is halted and resumed one hart at a time, and polled one hart
+// at a time.  The selected hart is selected again afterwards.
+
+static
+uint32_t group_halt_each (uint32_t mask)
+{
+    uint32_t status = status_ok;
+    uint32_t dmstatus;
+    for (uint32_t h = 0; h < BE_HARTS_MAX; h++) {
+	if (! ((mask >> h) & 1)) continue;
+	dmcontrol_hart_write (h, true, false);
+	if (poll_dmstatus ("group_halt_each", DMSTATUS_ALLHALTED, DMSTATUS_ALLHALTED,
+			   & dmstatus, false) != status_ok)
+	    status = status_err;
+	dmcontrol_hart_write (h, false, false);    // clear haltreq
+    }
+    hartsel_write ();
+    return status;
+}
+
+static
+uint32_t group_resume_each (uint32_t mask)
+{
+    uint32_t status = status_ok;
+    uint32_t dmstatus;
+    for (uint32_t h = 0; h < BE_HARTS_MAX; h++) {
+	if (! ((mask >> h) & 1)) continue;
+	dmcontrol_hart_write (h, false, true);
+	if (poll_dmstatus ("group_resume_each", DMSTATUS_ALLRESUMEACK, DMSTATUS_ALLRESUMEACK,
+			   & dmstatus, false) != status_ok)
+	    status = status_err;
+    }
+    hartsel_write ();
+    return status;
+}
+
+static
+uint32_t group_halted_each (uint32_t mask)
+{
+    uint32_t halted_mask = 0;
+    for (uint32_t h = 0; h < BE_HARTS_MAX; h++) {
+	if (! ((mask >> h) & 1)) continue;
+	dmcontrol_hart_write (h, false, false);
+	if (dmi_read (dm_addr_dmstatus) & DMSTATUS_ALLHALTED)
+	    halted_mask |= (1u << h);
+    }
+    hartsel_write ();
+    return halted_mask;
+}
+
+uint32_t gdbstub_be_select_hart (uint32_t hart)
 {
     if (! initialized) return status_ok;
+    if (hart >= gdbstub_be_num_harts ()) return status_err;
+
+    if (hart != be_hartsel) {
+	regs_snapshot_invalidate ();
+	hart_select (hart);
+	hartsel_write ();
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "gdbstub_be_select_hart (%0d)\n", hart);
+	    fflush (logfile_fp);
+	}
+    }
+    return status_ok;
+}
+
+uint32_t gdbstub_be_selected_hart (void)
+{
+    return be_hartsel;
+}
+
+bool gdbstub_be_stopped_by_step (void)
+{
+    return (last_halt_cause == DM_DCSR_CAUSE_STEP);
+}
+
+// ================================================================
+// dcsr.stepie policy
+// With BE_STEPIE_OFF (or _ON), dcsr.stepie is cleared (set) while a
+// hart single-steps, and restored when it continues.  With stepie
+// clear, a step never lands in a trap handler: pending interrupts are
+// taken after the hart continues.  We count the steps at which an
+// interrupt was pending and enabled (as per mip, mie and mstatus.MIE),
+// each of which would otherwise have entered a trap handler.
+
+#define CSR_ADDR_MSTATUS  0x300
+#define CSR_ADDR_MIE      0x304
+#define CSR_ADDR_MIP      0x344
+#define MSTATUS_MIE       0x8
+
+void gdbstub_be_set_stepie (BE_Stepie policy)
+{
+    stepie_policy = policy;
+}
+
+void gdbstub_be_stepie_status (char *buf, const size_t buf_size)
+{
+    snprintf (buf, buf_size,
+	      "Interrupts while stepping (dcsr.stepie): %s\n"
+	      "    %0" PRId64 " steps with stepie changed; at %0" PRId64 " of them an interrupt was pending"
+	      " (trap handler steps avoided)\n",
+	      ((stepie_policy == BE_STEPIE_KEEP) ? "keep"
+	       : ((stepie_policy == BE_STEPIE_OFF) ? "off" : "on")),
+	      stepie_n_steps, stepie_n_masked);
+}
+
+// Would the selected hart take an interrupt if it ran now?
+static
+bool interrupt_pending (const uint8_t xlen, uint32_t dcsr)
+{
+    uint64_t mip, mie, mstatus;
+    if ((gdbstub_be_CSR_read (xlen, CSR_ADDR_MIP, & mip) != status_ok)
+	|| (gdbstub_be_CSR_read (xlen, CSR_ADDR_MIE, & mie) != status_ok)
+	|| ((mip & mie) == 0))
+	return false;
+    // In M mode, only if mstatus.MIE; in lower modes, M interrupts always are
+    if (fn_dcsr_prv (dcsr) != 3)
+	return true;
+    return ((gdbstub_be_CSR_read (xlen, CSR_ADDR_MSTATUS, & mstatus) == status_ok)
+	    && ((mstatus & MSTATUS_MIE) != 0));
+}
+
+// ================================================================
+// Set (for a step) or clear (to continue) dcsr.step of the selected hart,
+// and set or restore dcsr.stepie according to the policy
 
-    // Read 'dcsr' register
+static
+uint32_t dcsr_set_step (const uint8_t xlen, bool step, char *dbg_string)
+{
     uint64_t dcsr64;
     uint8_t  cmderr;
+    uint32_t hart_bit = (1u << be_hartsel);
 
     if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "gdbstub_be_continue: read dcsr ...\n");
+	fprintf (logfile_fp, "%s: read dcsr ...\n", dbg_string);
 	fflush (logfile_fp);
     }
-    uint32_t status = gdbstub_be_reg_read (xlen, csr_addr_dcsr, & dcsr64, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (csr_addr_dcsr, & dcsr64, & cmderr);
     if (status == status_err) return status_err;
 
     uint32_t dcsr = (uint32_t) dcsr64;
     if (logfile_fp != NULL) {
-	fprint_dcsr (logfile_fp,
-		     "gdbstub_be_continue: read dcsr => ", dcsr, "\n");
+	fprintf (logfile_fp, "%s: ", dbg_string);
+	fprint_dcsr (logfile_fp, "read dcsr => ", dcsr, "\n");
 	fflush (logfile_fp);
     }
 
-    // If dcsr.step bit is set, clear it
-    if (fn_dcsr_step (dcsr)) {
+    bool stepie = fn_dcsr_stepie (dcsr);
+    bool saved  = ((stepie_saved & hart_bit) != 0);
+    if (step && (! saved) && (stepie_policy != BE_STEPIE_KEEP)) {
+	bool want = (stepie_policy == BE_STEPIE_ON);
+	if (stepie != want) {
+	    stepie_orig   = ((stepie_orig & (~ hart_bit)) | (stepie ? hart_bit : 0));
+	    stepie_saved |= hart_bit;
+	    stepie        = want;
+	}
+    }
+    else if ((! step) && saved) {
+	stepie        = ((stepie_orig & hart_bit) != 0);
+	stepie_saved &= (~ hart_bit);
+    }
+    if (step && ((stepie_saved & hart_bit) != 0)) {
+	stepie_n_steps++;
+	if ((! stepie) && interrupt_pending (xlen, dcsr))
+	    stepie_n_masked++;
+    }
+
+    if ((fn_dcsr_step (dcsr) != step) || (fn_dcsr_stepie (dcsr) != stepie)) {
 	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "gdbstub_be_continue: clear single-step bit in dcsr\n");
+	    fprintf (logfile_fp, "%s: %s single-step bit, stepie %0d in dcsr\n",
+		     dbg_string, (step ? "set" : "clear"), stepie);
 	    fflush (logfile_fp);
 	}
 	dcsr = fn_mk_dcsr (fn_dcsr_xdebugver (dcsr),
 			   fn_dcsr_ebreakm (dcsr),
 			   fn_dcsr_ebreaks (dcsr),
 			   fn_dcsr_ebreaku (dcsr),
-			   fn_dcsr_stepie (dcsr),
+			   stepie,                      // stepie
 			   fn_dcsr_stopcount (dcsr),
 			   fn_dcsr_stoptime (dcsr),
 			   fn_dcsr_cause (dcsr),
 			   fn_dcsr_mprven (dcsr),
 			   fn_dcsr_nmip (dcsr),
-			   false,                       // step
+			   step,                        // step
 			   fn_dcsr_prv (dcsr));
 
 	// Write back 'dcsr' register
 	if (logfile_fp != NULL) {
-	    fprint_dcsr (logfile_fp,
-			 "gdbstub_be_continue: write reg ", dcsr, "\n");
+	    fprintf (logfile_fp, "%s: ", dbg_string);
+	    fprint_dcsr (logfile_fp, "write reg ", dcsr, "\n");
 	    fflush (logfile_fp);
 	}
-	status = gdbstub_be_reg_write (xlen, csr_addr_dcsr, dcsr, & cmderr);
+	// (not with gdbstub_be_reg_write, which forgets what we know of dcsr)
+	status = be_ops->reg_write (csr_addr_dcsr, dcsr, & cmderr);
 	if (status == status_err) return status_err;
     }
 
+    if (step)
+	dcsr_step_clear &= (~ hart_bit);
+    else
+	dcsr_step_clear |= hart_bit;
+    return status_ok;
+}
+
+// ================================================================
+// Continue the HW execution at given PC
+
+uint32_t gdbstub_be_continue (const uint8_t xlen)
+{
+    if (! initialized) return status_ok;
+
+    regs_snapshot_invalidate ();
+
+    uint32_t status = dcsr_set_step (xlen, false, "gdbstub_be_continue");
+    if (status == status_err) return status_err;
+
     // Write 'resumereq' to dmcontrol
     uint32_t dmcontrol;
     dmcontrol = fn_mk_dmcontrol (false,    // haltreq
@@ -1022,8 +2251,8 @@ uint32_t gdbstub_be_continue (const uint8_t xlen)
 				 false,    // hartreset
 				 false,    // ackhavereset
 				 false,    // hasel
-				 0,        // hartsello
-				 0,        // hartselhi
+				 BE_HARTSELLO, // hartsello
+				 BE_HARTSELHI, // hartselhi
 				 false,    // setresethaltreq
 				 false,    // clrresethaltreq
 				 false,    // ndmreset
@@ -1036,13 +2265,15 @@ uint32_t gdbstub_be_continue (const uint8_t xlen)
 
     dmi_write (dm_addr_dmcontrol, dmcontrol);
 
-    // Poll dmstatus until 'allrunning'
+    // Poll dmstatus until 'allresumeack'
+    // (not 'allrunning': the hart may already have halted again, e.g.,
+    // on a tracepoint just after the resume PC)
     uint32_t dmstatus;
-    poll_dmstatus ("gdbstub_be_continue", DMSTATUS_ALLRUNNING, DMSTATUS_ALLRUNNING,
+    poll_dmstatus ("gdbstub_be_continue", DMSTATUS_ALLRESUMEACK, DMSTATUS_ALLRESUMEACK,
 		   & dmstatus, false);
     fprint_dmstatus (logfile_fp, "    ", dmstatus, "\n");
 
-    if (! (dmstatus & DMSTATUS_ALLRUNNING)) {
+    if (! (dmstatus & DMSTATUS_ALLRESUMEACK)) {
 	// Still not running
         if ((verbosity > 1) && (logfile_fp != NULL)) {
 	    fprintf (logfile_fp, "    %s => still not running (numHaltChecks %d ) \n",
@@ -1061,7 +2292,8 @@ uint32_t gdbstub_be_continue (const uint8_t xlen)
 
     numHaltChecks = 0;
 
-    run_mode = CONTINUE;
+    group_mask = 0;
+    run_mode   = CONTINUE;
     return  status_ok;
 }
 
@@ -1074,54 +2306,11 @@ uint32_t  gdbstub_be_step (const uint8_t xlen)
 {
     if (! initialized) return status_ok;
 
-    // Read 'dcsr' register
-    uint64_t dcsr64;
-    uint8_t  cmderr;
+    regs_snapshot_invalidate ();
 
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "gdbstub_be_step: read dcsr ...\n");
-	fflush (logfile_fp);
-    }
-    uint32_t status = gdbstub_be_reg_read (xlen, csr_addr_dcsr, & dcsr64, & cmderr);
+    uint32_t status = dcsr_set_step (xlen, true, "gdbstub_be_step");
     if (status == status_err) return status_err;
 
-    uint32_t dcsr = (uint32_t) dcsr64;
-    if (logfile_fp != NULL) {
-	fprint_dcsr (logfile_fp,
-		     "gdbstub_be_step: read dcsr => ", dcsr, "\n");
-	fflush (logfile_fp);
-    }
-
-    // If dcsr.step bit is clear, set it
-    if (! fn_dcsr_step (dcsr)) {
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp,
-		     "gdbstub_be_step: set single-step bit in dcsr\n");
-	    fflush (logfile_fp);
-	}
-	dcsr = fn_mk_dcsr (fn_dcsr_xdebugver (dcsr),
-			   fn_dcsr_ebreakm (dcsr),
-			   fn_dcsr_ebreaks (dcsr),
-			   fn_dcsr_ebreaku (dcsr),
-			   fn_dcsr_stepie (dcsr),
-			   fn_dcsr_stopcount (dcsr),
-			   fn_dcsr_stoptime (dcsr),
-			   fn_dcsr_cause (dcsr),
-			   fn_dcsr_mprven (dcsr),
-			   fn_dcsr_nmip (dcsr),
-			   true,                       // step
-			   fn_dcsr_prv (dcsr));
-
-	// Write back 'dcsr' register
-	if (logfile_fp != NULL) {
-	    fprint_dcsr (logfile_fp,
-			 "gdbstub_be_step: write reg ", dcsr, "\n");
-	    fflush (logfile_fp);
-	}
-	status = gdbstub_be_reg_write (xlen, csr_addr_dcsr, dcsr, & cmderr);
-	if (status == status_err) return status_err;
-    }
-
     // Write 'resumereq' to dmcontrol
     if (logfile_fp != NULL) {
 	fprintf (logfile_fp,
@@ -1133,8 +2322,8 @@ uint32_t  gdbstub_be_step (const uint8_t xlen)
 					  false,    // hartreset
 					  false,    // ackhavereset
 					  false,    // hasel
-					  0,        // hartsello
-					  0,        // hartselhi
+					  BE_HARTSELLO, // hartsello
+					  BE_HARTSELHI, // hartselhi
 					  false,    // setresethaltreq
 					  false,    // clrresethaltreq
 					  false,    // ndmreset
@@ -1158,7 +2347,8 @@ uint32_t  gdbstub_be_step (const uint8_t xlen)
 	fprintf (logfile_fp, "gdbstub_be_step () => ok\n");
 	fflush (logfile_fp);
     }
-    run_mode = PAUSED;
+    group_mask = 0;
+    run_mode   = PAUSED;
     return status_ok;
 }
 
@@ -1169,14 +2359,24 @@ uint32_t  gdbstub_be_stop (const uint8_t xlen)
 {
     if (! initialized) return status_ok;
 
+    regs_snapshot_invalidate ();
+
+    // A group of harts is halted all at once, with the hart array mask
+    // (else, the others one by one, and then the selected hart as usual)
+    bool hasel = ((group_mask != 0) && dm_caps ()->hasel);
+    if (hasel)
+	hawindow_write (group_mask);
+    else if (group_mask != 0)
+	group_halt_each (group_mask & (~ (1u << be_hartsel)));
+
     // Write 'haltreq' to dmcontrol
     uint32_t dmcontrol = fn_mk_dmcontrol (true,     // haltreq
 					  false,    // resumereq
 					  false,    // hartreset
 					  false,    // ackhavereset
-					  false,    // hasel
-					  0,        // hartsello
-					  0,        // hartselhi
+					  hasel,    // hasel
+					  BE_HARTSELLO, // hartsello
+					  BE_HARTSELHI, // hartselhi
 					  false,    // setresethaltreq
 					  false,    // clrresethaltreq
 					  false,    // ndmreset
@@ -1195,7 +2395,91 @@ uint32_t  gdbstub_be_stop (const uint8_t xlen)
 	fprintf (logfile_fp, "gdbstub_be_stop () => ok\n");
 	fflush (logfile_fp);
     }
-    run_mode = PAUSED;
+    group_mask = 0;
+    run_mode   = PAUSED;
+    return status_ok;
+}
+
+// ================================================================
+// Resume the harts in step_mask for one instruction, and those in
+// run_mask to run, all at once.  Harts whose dcsr.step is already right
+// are not touched before the resume.  The selected hart stays selected
+// if it is resumed; otherwise the lowest-numbered stepping (else
+// running) hart is selected.
+
+uint32_t gdbstub_be_harts_resume (const uint8_t xlen, uint32_t step_mask, uint32_t run_mask)
+{
+    if (! initialized) return status_ok;
+
+    uint32_t mask    = step_mask | run_mask;
+    uint32_t n_harts = gdbstub_be_num_harts ();
+    if ((mask == 0) || ((step_mask & run_mask) != 0)
+	|| ((n_harts < BE_HARTS_MAX) && ((mask >> n_harts) != 0)))
+	return status_err;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_harts_resume (step 0x%0x, run 0x%0x)\n", step_mask, run_mask);
+	fflush (logfile_fp);
+    }
+
+    regs_snapshot_invalidate ();
+
+    // dcsr.step of each hart
+    uint32_t hartsel = be_hartsel;
+    for (uint32_t h = 0; h < n_harts; h++) {
+	bool step = ((step_mask >> h) & 1);
+	bool run  = ((run_mask  >> h) & 1);
+	if ((! step) && ((! run) || ((dcsr_step_clear >> h) & 1)))
+	    continue;
+	gdbstub_be_select_hart (h);
+	if (dcsr_set_step (xlen, step, "gdbstub_be_harts_resume") != status_ok)
+	    return status_err;
+    }
+
+    if (! ((mask >> hartsel) & 1)) {
+	uint32_t first = ((step_mask != 0) ? step_mask : run_mask);
+	for (hartsel = 0; ! ((first >> hartsel) & 1); hartsel++)
+	    ;
+    }
+    hart_select (hartsel);
+
+    // Resume them with one dmcontrol write (or, without the hart array
+    // mask, the others one by one and then the selected hart)
+    bool group = ((mask & (mask - 1)) != 0);    // more than one hart
+    bool hasel = (group && dm_caps ()->hasel);
+    if (hasel)
+	hawindow_write (mask);
+    else if (group && (group_resume_each (mask & (~ (1u << be_hartsel))) != status_ok))
+	return status_err;
+
+    uint32_t dmcontrol = fn_mk_dmcontrol (false,          // haltreq
+					  true,           // resumereq
+					  false,          // hartreset
+					  false,          // ackhavereset
+					  hasel,          // hasel
+					  BE_HARTSELLO,   // hartsello
+					  BE_HARTSELHI,   // hartselhi
+					  false,          // setresethaltreq
+					  false,          // clrresethaltreq
+					  false,          // ndmreset
+					  true);          // dmactive
+    if (logfile_fp != NULL) {
+	fprint_dmcontrol (logfile_fp, "gdbstub_be_harts_resume: write ", dmcontrol, "\n");
+	fflush (logfile_fp);
+    }
+    dmi_write (dm_addr_dmcontrol, dmcontrol);
+
+    // Poll dmstatus until 'allresumeack' (of all the selected harts)
+    uint32_t dmstatus;
+    uint32_t status = poll_dmstatus ("gdbstub_be_harts_resume",
+				     DMSTATUS_ALLRESUMEACK, DMSTATUS_ALLRESUMEACK,
+				     & dmstatus, false);
+    if (status != status_ok)
+	return status_err;
+
+    numHaltChecks = 0;
+    group_mask    = (group ? mask : 0);
+    run_mode      = CONTINUE;
     return status_ok;
 }
 
@@ -1221,8 +2505,18 @@ int32_t  gdbstub_be_get_stop_reason (const uint8_t  xlen,
 	fflush (logfile_fp);
     }
     // Poll dmstatus until 'allhalted'
+    // (for a group of harts: until any of them has halted)
     uint32_t dmstatus;
-    poll_dmstatus ("gdbstub_be_get_stop_reason", DMSTATUS_ALLHALTED, DMSTATUS_ALLHALTED, & dmstatus, commands_preempt);
+    uint32_t halted_mask = 0;
+    if (group_mask != 0) {
+	if (dm_caps ()->hasel)
+	    halted_mask = dmi_read (dm_addr_haltsum0) & group_mask;
+	else
+	    halted_mask = group_halted_each (group_mask);
+	dmstatus    = ((halted_mask != 0) ? DMSTATUS_ALLHALTED : 0);
+    }
+    else
+	poll_dmstatus ("gdbstub_be_get_stop_reason", DMSTATUS_ALLHALTED, DMSTATUS_ALLHALTED, & dmstatus, commands_preempt);
 
     if (! (dmstatus & DMSTATUS_ALLHALTED)) {
 	// Still running
@@ -1253,6 +2547,23 @@ int32_t  gdbstub_be_get_stop_reason (const uint8_t  xlen,
 	fflush (logfile_fp);
     }
 
+    if (group_mask != 0) {
+	// All-stop: halt the rest of the group, and report the selected
+	// hart if it is one of those that halted, else the lowest-numbered
+	uint32_t hart = be_hartsel;
+	if (! ((halted_mask >> hart) & 1))
+	    for (hart = 0; ! ((halted_mask >> hart) & 1); hart++)
+		;
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp,
+		     "    gdbstub_be_get_stop_reason (): harts 0x%0x of group 0x%0x halted; reporting hart %0d\n",
+		     halted_mask, group_mask, hart);
+	    fflush (logfile_fp);
+	}
+	gdbstub_be_stop (xlen);
+	gdbstub_be_select_hart (hart);
+    }
+
     run_mode = PAUSED;
 
     // Read dcsr
@@ -1265,11 +2576,12 @@ int32_t  gdbstub_be_get_stop_reason (const uint8_t  xlen,
     uint64_t dcsr64;
     uint8_t  cmderr;
 
-    uint32_t status = gdbstub_be_reg_read (xlen, csr_addr_dcsr, & dcsr64, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (csr_addr_dcsr, & dcsr64, & cmderr);
     if (status == status_err) return -1;
 
     uint32_t dcsr = (uint32_t) dcsr64;
     DM_DCSR_Cause cause = fn_dcsr_cause (dcsr);
+    last_halt_cause = cause;
     if (logfile_fp != NULL) {
 	fprintf (logfile_fp,
 		 "    gdbstub_be_get_stop_reason () => halted; dcsr.cause = %0d\n",
@@ -1339,7 +2651,7 @@ uint32_t  gdbstub_be_PC_read (const uint8_t xlen, uint64_t *p_PC)
 
     // Read 'dpc' in debug module, = CSR 0X7b1
     uint8_t  cmderr;
-    uint32_t status = gdbstub_be_reg_read (xlen, csr_addr_dpc, p_PC, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (csr_addr_dpc, p_PC, & cmderr);
     if (status == status_err) {
 	if (logfile_fp != NULL) {
 	    fprint_abstractcs_cmderr (logfile_fp,
@@ -1376,7 +2688,7 @@ uint32_t  gdbstub_be_GPR_read (const uint8_t xlen, uint8_t regnum, uint64_t *p_r
     // Debug module encodes GPR x as 0x1000 + x
     uint8_t  cmderr;
     uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_gpr_0);
-    uint32_t status = gdbstub_be_reg_read (xlen, hwregnum, p_regval, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (hwregnum, p_regval, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1397,6 +2709,53 @@ uint32_t  gdbstub_be_GPR_read (const uint8_t xlen, uint8_t regnum, uint64_t *p_r
     return status;
 }
 
+// ================================================================
+// Read all 32 GPRs in SoC into p_regvals [0..31]
+
+uint32_t  gdbstub_be_GPRs_read (const uint8_t xlen, uint64_t *p_regvals)
+{
+    memset (p_regvals, 0, 32 * sizeof (uint64_t));
+    if (! initialized) return status_ok;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_GPRs_read\n");
+	fflush (logfile_fp);
+    }
+
+    // x0 is hardwired to zero
+
+    // Optimistically (see abs_batch_begin), then with polling if need be
+    if (abs_batch_begin ()) {
+	for (uint8_t regnum = 1; regnum < 32; regnum++) {
+	    uint8_t  cmderr;
+	    uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_gpr_0);
+	    gdbstub_be_reg_read (hwregnum, & (p_regvals [regnum]), & cmderr);
+	}
+	if (abs_batch_end ("gdbstub_be_GPRs_read") == status_ok) {
+	    for (uint8_t regnum = 1; regnum < 32; regnum++)
+		regs_snapshot [regnum] = p_regvals [regnum];
+	    regs_snapshot_valid |= 0xFFFFFFFEULL;
+	    return status_ok;
+	}
+    }
+
+    for (uint8_t regnum = 1; regnum < 32; regnum++) {
+	uint8_t  cmderr;
+	uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_gpr_0);
+	uint32_t status = gdbstub_be_reg_read (hwregnum, & (p_regvals [regnum]), & cmderr);
+	if (status == status_err) {
+	    if (logfile_fp != NULL) {
+		fprintf (logfile_fp,
+			 "    ERROR: gdbstub_be_GPRs_read (gpr 0x%0x)", regnum);
+		fprint_abstractcs_cmderr (logfile_fp, " => ", cmderr, "\n");
+		fflush (logfile_fp);
+	    }
+	    return status_err;
+	}
+    }
+    return status_ok;
+}
+
 // ================================================================
 // Read a value from a FPR register in SoC
 
@@ -1415,7 +2774,7 @@ uint32_t  gdbstub_be_FPR_read (const uint8_t xlen, uint8_t regnum, uint64_t *p_r
     // Debug module encodes FPR x as 0x1020 + x
     uint8_t  cmderr;
     uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_fpr_0);
-    uint32_t status = gdbstub_be_reg_read (xlen, hwregnum, p_regval, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (hwregnum, p_regval, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1454,7 +2813,7 @@ uint32_t  gdbstub_be_CSR_read (const uint8_t xlen, uint16_t regnum, uint64_t *p_
     // Debug module encodes CSR x as x
     uint8_t  cmderr;
     uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_csr_0);
-    uint32_t status = gdbstub_be_reg_read (xlen, hwregnum, p_regval, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (hwregnum, p_regval, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1476,6 +2835,195 @@ uint32_t  gdbstub_be_CSR_read (const uint8_t xlen, uint16_t regnum, uint64_t *p_
     return status;
 }
 
+// ================================================================
+// Sampling CSRs of a running hart
+
+// With Quick Access (abstract command type 1), the DM halts the hart,
+// runs the program buffer and resumes the hart in one command, so a
+// sample costs a command write, an abstractcs poll and a data read, and
+// the hart is stopped only while the program runs.  The program copies
+// the CSR through s0 (saved in dscratch0) into the memory-mapped
+// data0/data1 (hartinfo.dataaddr):
+//     csrw dscratch0, s0;  csrr s0, csr;  sw/sd s0, dataaddr(zero);  csrr s0, dscratch0;  ebreak
+// It is written once, and reused while the same CSR is sampled.
+// Without Quick Access (or the progbuf, dscratch0 and data access it
+// needs), the hart is halted, the CSR read, and the hart resumed.
+
+#define QUICK_PROG_LEN  5
+
+// Quick Access: try it with a program that just returns.  This must be
+// done while the hart is halted: it then fails at once, with
+// 'halt/resume' if the DM has Quick Access and 'not supported' if not.
+// (On a running hart it would halt and resume it.)
+static
+void quick_probe (void)
+{
+    dm_caps ();
+    DM_Caps *c = & dm_caps_cache;
+    c->quick_probed = true;
+    c->quick_access = false;
+    if (c->progbufsize == 0)
+	return;
+
+    dmi_write (dm_addr_progbuf0, INSTR_EBREAK);
+    quick_prog_csr = -1;
+    dmi_write (dm_addr_command, ((uint32_t) DM_COMMAND_CMDTYPE_QUICK_ACCESS) << 24);
+    uint32_t abstractcs;
+    if (poll_abstractcs_until_notbusy ("quick_probe", & abstractcs) != status_ok)
+	return;
+    uint8_t cmderr = fn_abstractcs_cmderr (abstractcs);
+    c->quick_access = ((cmderr == DM_ABSTRACTCS_CMDERR_NONE)
+		       || (cmderr == DM_ABSTRACTCS_CMDERR_HALT_RESUME));
+    if (cmderr != 0)
+	dmi_write (dm_addr_abstractcs, fn_mk_abstractcs (DM_ABSTRACTCS_CMDERR_OTHER));
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "quick_probe: Quick Access %s\n", (c->quick_access ? "supported" : "not supported"));
+	fflush (logfile_fp);
+    }
+}
+
+static
+bool quick_usable (const uint8_t xlen)
+{
+    const DM_Caps *c = dm_caps ();
+    return (c->quick_access
+	    && c->dataaccess
+	    && (c->nscratch >= 1)
+	    && (c->datasize >= ((xlen == 32) ? 1 : 2))
+	    && (c->progbufsize >= (QUICK_PROG_LEN - (c->impebreak ? 1 : 0))));
+}
+
+static
+void quick_prog_write (const uint8_t xlen, uint16_t csr)
+{
+    const DM_Caps *c      = dm_caps ();
+    uint32_t       imm    = c->dataaddr;                 // 12-bit, sign-extended by sw/sd
+    uint32_t       funct3 = ((xlen == 32) ? 2 : 3);      // sw or sd
+    uint32_t prog [QUICK_PROG_LEN] = {
+	0x7B241073,                                          // csrw dscratch0, s0
+	(((uint32_t) csr) << 20) | 0x00002473,               // csrr s0, csr
+	(((imm >> 5) & 0x7F) << 25) | (8 << 20) | (funct3 << 12) | ((imm & 0x1F) << 7) | 0x23,
+	0x7B202473,                                          // csrr s0, dscratch0
+	INSTR_EBREAK
+    };
+    uint32_t n = min (QUICK_PROG_LEN, c->progbufsize);
+    for (uint32_t j = 0; j < n; j++)
+	dmi_write ((uint16_t) (dm_addr_progbuf0 + j), prog [j]);
+    quick_prog_csr = csr;
+}
+
+// dmcontrol for the selected hart, with haltreq/resumereq
+static
+uint32_t sample_dmcontrol (bool haltreq, bool resumereq)
+{
+    return fn_mk_dmcontrol (haltreq,        // haltreq
+			    resumereq,      // resumereq
+			    false,          // hartreset
+			    false,          // ackhavereset
+			    false,          // hasel
+			    BE_HARTSELLO,   // hartsello
+			    BE_HARTSELHI,   // hartselhi
+			    false,          // setresethaltreq
+			    false,          // clrresethaltreq
+			    false,          // ndmreset
+			    true);          // dmactive
+}
+
+// Halt the selected hart, read the CSR, and resume it.  The hart may
+// have halted by itself (breakpoint, trigger, ...) just before our
+// haltreq; it is resumed only if dcsr.cause says we halted it.
+static
+uint32_t csr_sample_halt_resume (const uint8_t xlen, uint16_t csr, uint64_t *p_val)
+{
+    uint32_t dmstatus;
+    uint8_t  cmderr;
+    uint64_t dcsr;
+
+    dmi_write (dm_addr_dmcontrol, sample_dmcontrol (true, false));
+    uint32_t status = poll_dmstatus ("gdbstub_be_csr_sample", DMSTATUS_ALLHALTED, DMSTATUS_ALLHALTED,
+				     & dmstatus, false);
+    dmi_write (dm_addr_dmcontrol, sample_dmcontrol (false, false));
+    if (status != status_ok)
+	return status;
+
+    if (! dm_caps ()->quick_probed)
+	quick_probe ();
+
+    status = gdbstub_be_reg_read ((uint16_t) (csr + dm_command_access_reg_regno_csr_0),
+				  p_val, & cmderr);
+    regs_snapshot_invalidate ();
+
+    if (gdbstub_be_reg_read (csr_addr_dcsr, & dcsr, & cmderr) != status_ok)
+	return status_err;
+    if (fn_dcsr_cause ((uint32_t) dcsr) != DM_DCSR_CAUSE_HALTREQ) {
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "gdbstub_be_csr_sample: hart halted by itself (dcsr.cause %0d); not resumed\n",
+		     fn_dcsr_cause ((uint32_t) dcsr));
+	    fflush (logfile_fp);
+	}
+	return status;
+    }
+
+    dmi_write (dm_addr_dmcontrol, sample_dmcontrol (false, true));
+    if (poll_dmstatus ("gdbstub_be_csr_sample", DMSTATUS_ALLRESUMEACK, DMSTATUS_ALLRESUMEACK,
+		       & dmstatus, false) != status_ok)
+	return status_err;
+    return status;
+}
+
+uint32_t  gdbstub_be_csr_sample (const uint8_t xlen, uint16_t csr, uint64_t *p_val)
+{
+    *p_val = 0;
+    if (! initialized) return status_ok;
+
+    uint64_t t0 = usecs_now ();
+    uint8_t  cmderr;
+
+    if ((! dm_caps ()->quick_probed) && (dmi_read (dm_addr_dmstatus) & DMSTATUS_ALLHALTED))
+	quick_probe ();
+
+    if (quick_usable (xlen)) {
+	if (quick_prog_csr != csr)
+	    quick_prog_write (xlen, csr);
+	dmi_write (dm_addr_command, ((uint32_t) DM_COMMAND_CMDTYPE_QUICK_ACCESS) << 24);
+
+	uint32_t abstractcs;
+	if (poll_abstractcs_until_notbusy ("gdbstub_be_csr_sample", & abstractcs) != status_ok)
+	    return status_err;
+	cmderr = fn_abstractcs_cmderr (abstractcs);
+	if (cmderr == 0) {
+	    uint64_t val = dmi_read (dm_addr_data0);
+	    if (xlen == 64)
+		val |= ((uint64_t) dmi_read (dm_addr_data1)) << 32;
+	    *p_val = val;
+	    sample_n_quick++;
+	    sample_t_quick += usecs_now () - t0;
+	    return status_ok;
+	}
+	dmi_write (dm_addr_abstractcs, fn_mk_abstractcs (DM_ABSTRACTCS_CMDERR_OTHER));
+	if (cmderr != DM_ABSTRACTCS_CMDERR_HALT_RESUME) {
+	    if (logfile_fp != NULL) {
+		fprintf (logfile_fp, "gdbstub_be_csr_sample (csr 0x%0x): Quick Access", csr);
+		fprint_abstractcs_cmderr (logfile_fp, ": abstractcs.cmderr: ", cmderr, "\n");
+		fflush (logfile_fp);
+	    }
+	    return status_err;
+	}
+	// Fall through: the hart is halted
+    }
+    else if (! (dmi_read (dm_addr_dmstatus) & DMSTATUS_ALLHALTED)) {
+	uint32_t status = csr_sample_halt_resume (xlen, csr, p_val);
+	sample_n_haltresume++;
+	sample_t_haltresume += usecs_now () - t0;
+	return status;
+    }
+
+    // The hart is halted: just read the CSR
+    sample_n_halted++;
+    return gdbstub_be_reg_read ((uint16_t) (csr + dm_command_access_reg_regno_csr_0),
+				p_val, & cmderr);
+}
+
 // ================================================================
 // Read a value from PRIV
 
@@ -1492,7 +3040,7 @@ uint32_t  gdbstub_be_PRIV_read (const uint8_t xlen, uint64_t *p_PRIV)
     // PRIV is a virtual register aliasing dcsr.prv
     uint64_t dcsr64;
     uint8_t  cmderr;
-    uint32_t status = gdbstub_be_reg_read (xlen, csr_addr_dcsr, &dcsr64, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (csr_addr_dcsr, &dcsr64, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1565,6 +3113,15 @@ uint32_t  gdbstub_be_mem_read_subword (const uint8_t   xlen,
 	return status_err;
     }
 
+    // DM without this access size: read the containing word
+    if ((len != 4) && (! dm_caps_sbaccess (sbaccess))) {
+	uint32_t word;
+	status = gdbstub_be_mem_read_subword (xlen, (addr & (~ addr_lsb_mask)), & word, 4);
+	if (status != status_ok) return status;
+	*data = (word >> ((addr & addr_lsb_mask) * 8));
+	return status_ok;
+    }
+
     // Write SBCS
 
     status = gdbstub_be_wait_for_sb_nonbusy (NULL);
@@ -1584,20 +3141,7 @@ uint32_t  gdbstub_be_mem_read_subword (const uint8_t   xlen,
     // Write address to sbaddress1/0 (which will start a bus read)
     status = gdbstub_be_wait_for_sb_nonbusy (NULL);
     if (status == status_err) return status;
-    if (xlen == 64) {
-	// Write upper 64b of address to sbaddress1
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    Write to sbaddress1: 0x%08" PRIx32 "\n", (uint32_t) (addr >> 32));
-	    fflush (logfile_fp);
-	}
-	dmi_write (dm_addr_sbaddress1, (uint32_t) (addr >> 32));
-    }
-    // Write lower 32b of the address to sbaddress0
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "    Write to sbaddress0: 0x%08" PRIx32 "\n", (uint32_t) addr);
-	fflush (logfile_fp);
-    }
-    dmi_write (dm_addr_sbaddress0, (uint32_t) addr);
+    be_ops->sbaddress_write (addr);
 
     status = gdbstub_be_wait_for_sb_nonbusy (NULL);
     if (status == status_err) return status;
@@ -1631,120 +3175,238 @@ uint32_t  gdbstub_be_mem_read (const uint8_t   xlen,
     if (len == 0)
 	return status_ok;
 
-    uint32_t status = 0;
-
-    const uint64_t addr_lsb_mask = 0x3;
-    const uint64_t addr_lim      = addr + len;
-    uint64_t       addr4         = (addr & (~ addr_lsb_mask));            // 32b-aligned at/below addr
-    const uint64_t addr_lim4     = ((addr_lim + 3) & (~ addr_lsb_mask));  // 32b-aligned at/below addr_lim
-    size_t         jd            = 0;                                     // index into data []
+    uint32_t status = be_ops->mem_read_words (addr, data, len);
+    if (status != status_ok) return status;
 
-    // Write SBCS
-    status = gdbstub_be_wait_for_sb_nonbusy (NULL);
-    if (status == status_err) return status;
-    uint32_t sbcs = fn_mk_sbcs (true,                      // sbbusyerr (W1C)
-				true,                      // sbreadonaddr
-				DM_SBACCESS_32_BIT,        // sbaccess (size)
-				true,                      // sbautoincrement
-				true,                      // sbreadondata
-				DM_SBERROR_UNDEF7_W1C);    // Clear sberror
+    // Log it
     if (logfile_fp != NULL) {
-	fprint_sbcs (logfile_fp, "    Write ", sbcs, "\n");
+	fprint_mem_data (logfile_fp, verbosity, data, len);
 	fflush (logfile_fp);
     }
-    dmi_write (dm_addr_sbcs, sbcs);
 
-    // Write the initial address to sbaddress0 (which will start a bus read)
-    status = gdbstub_be_wait_for_sb_nonbusy (NULL);
-    if (status == status_err) return status;
-    if (xlen == 64) {
-	// Write upper 32b of address to sbaddress1
+    return status_ok;
+}
+
+// ================================================================
+// Scatter-gather memory reads (see gdbstub_be.h)
+
+// With merge, items are visited in address order (through a sorted
+// array of pointers, so that the caller's array keeps its order), and
+// items at most BE_SG_MERGE_GAP bytes apart are read together in one
+// gdbstub_be_mem_read, i.e., one SBA setup and an autoincrement burst,
+// of up to BE_SG_BURST_MAX bytes.  Bigger items are read on their own.
+
+// One item, with an access of its own size if it has one
+static
+uint32_t mem_read_item (const uint8_t xlen, const BE_Mem_Item *p_item)
+{
+    uint64_t addr = p_item->addr;
+    uint32_t len  = p_item->len;
+    uint32_t x [2];
+    uint32_t status;
+
+    if (((len != 1) && (len != 2) && (len != 4) && (len != 8)) || ((addr & (len - 1)) != 0))
+	return gdbstub_be_mem_read (xlen, addr, (char *) p_item->dst, len);
+
+    if (len < 8)
+	status = gdbstub_be_mem_read_subword (xlen, addr, & (x [0]), len);
+    else if (! dm_caps_sbaccess (DM_SBACCESS_64_BIT)) {
+	// Low word first, as a 64-bit access would be split by the bus
+	status = gdbstub_be_mem_read_subword (xlen, addr, & (x [0]), 4);
+	if (status == status_ok)
+	    status = gdbstub_be_mem_read_subword (xlen, addr + 4, & (x [1]), 4);
+    }
+    else {
+	status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+	if (status == status_err) return status;
+	uint32_t sbcs = fn_mk_sbcs (true,                      // sbbusyerr (W1C)
+				    true,                      // sbreadonaddr
+				    DM_SBACCESS_64_BIT,        // sbaccess (size)
+				    false,                     // sbautoincrement
+				    false,                     // sbreadondata
+				    DM_SBERROR_UNDEF7_W1C);    // Clear sberror
+	if (logfile_fp != NULL)
+	    fprint_sbcs (logfile_fp, "    Write ", sbcs, "\n");
+	dmi_write (dm_addr_sbcs, sbcs);
+	be_ops->sbaddress_write (addr);
+	status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+	if (status == status_err) return status;
+	x [0] = dmi_read (dm_addr_sbdata0);
+	x [1] = dmi_read (dm_addr_sbdata1);
+    }
+    if (status != status_ok)
+	return status;
+
+    for (uint32_t j = 0; j < len; j++)
+	p_item->dst [j] = (uint8_t) (x [j / 4] >> (8 * (j % 4)));
+    return status_ok;
+}
+
+static
+int cmp_mem_item_addr (const void *a, const void *b)
+{
+    uint64_t x = (* (const BE_Mem_Item * const *) a)->addr;
+    uint64_t y = (* (const BE_Mem_Item * const *) b)->addr;
+    return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+uint32_t  gdbstub_be_mem_read_sg (const uint8_t  xlen,
+				  BE_Mem_Item   *items,
+				  const uint32_t n_items,
+				  const bool     merge,
+				  uint32_t      *p_n_bursts)
+{
+    static uint8_t burst [BE_SG_BURST_MAX];
+
+    if (p_n_bursts != NULL) *p_n_bursts = 0;
+    if (n_items == 0) return status_ok;
+
+    if (! merge) {
+	uint32_t status = status_ok;
+	uint32_t j;
+	for (j = 0; (j < n_items) && (status == status_ok); j++)
+	    status = mem_read_item (xlen, & (items [j]));
 	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    Write to sbaddress1: 0x%08" PRIx32 "\n", (uint32_t) (addr4 >> 32));
+	    fprintf (logfile_fp, "gdbstub_be_mem_read_sg: %0d items, not merged%s\n",
+		     n_items, ((status == status_ok) ? "" : ": ERROR"));
 	    fflush (logfile_fp);
 	}
-	dmi_write (dm_addr_sbaddress1, (uint32_t) (addr4 >> 32));
-    }
-    // Write lower 32b of the address to sbaddress0
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "    Write to sbaddress0: 0x%08" PRIx32 "\n", (uint32_t) addr4);
-	fflush (logfile_fp);
+	if (p_n_bursts != NULL) *p_n_bursts = j;
+	return status;
     }
-    dmi_write (dm_addr_sbaddress0, (uint32_t) addr4);
 
-    // Repeatedly read sbdata0
-    while (addr4 < addr_lim4) {
-	assert (jd < len);
-	status = gdbstub_be_wait_for_sb_nonbusy (NULL);
-	if (status == status_err) return status;
-	uint32_t x = dmi_read (dm_addr_sbdata0);
-
-	// If this is first word and addr is unaligned, copy relevant bytes (< 4)
-	if (addr4 < addr) {
-	    assert ((addr - addr4) < 4);
-	    uint8_t  *p_x    = (uint8_t *) (& x);
-	    size_t    offset = (size_t) (addr - addr4);
-	    memcpy (& (data [0]), & (p_x [offset]), 4 - offset);
-	    jd    += (4 - offset);
-	    /*
-	    if (logfile_fp != NULL) {
-	    fprintf (logfile_fp,
-                     "gdbstub_be_mem_read: addr4 0x%0" PRIx64 ", initial %0zu bytes\n",
-		     addr4, (4 - offset));
-            }
-	    */
-	}
-	// If this is intermediate whole-32b word, copy all 4 bytes
-	else if ((addr4 + 4) <= addr_lim) {
-	    memcpy (& (data [jd]), & x, 4);
-	    jd    += 4;
-	    /*
-	    if (logfile_fp != NULL) {
-	    fprintf (logfile_fp,
-	             "gdbstub_be_mem_read: addr4 0x%0" PRIx64 ", 4 bytes\n", addr4);
-            }
-	    */
+    BE_Mem_Item **sorted = (BE_Mem_Item **) malloc (n_items * sizeof (BE_Mem_Item *));
+    if (sorted == NULL) return status_err;
+    for (uint32_t j = 0; j < n_items; j++)
+	sorted [j] = & (items [j]);
+    qsort (sorted, n_items, sizeof (BE_Mem_Item *), cmp_mem_item_addr);
+
+    uint32_t status   = status_ok;
+    uint32_t n_bursts = 0;
+    uint32_t i        = 0;
+    while ((i < n_items) && (status == status_ok)) {
+	BE_Mem_Item *p_i = sorted [i];
+	if (p_i->len > BE_SG_BURST_MAX) {
+	    status = gdbstub_be_mem_read (xlen, p_i->addr, (char *) p_i->dst, p_i->len);
+	    n_bursts++;
+	    i++;
+	    continue;
 	}
-	// If this is last word and remainder is < 4 bytes, copy relevant bytes (< 4)
-	else {
-	    memcpy (& (data [jd]), & x, addr_lim - addr4);
-	    jd    += (addr_lim - addr4);
-	    assert (jd >= len);
-	    /*
-	    if (logfile_fp != NULL) {
-	    fprintf (logfile_fp,
-                     "gdbstub_be_mem_read: addr4 0x%0" PRIx64 ", final %0" PRId64 " bytes\n",
-		     addr4, (addr_lim - addr4));
-            }
-	    */
+
+	uint64_t start = p_i->addr;
+	uint64_t end   = start + p_i->len;
+	uint32_t j     = i + 1;
+	while (j < n_items) {
+	    BE_Mem_Item *p_j   = sorted [j];
+	    uint64_t     end_j = p_j->addr + p_j->len;
+	    if ((p_j->addr > (end + BE_SG_MERGE_GAP))
+		|| ((((end_j > end) ? end_j : end) - start) > BE_SG_BURST_MAX))
+		break;
+	    if (end_j > end)
+		end = end_j;
+	    j++;
 	}
-	addr4 += 4;
+
+	status = gdbstub_be_mem_read (xlen, start, (char *) burst, (size_t) (end - start));
+	if (status == status_ok)
+	    for (uint32_t k = i; k < j; k++)
+		memcpy (sorted [k]->dst, & (burst [sorted [k]->addr - start]), sorted [k]->len);
+	n_bursts++;
+	i = j;
     }
+    free (sorted);
 
-    // Log it
     if (logfile_fp != NULL) {
-	fprint_mem_data (logfile_fp, verbosity, data, jd);
+	fprintf (logfile_fp, "gdbstub_be_mem_read_sg: %0d items in %0d bursts%s\n",
+		 n_items, n_bursts, ((status == status_ok) ? "" : ": ERROR"));
 	fflush (logfile_fp);
     }
-
-    return status_ok;
+    if (p_n_bursts != NULL) *p_n_bursts = n_bursts;
+    return status;
 }
 
 // ================================================================
-// Write a value into the RISC-V PC
-
-uint32_t  gdbstub_be_PC_write (const uint8_t xlen, uint64_t regval)
+// Follow a linked list in memory: read node_size bytes at each node,
+// starting at head, and take the next node's address from the
+// XLEN-sized pointer at next_off (which may lie beyond node_size).
+// Each node is read with one SBA burst.  The walk stops at a NULL
+// pointer, at a node already visited (circular lists, cycles), after
+// max_nodes nodes, or when buf is full; *p_next is the pointer it
+// stopped at (0 at the end of the list).
+
+uint32_t  gdbstub_be_mem_walk (const uint8_t  xlen,
+			       const uint64_t head,
+			       const uint32_t next_off,
+			       const uint32_t node_size,
+			       const uint32_t max_nodes,
+			       uint8_t       *buf,
+			       const size_t   buf_size,
+			       uint64_t      *node_addrs,
+			       uint32_t      *p_n_nodes,
+			       uint64_t      *p_next)
 {
-    if (! initialized) return status_ok;
+    static uint8_t node [BE_WALK_NODE_MAX];
 
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "gdbstub_be_PC_write (data 0x%0" PRIx64 ")\n", regval);
-	fflush (logfile_fp);
-    }
+    const uint32_t ptr_bytes = xlen / 8;
+    uint32_t status  = status_ok;
+    uint32_t n_nodes = 0;
+    uint64_t addr    = head;
 
-    // Write 'dpc' in debug module, = CSR 0X7b1
+    // (checked before adding, which could wrap around)
+    if ((node_size == 0) || (node_size > BE_WALK_NODE_MAX) || (next_off > (BE_WALK_NODE_MAX - ptr_bytes)))
+	return status_err;
+
+    const uint32_t span = (((next_off + ptr_bytes) > node_size)
+			   ? (next_off + ptr_bytes)
+			   : node_size);
+
+    while ((addr != 0)
+	   && (n_nodes < max_nodes)
+	   && ((((size_t) n_nodes + 1) * node_size) <= buf_size)) {
+	uint32_t j;
+	for (j = 0; j < n_nodes; j++)
+	    if (node_addrs [j] == addr)
+		break;
+	if (j < n_nodes)
+	    break;
+
+	status = gdbstub_be_mem_read (xlen, addr, (char *) node, span);
+	if (status != status_ok)
+	    break;
+	memcpy (& (buf [n_nodes * node_size]), node, node_size);
+	node_addrs [n_nodes] = addr;
+	n_nodes++;
+
+	addr = 0;
+	for (j = 0; j < ptr_bytes; j++)
+	    addr |= ((uint64_t) node [next_off + j]) << (8 * j);
+    }
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_mem_walk: head 0x%0" PRIx64 ": %0d nodes, next 0x%0" PRIx64 "%s\n",
+		 head, n_nodes, addr, ((status == status_ok) ? "" : ": ERROR"));
+	fflush (logfile_fp);
+    }
+    *p_n_nodes = n_nodes;
+    *p_next    = addr;
+    return status;
+}
+
+// ================================================================
+// Write a value into the RISC-V PC
+
+uint32_t  gdbstub_be_PC_write (const uint8_t xlen, uint64_t regval)
+{
+    if (! initialized) return status_ok;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_PC_write (data 0x%0" PRIx64 ")\n", regval);
+	fflush (logfile_fp);
+    }
+
+    // Write 'dpc' in debug module, = CSR 0X7b1
     uint8_t  cmderr;
-    uint32_t status = gdbstub_be_reg_write (xlen, csr_addr_dpc, regval, & cmderr);
+    uint32_t status = gdbstub_be_reg_write (csr_addr_dpc, regval, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1784,7 +3446,7 @@ uint32_t  gdbstub_be_GPR_write (const uint8_t xlen, uint8_t regnum, uint64_t reg
     // Debug module encodes GPR x as 0x1000 + x
     uint8_t  cmderr;
     uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_gpr_0);
-    uint32_t status = gdbstub_be_reg_write (xlen, hwregnum, regval, & cmderr);
+    uint32_t status = gdbstub_be_reg_write (hwregnum, regval, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1798,6 +3460,37 @@ uint32_t  gdbstub_be_GPR_write (const uint8_t xlen, uint8_t regnum, uint64_t reg
     return status;
 }
 
+// ================================================================
+// Write p_regvals [1..31] into GPRs x1..x31 (x0 is hardwired to zero)
+
+uint32_t  gdbstub_be_GPRs_write (const uint8_t xlen, const uint64_t *p_regvals)
+{
+    if (! initialized) return status_ok;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_GPRs_write\n");
+	fflush (logfile_fp);
+    }
+
+    // Optimistically (see abs_batch_begin), then with polling if need be
+    if (abs_batch_begin ()) {
+	for (uint8_t regnum = 1; regnum < 32; regnum++) {
+	    uint8_t  cmderr;
+	    uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_gpr_0);
+	    gdbstub_be_reg_write (hwregnum, p_regvals [regnum], & cmderr);
+	}
+	if (abs_batch_end ("gdbstub_be_GPRs_write") == status_ok)
+	    return status_ok;
+    }
+
+    for (uint8_t regnum = 1; regnum < 32; regnum++) {
+	uint32_t status = gdbstub_be_GPR_write (xlen, regnum, p_regvals [regnum]);
+	if (status != status_ok)
+	    return status;
+    }
+    return status_ok;
+}
+
 // ================================================================
 // Write a value into a RISC-V FPR register
 
@@ -1817,7 +3510,7 @@ uint32_t  gdbstub_be_FPR_write (const uint8_t xlen, uint8_t regnum, uint64_t reg
     // Debug module encodes FPR x as 0x1000 + x
     uint8_t  cmderr;
     uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_fpr_0);
-    uint32_t status = gdbstub_be_reg_write (xlen, hwregnum, regval, & cmderr);
+    uint32_t status = gdbstub_be_reg_write (hwregnum, regval, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1851,7 +3544,7 @@ uint32_t  gdbstub_be_CSR_write (const uint8_t xlen, uint16_t regnum, uint64_t re
     // Debug module encodes CSR x as x
     uint8_t  cmderr;
     uint16_t hwregnum = (uint16_t) (regnum + dm_command_access_reg_regno_csr_0);
-    uint32_t status = gdbstub_be_reg_write (xlen, hwregnum, regval, & cmderr);
+    uint32_t status = gdbstub_be_reg_write (hwregnum, regval, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1883,7 +3576,7 @@ uint32_t  gdbstub_be_PRIV_write (const uint8_t xlen, uint64_t regval)
     // PRIV is a virtual register aliasing dcsr.prv
     uint64_t dcsr64;
     uint8_t  cmderr;
-    uint32_t status = gdbstub_be_reg_read (xlen, csr_addr_dcsr, &dcsr64, & cmderr);
+    uint32_t status = gdbstub_be_reg_read (csr_addr_dcsr, &dcsr64, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1909,7 +3602,7 @@ uint32_t  gdbstub_be_PRIV_write (const uint8_t xlen, uint64_t regval)
 		       fn_dcsr_step (dcsr),
 		       (DM_DCSR_PRV) regval);
 
-    status = gdbstub_be_reg_write (xlen, csr_addr_dcsr, dcsr, & cmderr);
+    status = gdbstub_be_reg_write (csr_addr_dcsr, dcsr, & cmderr);
 
     if (status == status_err) {
 	if (logfile_fp != NULL) {
@@ -1967,6 +3660,19 @@ uint32_t  gdbstub_be_mem_write_subword (const uint8_t   xlen,
 	sbaccess = DM_SBACCESS_32_BIT;
     }
 
+    // DM without this access size: read-modify-write the containing
+    // word (not atomic with respect to the hart or devices)
+    if ((len != 4) && (! dm_caps_sbaccess (sbaccess))) {
+	uint64_t word_addr = (addr & (~ ((uint64_t) 0x3)));
+	uint32_t shift     = (uint32_t) ((addr & 0x3) * 8);
+	uint32_t mask      = ((len == 1) ? 0xFF : 0xFFFF) << shift;
+	uint32_t word;
+	status = gdbstub_be_mem_read_subword (xlen, word_addr, & word, 4);
+	if (status != status_ok) return status;
+	word = ((word & (~ mask)) | ((data << shift) & mask));
+	return gdbstub_be_mem_write_subword (xlen, word_addr, word, 4);
+    }
+
     // Write SBCS
     status = gdbstub_be_wait_for_sb_nonbusy (NULL);
     if (status == status_err) return status;
@@ -1985,20 +3691,7 @@ uint32_t  gdbstub_be_mem_write_subword (const uint8_t   xlen,
     // Write address to sbaddress1/0
     status = gdbstub_be_wait_for_sb_nonbusy (NULL);
     if (status == status_err) return status;
-    if (xlen == 64) {
-	// Write upper 32b of address to sbaddress1
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    Write to sbaddress1: 0x%08" PRIx32 "\n", (uint32_t) (addr >> 32));
-	    fflush (logfile_fp);
-	}
-	dmi_write (dm_addr_sbaddress1, (uint32_t) (addr >> 32));
-    }
-    // Write lower 32b of the address to sbaddress0
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "    Write to sbaddress0: 0x%08" PRIx32 "\n", (uint32_t) addr);
-	fflush (logfile_fp);
-    }
-    dmi_write (dm_addr_sbaddress0, (uint32_t) addr);
+    be_ops->sbaddress_write (addr);
 
     // Write the data
     dmi_write (dm_addr_sbdata0, data);
@@ -2008,58 +3701,116 @@ uint32_t  gdbstub_be_mem_write_subword (const uint8_t   xlen,
 }
 
 // ================================================================
-// Write 'len' bytes of 'data' into RISC-V system memory, starting at address 'addr'
-// Only performs 32-bit writes on the Debug Module.
+// Byte sources (see gdbstub_be_mem_write_src)
 
-uint32_t  gdbstub_be_mem_write (const uint8_t   xlen,
-				const uint64_t  addr,
-				const char     *data,
-				const size_t    len)
+static
+void byte_src_bin_get (BE_Byte_Src *src, uint8_t *dest, const size_t n)
 {
-    if (! initialized) return status_ok;
+    memcpy (dest, src->p, n);
+    src->p += n;
+}
 
-    if (logfile_fp != NULL) {
-	fprintf (logfile_fp,
-		 "gdbstub_be_mem_write (addr 0x%0" PRIx64 ", data, len %0zu)\n",
-		 addr, len);
-	fflush (logfile_fp);
+void gdbstub_be_byte_src_bin (BE_Byte_Src *src, const char *data)
+{
+    src->get = byte_src_bin_get;
+    src->p   = data;
+}
+
+// The next 4 bytes of src as a little-endian word (whatever the
+// alignment of the source, and the host's byte order)
+
+static inline
+uint32_t byte_src_word (BE_Byte_Src *src)
+{
+    uint8_t b [4];
+    src->get (src, b, 4);
+    return (  ((uint32_t) b [0])
+	    | (((uint32_t) b [1]) << 8)
+	    | (((uint32_t) b [2]) << 16)
+	    | (((uint32_t) b [3]) << 24));
+}
+
+// Replace bytes [offset, offset + n) of the little-endian word x with
+// the next n bytes of src
+
+static
+uint32_t byte_src_merge (BE_Byte_Src *src, uint32_t x, const size_t offset, const size_t n)
+{
+    uint8_t b [4];
+    src->get (src, b, n);
+    for (size_t j = 0; j < n; j++) {
+	uint32_t shift = (uint32_t) (8 * (offset + j));
+	x = (x & (~ (((uint32_t) 0xFF) << shift))) | (((uint32_t) b [j]) << shift);
     }
+    return x;
+}
 
-    if (len == 0)
-	return status_ok;
+// ================================================================
+// Wait for the writes to finish, and check sbcs for errors
 
-    // Log it
-    if (logfile_fp != NULL) {
-	fprint_mem_data (logfile_fp, verbosity, data, len);
-	fflush (logfile_fp);
+static
+uint32_t sba_write_check (void)
+{
+    uint32_t sbcs;
+    uint32_t status = gdbstub_be_wait_for_sb_nonbusy (& sbcs);
+    if (status != status_ok) return status;
+
+    if (fn_sbcs_sbbusyerror (sbcs)) {
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "    ERROR: sbcs.sbbusyerror\n");
+	    fflush (logfile_fp);
+	}
+	return status_err;
+    }
+
+    DM_sberror sberror = fn_sbcs_sberror (sbcs);
+    if (sberror != DM_SBERROR_NONE) {
+	if (logfile_fp != NULL) {
+	    fprint_sberror (logfile_fp, "    ERROR: sbcs.sberror: ", sberror, "\n");
+	    fflush (logfile_fp);
+	}
+	return status_err;
     }
+    return status_ok;
+}
 
+// ================================================================
+// Write 'len' bytes from 'src' into RISC-V system memory, starting at address 'addr'
+// Only performs 32-bit writes on the Debug Module.
+
+static
+uint32_t  mem_write_src (const uint8_t   xlen,
+			 const uint64_t  addr,
+			 BE_Byte_Src    *src,
+			 const size_t    len)
+{
     uint32_t status = 0;
 
     const uint64_t addr_lim  = addr + len;
     uint64_t       addr4     = (addr & (~ ((uint64_t) 0x3)));        // 32b-aligned at/below addr
     const uint64_t addr_lim4 = (addr_lim & (~ ((uint64_t) 0x3)));    // 32b-aligned at/below addr_lim
-    size_t         jd        = 0;                       // index into data []
 
     // ----------------
     // Write any initial  unaligned bytes by doing a 32b read-modify-write
+    // (all of them, if they end within the same word)
 
     if (addr != addr4) {
 	uint32_t x;
-	status = gdbstub_be_mem32_read ("gdbstub_be_mem32_read", xlen, addr4, & x);
+	status = gdbstub_be_mem32_read ("gdbstub_be_mem32_read", addr4, & x);
 	if (status != status_ok) return status;
-	uint8_t  *p_x    = (uint8_t *) (& x);
 	size_t    offset = (size_t) (addr - addr4);
-	memcpy (& (p_x [offset]), & (data [0]), 4 - offset);
-	status = gdbstub_be_mem32_write ("gdbstub_be_mem_write", xlen, addr4, x);
+	size_t    n      = (((4 - offset) < len) ? (4 - offset) : len);
+	x = byte_src_merge (src, x, offset, n);
+	status = gdbstub_be_mem32_write ("gdbstub_be_mem_write", addr4, x);
 	if (status != status_ok) return status;
 
 	addr4 += 4;
-	jd    += (4 - offset);
 	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    Write initial sub-word (%0zu bytes)\n", (4 - offset));
+	    fprintf (logfile_fp, "    Write initial sub-word (%0zu bytes)\n", n);
 	    fflush (logfile_fp);
 	}
+	if (addr4 >= addr_lim)
+	    return status_ok;
     }
 
     // ----------------
@@ -2071,105 +3822,366 @@ uint32_t  gdbstub_be_mem_write (const uint8_t   xlen,
 	    fflush (logfile_fp);
 	}
 
-    // Write SBCS
-    status = gdbstub_be_wait_for_sb_nonbusy (NULL);
-    if (status == status_err) return status;
-    uint32_t sbcs = fn_mk_sbcs (true,                      // sbbusyerr (W1C)
-				false,                     // sbreadonaddr
-				DM_SBACCESS_32_BIT,        // sbaccess (size)
-				true,                      // sbautoincrement
-				false,                     // sbreadondata
-				DM_SBERROR_UNDEF7_W1C);    // Clear sberror
+    status = be_ops->mem_write_words (addr4, addr_lim4, src);
+    if (status != status_ok) return status;
+    addr4 = addr_lim4;
+
+    // ----------------
+    // Write any final unaligned bytes by doing a 32b read-modify-write
+
+    if (addr4 < addr_lim) {
+	uint32_t x;
+	gdbstub_be_mem32_read ("gdbstub_be_mem_write", addr4, & x);
+	size_t    n      = (size_t) (addr_lim - addr4);
+	x = byte_src_merge (src, x, 0, n);
+	gdbstub_be_mem32_write ("gdbstub_be_mem_write", addr4, x);
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "    Write final sub-word (%0zu bytes)\n", n);
+	    fflush (logfile_fp);
+	}
+    }
+
+    // ----------------
+    // Check for errors
+    return sba_write_check ();
+}
+
+// ================================================================
+// Write 'len' bytes of 'data' into RISC-V system memory, starting at address 'addr'
+
+uint32_t  gdbstub_be_mem_write (const uint8_t   xlen,
+				const uint64_t  addr,
+				const char     *data,
+				const size_t    len)
+{
+    if (! initialized) return status_ok;
+
     if (logfile_fp != NULL) {
-	fprint_sbcs (logfile_fp, "    Write ", sbcs, "\n");
+	fprintf (logfile_fp,
+		 "gdbstub_be_mem_write (addr 0x%0" PRIx64 ", data, len %0zu)\n",
+		 addr, len);
 	fflush (logfile_fp);
     }
-    dmi_write (dm_addr_sbcs, sbcs);
 
-    // Write address to sbaddress1/0
-    status = gdbstub_be_wait_for_sb_nonbusy (NULL);
-    if (status == status_err) return status;
-    if (xlen == 64) {
-	// Write upper 64b of address to sbaddress1
+    if (len == 0)
+	return status_ok;
+
+    // Log it
+    if (logfile_fp != NULL) {
+	fprint_mem_data (logfile_fp, verbosity, data, len);
+	fflush (logfile_fp);
+    }
+
+    BE_Byte_Src src;
+    gdbstub_be_byte_src_bin (& src, data);
+    return mem_write_src (xlen, addr, & src, len);
+}
+
+// ================================================================
+// Write 'len' bytes from 'src' into RISC-V system memory, starting at address 'addr'
+
+uint32_t  gdbstub_be_mem_write_src (const uint8_t   xlen,
+				    const uint64_t  addr,
+				    BE_Byte_Src    *src,
+				    const size_t    len)
+{
+    if (! initialized) return status_ok;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp,
+		 "gdbstub_be_mem_write_src (addr 0x%0" PRIx64 ", src, len %0zu)\n",
+		 addr, len);
+	fflush (logfile_fp);
+    }
+
+    if (len == 0)
+	return status_ok;
+
+    return mem_write_src (xlen, addr, src, len);
+}
+
+// ================================================================
+// Write streams: consecutive writes, each starting where the previous
+// one ended, continue one SBA autoincrement stream.  Only the first
+// pays for the sbcs/sbaddress setup and a read of the word containing
+// its first byte (if unaligned); bytes of a partial last word are held
+// until the next write completes the word, or until the flush, which
+// does the read-modify-write of that word and the final sbbusy/sberror
+// check.  So a bus error is only seen at the flush.
+
+uint32_t  gdbstub_be_mem_write_stream (const uint8_t   xlen,
+				       const uint64_t  addr,
+				       BE_Byte_Src    *src,
+				       const size_t    len)
+{
+    if (! initialized) return status_ok;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp,
+		 "gdbstub_be_mem_write_stream (addr 0x%0" PRIx64 ", src, len %0zu)%s\n",
+		 addr, len, ((wstream_open && (addr == wstream_next)) ? ": continue" : ""));
+	fflush (logfile_fp);
+    }
+
+    if (len == 0)
+	return status_ok;
+
+    uint32_t status;
+    if (wstream_open && (addr != wstream_next)) {
+	status = gdbstub_be_mem_write_flush (xlen);
+	if (status != status_ok) return status;
+    }
+
+    if (! wstream_open) {
+	if (wstream_lost)
+	    return gdbstub_be_mem_write_flush (xlen);
+	uint64_t addr4 = (addr & (~ ((uint64_t) 0x3)));
+	if (addr != addr4) {
+	    uint32_t x;
+	    status = gdbstub_be_mem32_read ("gdbstub_be_mem_write_stream", addr4, & x);
+	    if (status != status_ok) return status;
+	    for (size_t j = 0; j < 4; j++)
+		wstream_tail [j] = (uint8_t) (x >> (8 * j));
+	}
+	status = be_ops->sba_write_setup (addr4);
+	if (status != status_ok) return status;
+	wstream_open = true;
+	wstream_next = addr;
+	wstream_n_streams++;
+    }
+    wstream_n_writes++;
+
+    size_t n = len;
+    while (n > 0) {
+	size_t offset = (size_t) (wstream_next & 0x3);
+	size_t chunk  = (((4 - offset) < n) ? (4 - offset) : n);
+	if ((offset == 0) && (chunk == 4)) {
+	    dmi_write (dm_addr_sbdata0, byte_src_word (src));
+	}
+	else {
+	    src->get (src, & (wstream_tail [offset]), chunk);
+	    if ((offset + chunk) == 4)
+		dmi_write (dm_addr_sbdata0, (  ((uint32_t) wstream_tail [0])
+					     | (((uint32_t) wstream_tail [1]) << 8)
+					     | (((uint32_t) wstream_tail [2]) << 16)
+					     | (((uint32_t) wstream_tail [3]) << 24)));
+	}
+	wstream_next += chunk;
+	n            -= chunk;
+    }
+    return status_ok;
+}
+
+uint32_t  gdbstub_be_mem_write_flush (const uint8_t xlen)
+{
+    if (wstream_lost) {
+	wstream_lost = false;
+	wstream_n_errors++;
 	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    Write to sbaddress1: 0x%08" PRIx32 "\n", (uint32_t) (addr4 >> 32));
+	    fprintf (logfile_fp, "gdbstub_be_mem_write_flush: ERROR: stream lost in Debug Module recovery\n");
 	    fflush (logfile_fp);
 	}
-	dmi_write (dm_addr_sbaddress1, (uint32_t) (addr4 >> 32));
+	return status_err;
+    }
+    if (! wstream_open) return status_ok;
+    wstream_open = false;
+
+    uint32_t status  = sba_write_check ();
+    size_t   n_tail  = (size_t) (wstream_next & 0x3);
+    if ((status == status_ok) && (n_tail != 0)) {
+	uint64_t addr4 = (wstream_next & (~ ((uint64_t) 0x3)));
+	uint32_t x;
+	status = gdbstub_be_mem32_read ("gdbstub_be_mem_write_flush", addr4, & x);
+	if (status == status_ok) {
+	    for (size_t j = 0; j < n_tail; j++)
+		x = (x & (~ (((uint32_t) 0xFF) << (8 * j)))) | (((uint32_t) wstream_tail [j]) << (8 * j));
+	    status = gdbstub_be_mem32_write ("gdbstub_be_mem_write_flush", addr4, x);
+	}
     }
-    // Write lower 64b of the address to sbaddress0
+    if (status != status_ok)
+	wstream_n_errors++;
+
     if (logfile_fp != NULL) {
-	fprintf (logfile_fp, "    Write to sbaddress0: 0x%08" PRIx32 "\n", (uint32_t) addr4);
+	fprintf (logfile_fp, "gdbstub_be_mem_write_flush: stream ends at 0x%0" PRIx64 "%s\n",
+		 wstream_next, ((status == status_ok) ? "" : ": ERROR"));
 	fflush (logfile_fp);
     }
-    dmi_write (dm_addr_sbaddress0, (uint32_t) addr4);
+    return status;
+}
 
-    while (addr4 < addr_lim4) {
-	// status = gdbstub_be_wait_for_sb_nonbusy (NULL);
-	// if (status == status_err) return status;
+// ****************************************************************
+// ****************************************************************
+// ****************************************************************
+// Breakpoints and watchpoints
 
-	uint32_t *p = (uint32_t *) (& (data [jd]));
-	uint32_t  x = *p;
-	if (verbosity > 1)
+// ================================================================
+// Hardware triggers
+
+// mcontrol (tdata1 type 2) fields
+#define MCONTROL_TYPE          2
+#define MCONTROL_ACTION_DEBUG  (((uint64_t) 1) << 12)
+#define MCONTROL_M             (((uint64_t) 1) << 6)
+#define MCONTROL_S             (((uint64_t) 1) << 4)
+#define MCONTROL_U             (((uint64_t) 1) << 3)
+#define MCONTROL_KINDS         (BE_TRIGGER_EXECUTE | BE_TRIGGER_STORE | BE_TRIGGER_LOAD)
+
+// Upper limit on number of triggers we look at
+#define TRIGGERS_MAX  32
+
+uint32_t  gdbstub_be_trigger_insert (const uint8_t   xlen,
+				     const uint32_t  kind,
+				     const uint64_t  addr,
+				     uint32_t       *p_index)
+{
+    if (! initialized) return status_err;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp,
+		 "gdbstub_be_trigger_insert (kind 0x%0x, addr 0x%0" PRIx64 ")\n", kind, addr);
+	fflush (logfile_fp);
+    }
+
+    uint64_t tdata1_type = ((uint64_t) MCONTROL_TYPE) << (xlen - 4);
+    uint64_t tdata1_dmode = ((uint64_t) 1) << (xlen - 5);
+    uint64_t tdata1 = (tdata1_type | tdata1_dmode | MCONTROL_ACTION_DEBUG
+		       | MCONTROL_M | MCONTROL_S | MCONTROL_U
+		       | (kind & MCONTROL_KINDS));
+
+    for (uint32_t j = 0; j < TRIGGERS_MAX; j++) {
+	// tselect reads back differently when there is no trigger j
+	uint64_t val;
+	uint32_t status = gdbstub_be_CSR_write (xlen, csr_addr_tselect, j);
+	if (status == status_ok)
+	    status = gdbstub_be_CSR_read (xlen, csr_addr_tselect, & val);
+	if ((status != status_ok) || (val != j))
+	    break;
+
+	// Skip triggers in use
+	status = gdbstub_be_CSR_read (xlen, csr_addr_tdata1, & val);
+	if (status != status_ok)
+	    break;
+	uint64_t type = (val >> (xlen - 4)) & 0xF;
+	if ((type != 0) && (type != MCONTROL_TYPE))
+	    continue;
+	if ((type == MCONTROL_TYPE) && ((val & MCONTROL_KINDS) != 0))
+	    continue;
+
+	// Try it; the trigger may not support this configuration
+	gdbstub_be_CSR_write (xlen, csr_addr_tdata1, 0);
+	gdbstub_be_CSR_write (xlen, csr_addr_tdata2, addr);
+	gdbstub_be_CSR_write (xlen, csr_addr_tdata1, tdata1);
+	status = gdbstub_be_CSR_read (xlen, csr_addr_tdata1, & val);
+	if ((status == status_ok)
+	    && (((val >> (xlen - 4)) & 0xF) == MCONTROL_TYPE)
+	    && ((val & MCONTROL_KINDS) == (kind & MCONTROL_KINDS))) {
 	    if (logfile_fp != NULL) {
-		fprintf (logfile_fp,
-			 "    Write to addr: 0x%08" PRIx64 " <= data 0x%08x\n",
-			 addr4, x);
+		fprintf (logfile_fp, "    gdbstub_be_trigger_insert => trigger %0d\n", j);
 		fflush (logfile_fp);
 	    }
+	    *p_index = j;
+	    return status_ok;
+	}
+	gdbstub_be_CSR_write (xlen, csr_addr_tdata1, 0);
+    }
 
-	// Show progress every 1 MB
-	if (in_elf_load && ((addr4 & 0xFFFFF) == 0))
-	    fprintf (stdout,
-		     "    ... mem [0x%08" PRIx64 "] <= 0x%08x\n",
-		     addr4, x);
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "    gdbstub_be_trigger_insert => no trigger available\n");
+	fflush (logfile_fp);
+    }
+    return status_err;
+}
 
-	dmi_write (dm_addr_sbdata0, x);
+uint32_t  gdbstub_be_trigger_remove (const uint8_t xlen, const uint32_t index)
+{
+    if (! initialized) return status_err;
 
-	addr4 += 4;
-	jd    += 4;
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_trigger_remove (trigger %0d)\n", index);
+	fflush (logfile_fp);
     }
 
-    // ----------------
-    // Write any final unaligned bytes by doing a 32b read-modify-write
+    uint32_t status = gdbstub_be_CSR_write (xlen, csr_addr_tselect, index);
+    if (status == status_ok)
+	status = gdbstub_be_CSR_write (xlen, csr_addr_tdata1, 0);
+    return status;
+}
 
-    if (addr4 < addr_lim) {
-	uint32_t x;
-	gdbstub_be_mem32_read ("gdbstub_be_mem_write", xlen, addr4, & x);
-	uint8_t  *p_x    = (uint8_t *) (& x);
-	size_t    n      = (size_t) (addr_lim - addr4);
-	memcpy (p_x, & (data [jd]), n);
-	gdbstub_be_mem32_write ("gdbstub_be_mem_write", xlen, addr4, x);
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    Write final sub-word (%0zu bytes)\n", n);
-	    fflush (logfile_fp);
-	}
+// ================================================================
+// Software breakpoints
+
+uint32_t  gdbstub_be_sw_break_insert (const uint8_t   xlen,
+				      const uint64_t  addr,
+				      uint8_t        *orig,
+				      size_t         *p_len)
+{
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_sw_break_insert (addr 0x%0" PRIx64 ")\n", addr);
+	fflush (logfile_fp);
     }
 
-    // ----------------
-    // Check for errors
-    status = gdbstub_be_wait_for_sb_nonbusy (& sbcs);
+    // Read 2 bytes first, since a compressed instruction may be the last in memory
+    uint32_t status = gdbstub_be_mem_read (xlen, addr, (char *) orig, 2);
     if (status != status_ok) return status;
 
-    if (fn_sbcs_sbbusyerror (sbcs)) {
-	if (logfile_fp != NULL) {
-	    fprintf (logfile_fp, "    ERROR: sbcs.sbbusyerror\n");
-	    fflush (logfile_fp);
-	}
-	return status_err;
+    uint8_t bytes [4];
+    if ((orig [0] & 0x3) != 0x3) {
+	*p_len    = 2;
+	bytes [0] = (uint8_t) (INSTR_C_EBREAK & 0xFF);
+	bytes [1] = (uint8_t) ((INSTR_C_EBREAK >> 8) & 0xFF);
     }
+    else {
+	status = gdbstub_be_mem_read (xlen, addr + 2, (char *) & (orig [2]), 2);
+	if (status != status_ok) return status;
+	*p_len    = 4;
+	bytes [0] = (uint8_t) ((INSTR_EBREAK >>  0) & 0xFF);
+	bytes [1] = (uint8_t) ((INSTR_EBREAK >>  8) & 0xFF);
+	bytes [2] = (uint8_t) ((INSTR_EBREAK >> 16) & 0xFF);
+	bytes [3] = (uint8_t) ((INSTR_EBREAK >> 24) & 0xFF);
+    }
+    return gdbstub_be_mem_write (xlen, addr, (char *) bytes, *p_len);
+}
 
-    DM_sberror sberror = fn_sbcs_sberror (sbcs);
-    if (sberror != DM_SBERROR_NONE) {
-	if (logfile_fp != NULL) {
-	    fprint_sberror (logfile_fp, "    ERROR: sbcs.sberror: ", sberror, "\n");
-	    fflush (logfile_fp);
-	}
-	return status_err;
+uint32_t  gdbstub_be_sw_break_remove (const uint8_t   xlen,
+				      const uint64_t  addr,
+				      const uint8_t  *orig,
+				      const size_t    len)
+{
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_be_sw_break_remove (addr 0x%0" PRIx64 ")\n", addr);
+	fflush (logfile_fp);
     }
 
-    // ----------------
+    return gdbstub_be_mem_write (xlen, addr, (const char *) orig, len);
+}
+
+// ================================================================
+// ELF symbol lookup
+
+uint32_t  gdbstub_be_elf_symbol (const char *name, uint64_t *p_value)
+{
+#ifdef GDBSTUB_NO_ELF_LOAD
+    return status_err;
+#else
+    return ((elf_symbol_lookup (name, p_value) == 1) ? status_ok : status_err);
+#endif
+}
+
+// ================================================================
+// Read from the memory image of the last ELF file loaded
+
+uint32_t  gdbstub_be_elf_read (const uint64_t addr, char *data, const size_t len)
+{
+#ifdef GDBSTUB_NO_ELF_LOAD
+    return status_err;
+#else
+    if ((! last_elf_valid)
+	|| (addr < last_elf_features.min_addr)
+	|| (addr + len > last_elf_features.max_addr + 1))
+	return status_err;
+
+    memcpy (data, & (last_elf_features.mem_buf [addr]), len);
     return status_ok;
+#endif
 }
 
 // ****************************************************************
@@ -2203,6 +4215,8 @@ uint32_t  gdbstub_be_dmi_write (const uint16_t  dmi_addr, uint32_t  dmi_data)
 {
     if (! initialized) return status_ok;
 
+    regs_snapshot_invalidate ();
+
     if (logfile_fp != NULL) {
 	fprintf (logfile_fp,
 		 "gdbstub_be_dmi_write (dmi 0x%0x, data 0x%0" PRIx32 ")\n",
@@ -15,13 +15,23 @@
 // Public globals
 
 // ================================================================
-// Word bitwidth (32 for RV32, 64 for RV64)
+// Word bitwidth (32 for RV32, 64 for RV64) of the selected hart
 // (Important: affects format of data strings in RSP communication with GDB)
 // This defaults to 64 (for RV64), but can be set to 32.
 // If gdbstub_be_elf_load() is invoked, it'll be picked up from the ELF file.
+// The xlen arguments of the functions below are this; the register and
+// memory paths use the selected hart's XLEN-specialized ones.
 
 extern
-uint8_t gdbstub_be_xlen;
+uint8_t gdbstub_be_xlen (void);
+
+// Set XLEN (32 or 64) of all harts, or of one, which also selects the
+// XLEN-specialized register and memory paths for them.
+extern
+uint32_t gdbstub_be_set_xlen (const uint8_t xlen);
+
+extern
+uint32_t gdbstub_be_set_hart_xlen (const uint32_t hart, const uint8_t xlen);
 
 // ================================================================
 // Help
@@ -31,6 +41,13 @@ uint8_t gdbstub_be_xlen;
 extern
 const char *gdbstub_be_help (void);
 
+// ================================================================
+// Monotonic real-time clock, in microseconds, for timeouts and rates
+// (shared by all the gdbstub modules)
+
+extern
+uint64_t usecs_now (void);
+
 // ================================================================
 // Initialize gdbstub_be
 
@@ -52,6 +69,7 @@ uint32_t  gdbstub_be_dm_reset (const uint8_t xlen);
 // ================================================================
 // Reset the NDM (non-debug module, i.e., everything but the debug module)
 // The argument indicates whether the hart is running/halted after reset
+// (halted before its first instruction, if the DM supports halt-on-reset)
 
 extern
 uint32_t  gdbstub_be_ndm_reset (const uint8_t xlen, bool haltreq);
@@ -59,10 +77,49 @@ uint32_t  gdbstub_be_ndm_reset (const uint8_t xlen, bool haltreq);
 // ================================================================
 // Reset the HART 
 // The argument indicates whether the hart is running/halted after reset
+// (halted before its first instruction, if the DM supports halt-on-reset)
 
 extern
 uint32_t  gdbstub_be_hart_reset (const uint8_t xlen, bool haltreq);
 
+// ================================================================
+// Debug Module capabilities (read once, until the DM is reset):
+// version, authentication, hartinfo, abstract command data/progbuf
+// sizes and System Bus Access sizes (NUL-terminated, into buf)
+
+extern
+void  gdbstub_be_dm_info (char *buf, const size_t buf_size);
+
+// Allow optimistic (unpolled) batches of abstract commands; they are
+// also turned off by themselves if overruns are frequent
+extern
+void  gdbstub_be_abstract_optimistic (bool allowed);
+
+// ================================================================
+// Debug Module health: recovery from a wedged DM, and its metrics
+
+// Run the recovery sequence now (status_ok if the DM is healthy after it)
+extern
+uint32_t  gdbstub_be_dm_recover (void);
+
+// Allow the last recovery step, ndmreset (which resets the hart)
+extern
+void  gdbstub_be_dm_recover_ndmreset (bool allowed);
+
+// Fault and recovery counts, and times to recover (NUL-terminated, into buf)
+extern
+void  gdbstub_be_dm_health (char *buf, const size_t buf_size);
+
+// Invalidation hooks: every module that caches target state (the
+// front end, watchpoints, RTT, record, ...) registers one.  They are
+// called after each Debug Module recovery; hart_reset is true if the
+// recovery reset the hart (ndmreset), clearing its triggers and memory
+// state as well.
+typedef void (*BE_Invalidate_Fn) (const uint8_t xlen, const bool hart_reset);
+
+extern
+void  gdbstub_be_register_invalidate (BE_Invalidate_Fn fn);
+
 // ================================================================
 // Set verbosity to n in RISC-V system
 
@@ -75,6 +132,14 @@ uint32_t gdbstub_be_verbosity (uint32_t n);
 extern
 uint32_t gdbstub_be_elf_load (const char *elf_filename);
 
+// ================================================================
+// Restart the program: ndmreset with the hart halted, reload the ELF
+// file incrementally (the last one loaded, if elf_filename is NULL or
+// empty) and set the PC to its '_start' symbol.  The hart is left halted.
+
+extern
+uint32_t gdbstub_be_restart (const uint8_t xlen, const char *elf_filename);
+
 // ================================================================
 // Continue the HW execution at given PC
 
@@ -102,6 +167,49 @@ int32_t  gdbstub_be_get_stop_reason (const uint8_t  xlen,
 				     uint8_t       *p_stop_reason,
 				     bool           commands_preempt);
 
+// True if the last halt reported by gdbstub_be_get_stop_reason was
+// the end of a single step
+
+extern
+bool  gdbstub_be_stopped_by_step (void);
+
+// ================================================================
+// Interrupts while single-stepping: leave dcsr.stepie as it is, or
+// clear (set) it while stepping and restore it on continue
+
+typedef enum { BE_STEPIE_KEEP, BE_STEPIE_OFF, BE_STEPIE_ON } BE_Stepie;
+
+extern
+void  gdbstub_be_set_stepie (BE_Stepie policy);
+
+// Policy, and counts of steps taken with stepie changed and of trap
+// handler entries avoided (NUL-terminated, into buf)
+extern
+void  gdbstub_be_stepie_status (char *buf, const size_t buf_size);
+
+// ================================================================
+// Harts
+// Register accesses, step, continue and stop act on the selected hart
+// (initially hart 0).  Harts are numbered 0 .. gdbstub_be_num_harts () - 1.
+
+extern
+uint32_t  gdbstub_be_num_harts (void);
+
+extern
+uint32_t  gdbstub_be_select_hart (uint32_t hart);
+
+extern
+uint32_t  gdbstub_be_selected_hart (void);
+
+// Resume the harts in step_mask (bit h: hart h) for one instruction and
+// those in run_mask to run, all with a single dmcontrol write.  They
+// run as a group: gdbstub_be_get_stop_reason reports a halt as soon as
+// any of them halts, after halting the others, and selects that hart;
+// gdbstub_be_stop halts them all.
+
+extern
+uint32_t  gdbstub_be_harts_resume (const uint8_t xlen, uint32_t step_mask, uint32_t run_mask);
+
 // ================================================================
 // This is not a debugger function at all, just an aid for humans
 // perusing the logfile.  A GDB command can result in several DMI
@@ -124,6 +232,12 @@ uint32_t  gdbstub_be_PC_read (const uint8_t xlen, uint64_t *p_PC);
 extern
 uint32_t  gdbstub_be_GPR_read (const uint8_t xlen, uint8_t regnum, uint64_t *p_regval);
 
+// ================================================================
+// Read all 32 GPRs in SoC into p_regvals [0..31]
+
+extern
+uint32_t  gdbstub_be_GPRs_read (const uint8_t xlen, uint64_t *p_regvals);
+
 // ================================================================
 // Read a value from a FPR register in SoC
 
@@ -136,6 +250,15 @@ uint32_t  gdbstub_be_FPR_read (const uint8_t xlen, uint8_t regnum, uint64_t *p_r
 extern
 uint32_t  gdbstub_be_CSR_read (const uint8_t xlen, uint16_t regnum, uint64_t *p_regval);
 
+// ================================================================
+// Read a CSR of the selected hart while it runs, perturbing it as
+// little as possible: with the DM's Quick Access command if it has it
+// (see gdbstub_be_dm_info), else by halting and resuming the hart.
+// On a halted hart, the CSR is just read.  csr_addr_dpc gives the PC.
+
+extern
+uint32_t  gdbstub_be_csr_sample (const uint8_t xlen, uint16_t csr, uint64_t *p_val);
+
 // ================================================================
 // Read a value from PRIV
 
@@ -161,12 +284,65 @@ uint32_t  gdbstub_be_mem_read (const uint8_t   xlen,
 			       char           *data,
 			       const size_t    len);
 
+// ================================================================
+// Scatter-gather memory reads: read many small, possibly scattered,
+// items.  With merge (for RAM only), items at most BE_SG_MERGE_GAP
+// bytes apart are read in one burst (of up to BE_SG_BURST_MAX bytes,
+// including the bytes between them), whatever the order of items [].
+// Without merge (e.g., device registers), each item is read on its own,
+// with an access of its size when it is 1, 2, 4 or 8 bytes and aligned.
+// Item j's bytes go to items [j].dst.  *p_n_bursts (if not NULL) gets
+// the number of bursts (SBA reads).
+
+#define BE_SG_MERGE_GAP   64
+#define BE_SG_BURST_MAX   4096
+
+typedef struct {
+    uint64_t  addr;
+    uint32_t  len;
+    uint8_t  *dst;
+} BE_Mem_Item;
+
+extern
+uint32_t  gdbstub_be_mem_read_sg (const uint8_t  xlen,
+				  BE_Mem_Item   *items,
+				  const uint32_t n_items,
+				  const bool     merge,
+				  uint32_t      *p_n_bursts);
+
+// ================================================================
+// Follow a linked list in memory, reading node_size bytes of each node
+// into buf (and its address into node_addrs) and taking the next node
+// from the XLEN-sized pointer at next_off.  Stops at NULL, at a node
+// already visited, after max_nodes or when buf is full; *p_next is the
+// pointer at which it stopped.
+
+#define BE_WALK_NODE_MAX  4096
+
+extern
+uint32_t  gdbstub_be_mem_walk (const uint8_t  xlen,
+			       const uint64_t head,
+			       const uint32_t next_off,
+			       const uint32_t node_size,
+			       const uint32_t max_nodes,
+			       uint8_t       *buf,
+			       const size_t   buf_size,
+			       uint64_t      *node_addrs,
+			       uint32_t      *p_n_nodes,
+			       uint64_t      *p_next);
+
 // ================================================================
 // Write a value into the RISC-V PC
 
 extern
 uint32_t  gdbstub_be_PC_write (const uint8_t xlen, uint64_t regval);
 
+// ================================================================
+// Write p_regvals [1..31] into GPRs x1..x31 (x0 is hardwired to zero)
+
+extern
+uint32_t  gdbstub_be_GPRs_write (const uint8_t xlen, const uint64_t *p_regvals);
+
 // ================================================================
 // Write a value into a RISC-V GPR register
 
@@ -207,6 +383,93 @@ uint32_t  gdbstub_be_mem_write_subword (const uint8_t   xlen,
 extern
 uint32_t  gdbstub_be_mem_write (const uint8_t xlen, const uint64_t addr, const char *data, const size_t len);
 
+// ================================================================
+// A source of bytes for gdbstub_be_mem_write_src, so that callers can
+// decode data (e.g., hex digits of an RSP 'M' packet) as it is written
+// instead of into a buffer first.  get () stores the next n (1..4)
+// bytes at dest and advances p.
+
+typedef struct BE_Byte_Src {
+    void       (*get) (struct BE_Byte_Src *src, uint8_t *dest, const size_t n);
+    const char  *p;
+} BE_Byte_Src;
+
+// A source for plain bytes at 'data'
+extern
+void gdbstub_be_byte_src_bin (BE_Byte_Src *src, const char *data);
+
+// As gdbstub_be_mem_write, taking 'len' bytes from 'src'
+
+extern
+uint32_t  gdbstub_be_mem_write_src (const uint8_t xlen, const uint64_t addr, BE_Byte_Src *src, const size_t len);
+
+// As gdbstub_be_mem_write_src, but a write that starts where the
+// previous one ended continues the same SBA autoincrement stream.
+// Bus errors are only reported by gdbstub_be_mem_write_flush, which
+// must be called before any other gdbstub_be access to the target
+// (it does nothing if no stream is open).
+
+extern
+uint32_t  gdbstub_be_mem_write_stream (const uint8_t xlen, const uint64_t addr, BE_Byte_Src *src, const size_t len);
+
+extern
+uint32_t  gdbstub_be_mem_write_flush (const uint8_t xlen);
+
+// ****************************************************************
+// ****************************************************************
+// ****************************************************************
+// Breakpoints and watchpoints
+
+// ================================================================
+// Hardware triggers (mcontrol address match, action: enter Debug Mode).
+// 'kind' is a combination of the BE_TRIGGER_ bits.  The first trigger
+// that is not in use and accepts the configuration is taken; its index
+// is returned in *p_index, for gdbstub_be_trigger_remove.
+// Returns status_err if there is no such trigger.
+
+#define BE_TRIGGER_LOAD     0x1
+#define BE_TRIGGER_STORE    0x2
+#define BE_TRIGGER_EXECUTE  0x4
+
+extern
+uint32_t  gdbstub_be_trigger_insert (const uint8_t   xlen,
+				     const uint32_t  kind,
+				     const uint64_t  addr,
+				     uint32_t       *p_index);
+
+extern
+uint32_t  gdbstub_be_trigger_remove (const uint8_t xlen, const uint32_t index);
+
+// ================================================================
+// Software breakpoints: write an ebreak (a c.ebreak over a compressed
+// instruction) at addr.  The original instruction's bytes are returned
+// in orig [0 .. *p_len - 1], for gdbstub_be_sw_break_remove.
+
+extern
+uint32_t  gdbstub_be_sw_break_insert (const uint8_t   xlen,
+				      const uint64_t  addr,
+				      uint8_t        *orig,
+				      size_t         *p_len);
+
+extern
+uint32_t  gdbstub_be_sw_break_remove (const uint8_t   xlen,
+				      const uint64_t  addr,
+				      const uint8_t  *orig,
+				      const size_t    len);
+
+// ================================================================
+// Look up a symbol of the last ELF file loaded with gdbstub_be_elf_load.
+
+extern
+uint32_t  gdbstub_be_elf_symbol (const char *name, uint64_t *p_value);
+
+// ================================================================
+// Read [addr, addr + len) from the memory image of the last ELF file
+// loaded with gdbstub_be_elf_load (status_err if not all inside it).
+
+extern
+uint32_t  gdbstub_be_elf_read (const uint64_t addr, char *data, const size_t len);
+
 // ****************************************************************
 // ****************************************************************
 // ****************************************************************
@@ -236,4 +499,5 @@ uint32_t  gdbstub_be_dmi_write (uint16_t dmi_addr, uint32_t dmi_data);
 extern
 bool  gdbstub_be_poll_preempt (bool include_commands);
 
+
 // ****************************************************************
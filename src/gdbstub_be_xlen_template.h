@@ -0,0 +1,336 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// XLEN-specialized hot paths of gdbstub_be.c
+
+// This file is a template: gdbstub_be.c includes it once per XLEN,
+// with XLEN #defined to 32 or 64, and gets reg_read_rv32 and
+// reg_read_rv64, etc.  Inside, XLEN is a compile-time constant, so
+// the tests on it fold away.  There is deliberately no include guard.
+
+// The instances are collected into a BE_Xlen_Ops table per XLEN
+// (gdbstub_be.c).  Each hart has its table, chosen when its XLEN is
+// set; the selected hart's is used directly, without testing xlen.
+// Within an instance, calls to the other functions of the same
+// instance are direct.
+
+// ================================================================
+
+#ifndef XLEN
+#error "gdbstub_be_xlen_template.h: define XLEN (32 or 64) before including"
+#endif
+
+#define XLEN_FN2(name, xlen)  name ## _rv ## xlen
+#define XLEN_FN1(name, xlen)  XLEN_FN2 (name, xlen)
+#define XLEN_FN(name)         XLEN_FN1 (name, XLEN)
+
+#if (XLEN == 32)
+#define XLEN_AARSIZE  DM_COMMAND_ACCESS_REG_SIZE_LOWER32
+#else
+#define XLEN_AARSIZE  DM_COMMAND_ACCESS_REG_SIZE_LOWER64
+#endif
+
+// ================================================================
+// Read a register with an abstract command (see gdbstub_be_reg_read)
+
+static
+uint32_t XLEN_FN (reg_read) (uint16_t dm_regnum, uint64_t *p_regval, uint8_t *p_cmderr)
+{
+    // Assuming abstractcs.cmderr == 0 in the HW
+    uint32_t abstractcs;
+    uint64_t data0 = 0;
+    uint64_t data1 = 0;
+
+    // Use the snapshot if we've already read this register during this stop
+    int32_t j = regs_snapshot_index (dm_regnum);
+    if ((j >= 0) && ((regs_snapshot_valid >> j) & 1)) {
+	*p_regval = regs_snapshot [j];
+	*p_cmderr = 0;
+	return status_ok;
+    }
+
+    // Send command to do a register read
+    if (verbosity == 2)
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp,
+		     "    gdbstub_be_reg_read (0x%0x): read command\n",
+		     dm_regnum);
+	    fflush (logfile_fp);
+	}
+
+    uint32_t command = fn_mk_command_access_reg (XLEN_AARSIZE,    // aarsize
+						 false,    // aarpostincrement
+						 false,    // postexec
+						 true,     // transfer
+						 false,    // write
+						 dm_regnum);
+    dmi_write (dm_addr_command, command);
+
+    // Optimistic batch: take the data now, checked by abs_batch_end
+    // (so not to be kept in the snapshot until then)
+    if (abs_in_batch) {
+	data0 = dmi_read (dm_addr_data0);
+#if (XLEN == 64)
+	data1 = ((uint64_t) dmi_read (dm_addr_data1)) << 32;
+#endif
+	*p_regval = data1 | data0;
+	*p_cmderr = 0;
+	return status_ok;
+    }
+
+    // Poll abstractcs until not busy
+    poll_abstractcs_until_notbusy ("gdbstub_be_reg_read", & abstractcs);
+
+    *p_cmderr = check_abstractcs_error ("gdbstub_be_reg_read", abstractcs);
+
+    if (*p_cmderr == 0) {
+	// Read data0 register
+	data0 = dmi_read (dm_addr_data0);
+#if (XLEN == 64)
+	// Read upper 32 bits from data1
+	data1 = dmi_read (dm_addr_data1);
+	data1 = data1 << 32;
+#endif
+	*p_regval = data1 | data0;
+	if (j >= 0) {
+	    regs_snapshot [j] = *p_regval;
+	    regs_snapshot_valid |= (1ULL << j);
+	}
+	if (verbosity == 2)
+	    if (logfile_fp != NULL) {
+		fprintf (logfile_fp,
+			 "    gdbstub_be_reg_read (0x%0x) => 0x%0" PRIx64 "\n",
+			 dm_regnum, *p_regval);
+		fflush (logfile_fp);
+	    }
+	return  status_ok;
+    }
+    else {
+	return  status_err;
+    }
+}
+
+// ================================================================
+// Write a register with an abstract command (see gdbstub_be_reg_write)
+
+static
+uint32_t XLEN_FN (reg_write) (uint16_t dm_regnum, uint64_t regval, uint8_t *p_cmderr)
+{
+    if (verbosity == 2)
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp,
+		     "    gdbstub_be_reg_write (0x%0x, 0x%0" PRIx64 ")\n",
+		     dm_regnum, regval);
+	    fflush (logfile_fp);
+	}
+
+    // Assuming abstractcs.cmderr == 0
+    uint32_t abstractcs;
+
+    // Re-read after a write (e.g., writes to x0 have no effect)
+    int32_t j = regs_snapshot_index (dm_regnum);
+    if (j >= 0)
+	regs_snapshot_valid &= (~ (1ULL << j));
+
+    // Write regval to dm_data0 register
+    dmi_write (dm_addr_data0, (uint32_t) regval);
+
+#if (XLEN == 64)
+    // Write upper bits of regval to dm_data1 register
+    dmi_write (dm_addr_data1, (uint32_t) (regval >> 32));
+#endif
+
+    // Send command to do a register write
+    uint32_t command = fn_mk_command_access_reg (XLEN_AARSIZE,    // aarsize
+						 false,    // postincrement
+						 false,    // postexec
+						 true,     // transfer
+						 true,     // write
+						 dm_regnum);
+    dmi_write (dm_addr_command, command);
+
+    // Optimistic batch: don't wait, checked by abs_batch_end
+    if (abs_in_batch) {
+	*p_cmderr = 0;
+	return status_ok;
+    }
+
+    // Poll abstractcs until not busy
+    poll_abstractcs_until_notbusy ("gdbstub_be_reg_write", & abstractcs);
+
+    *p_cmderr = check_abstractcs_error ("gdbstub_be_reg_write", abstractcs);
+
+    if (*p_cmderr == 0) {
+	return status_ok;
+    }
+    else {
+	return status_ok;
+    }
+}
+
+// ================================================================
+// Write a System Bus address to sbaddress1/0.
+// The write to sbaddress0 starts a bus read if sbcs.sbreadonaddr is set.
+
+static
+void XLEN_FN (sbaddress_write) (const uint64_t addr)
+{
+#if (XLEN == 64)
+    // Write upper 32b of address to sbaddress1
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "    Write to sbaddress1: 0x%08" PRIx32 "\n", (uint32_t) (addr >> 32));
+	fflush (logfile_fp);
+    }
+    dmi_write (dm_addr_sbaddress1, (uint32_t) (addr >> 32));
+#endif
+    // Write lower 32b of the address to sbaddress0
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "    Write to sbaddress0: 0x%08" PRIx32 "\n", (uint32_t) addr);
+	fflush (logfile_fp);
+    }
+    dmi_write (dm_addr_sbaddress0, (uint32_t) addr);
+}
+
+// ================================================================
+// Set up sbcs for 32-bit autoincrement writes, starting at addr4
+
+static
+uint32_t XLEN_FN (sba_write_setup) (const uint64_t addr4)
+{
+    uint32_t status;
+
+    // Write SBCS
+    status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+    if (status == status_err) return status;
+    uint32_t sbcs = fn_mk_sbcs (true,                      // sbbusyerr (W1C)
+				false,                     // sbreadonaddr
+				DM_SBACCESS_32_BIT,        // sbaccess (size)
+				true,                      // sbautoincrement
+				false,                     // sbreadondata
+				DM_SBERROR_UNDEF7_W1C);    // Clear sberror
+    if (logfile_fp != NULL) {
+	fprint_sbcs (logfile_fp, "    Write ", sbcs, "\n");
+	fflush (logfile_fp);
+    }
+    dmi_write (dm_addr_sbcs, sbcs);
+
+    // Write address to sbaddress1/0
+    status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+    if (status == status_err) return status;
+    XLEN_FN (sbaddress_write) (addr4);
+    return status_ok;
+}
+
+// ================================================================
+// Read len bytes at addr (len > 0, any alignment) into data, with one
+// 32-bit autoincrement burst (see gdbstub_be_mem_read).
+// Partial words at the two ends are copied outside the burst loop, so
+// the loop itself copies whole words.
+
+static
+uint32_t XLEN_FN (mem_read_words) (const uint64_t addr, char *data, const size_t len)
+{
+    uint32_t status;
+
+    const uint64_t addr_lim  = addr + len;
+    const uint64_t addr4     = (addr & (~ ((uint64_t) 0x3)));             // 32b-aligned at/below addr
+    const uint64_t addr_lim4 = ((addr_lim + 3) & (~ ((uint64_t) 0x3)));   // 32b-aligned at/above addr_lim
+    const size_t   n_words   = (size_t) ((addr_lim4 - addr4) / 4);
+    const size_t   offset    = (size_t) (addr - addr4);                   // bytes skipped in first word
+    size_t         jd        = 0;                                         // index into data []
+    uint32_t       x;
+
+    // Write SBCS
+    status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+    if (status == status_err) return status;
+    uint32_t sbcs = fn_mk_sbcs (true,                      // sbbusyerr (W1C)
+				true,                      // sbreadonaddr
+				DM_SBACCESS_32_BIT,        // sbaccess (size)
+				true,                      // sbautoincrement
+				true,                      // sbreadondata
+				DM_SBERROR_UNDEF7_W1C);    // Clear sberror
+    if (logfile_fp != NULL) {
+	fprint_sbcs (logfile_fp, "    Write ", sbcs, "\n");
+	fflush (logfile_fp);
+    }
+    dmi_write (dm_addr_sbcs, sbcs);
+
+    // Write the initial address to sbaddress0 (which will start a bus read)
+    status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+    if (status == status_err) return status;
+    XLEN_FN (sbaddress_write) (addr4);
+
+    // First word, if addr is unaligned or all of it is within one word
+    size_t jw = 0;
+    if ((offset != 0) || (n_words == 1)) {
+	status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+	if (status == status_err) return status;
+	x = dmi_read (dm_addr_sbdata0);
+	size_t n = (((4 - offset) < len) ? (4 - offset) : len);
+	memcpy (& (data [0]), ((uint8_t *) & x) + offset, n);
+	jd = n;
+	jw = 1;
+    }
+
+    // Whole words in between
+    const size_t jw_lim = (((addr_lim & 0x3) != 0) ? (n_words - 1) : n_words);
+    for (; jw < jw_lim; jw++) {
+	status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+	if (status == status_err) return status;
+	x = dmi_read (dm_addr_sbdata0);
+	memcpy (& (data [jd]), & x, 4);
+	jd += 4;
+    }
+
+    // Last word, if addr_lim is unaligned (and it's not the first word)
+    if (jd < len) {
+	status = gdbstub_be_wait_for_sb_nonbusy (NULL);
+	if (status == status_err) return status;
+	x = dmi_read (dm_addr_sbdata0);
+	memcpy (& (data [jd]), & x, len - jd);
+	jd = len;
+    }
+    assert (jd == len);
+    return status_ok;
+}
+
+// ================================================================
+// Write the whole words [addr4, addr_lim4) from src, with one 32-bit
+// autoincrement burst (see mem_write_src)
+
+static
+uint32_t XLEN_FN (mem_write_words) (uint64_t addr4, const uint64_t addr_lim4, BE_Byte_Src *src)
+{
+    uint32_t status = XLEN_FN (sba_write_setup) (addr4);
+    if (status != status_ok) return status;
+
+    while (addr4 < addr_lim4) {
+	uint32_t x = byte_src_word (src);
+	if (verbosity > 1)
+	    if (logfile_fp != NULL) {
+		fprintf (logfile_fp,
+			 "    Write to addr: 0x%08" PRIx64 " <= data 0x%08x\n",
+			 addr4, x);
+		fflush (logfile_fp);
+	    }
+
+	// Show progress every 1 MB
+	if (in_elf_load && ((addr4 & 0xFFFFF) == 0))
+	    fprintf (stdout,
+		     "    ... mem [0x%08" PRIx64 "] <= 0x%08x\n",
+		     addr4, x);
+
+	dmi_write (dm_addr_sbdata0, x);
+
+	addr4 += 4;
+    }
+    return status_ok;
+}
+
+// ================================================================
+
+#undef XLEN_AARSIZE
+#undef XLEN_FN
+#undef XLEN_FN1
+#undef XLEN_FN2
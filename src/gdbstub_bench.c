@@ -0,0 +1,292 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+
+// ================================================================
+// Timing driver for the gdbstub_be register and memory paths.
+
+// Standalone: instead of gdbstub_dmi_stub.c and the front end, it
+// links gdbstub_be.c with a simulated Debug Module (one hart, always
+// halted, abstract register access, System Bus Access to a RAM), and
+// times, for RV32 and for RV64, register writes/reads and memory
+// reads/writes, reporting time and DMI accesses per operation.
+// Build and run:
+//     cc -O2 -o gdbstub_bench gdbstub_bench.c gdbstub_be.c RVDM.c Elf_read.c -lelf
+//     ./gdbstub_bench [iterations]
+
+// ================================================================
+// C lib includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+// ----------------
+// Project includes
+
+#include  "RVDM.h"
+#include  "gdbstub_be.h"
+
+// ================================================================
+// Simulated Debug Module
+
+#define SIM_MEM_BASE  0x80000000ULL
+#define SIM_MEM_SIZE  (1u << 20)
+
+static uint8_t   sim_mem [SIM_MEM_SIZE];
+static uint64_t  sim_gpr [32];
+static uint64_t  sim_csr [4096];
+static uint32_t  sim_data [2];
+static uint32_t  sim_dmcontrol;
+static uint32_t  sim_cmderr;
+static uint32_t  sim_sbcs;
+static uint64_t  sim_sbaddress;
+static uint64_t  sim_sbdata;
+static uint8_t   sim_xlen = 64;
+
+static uint64_t  n_dmi;    // DMI accesses so far
+
+// sbcs: sbversion 1, sbasize 64, accesses of 8/16/32/64 bits
+#define SIM_SBCS_RO  ((1u << 29) | (64u << 5) | 0xF)
+
+static
+void sim_sb_access (const bool read)
+{
+    uint32_t n    = (1u << ((sim_sbcs >> 17) & 0x7));
+    uint64_t offs = sim_sbaddress - SIM_MEM_BASE;
+
+    if ((sim_sbaddress < SIM_MEM_BASE) || ((offs + n) > SIM_MEM_SIZE)) {
+	sim_sbcs |= (DM_SBERROR_BADADDR << 12);
+	return;
+    }
+    if (read) {
+	sim_sbdata = 0;
+	memcpy (& sim_sbdata, & (sim_mem [offs]), n);
+    }
+    else
+	memcpy (& (sim_mem [offs]), & sim_sbdata, n);
+
+    if ((sim_sbcs >> 16) & 1)    // sbautoincrement
+	sim_sbaddress += n;
+}
+
+static
+void sim_command (const uint32_t command)
+{
+    uint32_t aarsize  = ((command >> 20) & 0x7);
+    bool     transfer = ((command >> 17) & 1);
+    bool     write    = ((command >> 16) & 1);
+    uint32_t regno    = (command & 0xFFFF);
+
+    if ((command >> 24) != DM_COMMAND_CMDTYPE_ACCESS_REG) {
+	sim_cmderr = DM_ABSTRACTCS_CMDERR_NOT_SUPPORTED;
+	return;
+    }
+    if (! transfer)
+	return;
+    if ((aarsize != DM_COMMAND_ACCESS_REG_SIZE_LOWER32)
+	&& ((aarsize != DM_COMMAND_ACCESS_REG_SIZE_LOWER64) || (sim_xlen == 32))) {
+	sim_cmderr = DM_ABSTRACTCS_CMDERR_NOT_SUPPORTED;
+	return;
+    }
+
+    uint64_t *p_reg;
+    if (regno < 0x1000)
+	p_reg = & (sim_csr [regno]);
+    else if ((regno >= 0x1000) && (regno < 0x1020))
+	p_reg = & (sim_gpr [regno - 0x1000]);
+    else {
+	sim_cmderr = DM_ABSTRACTCS_CMDERR_EXCEPTION;
+	return;
+    }
+
+    if (write) {
+	uint64_t x = sim_data [0];
+	if (aarsize == DM_COMMAND_ACCESS_REG_SIZE_LOWER64)
+	    x |= (((uint64_t) sim_data [1]) << 32);
+	if (regno != 0x1000)
+	    *p_reg = x;
+    }
+    else {
+	sim_data [0] = (uint32_t) *p_reg;
+	sim_data [1] = (uint32_t) (*p_reg >> 32);
+    }
+}
+
+void dmi_write (uint16_t addr, uint32_t data)
+{
+    n_dmi++;
+    if (addr == dm_addr_dmcontrol)
+	sim_dmcontrol = (data & (~ ((1u << 31) | (1u << 30) | (1u << 28) | (1u << 1))));
+    else if (addr == dm_addr_abstractcs)
+	sim_cmderr &= (~ ((data >> 8) & 0x7));
+    else if (addr == dm_addr_command) {
+	if (sim_cmderr == 0)
+	    sim_command (data);
+    }
+    else if (addr == dm_addr_data0)
+	sim_data [0] = data;
+    else if (addr == dm_addr_data1)
+	sim_data [1] = data;
+    else if (addr == dm_addr_sbcs)
+	sim_sbcs = (SIM_SBCS_RO
+		    | (data & ((1u << 20) | (0x7u << 17) | (1u << 16) | (1u << 15)))
+		    | (sim_sbcs & (~ data) & (0x7u << 12)));
+    else if (addr == dm_addr_sbaddress0) {
+	sim_sbaddress = ((sim_sbaddress & 0xFFFFFFFF00000000ULL) | data);
+	if ((sim_sbcs >> 20) & 1)    // sbreadonaddr
+	    sim_sb_access (true);
+    }
+    else if (addr == dm_addr_sbaddress1)
+	sim_sbaddress = ((sim_sbaddress & 0xFFFFFFFFULL) | (((uint64_t) data) << 32));
+    else if (addr == dm_addr_sbdata0) {
+	sim_sbdata = ((sim_sbdata & 0xFFFFFFFF00000000ULL) | data);
+	sim_sb_access (false);
+    }
+    else if (addr == dm_addr_sbdata1)
+	sim_sbdata = ((sim_sbdata & 0xFFFFFFFFULL) | (((uint64_t) data) << 32));
+}
+
+uint32_t dmi_read (uint16_t addr)
+{
+    n_dmi++;
+    if (addr == dm_addr_dmcontrol)
+	return sim_dmcontrol;
+    else if (addr == dm_addr_dmstatus)
+	// version 0.13, authenticated, allhalted/anyhalted, allresumeack/anyresumeack
+	return (2 | (1u << 7) | (1u << 9) | (1u << 8) | (1u << 17) | (1u << 16));
+    else if (addr == dm_addr_abstractcs)
+	return ((sim_cmderr << 8) | 2);    // datacount 2, progbufsize 0
+    else if (addr == dm_addr_data0)
+	return sim_data [0];
+    else if (addr == dm_addr_data1)
+	return sim_data [1];
+    else if (addr == dm_addr_haltsum0)
+	return 1;
+    else if (addr == dm_addr_sbcs)
+	return sim_sbcs;
+    else if (addr == dm_addr_sbaddress0)
+	return (uint32_t) sim_sbaddress;
+    else if (addr == dm_addr_sbaddress1)
+	return (uint32_t) (sim_sbaddress >> 32);
+    else if (addr == dm_addr_sbdata0) {
+	uint32_t x = (uint32_t) sim_sbdata;
+	if ((sim_sbcs >> 15) & 1)    // sbreadondata
+	    sim_sb_access (true);
+	return x;
+    }
+    else if (addr == dm_addr_sbdata1)
+	return (uint32_t) (sim_sbdata >> 32);
+    else
+	return 0;
+}
+
+// gdbstub_be calls this (from the front end) while it polls the DM
+bool gdbstub_be_poll_preempt (bool include_commands)
+{
+    return false;
+}
+
+// ================================================================
+// Timing
+
+static
+uint64_t nsecs_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ((uint64_t) ts.tv_nsec);
+}
+
+static
+void report (const uint8_t xlen, const char *what, const uint64_t n_ops,
+	     const uint64_t nsecs, const uint64_t dmis)
+{
+    fprintf (stdout, "RV%0d  %-28s %10.1f ns/op  %8.1f DMI/op\n",
+	     xlen, what, ((double) nsecs) / n_ops, ((double) dmis) / n_ops);
+}
+
+#define BENCH_MEM_LEN  4096
+
+static
+void bench_xlen (const uint8_t xlen, const uint32_t n_iters)
+{
+    static char buf [BENCH_MEM_LEN + 8];
+    uint64_t    t0, d0;
+
+    sim_xlen = xlen;
+    gdbstub_be_set_xlen (xlen);
+
+    // Each write drops the register from the per-stop snapshot, so each
+    // read goes to the DM too
+    t0 = nsecs_now ();
+    d0 = n_dmi;
+    for (uint32_t j = 0; j < n_iters; j++)
+	for (uint8_t r = 1; r < 32; r++) {
+	    uint64_t x;
+	    gdbstub_be_GPR_write (xlen, r, j + r);
+	    gdbstub_be_GPR_read  (xlen, r, & x);
+	}
+    report (xlen, "GPR write + read", ((uint64_t) n_iters) * 31, nsecs_now () - t0, n_dmi - d0);
+
+    t0 = nsecs_now ();
+    d0 = n_dmi;
+    for (uint32_t j = 0; j < n_iters; j++)
+	gdbstub_be_mem_read (xlen, SIM_MEM_BASE + 1, buf, BENCH_MEM_LEN);
+    report (xlen, "mem_read  4 KB (unaligned)", n_iters, nsecs_now () - t0, n_dmi - d0);
+
+    t0 = nsecs_now ();
+    d0 = n_dmi;
+    for (uint32_t j = 0; j < n_iters; j++)
+	gdbstub_be_mem_write (xlen, SIM_MEM_BASE + 1, buf, BENCH_MEM_LEN);
+    report (xlen, "mem_write 4 KB (unaligned)", n_iters, nsecs_now () - t0, n_dmi - d0);
+}
+
+// ================================================================
+// Check that what is read back is what was written, for the partial
+// words at either end too
+
+static
+uint32_t check_xlen (const uint8_t xlen)
+{
+    char wr [64], rd [64];
+
+    gdbstub_be_set_xlen (xlen);
+    for (size_t offset = 0; offset < 4; offset++)
+	for (size_t len = 1; len <= 12; len++) {
+	    for (size_t j = 0; j < len; j++)
+		wr [j] = (char) ((offset << 6) + (len << 2) + j);
+	    memset (rd, 0, sizeof (rd));
+	    gdbstub_be_mem_write (xlen, SIM_MEM_BASE + 0x100 + offset, wr, len);
+	    gdbstub_be_mem_read  (xlen, SIM_MEM_BASE + 0x100 + offset, rd, len);
+	    if (memcmp (wr, rd, len) != 0) {
+		fprintf (stdout, "RV%0d  MISMATCH: offset %0zu len %0zu\n", xlen, offset, len);
+		return status_err;
+	    }
+	}
+    return status_ok;
+}
+
+// ================================================================
+
+int main (int argc, char **argv)
+{
+    uint32_t n_iters = ((argc > 1) ? (uint32_t) strtoul (argv [1], NULL, 0) : 2000);
+
+    sim_csr [csr_addr_dcsr] = (4u << 28) | (DM_DCSR_CAUSE_HALTREQ << 6) | 3;    // xdebugver 4, M mode
+
+    if (gdbstub_be_init (NULL, false) != status_ok) {
+	fprintf (stderr, "gdbstub_bench: gdbstub_be_init failed\n");
+	return 1;
+    }
+
+    if ((check_xlen (32) != status_ok) || (check_xlen (64) != status_ok))
+	return 1;
+
+    bench_xlen (32, n_iters);
+    bench_xlen (64, n_iters);
+    return 0;
+}
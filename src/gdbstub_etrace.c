@@ -0,0 +1,968 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Instruction trace (see gdbstub_etrace.h)
+
+// ================================================================
+// C lib includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+
+// ----------------
+// Local includes
+
+#include "gdbstub_be.h"
+#include "gdbstub_etrace.h"
+
+// ****************************************************************
+// Private definitions
+
+// Bytes per SBA read while downloading
+#define ETRACE_CHUNK          0x10000
+
+// Instructions followed for one packet before giving up (e.g., the
+// program spins and the reported address is never reached)
+#define ETRACE_FOLLOW_MAX     (1u << 24)
+
+#define ETRACE_ICACHE_SIZE    4096      // entries; a power of 2
+
+static FILE *logfile_fp = NULL;
+
+// ----------------
+// Configuration
+
+static uint64_t tbuf_addr = 0;      // the trace buffer
+static uint64_t tbuf_size = 0;
+
+static bool     ctrl_set   = false;
+static uint64_t ctrl_addr;
+static uint32_t ctrl_start;
+static uint32_t ctrl_stop;
+
+static bool     wp_set    = false;
+static uint64_t wp_addr;
+static uint64_t wp_wrap_mask;
+
+// Encoder parameters (names as in the E-Trace spec, without "_p") and
+// encapsulation: bytes of source id and timestamp after each header
+typedef struct {
+    const char *name;
+    uint64_t    value;
+    uint64_t    max;
+} Param;
+
+enum { P_IADDRESS_LSB, P_IADDRESS_WIDTH, P_FULL_ADDRESS,
+       P_PRIVILEGE_WIDTH, P_ECAUSE_WIDTH, P_CONTEXT_WIDTH, P_TIME_WIDTH,
+       P_SRCID_BYTES, P_TIMESTAMP_BYTES, P_NUM };
+
+static Param params [P_NUM] = {
+    { "iaddress_lsb",     1,  3 },
+    { "iaddress_width",   0, 64 },     // 0: XLEN
+    { "full_address",     0,  1 },
+    { "privilege_width",  2,  4 },
+    { "ecause_width",     6, 16 },
+    { "context_width",    0, 64 },
+    { "time_width",       0, 64 },
+    { "srcid_bytes",      0,  8 },
+    { "timestamp_bytes",  0,  8 }
+};
+
+#define PARAM(p)  (params [p].value)
+
+// ----------------
+// Encoder and downloaded trace
+
+static bool     encoder_running = false;
+static uint8_t *trace           = NULL;
+static uint64_t trace_len       = 0;
+static bool     trace_wrapped   = false;
+
+// ----------------
+// Decoded results: retired PCs and their counts (open addressing)
+
+typedef struct {
+    uint64_t pc;
+    uint64_t count;       // 0: empty slot
+    uint32_t len;         // instruction length, for coverage ranges
+} PC_Count;
+
+static PC_Count *pcs      = NULL;
+static uint64_t  pcs_size = 0;     // a power of 2
+static uint64_t  pcs_used = 0;
+
+// ----------------
+// Statistics
+
+static uint64_t n_bytes;
+static uint64_t n_idle;
+static uint64_t n_packets;
+static uint64_t n_format [4];
+static uint64_t n_traps;
+static uint64_t n_skipped;          // before the first sync
+static uint64_t n_truncated;
+static uint64_t n_instructions;
+static uint64_t n_errors;
+static char     first_error [256];
+
+// ----------------
+// Decoder state
+
+static uint8_t  xlen_d;
+static uint64_t addr_mask;
+static bool     start_of_trace;
+static bool     stop_at_last_branch;
+static bool     inferred_address;
+static bool     decode_failed;      // in this packet; resync at the next sync
+static uint64_t pc;
+static uint64_t last_pc;
+static uint64_t address;
+static uint64_t branch_map;
+static uint32_t branches;
+static uint32_t privilege;
+
+// ----------------
+// Instructions, fetched from the ELF image (or target memory) once
+
+typedef struct {
+    uint64_t addr;
+    uint32_t instr;
+    uint32_t len;        // 0: invalid
+} ICache_Entry;
+
+static ICache_Entry icache [ETRACE_ICACHE_SIZE];
+
+// ================================================================
+
+void gdbstub_etrace_init (FILE *logfile)
+{
+    logfile_fp = logfile;
+}
+
+// ================================================================
+// Configuration
+
+uint32_t gdbstub_etrace_set_buffer (uint64_t addr, uint64_t size)
+{
+    if ((size == 0) || (addr + size < addr))
+	return status_err;
+    tbuf_addr = addr;
+    tbuf_size = size;
+    return status_ok;
+}
+
+uint32_t gdbstub_etrace_set_control (uint64_t addr, uint32_t start_value, uint32_t stop_value)
+{
+    ctrl_set   = true;
+    ctrl_addr  = addr;
+    ctrl_start = start_value;
+    ctrl_stop  = stop_value;
+    return status_ok;
+}
+
+uint32_t gdbstub_etrace_set_wp (uint64_t addr, uint64_t wrap_mask)
+{
+    wp_set       = true;
+    wp_addr      = addr;
+    wp_wrap_mask = wrap_mask;
+    return status_ok;
+}
+
+uint32_t gdbstub_etrace_set_param (const char *name, uint64_t value)
+{
+    for (uint32_t j = 0; j < P_NUM; j++)
+	if (strcmp (name, params [j].name) == 0) {
+	    if (value > params [j].max)
+		return status_err;
+	    params [j].value = value;
+	    return status_ok;
+	}
+    return status_err;
+}
+
+// ================================================================
+// Encoder control: write a 32-bit value to the control register
+
+static
+uint32_t write_control (const uint8_t xlen, uint32_t value)
+{
+    if (! ctrl_set)
+	return status_err;
+
+    char bytes [4];
+    for (uint32_t j = 0; j < 4; j++)
+	bytes [j] = (char) (value >> (8 * j));
+    return gdbstub_be_mem_write (xlen, ctrl_addr, bytes, 4);
+}
+
+uint32_t gdbstub_etrace_start (const uint8_t xlen)
+{
+    uint32_t status = write_control (xlen, ctrl_start);
+    if (status == status_ok)
+	encoder_running = true;
+    return status;
+}
+
+uint32_t gdbstub_etrace_stop (const uint8_t xlen)
+{
+    uint32_t status = write_control (xlen, ctrl_stop);
+    if (status == status_ok)
+	encoder_running = false;
+    return status;
+}
+
+// ================================================================
+// Download
+
+static
+uint32_t read_buffer (const uint8_t xlen, uint64_t offset, uint64_t len, uint8_t *dest)
+{
+    while (len != 0) {
+	uint64_t n = ((len < ETRACE_CHUNK) ? len : ETRACE_CHUNK);
+	if (gdbstub_be_mem_read (xlen, tbuf_addr + offset, (char *) dest, n) != status_ok)
+	    return status_err;
+	offset += n;
+	dest   += n;
+	len    -= n;
+    }
+    return status_ok;
+}
+
+uint32_t gdbstub_etrace_download (const uint8_t xlen, const char *filename)
+{
+    if (tbuf_size == 0)
+	return status_err;
+
+    // Where the encoder has written up to; the whole buffer if unknown
+    uint64_t offset  = 0;
+    uint64_t len     = tbuf_size;
+    bool     wrapped = false;
+    if (wp_set) {
+	uint8_t  bytes [8] = { 0 };
+	uint32_t width = ((xlen == 32) ? 4 : 8);
+	if (gdbstub_be_mem_read (xlen, wp_addr, (char *) bytes, width) != status_ok)
+	    return status_err;
+	uint64_t wp = 0;
+	for (uint32_t j = 0; j < width; j++)
+	    wp |= ((uint64_t) bytes [j]) << (8 * j);
+	wrapped = ((wp & wp_wrap_mask) != 0);
+	wp &= (~ wp_wrap_mask);
+	if ((wp >= tbuf_addr) && (wp - tbuf_addr <= tbuf_size))
+	    offset = wp - tbuf_addr;
+	else if (wp <= tbuf_size)
+	    offset = wp;
+	else {
+	    if (logfile_fp != NULL) {
+		fprintf (logfile_fp,
+			 "gdbstub_etrace_download: write pointer 0x%0" PRIx64 " is outside the buffer\n",
+			 wp);
+		fflush (logfile_fp);
+	    }
+	    return status_err;
+	}
+	len = (wrapped ? tbuf_size : offset);
+	if (offset == tbuf_size)
+	    offset = 0;
+    }
+
+    uint8_t *p = realloc (trace, ((len == 0) ? 1 : len));
+    if (p == NULL)
+	return status_err;
+    trace         = p;
+    trace_len     = 0;
+    trace_wrapped = wrapped;
+
+    // Oldest byte first: if wrapped, [offset, end) then [0, offset)
+    uint32_t status;
+    if (wrapped) {
+	status = read_buffer (xlen, offset, tbuf_size - offset, trace);
+	if (status == status_ok)
+	    status = read_buffer (xlen, 0, offset, trace + (tbuf_size - offset));
+    }
+    else
+	status = read_buffer (xlen, 0, len, trace);
+    if (status != status_ok)
+	return status;
+    trace_len = len;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_etrace_download: %0" PRId64 " bytes%s\n",
+		 trace_len, (wrapped ? " (wrapped)" : ""));
+	fflush (logfile_fp);
+    }
+
+    if (filename != NULL) {
+	FILE *fp = fopen (filename, "wb");
+	if (fp == NULL)
+	    return status_err;
+	size_t n = fwrite (trace, 1, trace_len, fp);
+	fclose (fp);
+	if (n != trace_len)
+	    return status_err;
+    }
+    return status_ok;
+}
+
+// ================================================================
+// PC counts
+
+static
+void count_pc (uint64_t a, uint32_t len)
+{
+    if (4 * (pcs_used + 1) > 3 * pcs_size) {
+	uint64_t  new_size = ((pcs_size == 0) ? 4096 : (2 * pcs_size));
+	PC_Count *new_pcs  = calloc (new_size, sizeof (PC_Count));
+	if (new_pcs == NULL)
+	    return;
+	for (uint64_t j = 0; j < pcs_size; j++)
+	    if (pcs [j].count != 0) {
+		uint64_t h = ((pcs [j].pc >> 1) * 0x9E3779B97F4A7C15llu) & (new_size - 1);
+		while (new_pcs [h].count != 0)
+		    h = (h + 1) & (new_size - 1);
+		new_pcs [h] = pcs [j];
+	    }
+	free (pcs);
+	pcs      = new_pcs;
+	pcs_size = new_size;
+    }
+
+    uint64_t h = ((a >> 1) * 0x9E3779B97F4A7C15llu) & (pcs_size - 1);
+    while ((pcs [h].count != 0) && (pcs [h].pc != a))
+	h = (h + 1) & (pcs_size - 1);
+    if (pcs [h].count == 0) {
+	pcs [h].pc  = a;
+	pcs [h].len = len;
+	pcs_used++;
+    }
+    pcs [h].count++;
+}
+
+uint32_t gdbstub_etrace_clear (void)
+{
+    free (pcs);
+    pcs      = NULL;
+    pcs_size = 0;
+    pcs_used = 0;
+
+    n_bytes        = 0;
+    n_idle         = 0;
+    n_packets      = 0;
+    memset (n_format, 0, sizeof (n_format));
+    n_traps        = 0;
+    n_skipped      = 0;
+    n_truncated    = 0;
+    n_instructions = 0;
+    n_errors       = 0;
+    first_error [0] = 0;
+    return status_ok;
+}
+
+// ================================================================
+// Decode errors: counted, the first one kept; the decoder then
+// waits for the next sync packet
+
+static
+void decode_error (const char *fmt, ...)
+{
+    n_errors++;
+    decode_failed = true;
+    if (first_error [0] == 0) {
+	va_list ap;
+	va_start (ap, fmt);
+	vsnprintf (first_error, sizeof (first_error), fmt, ap);
+	va_end (ap);
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "gdbstub_etrace_decode: %s\n", first_error);
+	    fflush (logfile_fp);
+	}
+    }
+}
+
+// ================================================================
+// Instructions
+
+static
+bool read_code (uint64_t a, uint16_t *p_half)
+{
+    char bytes [2] = { 0, 0 };
+    if (gdbstub_be_elf_read (a, bytes, 2) != status_ok)
+	if (gdbstub_be_mem_read (xlen_d, a, bytes, 2) != status_ok)
+	    return false;
+    *p_half = (uint16_t) ((((uint8_t) bytes [1]) << 8) | ((uint8_t) bytes [0]));
+    return true;
+}
+
+static
+bool fetch (uint64_t a, uint32_t *p_instr, uint32_t *p_len)
+{
+    ICache_Entry *e = & (icache [(a >> 1) & (ETRACE_ICACHE_SIZE - 1)]);
+    if ((e->len == 0) || (e->addr != a)) {
+	uint16_t lo, hi = 0;
+	if (! read_code (a, & lo))
+	    return false;
+	// All-zeros is not an instruction (and is what we get without code)
+	if (lo == 0)
+	    return false;
+	if ((lo & 0x3) == 0x3)
+	    if (! read_code (a + 2, & hi))
+		return false;
+	e->addr  = a;
+	e->instr = (((uint32_t) hi) << 16) | lo;
+	e->len   = (((lo & 0x3) == 0x3) ? 4 : 2);
+    }
+    *p_instr = e->instr;
+    *p_len   = e->len;
+    return true;
+}
+
+static
+int64_t sext (uint64_t x, uint32_t width)
+{
+    if ((width == 0) || (width >= 64))
+	return (int64_t) x;
+    uint64_t m = 1llu << (width - 1);
+    x &= ((m << 1) - 1);
+    return (int64_t) ((x ^ m) - m);
+}
+
+typedef enum { I_SEQUENTIAL,     // next instruction is at pc + len
+	       I_BRANCH,         // conditional branch to pc + imm
+	       I_JUMP,           // inferable jump to pc + imm
+	       I_UNINFERABLE     // jalr, c.jr, c.jalr, xRET
+} I_Kind;
+
+static
+I_Kind classify (uint32_t instr, uint32_t len, int64_t *p_imm)
+{
+    if (len == 4) {
+	uint32_t opcode = instr & 0x7F;
+	if (opcode == 0x63) {
+	    *p_imm = sext (  (((instr >> 31) & 0x1)  << 12)
+			   | (((instr >>  7) & 0x1)  << 11)
+			   | (((instr >> 25) & 0x3F) <<  5)
+			   | (((instr >>  8) & 0xF)  <<  1), 13);
+	    return I_BRANCH;
+	}
+	if (opcode == 0x6F) {
+	    *p_imm = sext (  (((instr >> 31) & 0x1)   << 20)
+			   | (((instr >> 12) & 0xFF)  << 12)
+			   | (((instr >> 20) & 0x1)   << 11)
+			   | (((instr >> 21) & 0x3FF) <<  1), 21);
+	    return I_JUMP;
+	}
+	if (opcode == 0x67)
+	    return I_UNINFERABLE;
+	if ((instr == 0x30200073) || (instr == 0x10200073) || (instr == 0x00200073) || (instr == 0x7B200073))
+	    return I_UNINFERABLE;    // MRET, SRET, URET, DRET
+	return I_SEQUENTIAL;
+    }
+
+    uint32_t op = instr & 0x3;
+    uint32_t f3 = (instr >> 13) & 0x7;
+    if ((op == 1) && ((f3 == 5) || ((f3 == 1) && (xlen_d == 32)))) {
+	// C.J, C.JAL (RV32 only; C.ADDIW on RV64)
+	*p_imm = sext (  (((instr >> 12) & 0x1) << 11)
+		       | (((instr >> 11) & 0x1) <<  4)
+		       | (((instr >>  9) & 0x3) <<  8)
+		       | (((instr >>  8) & 0x1) << 10)
+		       | (((instr >>  7) & 0x1) <<  6)
+		       | (((instr >>  6) & 0x1) <<  7)
+		       | (((instr >>  3) & 0x7) <<  1)
+		       | (((instr >>  2) & 0x1) <<  5), 12);
+	return I_JUMP;
+    }
+    if ((op == 1) && ((f3 == 6) || (f3 == 7))) {
+	// C.BEQZ, C.BNEZ
+	*p_imm = sext (  (((instr >> 12) & 0x1) << 8)
+		       | (((instr >> 10) & 0x3) << 3)
+		       | (((instr >>  5) & 0x3) << 6)
+		       | (((instr >>  3) & 0x3) << 1)
+		       | (((instr >>  2) & 0x1) << 5), 9);
+	return I_BRANCH;
+    }
+    if ((op == 2) && (f3 == 4) && (((instr >> 2) & 0x1F) == 0) && (((instr >> 7) & 0x1F) != 0))
+	return I_UNINFERABLE;    // C.JR, C.JALR
+    return I_SEQUENTIAL;
+}
+
+static
+bool is_branch_at (uint64_t a)
+{
+    uint32_t instr, len;
+    int64_t  imm;
+    return (fetch (a, & instr, & len) && (classify (instr, len, & imm) == I_BRANCH));
+}
+
+// ================================================================
+// Following the program (after the reference decoder of the E-Trace spec)
+
+static
+void report_pc (void)
+{
+    uint32_t instr, len;
+    if (! fetch (pc, & instr, & len)) {
+	decode_error ("no code at 0x%0" PRIx64, pc);
+	return;
+    }
+    count_pc (pc, len);
+    n_instructions++;
+}
+
+// Advance pc by one instruction; true at an uninferable discontinuity
+// (pc is then 'target')
+static
+bool next_pc (uint64_t target)
+{
+    uint32_t instr, len;
+    int64_t  imm = 0;
+    uint64_t this_pc = pc;
+    bool     stop_here = false;
+
+    if (! fetch (pc, & instr, & len)) {
+	decode_error ("no code at 0x%0" PRIx64, pc);
+	return true;
+    }
+
+    switch (classify (instr, len, & imm)) {
+    case I_JUMP:
+	pc = (pc + (uint64_t) imm) & addr_mask;
+	break;
+    case I_UNINFERABLE:
+	if (stop_at_last_branch)
+	    decode_error ("unexpected uninferable discontinuity at 0x%0" PRIx64, pc);
+	pc = target;
+	stop_here = true;
+	break;
+    case I_BRANCH: {
+	if (branches == 0) {
+	    decode_error ("no branch map bit for the branch at 0x%0" PRIx64, pc);
+	    return true;
+	}
+	// Branch map: 0 for taken
+	bool taken = ((branch_map & 1) == 0);
+	branch_map >>= 1;
+	branches--;
+	pc = (taken ? ((pc + (uint64_t) imm) & addr_mask) : ((pc + len) & addr_mask));
+	break;
+    }
+    default:
+	pc = (pc + len) & addr_mask;
+    }
+    last_pc = this_pc;
+    return stop_here;
+}
+
+typedef struct {
+    uint32_t format;
+    uint32_t subformat;
+    uint32_t branch;           // format 3: 0 if the instruction is a taken branch
+    uint32_t privilege;
+    bool     interrupt;
+    bool     thaddr;
+    uint64_t address;          // without the iaddress_lsb bits
+    uint32_t branches;
+    uint64_t branch_map;
+    bool     notify;           // the flags, already compared with the bits before them
+    bool     updiscon;
+} Packet;
+
+static
+void follow_execution_path (const Packet *pk)
+{
+    uint64_t previous_address = pc;
+
+    for (uint32_t j = 0; j < ETRACE_FOLLOW_MAX; j++) {
+	if (inferred_address) {
+	    bool stop_here = next_pc (previous_address);
+	    report_pc ();
+	    if (decode_failed)
+		return;
+	    if (stop_here)
+		inferred_address = false;
+	    continue;
+	}
+
+	bool stop_here = next_pc (address);
+	report_pc ();
+	if (decode_failed)
+	    return;
+	uint32_t pending = (is_branch_at (pc) ? 1 : 0);
+
+	if ((branches == 1) && (pending == 1) && stop_at_last_branch) {
+	    // The branch map is used up, up to this (unresolved) branch
+	    stop_at_last_branch = false;
+	    return;
+	}
+	if (stop_here) {
+	    if (branches > pending)
+		decode_error ("%0d unprocessed branches at 0x%0" PRIx64, branches - pending, pc);
+	    return;
+	}
+	if ((pk->format != 3) && (pc == address) && (! stop_at_last_branch)) {
+	    if (pk->notify)
+		return;
+	    uint32_t instr, len;
+	    int64_t  imm;
+	    bool     after_uninferable = (fetch (last_pc, & instr, & len)
+					  && (classify (instr, len, & imm) == I_UNINFERABLE));
+	    if ((! after_uninferable) && (! pk->updiscon) && (branches == pending)) {
+		// Reached the reported address, but not by an uninferable
+		// discontinuity: it may be a later visit, so carry on from
+		// here with the next packet
+		inferred_address = true;
+		return;
+	    }
+	}
+	if ((pk->format == 3) && (pc == address) && (branches == pending))
+	    return;
+    }
+    decode_error ("lost in a loop following 0x%0" PRIx64, pc);
+}
+
+// ================================================================
+// Packet payloads: fields LSB first; bits past the end repeat the last one
+
+typedef struct {
+    const uint8_t *p;
+    uint64_t       n_bits;
+    uint64_t       pos;
+    uint32_t       last_bit;     // of the previous field
+} Bits;
+
+static
+uint64_t get_bits (Bits *b, uint32_t width)
+{
+    uint64_t v = 0;
+    for (uint32_t j = 0; j < width; j++) {
+	uint64_t pos = ((b->pos < b->n_bits) ? b->pos : (b->n_bits - 1));
+	uint32_t bit = (b->p [pos >> 3] >> (pos & 7)) & 1;
+	v |= ((uint64_t) bit) << j;
+	b->pos++;
+	b->last_bit = bit;
+    }
+    return v;
+}
+
+static
+bool parse_packet (const uint8_t *p, uint32_t len, Packet *pk)
+{
+    Bits     b = { p, 8 * (uint64_t) len, 0, 0 };
+    uint32_t addr_bits = (uint32_t) ((PARAM (P_IADDRESS_WIDTH) == 0) ? xlen_d : PARAM (P_IADDRESS_WIDTH))
+			  - (uint32_t) PARAM (P_IADDRESS_LSB);
+
+    memset (pk, 0, sizeof (*pk));
+    pk->format = (uint32_t) get_bits (& b, 2);
+
+    if (pk->format == 3) {
+	pk->subformat = (uint32_t) get_bits (& b, 2);
+	if (pk->subformat == 3)
+	    return true;                              // support: nothing for us
+	if (pk->subformat != 2)
+	    pk->branch = (uint32_t) get_bits (& b, 1);
+	pk->privilege = (uint32_t) get_bits (& b, (uint32_t) PARAM (P_PRIVILEGE_WIDTH));
+	get_bits (& b, (uint32_t) PARAM (P_TIME_WIDTH));
+	get_bits (& b, (uint32_t) PARAM (P_CONTEXT_WIDTH));
+	if (pk->subformat == 2)
+	    return true;
+	if (pk->subformat == 1) {
+	    get_bits (& b, (uint32_t) PARAM (P_ECAUSE_WIDTH));
+	    pk->interrupt = get_bits (& b, 1);
+	    pk->thaddr    = get_bits (& b, 1);
+	}
+	pk->address = get_bits (& b, addr_bits);
+	return true;
+    }
+
+    if (pk->format == 1) {
+	static const uint32_t map_sizes [] = { 1, 9, 17, 25, 31 };
+	pk->branches = (uint32_t) get_bits (& b, 5);
+	uint32_t map_len = 31;
+	if (pk->branches != 0)
+	    for (uint32_t j = 0; j < 5; j++)
+		if (pk->branches <= map_sizes [j]) {
+		    map_len = map_sizes [j];
+		    break;
+		}
+	pk->branch_map = get_bits (& b, map_len);
+	if (pk->branches == 0)
+	    return true;                              // a full map, no address
+    }
+
+    if ((pk->format == 1) || (pk->format == 2)) {
+	pk->address = get_bits (& b, addr_bits);
+	uint32_t msb      = b.last_bit;
+	uint32_t notify   = (uint32_t) get_bits (& b, 1);
+	uint32_t updiscon = (uint32_t) get_bits (& b, 1);
+	pk->notify   = (notify != msb);
+	pk->updiscon = (updiscon != notify);
+	return true;
+    }
+
+    return false;    // format 0: extensions
+}
+
+static
+void decode_packet (const uint8_t *p, uint32_t len)
+{
+    Packet   pk;
+    uint32_t lsb       = (uint32_t) PARAM (P_IADDRESS_LSB);
+    uint32_t addr_bits = (uint32_t) ((PARAM (P_IADDRESS_WIDTH) == 0) ? xlen_d : PARAM (P_IADDRESS_WIDTH)) - lsb;
+
+    n_packets++;
+    if (! parse_packet (p, len, & pk)) {
+	n_format [0]++;
+	return;
+    }
+    n_format [pk.format]++;
+    decode_failed = false;
+
+    if (pk.format == 3) {
+	if (pk.subformat >= 2)
+	    return;
+	if (pk.subformat == 1) {
+	    n_traps++;
+	    if (! pk.thaddr)
+		return;      // the address is that of the trapping instruction
+	}
+	inferred_address = false;
+	address = (pk.address << lsb) & addr_mask;
+	if ((pk.subformat == 1) || start_of_trace) {
+	    branches   = 0;
+	    branch_map = 0;
+	}
+	if (is_branch_at (address)) {
+	    branch_map |= ((uint64_t) pk.branch) << branches;
+	    branches++;
+	}
+	if ((pk.subformat == 0) && (! start_of_trace))
+	    follow_execution_path (& pk);
+	else {
+	    pc      = address;
+	    last_pc = pc;
+	    report_pc ();
+	}
+	privilege      = pk.privilege;
+	start_of_trace = decode_failed;
+	return;
+    }
+
+    if (start_of_trace) {
+	n_skipped++;
+	return;
+    }
+
+    if ((pk.format == 2) || (pk.branches != 0)) {
+	stop_at_last_branch = false;
+	if (PARAM (P_FULL_ADDRESS))
+	    address = (pk.address << lsb) & addr_mask;
+	else
+	    address = (address + (((uint64_t) sext (pk.address, addr_bits)) << lsb)) & addr_mask;
+    }
+    if (pk.format == 1) {
+	stop_at_last_branch = (pk.branches == 0);
+	uint32_t n = ((pk.branches == 0) ? 31 : pk.branches);
+	if (branches + n > 64) {
+	    decode_error ("branch map overflow at 0x%0" PRIx64, pc);
+	    start_of_trace = true;
+	    return;
+	}
+	branch_map |= pk.branch_map << branches;
+	branches   += n;
+    }
+    follow_execution_path (& pk);
+    if (decode_failed)
+	start_of_trace = true;
+}
+
+// ================================================================
+
+uint32_t gdbstub_etrace_decode (const uint8_t xlen, const char *filename)
+{
+    uint8_t *data = trace;
+    uint64_t len  = trace_len;
+
+    if (filename != NULL) {
+	FILE *fp = fopen (filename, "rb");
+	if (fp == NULL)
+	    return status_err;
+	fseek (fp, 0, SEEK_END);
+	long size = ftell (fp);
+	fseek (fp, 0, SEEK_SET);
+	data = malloc ((size <= 0) ? 1 : (size_t) size);
+	len  = ((size <= 0) ? 0 : (uint64_t) size);
+	if ((data == NULL) || (fread (data, 1, len, fp) != len)) {
+	    free (data);
+	    fclose (fp);
+	    return status_err;
+	}
+	fclose (fp);
+    }
+    else if (trace == NULL)
+	return status_err;
+
+    xlen_d    = ((xlen == 32) ? 32 : 64);
+    addr_mask = ((xlen_d == 32) ? 0xFFFFFFFFllu : 0xFFFFFFFFFFFFFFFFllu);
+    memset (icache, 0, sizeof (icache));
+
+    start_of_trace      = true;
+    stop_at_last_branch = false;
+    inferred_address    = false;
+    branches            = 0;
+    branch_map          = 0;
+
+    uint32_t skip = (uint32_t) (PARAM (P_SRCID_BYTES) + PARAM (P_TIMESTAMP_BYTES));
+    uint64_t j    = 0;
+    while (j < len) {
+	uint32_t payload_len = data [j] & 0x1F;
+	if (payload_len == 0) {
+	    n_idle++;
+	    j++;
+	    continue;
+	}
+	if (j + 1 + skip + payload_len > len) {
+	    n_truncated++;
+	    break;
+	}
+	decode_packet (& (data [j + 1 + skip]), payload_len);
+	j += 1 + skip + payload_len;
+    }
+    n_bytes += len;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp,
+		 "gdbstub_etrace_decode: %0" PRId64 " bytes, %0" PRId64 " instructions so far\n",
+		 len, n_instructions);
+	fflush (logfile_fp);
+    }
+
+    if (data != trace)
+	free (data);
+    return status_ok;
+}
+
+// ================================================================
+// Results
+
+static
+PC_Count *sorted_pcs (int (*cmp) (const void *, const void *))
+{
+    PC_Count *v = malloc (((pcs_used == 0) ? 1 : pcs_used) * sizeof (PC_Count));
+    if (v == NULL)
+	return NULL;
+    uint64_t n = 0;
+    for (uint64_t j = 0; j < pcs_size; j++)
+	if (pcs [j].count != 0)
+	    v [n++] = pcs [j];
+    qsort (v, n, sizeof (PC_Count), cmp);
+    return v;
+}
+
+static
+int cmp_count (const void *a, const void *b)
+{
+    const PC_Count *x = a, *y = b;
+    if (x->count != y->count)
+	return ((x->count > y->count) ? -1 : 1);
+    return ((x->pc < y->pc) ? -1 : (x->pc > y->pc));
+}
+
+static
+int cmp_pc (const void *a, const void *b)
+{
+    const PC_Count *x = a, *y = b;
+    return ((x->pc < y->pc) ? -1 : (x->pc > y->pc));
+}
+
+uint32_t gdbstub_etrace_write_histogram (const char *filename, uint64_t max_lines)
+{
+    PC_Count *v = sorted_pcs (cmp_count);
+    if (v == NULL)
+	return status_err;
+    FILE *fp = fopen (filename, "w");
+    if (fp == NULL) {
+	free (v);
+	return status_err;
+    }
+    fprintf (fp, "pc,count\n");
+    for (uint64_t j = 0; (j < pcs_used) && ((max_lines == 0) || (j < max_lines)); j++)
+	fprintf (fp, "0x%0" PRIx64 ",%0" PRId64 "\n", v [j].pc, v [j].count);
+    fclose (fp);
+    free (v);
+    return status_ok;
+}
+
+uint32_t gdbstub_etrace_write_coverage (const char *filename)
+{
+    PC_Count *v = sorted_pcs (cmp_pc);
+    if (v == NULL)
+	return status_err;
+    FILE *fp = fopen (filename, "w");
+    if (fp == NULL) {
+	free (v);
+	return status_err;
+    }
+    fprintf (fp, "start,end,instructions\n");
+    uint64_t j = 0;
+    while (j < pcs_used) {
+	uint64_t start = v [j].pc;
+	uint64_t end   = v [j].pc + v [j].len;
+	uint64_t n     = 1;
+	for (j++; (j < pcs_used) && (v [j].pc == end); j++, n++)
+	    end = v [j].pc + v [j].len;
+	fprintf (fp, "0x%0" PRIx64 ",0x%0" PRIx64 ",%0" PRId64 "\n", start, end, n);
+    }
+    fclose (fp);
+    free (v);
+    return status_ok;
+}
+
+void gdbstub_etrace_status (char *buf, const size_t buf_size)
+{
+    size_t n = 0;
+
+    if (buf_size == 0)
+	return;
+    buf [0] = 0;
+
+    if (buf_size > n)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n,
+				"E-Trace: buffer 0x%0" PRIx64 " (%0" PRId64 " bytes), encoder %s\n",
+				tbuf_addr, tbuf_size, (encoder_running ? "running" : "stopped"));
+    if (ctrl_set && (buf_size > n))
+	n += (size_t) snprintf (& (buf [n]), buf_size - n,
+				"    control 0x%0" PRIx64 " (start 0x%0" PRIx32 ", stop 0x%0" PRIx32 ")\n",
+				ctrl_addr, ctrl_start, ctrl_stop);
+    if (wp_set && (buf_size > n))
+	n += (size_t) snprintf (& (buf [n]), buf_size - n,
+				"    write pointer 0x%0" PRIx64 " (wrap mask 0x%0" PRIx64 ")\n",
+				wp_addr, wp_wrap_mask);
+    if (buf_size > n)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n,
+				"    downloaded %0" PRId64 " bytes%s; decoded %0" PRId64 " bytes:"
+				" %0" PRId64 " packets (sync %0" PRId64 ", address %0" PRId64 ","
+				" branch %0" PRId64 ", unsupported %0" PRId64 "), %0" PRId64 " idle\n",
+				trace_len, (trace_wrapped ? " (wrapped)" : ""), n_bytes,
+				n_packets, n_format [3], n_format [2], n_format [1], n_format [0], n_idle);
+    if (buf_size > n)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n,
+				"    %0" PRId64 " instructions, %0" PRId64 " distinct PCs, %0" PRId64 " traps,"
+				" %0" PRId64 " skipped before sync, %0" PRId64 " truncated, %0" PRId64 " errors\n",
+				n_instructions, pcs_used, n_traps, n_skipped, n_truncated, n_errors);
+    if ((first_error [0] != 0) && (buf_size > n))
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "    first error: %s\n", first_error);
+    if (buf_size > n) {
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "    params:");
+	for (uint32_t j = 0; (j < P_NUM) && (buf_size > n); j++)
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, " %s=%0" PRId64, params [j].name, params [j].value);
+	if (buf_size > n)
+	    snprintf (& (buf [n]), buf_size - n, "\n");
+    }
+}
+
+// ================================================================
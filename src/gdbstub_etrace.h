@@ -0,0 +1,103 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Instruction trace (RISC-V E-Trace) from an on-chip trace buffer.
+
+// The target's trace encoder writes E-Trace instruction packets
+// (te_inst) into a buffer in memory.  The encoder is started and
+// stopped by writing configurable values to an MMIO control register;
+// another MMIO register holds its write pointer, with an optional
+// "wrapped" bit.  The buffer is downloaded in bulk through System Bus
+// Access, or the same bytes can be taken from a file on the host (for
+// buffers captured elsewhere, or synthetic ones).
+
+// Packets are in the reference encapsulation: a header byte with the
+// payload length in bits [4:0] (0 for an idle byte), followed by
+// optional source-id and timestamp bytes and then the payload, whose
+// fields are packed LSB first and sign-extended from its last bit.
+// Decoded: formats 3 (sync: start, trap, context), 2 (address) and 1
+// (branch map, with or without an address), with full or differential
+// addresses.  Not decoded: format 0 (extensions), implicit returns,
+// and N-Trace.
+
+// The decoder follows the program from each sync point, fetching
+// instructions from the memory image of the loaded ELF file (from
+// target memory if there is none), taking conditional branches as the
+// branch maps say and jumping to reported addresses at uninferable
+// discontinuities (jalr, xRET).  Every retired PC is counted; the
+// counts can be written out as a PC histogram and as coverage (the
+// executed address ranges).
+
+// ================================================================
+
+#pragma once
+
+// ================================================================
+// Initialize (called once per GDB session).
+
+extern
+void gdbstub_etrace_init (FILE *logfile);
+
+// ================================================================
+// Configuration ('monitor' commands).  All return status_ok or status_err.
+
+// The trace buffer: [addr, addr + size)
+extern
+uint32_t gdbstub_etrace_set_buffer (uint64_t addr, uint64_t size);
+
+// The control register, and the values that start and stop the encoder
+extern
+uint32_t gdbstub_etrace_set_control (uint64_t addr, uint32_t start_value, uint32_t stop_value);
+
+// The write pointer register (an address in, or offset into, the
+// buffer); wrap_mask selects its "wrapped" bit(s), if any
+extern
+uint32_t gdbstub_etrace_set_wp (uint64_t addr, uint64_t wrap_mask);
+
+// Encoder/encapsulation parameters, by name (see gdbstub_etrace.c)
+extern
+uint32_t gdbstub_etrace_set_param (const char *name, uint64_t value);
+
+// ================================================================
+// Start and stop the encoder
+
+extern
+uint32_t gdbstub_etrace_start (const uint8_t xlen);
+
+extern
+uint32_t gdbstub_etrace_stop (const uint8_t xlen);
+
+// ================================================================
+// Download the trace buffer (oldest byte first) into the stub, and
+// also into a file if filename is not NULL.
+
+extern
+uint32_t gdbstub_etrace_download (const uint8_t xlen, const char *filename);
+
+// Decode the downloaded trace or, if filename is not NULL, a raw
+// trace from that file.  Counts are accumulated over decodes until
+// gdbstub_etrace_clear.
+
+extern
+uint32_t gdbstub_etrace_decode (const uint8_t xlen, const char *filename);
+
+extern
+uint32_t gdbstub_etrace_clear (void);
+
+// ================================================================
+// Results
+
+// "pc,count" lines, most frequent first (at most max_lines, if not 0)
+extern
+uint32_t gdbstub_etrace_write_histogram (const char *filename, uint64_t max_lines);
+
+// "start,end,instructions" lines: executed ranges [start, end)
+extern
+uint32_t gdbstub_etrace_write_coverage (const char *filename);
+
+// Status and statistics (NUL-terminated, into buf)
+extern
+void gdbstub_etrace_status (char *buf, const size_t buf_size);
+
+// ================================================================
@@ -21,6 +21,13 @@
 
 #include "gdbstub_be.h"
 #include "gdbstub_fe.h"
+#include "gdbstub_trace.h"
+#include "gdbstub_rtos.h"
+#include "gdbstub_watch.h"
+#include "gdbstub_sample.h"
+#include "gdbstub_rtt.h"
+#include "gdbstub_record.h"
+#include "gdbstub_etrace.h"
 
 // ================================================================
 // Terminology: In the following, 'RSP' = GDB's Remote Serial Protocol
@@ -36,8 +43,33 @@ static int   verbosity = 0;
 
 static const char control_C = 0x3;
 
+// A ^C that arrived while we were waiting for an ack (GDB can send it
+// at any time, e.g. while we stream 'O' packets); delivered by the
+// next recv_RSP_packet_from_GDB ().
+static bool control_C_pending = false;
+
 static bool waiting_for_stop_reason = false;
 
+// Thread selected by 'Hg' (0 if none: the thread on the hart)
+static uint64_t general_thread = 0;
+
+// LLDB: list all threads and their PCs in stop replies
+static bool list_threads_in_stop_reply = false;
+
+static uint8_t last_stop_reason = 0;
+
+// Write combining: consecutive 'X' packets continue one SBA write
+// stream (gdbstub_be_mem_write_stream), which is flushed before any
+// other packet.  A bus error found by the flush is deferred: it is the
+// reply to the next packet that writes or reads memory, or resumes the
+// hart (see deferred_write_error).
+static bool write_combine       = true;
+static bool write_error_pending = false;
+
+// Watchpoint part of the last stop reply ("watch:addr;" etc.), or
+// "replaylog:begin;" (reverse execution reached the start of the log), or empty
+static char stop_reason_watch [64] = "";
+
 // ================================================================
 // Help functions to print byte strings for debugging.
 
@@ -135,6 +167,22 @@ void fprint_packet (FILE *fp, const char *pre, const char *buf, const size_t buf
 
 #define GDB_RSP_WIRE_BUF_MAX  ((GDB_RSP_PKT_BUF_MAX * 2) + 4)
 
+// ================================================================
+// Bytes from GDB are read in chunks, as many as are available, into
+// rx_buf, and consumed from there by recv_ack_nak () and
+// recv_RSP_packet_from_GDB ().  On a serial link an ack and the packet
+// after it then usually cost one read () instead of one per byte.
+
+static char   rx_buf [GDB_RSP_WIRE_BUF_MAX];
+static size_t rx_len = 0;
+
+// After QStartNoAckMode, neither side sends '+' or '-'
+static bool no_ack_mode = false;
+
+// The '+' for the last packet received, when it can wait for the reply
+// (see ack_may_wait): it then goes out in the same write () as the reply
+static char ack_pending = 0;
+
 // ================================================================
 // Copies GDB RSP chars from src to dst, escaping any chars as necessary.
 // Returns the actual number of chars copied into dst, -1 if error.
@@ -259,7 +307,8 @@ uint8_t gdb_checksum (const char *buf, const size_t size)
 //        n, index of char just after token, if token found
 //                (even if the token length is > DEST_MAX-1)
 // Return a copy of the token in dest, including a null-termination.
-//    (but only up to the the first DEST_MAX-1 chars of the token)
+//    (but only up to the the first DEST_MAX chars of the token,
+//     so dest must have room for DEST_MAX+1 chars)
 
 static
 size_t find_token (char *dest, const size_t DEST_MAX, const char *src, const size_t src_len)
@@ -278,7 +327,7 @@ size_t find_token (char *dest, const size_t DEST_MAX, const char *src, const siz
     // Token found; copy it
     while ((js < src_len)
 	   && ((src [js] != ' ') && (src [js] != '\t'))) {
-	if (jd < DEST_MAX + 1) {
+	if (jd < DEST_MAX) {
 	    dest [jd] = src [js];
 	    jd++;
 	}
@@ -288,6 +337,31 @@ size_t find_token (char *dest, const size_t DEST_MAX, const char *src, const siz
     return js;
 }
 
+// ================================================================
+// Parse the next whitespace-delimited token at *p_src as an unsigned
+// number (decimal, 0x hex or 0 octal, as with strtoull), and advance
+// *p_src past it.  Return false if it is missing, is not such a number,
+// or is greater than max.
+
+static
+bool find_number (const char **p_src, const uint64_t max, uint64_t *p_x)
+{
+    const char *src = *p_src;
+    char       *end;
+
+    while ((*src == ' ') || (*src == '\t'))
+	src++;
+    if (! isdigit ((unsigned char) *src))    // also rejects a sign
+	return false;
+    errno = 0;
+    uint64_t x = strtoull (src, & end, 0);
+    if ((errno != 0) || (x > max) || ((*end != 0) && (*end != ' ') && (*end != '\t')))
+	return false;
+    *p_x    = x;
+    *p_src  = end;
+    return true;
+}
+
 // ================================================================
 // Send '+' (ack) or '-' (nak) to GDB
 // Return 0 if ok, -1 if err
@@ -325,6 +399,45 @@ int send_ack_nak (char ack_char)
     }
 }
 
+// ================================================================
+// Send the pending ack, if any, by itself
+
+static
+void flush_ack (void)
+{
+    if (ack_pending != 0) {
+	char ack_char = ack_pending;
+	ack_pending = 0;
+	send_ack_nak (ack_char);
+    }
+}
+
+// ================================================================
+// Read as many bytes as are available (and fit) into rx_buf.
+// Returns as read ().
+
+static
+ssize_t rx_fill (void)
+{
+    if (rx_len == GDB_RSP_WIRE_BUF_MAX) {
+	errno = EAGAIN;
+	return -1;
+    }
+    ssize_t n = read (gdb_fd, & (rx_buf [rx_len]), (GDB_RSP_WIRE_BUF_MAX - rx_len));
+    if (n > 0)
+	rx_len += (size_t) n;
+    return n;
+}
+
+// Drop the first n bytes of rx_buf
+
+static
+void rx_consume (const size_t n)
+{
+    memmove (rx_buf, & (rx_buf [n]), rx_len - n);
+    rx_len -= n;
+}
+
 // ================================================================
 // Receive '+' (ack) or '-' (nak) from GDB
 // Return '+' if ack, '-' if nak, 'E' if err
@@ -334,11 +447,16 @@ char recv_ack_nak (void)
 {
     const size_t n_iters_max = 1000000;
     size_t n_iters = 0;
-    char ack_char;
     while (true) {
-	ssize_t n = read (gdb_fd, & ack_char, 1);
-	if (n < 0) {
-	    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+	if (rx_len == 0) {
+	    ssize_t n = rx_fill ();
+	    if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		if (logfile) {
+		    fprintf (logfile, "ERROR: gdbstub_fe.recv_ack_nak: read () failed\n");
+		}
+		return 'E';
+	    }
+	    else if (n <= 0) {
 		// Nothing available yet
 		if (n_iters > n_iters_max) {
 		    if (logfile) {
@@ -347,28 +465,16 @@ char recv_ack_nak (void)
 		    }
 		    return 'E';
 		}
-		else {
-		    usleep (5);
-		    n_iters++;
-		}
-	    }
-	    else {
-		if (logfile) {
-		    fprintf (logfile, "ERROR: gdbstub_fe.recv_ack_nak: read () failed\n");
-		}
-		return 'E';
+		usleep (5);
+		n_iters++;
 	    }
+	    continue;
 	}
-	else if (n == 0) {
-	    if (n_iters > n_iters_max) {
-		if (logfile) {
-		    fprintf (logfile, "ERROR: gdbstub_fe.recv_ack_nak: nothing received in %0zu read () attempts\n",
-			     n_iters_max);
-		}
-		return 'E';
-	    }
-	    usleep (5);
-	    n_iters++;
+
+	char ack_char = rx_buf [0];
+	rx_consume (1);
+	if (ack_char == control_C) {
+	    control_C_pending = true;
 	}
 	else if ((ack_char == '+') || (ack_char == '-')) {
 	    if (logfile) {
@@ -408,48 +514,11 @@ uint8_t value_of_hex_digit (char ch)
 }
 
 // ================================================================
-// Convert a value (upto 64-bits) into ASCII hex digits (2 digits per byte)
-// in little-endian order.  'buf' must be at least:
-//     2 chars if gdbstub_be_word_size_bits =  8
-//     4 chars if gdbstub_be_word_size_bits = 16
-//     8 chars if gdbstub_be_word_size_bits = 32
-//    16 chars if gdbstub_be_word_size_bits = 64
+// Hex digits, for val_to_hex_rv32/64 (below)
 
 static
 const char hexchars[] = "0123456789abcdef";
 
-static
-void val_to_hex16 (const uint64_t val, const uint8_t xlen, char *buf)
-{
-    assert ((xlen == 8)
-	    || (xlen == 16)
-	    || (xlen == 32)
-	    || (xlen == 64));
-
-    buf[0]  = hexchars [(val >>  4) & 0xF];
-    buf[1]  = hexchars [(val >>  0) & 0xF];
-    if (xlen == 8) return;
-
-    buf[2]  = hexchars [(val >> 12) & 0xF];
-    buf[3]  = hexchars [(val >>  8) & 0xF];
-    if (xlen == 16) return;
-
-    buf[4]  = hexchars [(val >> 20) & 0xF];
-    buf[5]  = hexchars [(val >> 16) & 0xF];
-    buf[6]  = hexchars [(val >> 28) & 0xF];
-    buf[7]  = hexchars [(val >> 24) & 0xF];
-    if (xlen == 32) return;
-
-    buf[8]  = hexchars [(val >> 36) & 0xF];
-    buf[9]  = hexchars [(val >> 32) & 0xF];
-    buf[10] = hexchars [(val >> 44) & 0xF];
-    buf[11] = hexchars [(val >> 40) & 0xF];
-    buf[12] = hexchars [(val >> 52) & 0xF];
-    buf[13] = hexchars [(val >> 48) & 0xF];
-    buf[14] = hexchars [(val >> 60) & 0xF];
-    buf[15] = hexchars [(val >> 56) & 0xF];
-}
-
 // ================================================================
 // Convert ASCII hex digits (2 digits per byte) into a value (upto 64-bits)
 // in little-endian order.  'buf' must be at least:
@@ -490,6 +559,54 @@ uint32_t hex16_to_val (const char *buf, const uint8_t xlen, uint64_t *p_val)
     return status_ok;
 }
 
+// ================================================================
+// Convert a value into XLEN/4 ASCII hex digits (2 digits per byte) in
+// little-endian order, and back: one version per XLEN, for the register
+// packets.  A handler picks the codec for the current XLEN once, with
+// hex_codec (), instead of testing xlen for every register.
+
+#define DEFINE_HEX_CODEC(XLEN)						\
+    static								\
+    void val_to_hex_rv ## XLEN (const uint64_t val, char *buf)		\
+    {									\
+	for (int j = 0; j < ((XLEN) / 8); j++) {			\
+	    buf [2 * j]       = hexchars [(val >> ((8 * j) + 4)) & 0xF]; \
+	    buf [(2 * j) + 1] = hexchars [(val >> (8 * j)) & 0xF];	\
+	}								\
+    }									\
+									\
+    static								\
+    uint32_t hex_to_val_rv ## XLEN (const char *buf, uint64_t *p_val) \
+    {									\
+	uint64_t val = 0;						\
+	for (int j = 0; j < ((XLEN) / 8); j++) {			\
+	    if ((! isxdigit (buf [2 * j])) || (! isxdigit (buf [(2 * j) + 1]))) \
+		return status_err;					\
+	    val |= ((uint64_t) value_of_hex_digit (buf [2 * j])) << ((8 * j) + 4); \
+	    val |= ((uint64_t) value_of_hex_digit (buf [(2 * j) + 1])) << (8 * j); \
+	}								\
+	*p_val = val;							\
+	return status_ok;						\
+    }
+
+DEFINE_HEX_CODEC (32)
+DEFINE_HEX_CODEC (64)
+
+typedef struct {
+    size_t     n_hex_digits;
+    void     (*val_to_hex) (const uint64_t val, char *buf);
+    uint32_t (*hex_to_val) (const char *buf, uint64_t *p_val);
+} Hex_Codec;
+
+static const Hex_Codec hex_codec_rv32 = {  8, val_to_hex_rv32, hex_to_val_rv32 };
+static const Hex_Codec hex_codec_rv64 = { 16, val_to_hex_rv64, hex_to_val_rv64 };
+
+static inline
+const Hex_Codec *hex_codec (const uint8_t xlen)
+{
+    return ((xlen == 32) ? (& hex_codec_rv32) : (& hex_codec_rv64));
+}
+
 // ================================================================
 // Convert 'len' hex digits (2 per byte) in 'src' into bytes in 'dest'
 
@@ -509,6 +626,18 @@ void hex2bin (char *dest, const char *src, size_t len)
     }
 }
 
+// ================================================================
+// Byte source (for gdbstub_be_mem_write_src) for hex digits, 2 per byte
+
+static
+void hex_byte_src_get (BE_Byte_Src *src, uint8_t *dest, const size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+	dest [j] = (uint8_t) ((value_of_hex_digit (src->p [0]) << 4) | value_of_hex_digit (src->p [1]));
+	src->p += 2;
+    }
+}
+
 // ================================================================
 // Convert 'len' bytes in 'src' into hex digits (2 per byte) in 'dest'
 
@@ -537,7 +666,9 @@ void bin2hex (char *dest, const char *src, size_t len)
 static
 uint32_t send_RSP_packet_to_GDB (const char *buf, const size_t buf_len)
 {
-    char wire_buf [GDB_RSP_WIRE_BUF_MAX];
+    // wire_buf [0] is for a pending ack, sent along with the packet
+    char  wire_buf_ack [GDB_RSP_WIRE_BUF_MAX + 1];
+    char *wire_buf = & (wire_buf_ack [1]);
 
     wire_buf [0] = '$';
 
@@ -562,11 +693,22 @@ uint32_t send_RSP_packet_to_GDB (const char *buf, const size_t buf_len)
     wire_buf [wire_len + 3] = ckstr [1];
 
     while (true) {
-	// Write the packet out to GDB
+	// Write the packet (and the pending ack, if any) out to GDB
+	char  *out     = wire_buf;
+	size_t out_len = wire_len + 4;
+	if (ack_pending != 0) {
+	    wire_buf_ack [0] = ack_pending;
+	    ack_pending = 0;
+	    out--;
+	    out_len++;
+	    if (logfile) {
+		fprintf (logfile, "w %c\n", wire_buf_ack [0]);
+	    }
+	}
 	size_t n_sent = 0;
 	size_t n_iters = 0;
-	while (n_sent < (wire_len + 4)) {
-	    ssize_t n = write (gdb_fd, & (wire_buf [n_sent]), (wire_len + 4 - n_sent));
+	while (n_sent < out_len) {
+	    ssize_t n = write (gdb_fd, & (out [n_sent]), (out_len - n_sent));
 	    if (n < 0) {
 		if (logfile) {
 		    fprintf (logfile, "ERROR: gdbstub_fe.send_RSP_packet_to_GDB: write (wire_buf) failed\n");
@@ -593,6 +735,9 @@ uint32_t send_RSP_packet_to_GDB (const char *buf, const size_t buf_len)
 	    fprint_bytes (logfile, "w ", wire_buf, wire_len + 4, "\n");
 	}
 
+	if (no_ack_mode)
+	    return status_ok;
+
 	// Receive '+' (ack) or '-' (nak) from GDB
 	char ch = recv_ack_nak ();
 	if (ch == '+')
@@ -615,6 +760,19 @@ uint32_t send_RSP_packet_to_GDB (const char *buf, const size_t buf_len)
     return status_err;
 }
 
+// ================================================================
+// Whether the ack for a received packet can wait, to go out with the
+// reply: only for packets whose handlers reply promptly, since GDB
+// retransmits if the ack is slow to come.
+
+static
+bool ack_may_wait (const char *buf)
+{
+    if ((buf [0] == 0) || (strncmp (buf, "qRcmd", strlen ("qRcmd")) == 0))
+	return false;
+    return (strchr ("?gGHmMpPqTxXzZ", buf [0]) != NULL);
+}
+
 // ================================================================
 // Receive a GDB RSP packet from GDB ("$....#xx")
 // Since packets are of varying length, arrive as characters serially,
@@ -639,15 +797,27 @@ uint32_t send_RSP_packet_to_GDB (const char *buf, const size_t buf_len)
 static
 ssize_t recv_RSP_packet_from_GDB (char *buf, const size_t buf_size)
 {
-    // The sliding window
-    static char wire_buf [GDB_RSP_WIRE_BUF_MAX];
-    static size_t free_ptr = 0;
+    // The sliding window is rx_buf [0 .. rx_len)
+    char *wire_buf = rx_buf;
 
     // Invariant: all chars [0..] are relevant.
     // Established by moving relevant chars down to [0..] before returning.
     // Specifically, [0] contains the '$' of the next packet.
 
-    ssize_t n;
+    ssize_t n = 0;
+
+    // The ack for the previous packet, if its reply did not take it
+    flush_ack ();
+
+    if (control_C_pending && (buf_size >= 2)) {
+	control_C_pending = false;
+	if (logfile) {
+	    fprintf (logfile, "r \\x%02x (while waiting for an ack)\n", control_C);
+	}
+	buf [0] = control_C;
+	buf [1] = 0;
+	return 1;
+    }
 
     fd_set rfds, wfds, efds;
 
@@ -664,7 +834,8 @@ ssize_t recv_RSP_packet_from_GDB (char *buf, const size_t buf_size)
 	}
     }
 
-    int timeout = 1; // ms
+    // Don't wait if there are bytes to look at already
+    int timeout = ((rx_len == 0) ? 1 : 0); // ms
     struct timeval tv;
     tv.tv_sec = timeout / 1000;
     tv.tv_usec = (timeout % 1000) * 1000;
@@ -673,7 +844,7 @@ ssize_t recv_RSP_packet_from_GDB (char *buf, const size_t buf_size)
 	if (stop_fd >= 0 && FD_ISSET(stop_fd, &rfds)) {
 	    return -2;
 	}
-	n = read (gdb_fd, & (wire_buf [free_ptr]), (GDB_RSP_WIRE_BUF_MAX - free_ptr));
+	n = rx_fill ();
 	if (n < 0) {
 	    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
 		// Nothing available
@@ -692,21 +863,18 @@ ssize_t recv_RSP_packet_from_GDB (char *buf, const size_t buf_size)
 	    }
 	    return -1;
 	}
-	else {
-	    free_ptr += (size_t) n;
-	}
     }
 
     // Scan for the starting '$' of the packet, or ^C
     size_t start = 0;
-    while ((wire_buf [start] != '$') && (wire_buf [start] != control_C) && (start < free_ptr)) {
+    while ((wire_buf [start] != '$') && (wire_buf [start] != control_C) && (start < rx_len)) {
 	start++;
     }
 
     if (DEBUG_recv_RSP_packet_from_GDB && logfile) {
 	fprintf (logfile,
-		"recv_RSP_packet_from_GDB:DBG: free_ptr=%zu, n=%zd, start=%zu\n",
-		free_ptr, n, start);
+		"recv_RSP_packet_from_GDB:DBG: rx_len=%zu, n=%zd, start=%zu\n",
+		rx_len, n, start);
     }
 
     // discard garbage before packet, if any
@@ -717,18 +885,18 @@ ssize_t recv_RSP_packet_from_GDB (char *buf, const size_t buf_size)
 	    fprint_bytes (logfile, "    [", wire_buf, start, "]\n");
 	}
 
-	memmove (wire_buf, & (wire_buf [start]), free_ptr - start);
-	free_ptr -= start;
+	memmove (wire_buf, & (wire_buf [start]), rx_len - start);
+	rx_len -= start;
     }
 
-    if (free_ptr == 0) {
+    if (rx_len == 0) {
 	// no '$' or '^C' found
 	return 0;
     }
 
     // Debug:
     if (DEBUG_recv_RSP_packet_from_GDB && logfile) {
-	fprint_bytes (logfile, "recv_RSP_packet_from_GDB:DBG: ", wire_buf, (free_ptr-1), "\n");
+	fprint_bytes (logfile, "recv_RSP_packet_from_GDB:DBG: ", wire_buf, (rx_len-1), "\n");
     }
     // Check for ^C
     if (wire_buf [0] == control_C) {
@@ -748,8 +916,8 @@ ssize_t recv_RSP_packet_from_GDB (char *buf, const size_t buf_size)
 	}
 
 	// Discard the packet
-	memmove (wire_buf, & (wire_buf [1]), (free_ptr - 1));
-	free_ptr--;
+	memmove (wire_buf, & (wire_buf [1]), (rx_len - 1));
+	rx_len--;
 
 	buf [0] = control_C;
 	buf [1] = 0;
@@ -761,14 +929,14 @@ ssize_t recv_RSP_packet_from_GDB (char *buf, const size_t buf_size)
     // Scan for the ending '#' of the packet from [1] onwards
     size_t end = 1;
     while (wire_buf [end] != '#') {
-	if (end == (free_ptr - 1))
+	if (end == (rx_len - 1))
 	    return 0;
 	end++;
     }
     // assert (wire_buf [end]  == '#');
 
     // Check if we've received the two checksum chars after '#'
-    if ((free_ptr - end) < 3) {
+    if ((rx_len - end) < 3) {
 	// not yet
 	return 0;
     }
@@ -809,13 +977,19 @@ ssize_t recv_RSP_packet_from_GDB (char *buf, const size_t buf_size)
 	ret = gdb_unescape (buf, buf_size, & (wire_buf [1]), (end - 1));
     }
 
-    n = send_ack_nak (ack_char);
+    if (no_ack_mode)
+	n = 0;
+    else if ((ack_char == '+') && ack_may_wait (buf)) {
+	ack_pending = ack_char;
+	n = 0;
+    }
+    else
+	n = send_ack_nak (ack_char);
     if (n < 0)
 	ret = -1;
 
     // Discard the packet
-    memmove (wire_buf, & (wire_buf [end]), (free_ptr - (end + 3)));
-    free_ptr -= (end + 3);
+    rx_consume (end + 3);
 
     return ret;
 }
@@ -843,15 +1017,179 @@ void send_OK_or_error_response (uint32_t status)
     }
 }
 
+// ================================================================
+// Read register 'regnum' (GPR or PC) of thread 'tid'.
+// The thread on the hart is read from the hart (via the back end's
+// per-stop register snapshot); other RTOS threads from their saved context.
+
+static
+uint32_t hart_reg_read (const uint32_t regnum, uint64_t *p_val)
+{
+    if (regnum == 0x20)
+	return gdbstub_be_PC_read (gdbstub_be_xlen (), p_val);
+    return gdbstub_be_GPR_read (gdbstub_be_xlen (), (uint8_t) regnum, p_val);
+}
+
+static
+uint32_t thread_reg_read (const uint64_t tid, const uint32_t regnum, uint64_t *p_val)
+{
+    if (! gdbstub_rtos_active (gdbstub_be_xlen ())) {
+	// Each hart is a thread: select it for the read if need be
+	uint32_t hart   = gdbstub_be_selected_hart ();
+	uint32_t status = gdbstub_be_select_hart ((uint32_t) (tid - RTOS_THREAD_ID_HART));
+	if (status == status_ok)
+	    status = hart_reg_read (regnum, p_val);
+	gdbstub_be_select_hart (hart);
+	return status;
+    }
+    if (tid == gdbstub_rtos_current_thread (gdbstub_be_xlen ()))
+	return hart_reg_read (regnum, p_val);
+    return gdbstub_rtos_thread_reg_read (gdbstub_be_xlen (), tid, regnum, p_val);
+}
+
+// Registers sent along with stop replies and jThreadsInfo (PC, sp,
+// fp, ra), so that the debugger need not ask for them separately
+
+static const uint8_t expedited_regs [] = { 0x20, 2, 8, 1 };
+
+#define NUM_EXPEDITED_REGS  (sizeof (expedited_regs) / sizeof (expedited_regs [0]))
+
+// ================================================================
+// Format a stop-reason response for thread 'tid' into buf:
+//     'T' signal 'thread:' tid ';' { regnum ':' value ';' }
+// Returns the length.
+
+static
+size_t fmt_stop_reason (char *buf, const size_t buf_size, const uint8_t stop_reason, const uint64_t tid)
+{
+    const Hex_Codec *codec = hex_codec (gdbstub_be_xlen ());
+    const size_t num_ASCII_hex_digits = codec->n_hex_digits;
+
+    size_t n = (size_t) snprintf (buf, buf_size, "T%02xthread:%" PRIx64 ";%s",
+				  stop_reason, tid, stop_reason_watch);
+    for (size_t j = 0; j < NUM_EXPEDITED_REGS; j++) {
+	uint64_t value;
+	if ((n + 4 + num_ASCII_hex_digits) >= buf_size)
+	    break;
+	if (thread_reg_read (tid, expedited_regs [j], & value) != status_ok)
+	    continue;
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "%02x:", expedited_regs [j]);
+	codec->val_to_hex (value, & (buf [n]));
+	n += num_ASCII_hex_digits;
+	buf [n++] = ';';
+    }
+    buf [n] = 0;
+    return n;
+}
+
+// ================================================================
+// Append 'threads:' and 'thread-pcs:' (LLDB QListThreadsInStopReply) to buf.
+// Returns the new length; nothing is appended if it doesn't fit.
+
+static
+size_t append_threads_to_stop_reason (char *buf, const size_t buf_size, const size_t n0)
+{
+    static uint64_t ids [1024];
+    uint32_t        n_ids;
+    size_t          n = n0;
+
+    gdbstub_rtos_thread_ids (gdbstub_be_xlen (), ids, 1024, & n_ids);
+
+    n += (size_t) snprintf (& (buf [n]), buf_size - n, "threads:");
+    for (uint32_t j = 0; (j < n_ids) && (n < buf_size); j++)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "%s%" PRIx64, ((j == 0) ? "" : ","), ids [j]);
+    if (n < buf_size)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, ";thread-pcs:");
+    for (uint32_t j = 0; (j < n_ids) && (n < buf_size); j++) {
+	uint64_t pc = 0;
+	thread_reg_read (ids [j], 0x20, & pc);
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "%s%" PRIx64, ((j == 0) ? "" : ","), pc);
+    }
+    if (n < buf_size)
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, ";");
+
+    if (n >= buf_size) {
+	buf [n0] = 0;
+	return n0;
+    }
+    return n;
+}
+
 // ================================================================
 // Send a stop-reason response packet to GDB
 
 static
 void send_stop_reason (const uint8_t stop_reason)
 {
-    char response [8];
-    snprintf (response, 8, "T%02x", stop_reason);
-    send_RSP_packet_to_GDB (response, strlen (response));
+    char response [GDB_RSP_PKT_BUF_MAX];
+    last_stop_reason = stop_reason;
+
+    // Read all GPRs and the PC once, into the back end's per-stop snapshot
+    uint64_t GPR_vals [32], PC_val;
+    gdbstub_be_GPRs_read (gdbstub_be_xlen (), GPR_vals);
+    gdbstub_be_PC_read (gdbstub_be_xlen (), & PC_val);
+
+    uint64_t tid = gdbstub_rtos_current_thread (gdbstub_be_xlen ());
+    size_t   n   = fmt_stop_reason (response, GDB_RSP_PKT_BUF_MAX, stop_reason, tid);
+    if (list_threads_in_stop_reply)
+	n = append_threads_to_stop_reason (response, GDB_RSP_PKT_BUF_MAX, n);
+    send_RSP_packet_to_GDB (response, n);
+}
+
+// ================================================================
+// Called whenever the hart is about to run, or target state is written:
+// cached RTOS task lists are no longer valid
+
+static
+void target_state_changed (bool resuming)
+{
+    gdbstub_rtos_invalidate ();
+    if (resuming) {
+	general_thread = 0;
+	stop_reason_watch [0] = 0;
+    }
+}
+
+// ================================================================
+// Called just before the hart is resumed with 'continue'
+
+static
+void prepare_to_run (void)
+{
+    target_state_changed (true);
+    if (gdbstub_watch_emulating ())
+	gdbstub_watch_arm (gdbstub_be_xlen ());
+}
+
+// ================================================================
+// Called when the hart has halted: if a watchpoint caused it, note it
+// for the stop reply.  Returns true in that case.
+
+static
+bool note_watch_hit (void)
+{
+    uint32_t type;
+    uint64_t addr;
+    if (! gdbstub_watch_hit (gdbstub_be_xlen (), & type, & addr))
+	return false;
+    snprintf (stop_reason_watch, sizeof (stop_reason_watch), "%swatch:%" PRIx64 ";",
+	      ((type == WATCH_Z_READ) ? "r" : ((type == WATCH_Z_ACCESS) ? "a" : "")),
+	      addr);
+    return true;
+}
+
+// ================================================================
+// The RTOS thread whose registers 'g' and 'p' refer to, if it is not
+// the one running on the hart (0 otherwise)
+
+static
+uint64_t selected_saved_thread (void)
+{
+    if ((general_thread == 0) || (! gdbstub_rtos_active (gdbstub_be_xlen ())))
+	return 0;
+    if (general_thread == gdbstub_rtos_current_thread (gdbstub_be_xlen ()))
+	return 0;
+    return general_thread;
 }
 
 // ================================================================
@@ -860,7 +1198,7 @@ void send_stop_reason (const uint8_t stop_reason)
 static
 void handle_RSP_control_C (const char *buf, const size_t buf_len)
 {
-    uint32_t status = gdbstub_be_stop (gdbstub_be_xlen);
+    uint32_t status = gdbstub_be_stop (gdbstub_be_xlen ());
     if (status != status_ok) {
 	send_OK_or_error_response (status_err);
 	return;
@@ -875,7 +1213,7 @@ static
 void handle_RSP_stop_reason (const char *buf, const size_t buf_len)
 {
     uint8_t stop_reason;
-    int32_t sr = gdbstub_be_get_stop_reason (gdbstub_be_xlen, & stop_reason, false);
+    int32_t sr = gdbstub_be_get_stop_reason (gdbstub_be_xlen (), & stop_reason, false);
     if (sr == 0) {
         send_stop_reason (stop_reason);
         waiting_for_stop_reason = false;
@@ -894,6 +1232,88 @@ void handle_RSP_stop_reason (const char *buf, const size_t buf_len)
     }
 }
 
+// ================================================================
+// Execution recording (gdbstub_record.h).
+// While it is on, the hart is run forward by the stub, one recorded
+// step at a time, and the stop is reported right away.
+
+// Called now and then while the stub runs the hart: has GDB sent a ^C?
+
+static
+bool record_preempted (void)
+{
+    char buf [GDB_RSP_PKT_BUF_MAX];
+
+    if (! gdbstub_be_poll_preempt (true))
+	return false;
+    ssize_t sn = recv_RSP_packet_from_GDB (buf, GDB_RSP_PKT_BUF_MAX);
+    if (sn < 0)
+	return true;
+    else if ((sn > 0) && (buf [0] == control_C))
+	return true;
+    else if ((sn > 0) && logfile) {
+	fprintf (logfile, "WARNING: gdbstub_fe.record_preempted: ignoring packet while running: ");
+	fprint_bytes (logfile, "", buf, (size_t) sn - 1, "\n");
+    }
+    return false;
+}
+
+static
+void send_record_stop_reason (Record_Stop stop, uint8_t stop_reason, uint64_t watch_addr)
+{
+    if (stop == RECORD_STOP_HALT) {
+	if (note_watch_hit ())
+	    stop_reason = 0x05;
+    }
+    else if (stop == RECORD_STOP_WATCH)
+	snprintf (stop_reason_watch, sizeof (stop_reason_watch), "watch:%" PRIx64 ";", watch_addr);
+    else if (stop == RECORD_STOP_BEGIN)
+	snprintf (stop_reason_watch, sizeof (stop_reason_watch), "replaylog:begin;");
+    send_stop_reason (stop_reason);
+}
+
+static
+void record_run (Record_Run run, uint64_t start, uint64_t end)
+{
+    Record_Stop stop;
+    uint8_t     stop_reason;
+    uint64_t    watch_addr;
+
+    target_state_changed (true);
+    uint32_t status = gdbstub_record_run (gdbstub_be_xlen (), run, start, end,
+					  & stop, & stop_reason, & watch_addr);
+    if (status != status_ok) {
+	send_OK_or_error_response (status);
+	return;
+    }
+    send_record_stop_reason (stop, stop_reason, watch_addr);
+}
+
+// ================================================================
+// 'bs', 'bc': respond to '$bs' and '$bc' packets received from GDB
+// (reverse step, reverse continue), from the execution recording.
+// Without one, there is no history to go back into.
+
+static
+void handle_RSP_b_reverse (const char *buf, const size_t buf_len)
+{
+    Record_Stop stop;
+    uint64_t    watch_addr;
+
+    if ((strcmp (buf, "bs") != 0) && (strcmp (buf, "bc") != 0)) {
+	send_RSP_packet_to_GDB ("", 0);
+	return;
+    }
+
+    target_state_changed (true);
+    uint32_t status = gdbstub_record_reverse (gdbstub_be_xlen (), (buf [1] == 'c'), & stop, & watch_addr);
+    if (status != status_ok) {
+	send_OK_or_error_response (status);
+	return;
+    }
+    send_record_stop_reason (stop, ((stop == RECORD_STOP_INTERRUPT) ? 0x02 : 0x05), watch_addr);
+}
+
 // ================================================================
 // 'c': respond to '$c [addr]' packet received from GDB (continue)
 // addr is resume-PC, and is optional; if missing, resume from current PC
@@ -909,7 +1329,7 @@ void handle_RSP_c_continue (const char *buf, const size_t buf_len)
     }
     // "c addr": parse the PC value
     else if (1 == sscanf (buf, "c%" SCNx64 "", & PC_val)) {
-	gdbstub_be_PC_write (gdbstub_be_xlen, PC_val);
+	gdbstub_be_PC_write (gdbstub_be_xlen (), PC_val);
     }
     else {
 	// Neither "c" nor "c addr"
@@ -917,8 +1337,14 @@ void handle_RSP_c_continue (const char *buf, const size_t buf_len)
 	return;
     }
 
+    if (gdbstub_record_active ()) {
+	record_run (RECORD_RUN_CONTINUE, 0, 0);
+	return;
+    }
+
     // Send 'continue' command to HW side
-    status = gdbstub_be_continue (gdbstub_be_xlen);
+    prepare_to_run ();
+    status = gdbstub_be_continue (gdbstub_be_xlen ());
     if (status != status_ok) {
 	send_OK_or_error_response (status);
 	return;
@@ -934,58 +1360,347 @@ void handle_RSP_c_continue (const char *buf, const size_t buf_len)
 static
 void handle_RSP_shutdown (const char *buf, const size_t buf_len)
 {
-    uint32_t status = gdbstub_be_final (gdbstub_be_xlen);
+    uint32_t status = gdbstub_be_final (gdbstub_be_xlen ());
     send_OK_or_error_response (status);
 }
 
 // ================================================================
-// 'g': respond to '$g' packet received from GDB (read all regs)
-
-// Returns RISC-V regs in the following sequence:
-//     GPRs:  0..0x1F
-//     PC:   0x20
-//     FPRs: 0x21..0x40
+// '!': extended mode (GDB's 'target extended-remote'), which enables 'R' and 'vRun'
 
 static
-void handle_RSP_g_read_all_registers (const char *buf, const size_t buf_len)
+void handle_RSP_extended_mode (const char *buf, const size_t buf_len)
 {
-    uint32_t     status;
-    uint64_t     value;
-    char         response [33 * 16];
-    const size_t num_ASCII_hex_digits = gdbstub_be_xlen / (8 / 2);
+    send_OK_or_error_response (status_ok);
+}
 
-    // GPRs
-    uint8_t j;
-    for (j = 0; j < 32; j++) {
-	status = gdbstub_be_GPR_read (gdbstub_be_xlen, j, & value);
-	if (status != status_ok) {
-	    send_OK_or_error_response (status_err);
-	    return;
-	}
-	val_to_hex16 (value, gdbstub_be_xlen, & (response [j * num_ASCII_hex_digits]));
-    }
+// ================================================================
+// Restart the program inside the stub: reset, reload the ELF file and
+// set the PC to its entry point, without GDB having to reconnect.
 
-    // PC
-    status = gdbstub_be_PC_read (gdbstub_be_xlen, & value);
-    if (status != status_ok) {
-	send_OK_or_error_response (status_err);
-	return;
-    }
-    val_to_hex16 (value, gdbstub_be_xlen, & (response [32 * num_ASCII_hex_digits]));
+static
+uint32_t restart (const char *elf_filename)
+{
+    if (gdbstub_trace_running ())
+	gdbstub_trace_stop (gdbstub_be_xlen ());
+    gdbstub_trace_unselect_frame ();
+    if (gdbstub_record_active ())
+	gdbstub_record_stop ();
+    target_state_changed (true);
+    waiting_for_stop_reason = false;
+
+    return gdbstub_be_restart (gdbstub_be_xlen (), elf_filename);
+}
 
-    // TODO: FPRs
+// 'R': respond to '$R XX' packet received from GDB (restart; XX is ignored).
+// 'R' has no reply.
 
-    // Send assembled response
-    send_RSP_packet_to_GDB (response, 33 * num_ASCII_hex_digits);
+static
+void handle_RSP_R_restart (const char *buf, const size_t buf_len)
+{
+    restart (NULL);
 }
 
 // ================================================================
-// 'G': respond to '$Gxx...' packet received from GDB (write all regs)
-
-// 'xx...' contains RISC-V reg values in the following sequence:
-//     GPRs:  0..0x1F
-//     PC:   0x20
-//     FPRs: 0x21..0x40
+// 'vCont': respond to '$vCont;action[:thread-id];...' packet
+// Actions: c, Csig (continue), s, Ssig (step), t (stop), r start,end
+// (step while the PC is in [start, end)).  Signals are not delivered.
+// Each hart takes the leftmost action that applies to it.  Without an
+// RTOS, threads are harts; with one, all its threads are on the
+// selected hart.  All the harts that are to step or continue are
+// resumed together (gdbstub_be_harts_resume), as a group.
+
+// Range stepping in progress: the hart is stepped again, without
+// telling GDB, while its PC is in [range_start, range_end).
+static bool     range_stepping = false;
+static uint32_t range_hart;
+static uint64_t range_start, range_end;
+static uint32_t range_step_mask, range_run_mask;
+
+static
+void handle_RSP_vCont (const char *buf, const size_t buf_len)
+{
+    if (strcmp (buf, "vCont?") == 0) {
+	const char *response = "vCont;c;C;s;S;t;r";
+	send_RSP_packet_to_GDB (response, strlen (response));
+	return;
+    }
+
+    const uint32_t n_harts    = gdbstub_be_num_harts ();
+    const bool     rtos       = gdbstub_rtos_active (gdbstub_be_xlen ());
+    const uint32_t all_harts  = ((n_harts >= 32) ? 0xFFFFFFFF : ((1u << n_harts) - 1));
+    uint32_t       undecided  = all_harts;
+    uint32_t       step_mask  = 0;
+    uint32_t       run_mask   = 0;
+    uint32_t       stop_mask  = 0;
+    bool           range      = false;
+    uint64_t       r_start = 0, r_end = 0;
+
+    const char *p = & (buf [strlen ("vCont")]);
+    while (*p == ';') {
+	p++;
+	char     action = *p++;
+	uint64_t start  = 0;
+	uint64_t end    = 0;
+	char    *q;
+
+	// Signal or range arguments
+	if ((action == 'C') || (action == 'S')) {
+	    strtoul (p, & q, 16);
+	    p = q;
+	}
+	else if (action == 'r') {
+	    start = strtoull (p, & q, 16);
+	    if (*q != ',') {
+		send_OK_or_error_response (status_err);
+		return;
+	    }
+	    end = strtoull (q + 1, & q, 16);
+	    p = q;
+	}
+	else if ((action != 'c') && (action != 's') && (action != 't')) {
+	    send_OK_or_error_response (status_err);
+	    return;
+	}
+
+	// Which harts it applies to
+	uint32_t harts = undecided;
+	if (*p == ':') {
+	    p++;
+	    if (strncmp (p, "-1", 2) == 0)
+		p += 2;
+	    else {
+		uint64_t tid = strtoull (p, & q, 16);
+		p = q;
+		if (rtos)
+		    harts &= (1u << gdbstub_be_selected_hart ());
+		else if ((tid >= RTOS_THREAD_ID_HART) && ((tid - RTOS_THREAD_ID_HART) < n_harts))
+		    harts &= (1u << (tid - RTOS_THREAD_ID_HART));
+		else
+		    harts = 0;
+	    }
+	}
+	undecided &= (~ harts);
+
+	if ((action == 'c') || (action == 'C'))
+	    run_mask |= harts;
+	else if ((action == 's') || (action == 'S'))
+	    step_mask |= harts;
+	else if (action == 't')
+	    stop_mask |= harts;
+	else if (harts != 0) {
+	    // 'r': only one hart can be range-stepped
+	    if (range || ((harts & (harts - 1)) != 0)) {
+		send_OK_or_error_response (status_err);
+		return;
+	    }
+	    range   = true;
+	    r_start = start;
+	    r_end   = end;
+	    for (range_hart = 0; ! ((harts >> range_hart) & 1); range_hart++)
+		;
+	    step_mask |= harts;
+	}
+    }
+    if ((*p != 0) || ((step_mask | run_mask) == 0)) {
+	// Malformed, or nothing to resume (we are in all-stop mode)
+	send_OK_or_error_response (status_err);
+	return;
+    }
+
+    if (logfile) {
+	fprintf (logfile, "vCont: step 0x%0x, run 0x%0x, stop 0x%0x", step_mask, run_mask, stop_mask);
+	if (range)
+	    fprintf (logfile, ", range-step hart %0d in [0x%0" PRIx64 ", 0x%0" PRIx64 ")",
+		     range_hart, r_start, r_end);
+	fprintf (logfile, "\n");
+    }
+
+    // While recording, only the selected hart runs (the others stay halted)
+    if (gdbstub_record_active ()) {
+	uint32_t hart = gdbstub_be_selected_hart ();
+	if (range && (range_hart == hart))
+	    record_run (RECORD_RUN_RANGE, r_start, r_end);
+	else if ((step_mask >> hart) & 1)
+	    record_run (RECORD_RUN_STEP, 0, 0);
+	else if ((run_mask >> hart) & 1)
+	    record_run (RECORD_RUN_CONTINUE, 0, 0);
+	else
+	    send_OK_or_error_response (status_err);
+	return;
+    }
+
+    if (run_mask != 0)
+	prepare_to_run ();
+    else
+	target_state_changed (true);
+
+    uint32_t status = gdbstub_be_harts_resume (gdbstub_be_xlen (), step_mask, run_mask);
+    if (status != status_ok) {
+	send_OK_or_error_response (status);
+	return;
+    }
+
+    range_stepping  = range;
+    range_start     = r_start;
+    range_end       = r_end;
+    range_step_mask = step_mask;
+    range_run_mask  = run_mask;
+
+    // Go into 'waiting for stop-reason' mode
+    waiting_for_stop_reason = true;
+}
+
+// Called when the hart has halted: if it is range-stepping and has
+// just stepped to a PC still within the range, resume it (and the
+// rest of its group) again.  Returns true in that case.
+
+static
+bool range_step_continue (void)
+{
+    uint64_t PC_val;
+
+    if (! range_stepping)
+	return false;
+    if ((gdbstub_be_selected_hart () == range_hart)
+	&& gdbstub_be_stopped_by_step ()
+	&& (gdbstub_be_PC_read (gdbstub_be_xlen (), & PC_val) == status_ok)
+	&& (PC_val >= range_start) && (PC_val < range_end)) {
+	if (range_run_mask != 0)
+	    prepare_to_run ();
+	if (gdbstub_be_harts_resume (gdbstub_be_xlen (), range_step_mask, range_run_mask) == status_ok)
+	    return true;
+    }
+    range_stepping = false;
+    return false;
+}
+
+// ================================================================
+// 'v': respond to '$v...' packets received from GDB
+
+static
+void handle_RSP_v (const char *buf, const size_t buf_len)
+{
+    if (strncmp ("vCont", buf, strlen ("vCont")) == 0) {
+	handle_RSP_vCont (buf, buf_len);
+    }
+
+    else if ((strcmp (buf, "vRun") == 0) || (strncmp ("vRun;", buf, strlen ("vRun;")) == 0)) {
+	// Format: vRun;filename[;argument]...
+	// filename is hex-encoded; empty means the last ELF file loaded.
+	// Arguments are ignored (there is no OS to pass them to).
+	char filename [GDB_RSP_PKT_BUF_MAX / 2 + 1];
+	filename [0] = 0;
+	if (buf [4] == ';') {
+	    const char *p   = & (buf [5]);
+	    const char *end = strchr (p, ';');
+	    size_t      n   = ((end == NULL) ? strlen (p) : (size_t) (end - p));
+	    if ((n & 0x1) != 0) {
+		send_OK_or_error_response (status_err);
+		return;
+	    }
+	    hex2bin (filename, p, n);
+	    filename [n / 2] = 0;
+	}
+
+	uint32_t status = restart (filename);
+	if (status != status_ok) {
+	    send_OK_or_error_response (status_err);
+	    return;
+	}
+	// A fresh stop, at the entry point
+	send_stop_reason (0x05);
+    }
+
+    else if (strncmp ("vKill", buf, strlen ("vKill")) == 0) {
+	// There is no process to kill; just make sure the hart is halted
+	target_state_changed (true);
+	waiting_for_stop_reason = false;
+	uint32_t status = gdbstub_be_stop (gdbstub_be_xlen ());
+	send_OK_or_error_response (status);
+    }
+
+    else {
+	// Not supported (GDB falls back to other packets)
+	send_RSP_packet_to_GDB ("", 0);
+    }
+}
+
+// ================================================================
+// 'g': respond to '$g' packet received from GDB (read all regs)
+
+// Returns RISC-V regs in the following sequence:
+//     GPRs:  0..0x1F
+//     PC:   0x20
+//     FPRs: 0x21..0x40
+
+static
+void handle_RSP_g_read_all_registers (const char *buf, const size_t buf_len)
+{
+    uint32_t     status;
+    uint64_t     value;
+    uint64_t     GPR_vals [32];
+    char         response [33 * 16];
+    const Hex_Codec *codec = hex_codec (gdbstub_be_xlen ());
+    const size_t num_ASCII_hex_digits = codec->n_hex_digits;
+
+    // While looking at a trace frame, registers come from the trace
+    // buffer; those not collected are reported as 'x' (unavailable)
+    if (gdbstub_trace_selected_frame () >= 0) {
+	for (uint8_t j = 0; j < 33; j++) {
+	    if (gdbstub_trace_frame_reg_read (j, & value) == status_ok)
+		codec->val_to_hex (value, & (response [j * num_ASCII_hex_digits]));
+	    else
+		memset (& (response [j * num_ASCII_hex_digits]), 'x', num_ASCII_hex_digits);
+	}
+	send_RSP_packet_to_GDB (response, 33 * num_ASCII_hex_digits);
+	return;
+    }
+
+    // Registers of an RTOS thread that is not on the hart come from its
+    // saved context; those not saved are reported as 'x'
+    uint64_t tid = selected_saved_thread ();
+    if (tid != 0) {
+	for (uint8_t j = 0; j < 33; j++) {
+	    if (gdbstub_rtos_thread_reg_read (gdbstub_be_xlen (), tid, j, & value) == status_ok)
+		codec->val_to_hex (value, & (response [j * num_ASCII_hex_digits]));
+	    else
+		memset (& (response [j * num_ASCII_hex_digits]), 'x', num_ASCII_hex_digits);
+	}
+	send_RSP_packet_to_GDB (response, 33 * num_ASCII_hex_digits);
+	return;
+    }
+
+    // GPRs
+    status = gdbstub_be_GPRs_read (gdbstub_be_xlen (), GPR_vals);
+    if (status != status_ok) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+    uint8_t j;
+    for (j = 0; j < 32; j++)
+	codec->val_to_hex (GPR_vals [j], & (response [j * num_ASCII_hex_digits]));
+
+    // PC
+    status = gdbstub_be_PC_read (gdbstub_be_xlen (), & value);
+    if (status != status_ok) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+    codec->val_to_hex (value, & (response [32 * num_ASCII_hex_digits]));
+
+    // TODO: FPRs
+
+    // Send assembled response
+    send_RSP_packet_to_GDB (response, 33 * num_ASCII_hex_digits);
+}
+
+// ================================================================
+// 'G': respond to '$Gxx...' packet received from GDB (write all regs)
+
+// 'xx...' contains RISC-V reg values in the following sequence:
+//     GPRs:  0..0x1F
+//     PC:   0x20
+//     FPRs: 0x21..0x40
 
 static
 void handle_RSP_G_write_all_registers (const char *buf, const size_t buf_len)
@@ -996,12 +1711,17 @@ void handle_RSP_G_write_all_registers (const char *buf, const size_t buf_len)
     // TODO
     //uint64_t  FPR_vals [32];
     //uint64_t  FSR_val;
-    const size_t num_ASCII_hex_digits = gdbstub_be_xlen / (8 / 2);
+    const Hex_Codec *codec = hex_codec (gdbstub_be_xlen ());
+    const size_t num_ASCII_hex_digits = codec->n_hex_digits;
+
+    // The hex digits follow the 'G' (buf_len includes the terminating NUL)
+    const char   *hex     = & (buf [1]);
+    const size_t  hex_len = ((buf_len < 2) ? 0 : (buf_len - 2));
 
     // Check that the packet has the right number of hex digits for all the regs
-    if (buf_len != 33 * num_ASCII_hex_digits) {
+    if (hex_len != 33 * num_ASCII_hex_digits) {
 	if (logfile) {
-	    fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_G_write_all_registers (): invalid buf_len (%0zu)\n", buf_len);
+	    fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_G_write_all_registers (): invalid length (%0zu)\n", hex_len);
 	    fprintf (logfile, "    Expecting exactly 33 x %0zu hex digits\n", num_ASCII_hex_digits);
 	}
 	goto error_response;
@@ -1010,7 +1730,7 @@ void handle_RSP_G_write_all_registers (const char *buf, const size_t buf_len)
     // Parse all the GPR values
     uint8_t j;
     for (j = 0; j < 32; j++) {
-	status = hex16_to_val (& (buf [j * num_ASCII_hex_digits]), gdbstub_be_xlen, & (GPR_vals [j]));
+	status = codec->hex_to_val (& (hex [j * num_ASCII_hex_digits]), & (GPR_vals [j]));
 	if (status != status_ok) {
 	    if (logfile) {
 		fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_G_write_all_registers (): error parsing val for reg %0u\n",
@@ -1021,7 +1741,7 @@ void handle_RSP_G_write_all_registers (const char *buf, const size_t buf_len)
     }
 
     // Parse the PC value
-    status = hex16_to_val (& (buf [32 * num_ASCII_hex_digits]), gdbstub_be_xlen, & PC_val);
+    status = codec->hex_to_val (& (hex [32 * num_ASCII_hex_digits]), & PC_val);
     if (status != status_ok) {
 	if (logfile) {
 	    fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_G_write_all_registers (): error parsing val for PC\n");
@@ -1029,20 +1749,22 @@ void handle_RSP_G_write_all_registers (const char *buf, const size_t buf_len)
 	goto error_response;
     }
 
-    // Write GPRs to HW
-    for (j = 0; j < 32; j++) {
-	status = gdbstub_be_GPR_write (gdbstub_be_xlen, j, GPR_vals [j]);
-	if (status != status_ok) {
-	    if (logfile) {
-		fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_G_write_all_registers (): error writing val for reg %0u\n",
-			 j);
-	    }
-	    goto error_response;
+    // Registers saved by an RTOS for a switched-out thread are read-only
+    if (selected_saved_thread () != 0)
+	goto error_response;
+
+    // Write GPRs to HW (x0 is hardwired to zero)
+    target_state_changed (false);
+    status = gdbstub_be_GPRs_write (gdbstub_be_xlen (), GPR_vals);
+    if (status != status_ok) {
+	if (logfile) {
+	    fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_G_write_all_registers (): error writing GPRs\n");
 	}
+	goto error_response;
     }
 
     // Write PC to HW
-    status = gdbstub_be_PC_write (gdbstub_be_xlen, PC_val);
+    status = gdbstub_be_PC_write (gdbstub_be_xlen (), PC_val);
     if (status != status_ok) {
 	if (logfile) {
 	    fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_G_write_all_registers (): error writing val for PC\n");
@@ -1054,6 +1776,7 @@ void handle_RSP_G_write_all_registers (const char *buf, const size_t buf_len)
 
     // All ok, send OK response
     send_OK_or_error_response (status_ok);
+    return;
 
  error_response:
     if (logfile) {
@@ -1088,14 +1811,25 @@ void handle_RSP_m_read_mem (const char *buf, const size_t buf_len)
 
     char buf_bin [GDB_RSP_PKT_BUF_MAX / 2];
 
-    // Get memory data from HW
-    uint32_t status = gdbstub_be_mem_read (gdbstub_be_xlen, addr, buf_bin, length);
-    if (status != status_ok) {
-	if (logfile) {
-	    fprintf (logfile, "ERROR: gdbstub_fe.packet '$m...' packet from GDB: error reading HW memory\n");
+    // While looking at a trace frame, memory comes from the trace buffer
+    if (gdbstub_trace_selected_frame () >= 0) {
+	if (gdbstub_trace_frame_mem_read (addr, buf_bin, length) != status_ok) {
+	    send_OK_or_error_response (status_err);
+	    return;
 	}
-	send_OK_or_error_response (status_err);
-	return;
+    }
+    else {
+	// Get memory data from HW
+	uint32_t status = gdbstub_be_mem_read (gdbstub_be_xlen (), addr, buf_bin, length);
+	if (status != status_ok) {
+	    if (logfile) {
+		fprintf (logfile, "ERROR: gdbstub_fe.packet '$m...' packet from GDB: error reading HW memory\n");
+	    }
+	    send_OK_or_error_response (status_err);
+	    return;
+	}
+	// Hide installed tracepoints
+	gdbstub_trace_shadow_mem (addr, buf_bin, length);
     }
 
     // Encode bytes into hex chars
@@ -1149,12 +1883,11 @@ handle_RSP_M_write_mem_hex_data (const char *buf, const size_t buf_len)
 	return;
     }
 
-    // Convert from hex data digits to binary data
-    char buf_bin [GDB_RSP_PKT_BUF_MAX];
-    hex2bin (buf_bin, (p + 1), length * 2);
-
-    // Write the data to the HW side
-    uint32_t status = gdbstub_be_mem_write (gdbstub_be_xlen, addr, buf_bin, length);
+    // Write the data to the HW side, converting hex digits to bytes as it goes
+    BE_Byte_Src src = { hex_byte_src_get, (p + 1) };
+    target_state_changed (false);
+    gdbstub_record_forget_code ();
+    uint32_t status = gdbstub_be_mem_write_src (gdbstub_be_xlen (), addr, & src, length);
     send_OK_or_error_response (status);
 }
 
@@ -1172,23 +1905,46 @@ void handle_RSP_p_read_register (const char *buf, const size_t buf_len)
     uint32_t  regnum;
     uint64_t  value;
     char      response [16];
-    const size_t num_ASCII_hex_digits = gdbstub_be_xlen / (8 / 2);
+    const Hex_Codec *codec = hex_codec (gdbstub_be_xlen ());
+    const size_t num_ASCII_hex_digits = codec->n_hex_digits;
 
     if (1 != sscanf (buf, "p%x", & regnum)) {
 	send_OK_or_error_response (status_err);
 	return;
     }
 
+    // While looking at a trace frame, registers come from the trace buffer
+    if (gdbstub_trace_selected_frame () >= 0) {
+	if (gdbstub_trace_frame_reg_read (regnum, & value) == status_ok)
+	    codec->val_to_hex (value, response);
+	else
+	    memset (response, 'x', num_ASCII_hex_digits);
+	send_RSP_packet_to_GDB (response, num_ASCII_hex_digits);
+	return;
+    }
+
+    // GPRs, PC and FPRs of an RTOS thread that is not on the hart come
+    // from its saved context (CSRs are read from the hart)
+    uint64_t tid = selected_saved_thread ();
+    if ((tid != 0) && (regnum <= 0x40)) {
+	if (gdbstub_rtos_thread_reg_read (gdbstub_be_xlen (), tid, regnum, & value) == status_ok)
+	    codec->val_to_hex (value, response);
+	else
+	    memset (response, 'x', num_ASCII_hex_digits);
+	send_RSP_packet_to_GDB (response, num_ASCII_hex_digits);
+	return;
+    }
+
     if (regnum < 0x20) {
 	uint8_t gprnum = (uint8_t) regnum;
-	uint32_t status = gdbstub_be_GPR_read (gdbstub_be_xlen, gprnum, & value);
+	uint32_t status = gdbstub_be_GPR_read (gdbstub_be_xlen (), gprnum, & value);
 	if (status != status_ok) {
 	    send_OK_or_error_response (status_err);
 	    return;
 	}
     }
     else if (regnum == 0x20) {
-	uint32_t status = gdbstub_be_PC_read (gdbstub_be_xlen, & value);
+	uint32_t status = gdbstub_be_PC_read (gdbstub_be_xlen (), & value);
 	if (status != status_ok) {
 	    send_OK_or_error_response (status_err);
 	    return;
@@ -1197,7 +1953,7 @@ void handle_RSP_p_read_register (const char *buf, const size_t buf_len)
 
     else if ((0x21 <= regnum) && (regnum <= 0x40)) {
 	uint8_t fprnum = (uint8_t) (regnum - 0x21);
-	uint32_t status = gdbstub_be_FPR_read (gdbstub_be_xlen, fprnum, & value);
+	uint32_t status = gdbstub_be_FPR_read (gdbstub_be_xlen (), fprnum, & value);
 	if (status != status_ok) {
 	    send_OK_or_error_response (status_err);
 	    return;
@@ -1206,14 +1962,14 @@ void handle_RSP_p_read_register (const char *buf, const size_t buf_len)
 
     else if ((0x41 <= regnum) && (regnum <= (0x41 + 0xFFF))) {
 	uint16_t csr_addr = (uint16_t) (regnum - 0x41);
-	uint32_t status = gdbstub_be_CSR_read (gdbstub_be_xlen, csr_addr, & value);
+	uint32_t status = gdbstub_be_CSR_read (gdbstub_be_xlen (), csr_addr, & value);
 	if (status != status_ok) {
 	    send_OK_or_error_response (status_err);
 	    return;
 	}
     }
     else if (regnum == 0x1041) {
-	uint32_t status = gdbstub_be_PRIV_read (gdbstub_be_xlen, & value);
+	uint32_t status = gdbstub_be_PRIV_read (gdbstub_be_xlen (), & value);
 	if (status != status_ok) {
 	    send_OK_or_error_response (status_err);
 	    return;
@@ -1228,7 +1984,7 @@ void handle_RSP_p_read_register (const char *buf, const size_t buf_len)
 	return;
     }
 
-    val_to_hex16 (value, gdbstub_be_xlen, response);
+    codec->val_to_hex (value, response);
 
     send_RSP_packet_to_GDB (response, num_ASCII_hex_digits);
 }
@@ -1267,51 +2023,1336 @@ void handle_RSP_P_write_register (const char *buf, const size_t buf_len)
     }
     p++;
 
-    uint8_t reglen = gdbstub_be_xlen;
+    uint8_t reglen = gdbstub_be_xlen ();
     // PRIV is a virtual 1-byte register
     if (regnum == 0x1041)
 	reglen = 8;
 
-    // Parse the register value
-    status = hex16_to_val (p, reglen, & regval);
-    if (status != status_ok) {
-	if (logfile) {
-	    fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_P_write_register (): error parsing value for register %0d\n",
-		     regnum);
+    // Parse the register value
+    status = hex16_to_val (p, reglen, & regval);
+    if (status != status_ok) {
+	if (logfile) {
+	    fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_P_write_register (): error parsing value for register %0d\n",
+		     regnum);
+	}
+	status = 0x01;
+	goto done;
+    }
+
+    // Registers saved by an RTOS for a switched-out thread are read-only
+    if ((selected_saved_thread () != 0) && (regnum <= 0x40)) {
+	status = status_err;
+	goto done;
+    }
+
+    // Write the register
+    target_state_changed (false);
+    if (regnum < 0x20) {
+	uint8_t gprnum = (uint8_t) regnum;
+	status = gdbstub_be_GPR_write (gdbstub_be_xlen (), gprnum, regval);
+    }
+    else if (regnum == 0x20) {
+	status = gdbstub_be_PC_write (gdbstub_be_xlen (), regval);
+    }
+    else if ((0x21 <= regnum) && (regnum <= 0x40)) {
+	uint8_t fprnum = (uint8_t) (regnum - 0x21);
+	status = gdbstub_be_FPR_write (gdbstub_be_xlen (), fprnum, regval);
+    }
+    else if ((0x41 <= regnum) && (regnum <= (0x41 + 0xFFF))) {
+	uint16_t csr_addr = (uint16_t) (regnum - 0x41);
+	status = gdbstub_be_CSR_write (gdbstub_be_xlen (), csr_addr, regval);
+    }
+    else if (regnum == 0x1041) {
+	status = gdbstub_be_PRIV_write (gdbstub_be_xlen (), regval);
+    }
+    else
+	status = 01;
+
+ done:
+    if ((status != status_ok) && logfile) {
+	fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_P_write_register: gdbstub_be write error\n");
+	fprintf (logfile, "    regnum 0x%0x, regval 0x%0" PRIx64 "\n", regnum, regval);
+    }
+
+    send_OK_or_error_response (status);
+}
+
+// ================================================================
+// Tracepoint packets ('QT...' and 'qT...')
+// The tracepoints and trace buffer are managed in gdbstub_trace.c
+
+// Parse a hex number at *pp, advancing *pp past it.
+// A leading '-' is allowed (e.g., basereg -1 in 'M' actions).
+
+static
+uint32_t parse_hex (const char **pp, uint64_t *p_val)
+{
+    char *end;
+    *p_val = strtoull (*pp, & end, 16);
+    if (end == *pp)
+	return status_err;
+    *pp = end;
+    return status_ok;
+}
+
+// Parse "n:addr" (as in QTDP, QTEnable, qTP) at *pp, advancing *pp past it
+
+static
+uint32_t parse_tp_addr (const char **pp, uint32_t *p_tpnum, uint64_t *p_addr)
+{
+    uint64_t tpnum;
+    if ((parse_hex (pp, & tpnum) != status_ok) || (**pp != ':'))
+	return status_err;
+    *pp += 1;
+    if (parse_hex (pp, p_addr) != status_ok)
+	return status_err;
+    *p_tpnum = (uint32_t) tpnum;
+    return status_ok;
+}
+
+// ----------------
+// QTDP:n:addr:ena:step:pass[:Fflen][:Xlen,bytes][-]
+// QTDP:-n:addr:[S]action...[-]
+
+static
+uint32_t handle_RSP_QTDP (const char *buf)
+{
+    const char *p = & (buf [strlen ("QTDP:")]);
+    uint32_t    tpnum;
+    uint64_t    addr;
+
+    if (*p != '-') {
+	// New tracepoint
+	uint64_t step_count, pass_count;
+	if (parse_tp_addr (& p, & tpnum, & addr) != status_ok)
+	    return status_err;
+	if ((p[0] != ':') || ((p[1] != 'E') && (p[1] != 'D')) || (p[2] != ':'))
+	    return status_err;
+	bool enabled = (p[1] == 'E');
+	p += 3;
+	if ((parse_hex (& p, & step_count) != status_ok) || (*p != ':'))
+	    return status_err;
+	p++;
+	if (parse_hex (& p, & pass_count) != status_ok)
+	    return status_err;
+	// Fast tracepoints and conditions are not supported
+	if ((*p == ':') && ((p[1] == 'F') || (p[1] == 'X'))) {
+	    if (logfile)
+		fprintf (logfile, "ERROR: gdbstub_fe: QTDP: fast/conditional tracepoints not supported\n");
+	    return status_err;
+	}
+	return gdbstub_trace_define (tpnum, addr, enabled, step_count, pass_count);
+    }
+
+    // Actions for an existing tracepoint
+    p++;
+    if ((parse_tp_addr (& p, & tpnum, & addr) != status_ok) || (*p != ':'))
+	return status_err;
+    p++;
+    if (*p == 'S') {
+	// while-stepping actions; stepping was already rejected in QTDP
+	return status_err;
+    }
+    while ((*p != 0) && (*p != '-')) {
+	uint32_t status;
+	if (*p == 'R') {
+	    // R mask: we collect all GPRs and the PC regardless of the mask
+	    uint64_t mask;
+	    p++;
+	    if (parse_hex (& p, & mask) != status_ok)
+		return status_err;
+	    status = gdbstub_trace_add_regs (tpnum, addr);
+	}
+	else if (*p == 'M') {
+	    // M basereg,offset,len
+	    uint64_t basereg, offset, len;
+	    p++;
+	    bool neg = (*p == '-');
+	    if (neg) p++;
+	    if ((parse_hex (& p, & basereg) != status_ok) || (*p != ','))
+		return status_err;
+	    p++;
+	    if ((parse_hex (& p, & offset) != status_ok) || (*p != ','))
+		return status_err;
+	    p++;
+	    if (parse_hex (& p, & len) != status_ok)
+		return status_err;
+	    status = gdbstub_trace_add_mem (tpnum, addr,
+					    (neg ? -1 : (int32_t) basereg),
+					    offset, (uint32_t) len);
+	}
+	else {
+	    // 'X' agent expressions and anything else are not supported
+	    if (logfile)
+		fprintf (logfile, "ERROR: gdbstub_fe: QTDP: unsupported action '%c'\n", *p);
+	    return status_err;
+	}
+	if (status != status_ok)
+	    return status_err;
+    }
+    return status_ok;
+}
+
+// ----------------
+// QTFrame:n, QTFrame:pc:addr, QTFrame:tdp:t,
+// QTFrame:range:start:end, QTFrame:outside:start:end
+// Reply is 'Ff;Tt' (frame f, made by tracepoint t), or 'F-1' if none found
+
+static
+void handle_RSP_QTFrame (const char *buf)
+{
+    const char      *p = & (buf [strlen ("QTFrame:")]);
+    Trace_Find_Kind  kind;
+    uint64_t         a = 0, b = 0;
+    uint32_t         status = status_ok;
+
+    if (strncmp (p, "pc:", 3) == 0) {
+	kind = TRACE_FIND_PC;
+	p += 3;
+	status = parse_hex (& p, & a);
+    }
+    else if (strncmp (p, "tdp:", 4) == 0) {
+	kind = TRACE_FIND_TDP;
+	p += 4;
+	status = parse_hex (& p, & a);
+    }
+    else if ((strncmp (p, "range:", 6) == 0) || (strncmp (p, "outside:", 8) == 0)) {
+	kind = ((p[0] == 'r') ? TRACE_FIND_RANGE : TRACE_FIND_OUTSIDE);
+	p += ((p[0] == 'r') ? 6 : 8);
+	status = parse_hex (& p, & a);
+	if ((status == status_ok) && (*p == ':')) {
+	    p++;
+	    status = parse_hex (& p, & b);
+	}
+	else
+	    status = status_err;
+    }
+    else {
+	kind = TRACE_FIND_NUMBER;
+	status = parse_hex (& p, & a);
+	// QTFrame:ffffffff (i.e., -1) means stop looking at trace frames
+	if ((status == status_ok) && ((uint32_t) a == 0xFFFFFFFF)) {
+	    gdbstub_trace_unselect_frame ();
+	    send_OK_or_error_response (status_ok);
+	    return;
+	}
+    }
+
+    if (status != status_ok) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+
+    uint32_t tpnum;
+    int32_t  frame = gdbstub_trace_find_frame (kind, a, b, & tpnum);
+    char     response [32];
+    if (frame < 0)
+	snprintf (response, 32, "F-1");
+    else
+	snprintf (response, 32, "F%xT%x", frame, tpnum);
+    send_RSP_packet_to_GDB (response, strlen (response));
+}
+
+// ----------------
+// 'QT...' packets
+
+static
+void handle_RSP_QT (const char *buf, const size_t buf_len)
+{
+    uint32_t status = status_ok;
+
+    if (strcmp (buf, "QTinit") == 0) {
+	gdbstub_trace_stop (gdbstub_be_xlen ());
+	gdbstub_trace_clear ();
+    }
+    else if (strncmp (buf, "QTDP:", strlen ("QTDP:")) == 0) {
+	status = handle_RSP_QTDP (buf);
+    }
+    else if ((strncmp (buf, "QTEnable:", strlen ("QTEnable:")) == 0)
+	     || (strncmp (buf, "QTDisable:", strlen ("QTDisable:")) == 0)) {
+	bool        enable = (buf [2] == 'E');
+	const char *p = strchr (buf, ':') + 1;
+	uint32_t    tpnum;
+	uint64_t    addr;
+	status = parse_tp_addr (& p, & tpnum, & addr);
+	if (status == status_ok)
+	    status = gdbstub_trace_enable (tpnum, addr, enable);
+    }
+    else if (strcmp (buf, "QTStart") == 0) {
+	status = gdbstub_trace_start (gdbstub_be_xlen ());
+    }
+    else if (strcmp (buf, "QTStop") == 0) {
+	status = gdbstub_trace_stop (gdbstub_be_xlen ());
+    }
+    else if (strncmp (buf, "QTFrame:", strlen ("QTFrame:")) == 0) {
+	handle_RSP_QTFrame (buf);
+	return;
+    }
+    else if (strncmp (buf, "QTBuffer:size:", strlen ("QTBuffer:size:")) == 0) {
+	const char *p = & (buf [strlen ("QTBuffer:size:")]);
+	uint64_t    size;
+	if (strcmp (p, "-1") == 0)
+	    size = 1024 * 1024;
+	else
+	    status = parse_hex (& p, & size);
+	if (status == status_ok)
+	    status = gdbstub_trace_set_buffer_size (size);
+    }
+    else if (strcmp (buf, "QTBuffer:circular:1") == 0) {
+	// Only a linear trace buffer is supported
+	status = status_err;
+    }
+    else if ((strncmp (buf, "QTro", strlen ("QTro")) == 0)
+	     || (strncmp (buf, "QTDV", strlen ("QTDV")) == 0)
+	     || (strncmp (buf, "QTNotes", strlen ("QTNotes")) == 0)
+	     || (strncmp (buf, "QTDPsrc", strlen ("QTDPsrc")) == 0)
+	     || (strncmp (buf, "QTDisconnected", strlen ("QTDisconnected")) == 0)
+	     || (strncmp (buf, "QTBuffer:circular", strlen ("QTBuffer:circular")) == 0)) {
+	// Accepted and ignored
+	status = status_ok;
+    }
+    else {
+	if (logfile) {
+	    fprintf (logfile, "WARNING: gdbstub_fe.handle_RSP_QT: Unrecognized packet (%0zu chars): ", buf_len - 1);
+	    fprint_bytes (logfile, "", buf, buf_len - 1, "\n");
+	}
+	send_RSP_packet_to_GDB ("", 0);
+	return;
+    }
+
+    send_OK_or_error_response (status);
+}
+
+// ----------------
+// 'qT...' packets
+
+static
+void handle_RSP_qT (const char *buf, const size_t buf_len)
+{
+    char response [256];
+
+    if (strcmp (buf, "qTStatus") == 0) {
+	gdbstub_trace_status (response, sizeof (response));
+	send_RSP_packet_to_GDB (response, strlen (response));
+    }
+    else if (strncmp (buf, "qTP:", strlen ("qTP:")) == 0) {
+	const char *p = & (buf [strlen ("qTP:")]);
+	uint32_t    tpnum;
+	uint64_t    addr;
+	if ((parse_tp_addr (& p, & tpnum, & addr) != status_ok)
+	    || (gdbstub_trace_tp_status (tpnum, addr, response, sizeof (response)) != status_ok)) {
+	    send_OK_or_error_response (status_err);
+	    return;
+	}
+	send_RSP_packet_to_GDB (response, strlen (response));
+    }
+    else if ((strcmp (buf, "qTfP") == 0) || (strcmp (buf, "qTsP") == 0)
+	     || (strcmp (buf, "qTfV") == 0) || (strcmp (buf, "qTsV") == 0)) {
+	// No tracepoints or trace state variables to upload to GDB
+	send_RSP_packet_to_GDB ("l", 1);
+    }
+    else if (strncmp (buf, "qTV:", strlen ("qTV:")) == 0) {
+	// Trace state variables are not supported: value unknown
+	send_RSP_packet_to_GDB ("U", 1);
+    }
+    else {
+	if (logfile) {
+	    fprintf (logfile, "WARNING: gdbstub_fe.handle_RSP_qT: Unrecognized packet (%0zu chars): ", buf_len - 1);
+	    fprint_bytes (logfile, "", buf, buf_len - 1, "\n");
+	}
+	send_RSP_packet_to_GDB ("", 0);
+    }
+}
+
+// ================================================================
+// 'Q': respond to '$Q...#xx' packet received from GDB (general set)
+
+static
+void handle_RSP_Q (const char *buf, const size_t buf_len)
+{
+    if (strncmp ("QT", buf, strlen ("QT")) == 0) {
+	handle_RSP_QT (buf, buf_len);
+    }
+    else if (strcmp (buf, "QStartNoAckMode") == 0) {
+	// This packet and its OK are acked; nothing after them
+	send_OK_or_error_response (status_ok);
+	no_ack_mode = true;
+    }
+    else if (strcmp (buf, "QListThreadsInStopReply") == 0) {
+	list_threads_in_stop_reply = true;
+	send_OK_or_error_response (status_ok);
+    }
+    else {
+	if (logfile) {
+	    fprintf (logfile, "WARNING: gdbstub_fe.handle_RSP_Q: Unrecognized packet (%0zu chars): ", buf_len - 1);
+	    fprint_bytes (logfile, "", buf, buf_len - 1, "\n");
+	}
+	send_RSP_packet_to_GDB ("", 0);
+    }
+}
+
+// ================================================================
+// Thread packets ('qfThreadInfo', 'qsThreadInfo', 'qC', 'qThreadExtraInfo', 'qSymbol')
+// Threads are RTOS tasks (see gdbstub_rtos.c), or just the hart if no RTOS is detected.
+
+#define THREAD_IDS_MAX  1024
+
+static uint64_t thread_ids [THREAD_IDS_MAX];
+static uint32_t n_thread_ids    = 0;
+static uint32_t next_thread_idx = 0;
+
+static
+void send_thread_ids (void)
+{
+    char   response [GDB_RSP_PKT_BUF_MAX];
+    size_t n = 0;
+
+    if (next_thread_idx >= n_thread_ids) {
+	send_RSP_packet_to_GDB ("l", 1);
+	return;
+    }
+    response [n++] = 'm';
+    while ((next_thread_idx < n_thread_ids) && (n < (GDB_RSP_PKT_BUF_MAX - 32))) {
+	n += (size_t) snprintf (& (response [n]), GDB_RSP_PKT_BUF_MAX - n, "%s%" PRIx64,
+				((response [n - 1] == 'm') ? "" : ","),
+				thread_ids [next_thread_idx]);
+	next_thread_idx++;
+    }
+    send_RSP_packet_to_GDB (response, n);
+}
+
+// Ask GDB for the next symbol we need, or say we're done
+
+static
+void send_qSymbol_request (void)
+{
+    const char *name = gdbstub_rtos_next_symbol ();
+    if (name == NULL) {
+	send_OK_or_error_response (status_ok);
+	return;
+    }
+    char   response [256];
+    size_t len = strlen (name);
+    if (len > ((sizeof (response) - 8) / 2))
+	len = (sizeof (response) - 8) / 2;
+    memcpy (response, "qSymbol:", 8);
+    bin2hex (& (response [8]), name, len);
+    send_RSP_packet_to_GDB (response, 8 + (2 * len));
+}
+
+static
+void handle_RSP_q_thread (const char *buf, const size_t buf_len)
+{
+    if (strcmp (buf, "qfThreadInfo") == 0) {
+	gdbstub_rtos_thread_ids (gdbstub_be_xlen (), thread_ids, THREAD_IDS_MAX, & n_thread_ids);
+	next_thread_idx = 0;
+	send_thread_ids ();
+    }
+    else if (strcmp (buf, "qsThreadInfo") == 0) {
+	send_thread_ids ();
+    }
+    else if (strcmp (buf, "qC") == 0) {
+	char response [32];
+	snprintf (response, 32, "QC%" PRIx64, gdbstub_rtos_current_thread (gdbstub_be_xlen ()));
+	send_RSP_packet_to_GDB (response, strlen (response));
+    }
+    else if (strncmp (buf, "qThreadExtraInfo,", strlen ("qThreadExtraInfo,")) == 0) {
+	uint64_t id;
+	char     info [128];
+	if ((1 != sscanf (buf, "qThreadExtraInfo,%" SCNx64, & id))
+	    || (gdbstub_rtos_thread_extra_info (gdbstub_be_xlen (), id, info, sizeof (info)) != status_ok)) {
+	    send_OK_or_error_response (status_err);
+	    return;
+	}
+	char response [2 * sizeof (info)];
+	size_t len = strlen (info);
+	bin2hex (response, info, len);
+	send_RSP_packet_to_GDB (response, 2 * len);
+    }
+    else if (strncmp (buf, "qSymbol:", strlen ("qSymbol:")) == 0) {
+	// 'qSymbol::' starts a lookup; 'qSymbol:value:name' or
+	// 'qSymbol::name' answers our last request (name in hex)
+	const char *p_value = & (buf [strlen ("qSymbol:")]);
+	const char *p_name  = strchr (p_value, ':');
+	if ((p_name == NULL) || (p_name [1] == 0)) {
+	    gdbstub_rtos_lookup_start ();
+	}
+	else {
+	    p_name++;
+	    char   name [128];
+	    size_t n_hex = strlen (p_name);
+	    if (n_hex > (2 * (sizeof (name) - 1)))
+		n_hex = 2 * (sizeof (name) - 1);
+	    hex2bin (name, p_name, n_hex);
+	    name [n_hex / 2] = 0;
+
+	    uint64_t value;
+	    bool     found = (1 == sscanf (p_value, "%" SCNx64 ":", & value));
+	    gdbstub_rtos_set_symbol (name, found, (found ? value : 0));
+	}
+	send_qSymbol_request ();
+    }
+    else {
+	send_RSP_packet_to_GDB ("", 0);
+    }
+}
+
+// ================================================================
+// LLDB packets ('qRegisterInfo', 'qHostInfo', 'qProcessInfo',
+// 'qMemoryRegionInfo', 'qThreadStopInfo', 'jThreadsInfo')
+// These are answered from state gathered once per stop: the back end's
+// register snapshot and the RTOS thread cache.
+
+static const char *gpr_abi_names [32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "fp",   "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6",   "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8",   "s9", "s10", "s11", "t3", "t4", "t5", "t6" };
+
+// Register n in LLDB's numbering is GDB's register n (x0..x31, then PC);
+// 'offset' is the position in the 'g' packet.
+
+static
+void send_register_info (uint32_t regnum)
+{
+    char   response [256];
+    size_t n;
+    const uint32_t xlen_bytes = gdbstub_be_xlen () / 8;
+
+    if (regnum > 0x20) {
+	// End of register list
+	send_RSP_packet_to_GDB ("E45", 3);
+	return;
+    }
+
+    if (regnum == 0x20)
+	n = (size_t) snprintf (response, sizeof (response),
+			       "name:pc;bitsize:%d;offset:%d;encoding:uint;format:hex;"
+			       "set:General Purpose Registers;generic:pc;",
+			       gdbstub_be_xlen (), 32 * xlen_bytes);
+    else {
+	n = (size_t) snprintf (response, sizeof (response),
+			       "name:%s;alt-name:x%d;bitsize:%d;offset:%d;encoding:uint;format:hex;"
+			       "set:General Purpose Registers;gcc:%d;dwarf:%d;",
+			       gpr_abi_names [regnum], regnum, gdbstub_be_xlen (), regnum * xlen_bytes,
+			       regnum, regnum);
+	const char *generic = NULL;
+	switch (regnum) {
+	case 1: generic = "ra"; break;
+	case 2: generic = "sp"; break;
+	case 8: generic = "fp"; break;
+	default:
+	    if ((10 <= regnum) && (regnum <= 17)) {
+		n += (size_t) snprintf (& (response [n]), sizeof (response) - n,
+					"generic:arg%d;", regnum - 9);
+	    }
+	}
+	if (generic != NULL)
+	    n += (size_t) snprintf (& (response [n]), sizeof (response) - n, "generic:%s;", generic);
+    }
+    send_RSP_packet_to_GDB (response, n);
+}
+
+// qHostInfo and qProcessInfo: the target triple is hex-encoded
+
+static
+void send_host_or_process_info (bool process)
+{
+    char triple [32];
+    char triple_hex [64];
+    char response [256];
+
+    snprintf (triple, sizeof (triple), "riscv%d-unknown-unknown-elf", gdbstub_be_xlen ());
+    bin2hex (triple_hex, triple, strlen (triple));
+    triple_hex [2 * strlen (triple)] = 0;
+
+    snprintf (response, sizeof (response), "%striple:%s;endian:little;ptrsize:%d;ostype:unknown;vendor:unknown;",
+	      (process ? "pid:1;" : ""), triple_hex, gdbstub_be_xlen () / 8);
+    send_RSP_packet_to_GDB (response, strlen (response));
+}
+
+// qMemoryRegionInfo:addr
+// The stub has no memory map: the whole address space is one region
+
+static
+void send_memory_region_info (const char *buf)
+{
+    uint64_t addr;
+    if (1 != sscanf (buf, "qMemoryRegionInfo:%" SCNx64, & addr)) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+    if ((gdbstub_be_xlen () == 32) && (addr > 0xFFFFFFFFULL)) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+    char response [96];
+    snprintf (response, sizeof (response), "start:0;size:%" PRIx64 ";permissions:rwx;",
+	      (uint64_t) ((gdbstub_be_xlen () == 32) ? 0x100000000ULL : 0xFFFFFFFFFFFFFFFFULL));
+    send_RSP_packet_to_GDB (response, strlen (response));
+}
+
+// qThreadStopInfo<tid>: stop reply for one thread
+// (only the thread on the hart has a stop reason)
+
+static
+void send_thread_stop_info (const char *buf)
+{
+    uint64_t tid;
+    if ((1 != sscanf (buf, "qThreadStopInfo%" SCNx64, & tid))
+	|| (! gdbstub_rtos_thread_alive (gdbstub_be_xlen (), tid))) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+    char    response [256];
+    uint8_t stop_reason = ((tid == gdbstub_rtos_current_thread (gdbstub_be_xlen ())) ? last_stop_reason : 0);
+    size_t  n = fmt_stop_reason (response, sizeof (response), stop_reason, tid);
+    send_RSP_packet_to_GDB (response, n);
+}
+
+// jThreadsInfo: JSON array with, for each thread, its id, name,
+// stop reason (for the thread on the hart) and expedited registers
+
+static
+void send_threads_info (void)
+{
+    static uint64_t ids [1024];
+    uint32_t        n_ids;
+    char            response [GDB_RSP_PKT_BUF_MAX];
+    size_t          n = 0;
+    const Hex_Codec *codec = hex_codec (gdbstub_be_xlen ());
+    const size_t    num_ASCII_hex_digits = codec->n_hex_digits;
+    const size_t    max = GDB_RSP_PKT_BUF_MAX - 256;
+
+    gdbstub_rtos_thread_ids (gdbstub_be_xlen (), ids, 1024, & n_ids);
+    uint64_t current = gdbstub_rtos_current_thread (gdbstub_be_xlen ());
+
+    response [n++] = '[';
+    for (uint32_t j = 0; (j < n_ids) && (n < max); j++) {
+	char name [64];
+	if (gdbstub_rtos_thread_name (gdbstub_be_xlen (), ids [j], name, sizeof (name)) != status_ok)
+	    name [0] = 0;
+	// Keep the name valid as a JSON string
+	for (char *p = name; *p != 0; p++)
+	    if ((*p == '"') || (*p == '\\') || (! isprint ((unsigned char) *p)))
+		*p = '_';
+
+	n += (size_t) snprintf (& (response [n]), max - n,
+				"%s{\"tid\":%" PRIu64 ",\"name\":\"%s\"",
+				((j == 0) ? "" : ","), ids [j], name);
+	if ((ids [j] == current) && (n < max))
+	    n += (size_t) snprintf (& (response [n]), max - n,
+				    ",\"reason\":\"signal\",\"signal\":%d", last_stop_reason);
+	if (n < max)
+	    n += (size_t) snprintf (& (response [n]), max - n, ",\"registers\":{");
+	bool first = true;
+	for (size_t k = 0; (k < NUM_EXPEDITED_REGS) && (n < max); k++) {
+	    uint64_t value;
+	    if (thread_reg_read (ids [j], expedited_regs [k], & value) != status_ok)
+		continue;
+	    n += (size_t) snprintf (& (response [n]), max - n, "%s\"%d\":\"",
+				    (first ? "" : ","), expedited_regs [k]);
+	    codec->val_to_hex (value, & (response [n]));
+	    n += num_ASCII_hex_digits;
+	    response [n++] = '"';
+	    first = false;
+	}
+	if (n < max)
+	    n += (size_t) snprintf (& (response [n]), max - n, "}}");
+    }
+    if (n >= max) {
+	// Too many threads for one packet; LLDB falls back to other packets
+	send_RSP_packet_to_GDB ("E01", 3);
+	return;
+    }
+    response [n++] = ']';
+    send_RSP_packet_to_GDB (response, n);
+}
+
+// ----------------
+
+static
+void handle_RSP_q_lldb (const char *buf, const size_t buf_len)
+{
+    uint32_t regnum;
+
+    if (1 == sscanf (buf, "qRegisterInfo%x", & regnum))
+	send_register_info (regnum);
+    else if (strcmp (buf, "qHostInfo") == 0)
+	send_host_or_process_info (false);
+    else if (strcmp (buf, "qProcessInfo") == 0)
+	send_host_or_process_info (true);
+    else if (strncmp (buf, "qMemoryRegionInfo:", strlen ("qMemoryRegionInfo:")) == 0)
+	send_memory_region_info (buf);
+    else if (strncmp (buf, "qThreadStopInfo", strlen ("qThreadStopInfo")) == 0)
+	send_thread_stop_info (buf);
+    else
+	send_RSP_packet_to_GDB ("", 0);
+}
+
+// ================================================================
+// 'j': respond to '$j...#xx' packet (LLDB JSON packets)
+
+static
+void handle_RSP_j (const char *buf, const size_t buf_len)
+{
+    if (strcmp (buf, "jThreadsInfo") == 0)
+	send_threads_info ();
+    else {
+	if (logfile) {
+	    fprintf (logfile, "WARNING: gdbstub_fe.handle_RSP_j: Unrecognized packet (%0zu chars): ", buf_len - 1);
+	    fprint_bytes (logfile, "", buf, buf_len - 1, "\n");
+	}
+	send_RSP_packet_to_GDB ("", 0);
+    }
+}
+
+// ================================================================
+// 'H': respond to '$Hg id#xx' or '$Hc id#xx' packet (set thread for
+// subsequent register operations, or for continue/step)
+// Only 'Hg' matters: all threads run when the hart runs.
+
+static
+void handle_RSP_H_set_thread (const char *buf, const size_t buf_len)
+{
+    uint64_t id;
+
+    if (strcmp (& (buf [2]), "-1") == 0)
+	id = 0;
+    else if (1 != sscanf (& (buf [2]), "%" SCNx64, & id)) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+
+    if ((id != 0) && (! gdbstub_rtos_thread_alive (gdbstub_be_xlen (), id))) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+    if (buf [1] == 'g') {
+	general_thread = id;
+	// Without an RTOS, threads are harts: registers are read from the selected hart
+	if ((id != 0) && (! gdbstub_rtos_active (gdbstub_be_xlen ())))
+	    gdbstub_be_select_hart ((uint32_t) (id - RTOS_THREAD_ID_HART));
+    }
+    send_OK_or_error_response (status_ok);
+}
+
+// ================================================================
+// 'T': respond to '$T id#xx' packet (is thread alive?)
+
+static
+void handle_RSP_T_thread_alive (const char *buf, const size_t buf_len)
+{
+    uint64_t id;
+    if ((1 != sscanf (buf, "T%" SCNx64, & id))
+	|| (! gdbstub_rtos_thread_alive (gdbstub_be_xlen (), id))) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+    send_OK_or_error_response (status_ok);
+}
+
+// ================================================================
+// Send text to GDB's console ('O' packets), e.g., output of 'monitor' commands
+
+// While a monitor command runs, output is collected here and sent in
+// as few 'O' packets as possible.  Scripts ('monitor source', 'monitor
+// batch') flush it after each of their commands, so that it shows up
+// as the script goes.
+
+static int    console_batch_depth = 0;
+static char   console_batch_buf [(GDB_RSP_PKT_BUF_MAX - 1) / 2];
+static size_t console_batch_len = 0;
+
+static
+void send_console_output_now (const char *msg, size_t len)
+{
+    char   response [GDB_RSP_PKT_BUF_MAX];
+    size_t chunk_max = (GDB_RSP_PKT_BUF_MAX - 1) / 2;
+
+    while (len > 0) {
+	size_t chunk = ((len < chunk_max) ? len : chunk_max);
+	response [0] = 'O';
+	bin2hex (& (response [1]), msg, chunk);
+	send_RSP_packet_to_GDB (response, 1 + (2 * chunk));
+	msg += chunk;
+	len -= chunk;
+    }
+}
+
+static
+void console_batch_flush (void)
+{
+    send_console_output_now (console_batch_buf, console_batch_len);
+    console_batch_len = 0;
+}
+
+static
+void send_console_output (const char *msg)
+{
+    size_t len = strlen (msg);
+
+    if (console_batch_depth == 0) {
+	send_console_output_now (msg, len);
+	return;
+    }
+    while (len > 0) {
+	if (console_batch_len == sizeof (console_batch_buf))
+	    console_batch_flush ();
+	size_t room  = sizeof (console_batch_buf) - console_batch_len;
+	size_t chunk = ((len < room) ? len : room);
+	memcpy (& (console_batch_buf [console_batch_len]), msg, chunk);
+	console_batch_len += chunk;
+	msg += chunk;
+	len -= chunk;
+    }
+}
+
+// ================================================================
+// Invalidation hook (see gdbstub_be_register_invalidate).
+// GDB cannot be told asynchronously that the hart was reset, so a note
+// goes out with the next stop reply or monitor command output.
+
+static bool hart_reset_notice = false;
+
+static
+void target_state_invalidate (const uint8_t xlen, const bool hart_reset)
+{
+    target_state_changed (true);
+    if (hart_reset)
+	hart_reset_notice = true;
+}
+
+static
+void hart_reset_notify (void)
+{
+    if (hart_reset_notice) {
+	hart_reset_notice = false;
+	send_console_output ("Note: Debug Module recovery reset the hart;"
+			     " registers shown by GDB are stale until 'flushregs'\n");
+    }
+}
+
+// ================================================================
+// A packet (other than ^C) that arrives while a monitor command is
+// still running gets an error reply: every packet must get exactly one.
+
+static
+void reply_busy (const char *who, const char *buf, const ssize_t sn)
+{
+    if (logfile) {
+	fprintf (logfile, "WARNING: gdbstub_fe.%s: busy; error reply to packet: ", who);
+	fprint_bytes (logfile, "", buf, (size_t) sn - 1, "\n");
+    }
+    send_OK_or_error_response (status_err);
+}
+
+// ================================================================
+// Wait until the hart halts; a ^C from GDB stops it.
+// Returns the stop reason in *p_stop_reason.
+
+static
+uint32_t wait_for_halt (uint8_t *p_stop_reason)
+{
+    char buf [GDB_RSP_PKT_BUF_MAX];
+
+    while (true) {
+	int32_t sr = gdbstub_be_get_stop_reason (gdbstub_be_xlen (), p_stop_reason, true);
+	if (sr == 0) {
+	    if (note_watch_hit ())
+		*p_stop_reason = 0x05;
+	    return status_ok;
+	}
+	if (sr == -1) {
+	    if (gdbstub_be_stop (gdbstub_be_xlen ()) != status_ok)
+		return status_err;
+	    continue;
+	}
+
+	// Still running: an emulated watchpoint may have been hit
+	if (gdbstub_watch_emulating () && gdbstub_watch_poll (gdbstub_be_xlen ())) {
+	    gdbstub_be_stop (gdbstub_be_xlen ());
+	    continue;
+	}
+
+	// Look at what preempted the poll, if anything
+	ssize_t sn = recv_RSP_packet_from_GDB (buf, GDB_RSP_PKT_BUF_MAX);
+	if (sn < 0) {
+	    // GDB went away, or a stop was requested: leave the hart halted
+	    gdbstub_be_stop (gdbstub_be_xlen ());
+	    return status_err;
+	}
+	else if ((sn > 0) && (buf [0] == control_C)) {
+	    gdbstub_be_stop (gdbstub_be_xlen ());
+	}
+	else if (sn > 0) {
+	    reply_busy ("wait_for_halt", buf, sn);
+	}
+    }
+}
+
+// ================================================================
+// monitor run_to <symbol|addr>
+// Run to a symbol of the loaded ELF file, or to an address, using a
+// temporary hardware trigger (or a software breakpoint if no trigger is
+// free), entirely in the stub.  The stop is reported on GDB's console:
+// a monitor command cannot send GDB a stop reply, so GDB's register
+// cache still holds the old values until 'flushregs'.
+
+static
+uint32_t monitor_run_to (const char *where)
+{
+    char     msg [256];
+    uint64_t addr;
+
+    if (gdbstub_be_elf_symbol (where, & addr) != status_ok) {
+	char *end;
+	errno = 0;
+	addr = strtoull (where, & end, 0);
+	if ((errno != 0) || (end == where) || (*end != 0)) {
+	    snprintf (msg, sizeof (msg), "run_to: '%.64s' is not a symbol of the loaded ELF file, nor an address\n", where);
+	    send_console_output (msg);
+	    return status_err;
+	}
+    }
+
+    target_state_changed (true);
+
+    // If we are already there, step off first
+    uint64_t PC_val;
+    uint8_t  stop_reason;
+    uint32_t status = gdbstub_be_PC_read (gdbstub_be_xlen (), & PC_val);
+    if ((status == status_ok) && (PC_val == addr)) {
+	status = gdbstub_be_step (gdbstub_be_xlen ());
+	if (status == status_ok)
+	    status = wait_for_halt (& stop_reason);
+    }
+    if (status != status_ok) return status;
+
+    // Arm a temporary breakpoint
+    uint32_t trigger;
+    uint8_t  orig [4];
+    size_t   orig_len = 0;
+    bool     use_trigger = (gdbstub_be_trigger_insert (gdbstub_be_xlen (), BE_TRIGGER_EXECUTE, addr, & trigger)
+			    == status_ok);
+    if (! use_trigger) {
+	status = gdbstub_be_sw_break_insert (gdbstub_be_xlen (), addr, orig, & orig_len);
+	if (status != status_ok) {
+	    send_console_output ("run_to: could not set a breakpoint\n");
+	    return status;
+	}
+    }
+
+    // Run, wait, and disarm
+    prepare_to_run ();
+    status = gdbstub_be_continue (gdbstub_be_xlen ());
+    if (status == status_ok)
+	status = wait_for_halt (& stop_reason);
+
+    uint32_t status2 = (use_trigger
+			? gdbstub_be_trigger_remove (gdbstub_be_xlen (), trigger)
+			: gdbstub_be_sw_break_remove (gdbstub_be_xlen (), addr, orig, orig_len));
+    if (status != status_ok) return status;
+    if (status2 != status_ok) return status2;
+
+    // Report the stop, with the expedited registers
+    last_stop_reason = stop_reason;
+    gdbstub_be_PC_read (gdbstub_be_xlen (), & PC_val);
+    int n = snprintf (msg, sizeof (msg), "%s 0x%0" PRIx64 " (signal %0d):",
+		      ((PC_val == addr) ? "Stopped at" : "Stopped elsewhere, at"),
+		      PC_val, stop_reason);
+    for (size_t j = 1; j < (sizeof (expedited_regs) / sizeof (expedited_regs [0])); j++) {
+	uint64_t val;
+	if ((n < (int) sizeof (msg))
+	    && (gdbstub_be_GPR_read (gdbstub_be_xlen (), expedited_regs [j], & val) == status_ok))
+	    n += snprintf (& (msg [n]), sizeof (msg) - (size_t) n, " %s 0x%0" PRIx64,
+			   gpr_abi_names [expedited_regs [j]], val);
+    }
+    if (n < (int) sizeof (msg))
+	snprintf (& (msg [n]), sizeof (msg) - (size_t) n, "\n");
+    send_console_output (msg);
+    send_console_output ("run_to: GDB still shows the registers as they were; 'flushregs' to refresh them\n");
+    return status_ok;
+}
+
+// ================================================================
+// monitor wait_mem <addr> <mask> <value> <timeout_ms> [halt]
+// Poll memory through SBA, inside the stub, until
+// (mem [addr] & mask) == value or the timeout expires.  Reads a 4-byte
+// word, or an 8-byte one if mask or value needs it.  The polling
+// interval starts small, doubles while the word does not change (up to
+// WAIT_MEM_INTERVAL_MAX), and drops back when it does.  With 'halt',
+// the hart is halted as soon as the condition holds.  ^C from GDB
+// abandons the wait.  Returns status_err on timeout.
+// timeout_ms is at most UINT32_MAX (about 49 days), and the deadline
+// is clamped rather than allowed to wrap around.
+
+#define WAIT_MEM_INTERVAL_MIN       10    // usecs
+#define WAIT_MEM_INTERVAL_MAX    10000    // usecs
+
+static
+uint32_t monitor_wait_mem (uint64_t addr, uint64_t mask, uint64_t value, uint64_t timeout_ms, bool halt)
+{
+    char     msg [256];
+    char     buf [GDB_RSP_PKT_BUF_MAX];
+    size_t   len      = (((mask >> 32) != 0) || ((value >> 32) != 0)) ? 8 : 4;
+    uint64_t t_start  = usecs_now ();
+    uint64_t deadline = ((timeout_ms > ((UINT64_MAX - t_start) / 1000))
+			 ? UINT64_MAX
+			 : (t_start + (timeout_ms * 1000)));
+    uint64_t interval = WAIT_MEM_INTERVAL_MIN;
+    uint64_t n_polls  = 0;
+    uint64_t mem_val  = 0;
+    uint64_t prev_val = 0;
+
+    while (true) {
+	uint8_t bytes [8];
+	if (gdbstub_be_mem_read (gdbstub_be_xlen (), addr, (char *) bytes, len) != status_ok) {
+	    send_console_output ("wait_mem: memory read failed\n");
+	    return status_err;
+	}
+	n_polls++;
+	mem_val = 0;
+	for (size_t j = 0; j < len; j++)
+	    mem_val |= ((uint64_t) bytes [j]) << (8 * j);
+
+	uint64_t now = usecs_now ();
+	if ((mem_val & mask) == value) {
+	    if (halt) {
+		gdbstub_be_stop (gdbstub_be_xlen ());
+		// If GDB is waiting for a stop, the main loop reports it
+		if (! waiting_for_stop_reason)
+		    target_state_changed (true);
+	    }
+	    snprintf (msg, sizeof (msg),
+		      "wait_mem: [0x%0" PRIx64 "] = 0x%0" PRIx64 " after %0" PRId64 " usecs (%0" PRId64 " polls)%s\n",
+		      addr, mem_val, now - t_start, n_polls, (halt ? ", halted" : ""));
+	    send_console_output (msg);
+	    return status_ok;
+	}
+	if (now >= deadline)
+	    break;
+
+	// Back off while nothing changes
+	if ((n_polls > 1) && (mem_val != prev_val))
+	    interval = WAIT_MEM_INTERVAL_MIN;
+	else if (interval < WAIT_MEM_INTERVAL_MAX)
+	    interval = (((2 * interval) < WAIT_MEM_INTERVAL_MAX) ? (2 * interval) : WAIT_MEM_INTERVAL_MAX);
+	prev_val = mem_val;
+
+	// Sleep until the next poll, watching for ^C
+	uint64_t t_wake = now + interval;
+	if (t_wake > deadline)
+	    t_wake = deadline;
+	while (usecs_now () < t_wake) {
+	    if (gdbstub_be_poll_preempt (true)) {
+		ssize_t sn = recv_RSP_packet_from_GDB (buf, GDB_RSP_PKT_BUF_MAX);
+		if (sn < 0)
+		    return status_err;
+		if ((sn > 0) && (buf [0] == control_C)) {
+		    // A ^C meant for a running program still stops it
+		    if (waiting_for_stop_reason)
+			gdbstub_be_stop (gdbstub_be_xlen ());
+		    send_console_output ("wait_mem: interrupted\n");
+		    return status_err;
+		}
+		if (sn > 0)
+		    reply_busy ("monitor_wait_mem", buf, sn);
+	    }
+	    usleep (5);
+	}
+    }
+
+    snprintf (msg, sizeof (msg),
+	      "wait_mem: timed out after %0" PRId64 " ms (%0" PRId64 " polls); [0x%0" PRIx64 "] = 0x%0" PRIx64 "\n",
+	      timeout_ms, n_polls, addr, mem_val);
+    send_console_output (msg);
+    return status_err;
+}
+
+// ================================================================
+// monitor mem_gather [-merge] <sym|addr>[:width] ...
+// Read scattered locations (width 1, 2, 4 or 8 bytes, default 4) with
+// one scatter-gather request.  Each is read with an access of its width
+// (device registers may have side effects on reads); with -merge (RAM
+// only), gdbstub_be sorts them and merges nearby ones, and the bytes
+// between them, into a few SBA bursts.  Values are shown in the order given.
+
+#define MEM_GATHER_MAX  64
+
+static
+uint32_t monitor_mem_gather (const char *args, size_t args_len)
+{
+    BE_Mem_Item items [MEM_GATHER_MAX];
+    uint8_t     vals  [MEM_GATHER_MAX][8];
+    char        msg   [GDB_RSP_PKT_BUF_MAX / 2];
+    uint32_t    n_items = 0, n_bursts = 0, j;
+    size_t      n = 0, n1, k;
+    bool        merge = false;
+
+    while (n < args_len) {
+	char  tok [128] = "";
+	char *colon, *end;
+	n1 = find_token (tok, sizeof (tok) - 1, & (args [n]), args_len - n);
+	if ((n1 == 0) || (tok [0] == 0))
+	    break;
+	n += n1;
+	if ((n_items == 0) && (! merge) && (strcmp (tok, "-merge") == 0)) {
+	    merge = true;
+	    continue;
+	}
+	if (n_items == MEM_GATHER_MAX) {
+	    send_console_output ("mem_gather: too many locations\n");
+	    return status_err;
+	}
+
+	uint32_t width = 4;
+	colon = strchr (tok, ':');
+	if (colon != NULL) {
+	    *colon = 0;
+	    width  = (uint32_t) strtoul (colon + 1, & end, 0);
+	    if ((end == colon + 1) || (*end != 0)
+		|| ((width != 1) && (width != 2) && (width != 4) && (width != 8)))
+		return status_err;
+	}
+	uint64_t addr;
+	if (gdbstub_be_elf_symbol (tok, & addr) != status_ok) {
+	    addr = strtoull (tok, & end, 0);
+	    if ((end == tok) || (*end != 0))
+		return status_err;
+	}
+	items [n_items].addr = addr;
+	items [n_items].len  = width;
+	items [n_items].dst  = vals [n_items];
+	n_items++;
+    }
+    if (n_items == 0)
+	return status_err;
+
+    if (gdbstub_be_mem_read_sg (gdbstub_be_xlen (), items, n_items, merge, & n_bursts) != status_ok) {
+	send_console_output ("mem_gather: memory read failed\n");
+	return status_err;
+    }
+
+    k = 0;
+    for (j = 0; j < n_items; j++) {
+	uint64_t val = 0;
+	uint32_t b;
+	for (b = 0; b < items [j].len; b++)
+	    val |= ((uint64_t) vals [j][b]) << (8 * b);
+	k += (size_t) snprintf (& (msg [k]), sizeof (msg) - k,
+				"[0x%0" PRIx64 "]:%0d = 0x%0*" PRIx64 "\n",
+				items [j].addr, items [j].len, (int) (2 * items [j].len), val);
+	if (k >= sizeof (msg))
+	    break;
+    }
+    if (k < sizeof (msg))
+	snprintf (& (msg [k]), sizeof (msg) - k,
+		  "mem_gather: %0d locations in %0d %s\n", n_items, n_bursts, (merge ? "bursts" : "reads"));
+    send_console_output (msg);
+    return status_ok;
+}
+
+// ================================================================
+// monitor walk [*]<sym|addr> <next_off> <node_size> [max_nodes]
+// Follow a linked list inside the stub (gdbstub_be_mem_walk) and show
+// every node's address and payload, in list order, in one reply.
+// With '*', the head is the pointer stored at sym|addr.
+
+#define WALK_MAX_NODES_DEFAULT    64
+#define WALK_MAX_NODES          1024
+
+static
+uint32_t monitor_walk (const char *args)
+{
+    char     where [128];
+    uint64_t next_off, node_size, max_nodes = WALK_MAX_NODES_DEFAULT;
+    uint64_t head, next;
+    uint32_t n_nodes = 0, j, b;
+    char    *end;
+
+    size_t n = find_token (where, sizeof (where) - 1, args, strlen (args));
+    args += n;
+    if ((n == 0)
+	|| (! find_number (& args, BE_WALK_NODE_MAX - 8, & next_off))
+	|| (! find_number (& args, BE_WALK_NODE_MAX, & node_size))
+	|| ((! find_number (& args, WALK_MAX_NODES, & max_nodes)) && (strspn (args, " \t") != strlen (args)))
+	|| (node_size == 0) || (max_nodes == 0)) {
+	char msg [160];
+	snprintf (msg, sizeof (msg),
+		  "walk: expects [*]<sym|addr> <next_off> <node_size> [max_nodes],"
+		  " with next_off <= %0d, node_size 1..%0d, max_nodes 1..%0d\n",
+		  BE_WALK_NODE_MAX - 8, BE_WALK_NODE_MAX, WALK_MAX_NODES);
+	send_console_output (msg);
+	return status_err;
+    }
+
+    bool  deref = (where [0] == '*');
+    char *sym   = (deref ? & (where [1]) : where);
+    if (gdbstub_be_elf_symbol (sym, & head) != status_ok) {
+	head = strtoull (sym, & end, 0);
+	if ((end == sym) || (*end != 0))
+	    return status_err;
+    }
+    if (deref) {
+	uint8_t  ptr [8] = { 0 };
+	uint32_t ptr_bytes = gdbstub_be_xlen () / 8;
+	if (gdbstub_be_mem_read (gdbstub_be_xlen (), head, (char *) ptr, ptr_bytes) != status_ok) {
+	    send_console_output ("walk: memory read failed\n");
+	    return status_err;
+	}
+	head = 0;
+	for (b = 0; b < ptr_bytes; b++)
+	    head |= ((uint64_t) ptr [b]) << (8 * b);
+    }
+
+    size_t    buf_size = (size_t) max_nodes * node_size;
+    uint8_t  *buf      = (uint8_t *) malloc (buf_size);
+    uint64_t *addrs    = (uint64_t *) malloc (max_nodes * sizeof (uint64_t));
+    char     *msg      = (char *) malloc (((size_t) max_nodes * (24 + (2 * node_size))) + 128);
+    uint32_t  status   = status_err;
+
+    if ((buf != NULL) && (addrs != NULL) && (msg != NULL)) {
+	status = gdbstub_be_mem_walk (gdbstub_be_xlen (), head, (uint32_t) next_off,
+				      (uint32_t) node_size, (uint32_t) max_nodes,
+				      buf, buf_size, addrs, & n_nodes, & next);
+	size_t k = 0;
+	for (j = 0; j < n_nodes; j++) {
+	    k += (size_t) sprintf (& (msg [k]), "0x%0" PRIx64 ":", addrs [j]);
+	    for (b = 0; b < node_size; b++)
+		k += (size_t) sprintf (& (msg [k]), "%02x", buf [(j * node_size) + b]);
+	    msg [k++] = '\n';
 	}
-	status = 0x01;
-	goto done;
+	if (status != status_ok)
+	    sprintf (& (msg [k]), "walk: %0d nodes; memory read failed at 0x%0" PRIx64 "\n",
+		     n_nodes, next);
+	else if (next == 0)
+	    sprintf (& (msg [k]), "walk: %0d nodes; end of list\n", n_nodes);
+	else if (n_nodes == max_nodes)
+	    sprintf (& (msg [k]), "walk: %0d nodes; stopped at max_nodes (next 0x%0" PRIx64 ")\n",
+		     n_nodes, next);
+	else
+	    sprintf (& (msg [k]), "walk: %0d nodes; loops back to 0x%0" PRIx64 "\n", n_nodes, next);
+	send_console_output (msg);
     }
+    free (buf);
+    free (addrs);
+    free (msg);
+    return status;
+}
 
-    // Write the register
-    if (regnum < 0x20) {
-	uint8_t gprnum = (uint8_t) regnum;
-	status = gdbstub_be_GPR_write (gdbstub_be_xlen, gprnum, regval);
+// ================================================================
+// monitor source <file>
+// monitor batch <cmd> ; <cmd> ; ...
+// Run a script of monitor commands inside the stub, one per line of
+// the file (or separated by ';'), stopping at the first one that fails.
+// Blank lines and lines starting with '#' are skipped, and a leading
+// 'monitor' on a line is ignored, so a GDB script of monitor commands
+// can be used as is.  Output is sent to GDB's console after each
+// command.  Scripts may source other scripts, up to
+// MONITOR_SCRIPT_DEPTH_MAX deep.
+// In a batch, '\;' is a ';' within a command, '\\' is a '\', and a ';'
+// between double quotes does not end a command (the quotes are kept).
+
+#define MONITOR_SCRIPT_DEPTH_MAX  8
+
+static
+uint32_t monitor_command (const char *buf, const size_t buf_len, bool *p_known);
+
+// Run one command of a script; 'where' identifies it in error messages
+static
+uint32_t monitor_script_command (char *line, const char *where)
+{
+    char *p = line;
+    while ((*p == ' ') || (*p == '\t'))
+	p++;
+    size_t len = strlen (p);
+    while ((len > 0) && isspace ((unsigned char) p [len - 1]))
+	p [--len] = 0;
+    if ((len == 0) || (p [0] == '#'))
+	return status_ok;
+    if ((strncmp (p, "monitor", 7) == 0) && ((p [7] == ' ') || (p [7] == '\t'))) {
+	p   += 8;
+	len -= 8;
     }
-    else if (regnum == 0x20) {
-	status = gdbstub_be_PC_write (gdbstub_be_xlen, regval);
+
+    if (logfile) {
+	fprintf (logfile, "monitor script: %s: %s\n", where, p);
+	fflush (logfile);
     }
-    else if ((0x21 <= regnum) && (regnum <= 0x40)) {
-	uint8_t fprnum = (uint8_t) (regnum - 0x21);
-	status = gdbstub_be_FPR_write (gdbstub_be_xlen, fprnum, regval);
+
+    bool     known;
+    uint32_t status = monitor_command (p, len, & known);
+    if (status != status_ok) {
+	char msg [256];
+	snprintf (msg, sizeof (msg), "%s: %s: '%.128s'\n",
+		  where, (known ? "failed" : "unknown command"), p);
+	send_console_output (msg);
     }
-    else if ((0x41 <= regnum) && (regnum <= (0x41 + 0xFFF))) {
-	uint16_t csr_addr = (uint16_t) (regnum - 0x41);
-	status = gdbstub_be_CSR_write (gdbstub_be_xlen, csr_addr, regval);
+    console_batch_flush ();
+    return status;
+}
+
+static
+uint32_t monitor_source (const char *filename)
+{
+    static int depth = 0;
+    char       msg [256];
+
+    if (depth == MONITOR_SCRIPT_DEPTH_MAX) {
+	send_console_output ("source: scripts nested too deeply\n");
+	return status_err;
     }
-    else if (regnum == 0x1041) {
-	status = gdbstub_be_PRIV_write (gdbstub_be_xlen, regval);
+    FILE *fp = fopen (filename, "r");
+    if (fp == NULL) {
+	snprintf (msg, sizeof (msg), "source: could not open '%.128s'\n", filename);
+	send_console_output (msg);
+	return status_err;
     }
-    else
-	status = 01;
 
- done:
-    if ((status != status_ok) && logfile) {
-	fprintf (logfile, "ERROR: gdbstub_fe.handle_RSP_P_write_register: gdbstub_be write error\n");
-	fprintf (logfile, "    regnum 0x%0x, regval 0x%0" PRIx64 "\n", regnum, regval);
+    uint32_t status = status_ok;
+    uint32_t lineno = 0;
+    char     line [GDB_RSP_PKT_BUF_MAX];
+
+    depth++;
+    while ((status == status_ok) && (fgets (line, sizeof (line), fp) != NULL)) {
+	lineno++;
+	snprintf (msg, sizeof (msg), "%.128s:%0d", filename, lineno);
+	status = monitor_script_command (line, msg);
     }
+    depth--;
+    fclose (fp);
+    return status;
+}
 
-    send_OK_or_error_response (status);
+static
+uint32_t monitor_batch (const char *cmds, const size_t len)
+{
+    uint32_t status = status_ok;
+    uint32_t j      = 0;
+    char     line [GDB_RSP_PKT_BUF_MAX];
+    char     where [32];
+
+    for (size_t k = 0; (status == status_ok) && (k < len); ) {
+	size_t m      = k;
+	size_t n      = 0;
+	bool   quoted = false;
+	while ((m < len) && (quoted || (cmds [m] != ';'))) {
+	    char c = cmds [m++];
+	    if ((c == '\\') && (m < len) && ((cmds [m] == ';') || (cmds [m] == '\\')))
+		c = cmds [m++];
+	    else if (c == '"')
+		quoted = (! quoted);
+	    if (n < (sizeof (line) - 1))
+		line [n++] = c;
+	}
+	line [n] = 0;
+	j++;
+	snprintf (where, sizeof (where), "batch: command %0d", j);
+	status = monitor_script_command (line, where);
+	k = m + 1;
+    }
+    return status;
 }
 
 // ================================================================
@@ -1320,24 +3361,24 @@ void handle_RSP_P_write_register (const char *buf, const size_t buf_len)
 
 #define WORD_MAX 128
 
-static void
-handle_RSP_qRcmd (const char *buf, const size_t buf_len)
+// Perform a monitor command; *p_known is false if it is not recognized.
+// Output, if any, goes to GDB's console.
+
+static
+uint32_t monitor_command (const char *buf, const size_t buf_len, bool *p_known)
 {
     uint32_t status = status_ok;
-    char response [GDB_RSP_PKT_BUF_MAX];
+
+    *p_known = true;
 
     char cmd [WORD_MAX];
-    size_t n = find_token (cmd, WORD_MAX, buf, buf_len);
+    size_t n = find_token (cmd, WORD_MAX - 1, buf, buf_len);
 
     if (n == 0)
 	status = status_err;
 
     else if (strcmp (cmd, "help") == 0) {
-	const char *msg = gdbstub_be_help ();
-	response [0] = 'O';
-	size_t len = strlen (msg);
-	bin2hex (& (response [1]), msg, len);
-	send_RSP_packet_to_GDB (response, 1 + (2 * len));
+	send_console_output (gdbstub_be_help ());
 	status = status_ok;
     }
     else if (strcmp (cmd, "verbosity") == 0) {
@@ -1349,28 +3390,470 @@ handle_RSP_qRcmd (const char *buf, const size_t buf_len)
 	    status = gdbstub_be_verbosity (verbosity);
     }
     else if (strcmp (cmd, "xlen") == 0) {
-	uint8_t xlen;
-	int m = sscanf (& (buf [n]), "%" SCNu8, & xlen);
-	if (m != 1)
+	uint8_t  xlen;
+	uint32_t hart;
+	int m = sscanf (& (buf [n]), "%" SCNu8 " %" SCNu32, & xlen, & hart);
+	if (m == 1)
+	    status = gdbstub_be_set_xlen (xlen);
+	else if (m == 2)
+	    status = gdbstub_be_set_hart_xlen (hart, xlen);
+	else
 	    status = status_err;
-	else {
-	    gdbstub_be_xlen = xlen;
-	    status = status_ok;
-	}
     }
     else if (strcmp (cmd, "reset_dm") == 0) {
-	status = gdbstub_be_dm_reset (gdbstub_be_xlen);
+	target_state_changed (true);
+	status = gdbstub_be_dm_reset (gdbstub_be_xlen ());
     }
     else if (strcmp (cmd, "reset_ndm") == 0) {
 	bool haltreq = true;    // TODO: arg to reset_ndm?
-	status = gdbstub_be_ndm_reset (gdbstub_be_xlen, haltreq);
+	target_state_changed (true);
+	status = gdbstub_be_ndm_reset (gdbstub_be_xlen (), haltreq);
     }
     else if (strcmp (cmd, "reset_hart") == 0) {
 	bool haltreq = true;    // TODO: arg to reset_ndm?
-	status = gdbstub_be_hart_reset (gdbstub_be_xlen, haltreq);
+	target_state_changed (true);
+	status = gdbstub_be_hart_reset (gdbstub_be_xlen (), haltreq);
+    }
+    else if (strcmp (cmd, "watch") == 0) {
+	char msg [GDB_RSP_PKT_BUF_MAX / 2];
+	gdbstub_watch_status (msg, sizeof (msg));
+	send_console_output (msg);
+    }
+    else if (strcmp (cmd, "watch_mode") == 0) {
+	char arg [WORD_MAX];
+	find_token (arg, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	if (strcmp (arg, "auto") == 0)
+	    gdbstub_watch_set_mode (WATCH_MODE_AUTO);
+	else if (strcmp (arg, "hw") == 0)
+	    gdbstub_watch_set_mode (WATCH_MODE_HW);
+	else if (strcmp (arg, "emulated") == 0)
+	    gdbstub_watch_set_mode (WATCH_MODE_EMULATED);
+	else
+	    status = status_err;
+    }
+    else if (strcmp (cmd, "watch_period") == 0) {
+	uint64_t usecs;
+	if (1 != sscanf (& (buf [n]), "%" SCNu64, & usecs))
+	    status = status_err;
+	else
+	    gdbstub_watch_set_period (usecs);
+    }
+    else if (strcmp (cmd, "watch_match") == 0) {
+	uint64_t addr, value;
+	int m = sscanf (& (buf [n]), "%" SCNi64 " %" SCNi64, & addr, & value);
+	if (m < 1)
+	    status = status_err;
+	else
+	    status = gdbstub_watch_set_match (addr, (m == 2), value);
+    }
+    else if (strcmp (cmd, "sample") == 0) {
+	char msg [GDB_RSP_PKT_BUF_MAX / 2];
+	gdbstub_sample_status (msg, sizeof (msg));
+	send_console_output (msg);
+    }
+    else if (strcmp (cmd, "sample_add") == 0) {
+	// sample_add symbol|addr width [name]
+	char     where [WORD_MAX], width_s [WORD_MAX], name [WORD_MAX];
+	size_t   n1 = n + find_token (where, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	size_t   n2 = n1 + find_token (width_s, WORD_MAX - 1, & (buf [n1]), buf_len - n1);
+	uint64_t addr;
+	uint32_t width;
+	char    *end;
+	name [0] = 0;
+	find_token (name, WORD_MAX - 1, & (buf [n2]), buf_len - n2);
+	if (gdbstub_be_elf_symbol (where, & addr) == status_ok) {
+	    if (name [0] == 0)
+		strcpy (name, where);
+	}
+	else {
+	    addr = strtoull (where, & end, 0);
+	    if ((end == where) || (*end != 0))
+		status = status_err;
+	}
+	width = (uint32_t) strtoul (width_s, & end, 0);
+	if ((end == width_s) || (*end != 0))
+	    status = status_err;
+	if (status == status_ok)
+	    status = gdbstub_sample_add (addr, width, name);
+    }
+    else if (strcmp (cmd, "sample_csr") == 0) {
+	// sample_csr pc|mcycle|minstret|csr [name]
+	char     which [WORD_MAX] = "", name [WORD_MAX] = "";
+	size_t   n1 = n + find_token (which, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	uint64_t csr;
+	char    *end;
+	find_token (name, WORD_MAX - 1, & (buf [n1]), buf_len - n1);
+	if (strcmp (which, "pc") == 0)
+	    csr = 0x7B1;        // dpc
+	else if (strcmp (which, "mcycle") == 0)
+	    csr = 0xB00;        // mcycle
+	else if (strcmp (which, "minstret") == 0)
+	    csr = 0xB02;        // minstret
+	else {
+	    csr = strtoull (which, & end, 0);
+	    if ((end == which) || (*end != 0) || (csr > 0xFFF))
+		status = status_err;
+	}
+	if ((name [0] == 0) && (! isdigit ((unsigned char) which [0])))
+	    strcpy (name, which);
+	if (status == status_ok)
+	    status = gdbstub_sample_add_csr ((uint16_t) csr, name);
+    }
+    else if (strcmp (cmd, "sample_clear") == 0) {
+	status = gdbstub_sample_clear ();
+    }
+    else if (strcmp (cmd, "sample_rate") == 0) {
+	uint64_t hz;
+	if (1 != sscanf (& (buf [n]), "%" SCNu64, & hz))
+	    status = status_err;
+	else
+	    status = gdbstub_sample_set_rate (hz);
+    }
+    else if (strcmp (cmd, "sample_merge") == 0) {
+	char opt [WORD_MAX] = "";
+	find_token (opt, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	if (strcmp (opt, "on") == 0)
+	    status = gdbstub_sample_set_merge (true);
+	else if (strcmp (opt, "off") == 0)
+	    status = gdbstub_sample_set_merge (false);
+	else
+	    status = status_err;
+    }
+    else if (strcmp (cmd, "sample_output") == 0) {
+	char kind [WORD_MAX], filename [GDB_RSP_PKT_BUF_MAX];
+	size_t n2 = find_token (kind, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	filename [0] = 0;
+	if (n2 != 0)
+	    find_token (filename, GDB_RSP_PKT_BUF_MAX - 1, & (buf [n + n2]), buf_len - (n + n2));
+	if (strcmp (kind, "csv") == 0)
+	    status = gdbstub_sample_set_output (SAMPLE_OUT_CSV, filename);
+	else if (strcmp (kind, "bin") == 0)
+	    status = gdbstub_sample_set_output (SAMPLE_OUT_BIN, filename);
+	else if (strcmp (kind, "gdb") == 0)
+	    status = gdbstub_sample_set_output (SAMPLE_OUT_GDB, NULL);
+	else
+	    status = status_err;
+    }
+    else if (strcmp (cmd, "sample_start") == 0) {
+	status = gdbstub_sample_start ();
+    }
+    else if (strcmp (cmd, "sample_stop") == 0) {
+	status = gdbstub_sample_stop ();
+    }
+    else if (strcmp (cmd, "rtt") == 0) {
+	char msg [GDB_RSP_PKT_BUF_MAX / 2];
+	gdbstub_rtt_status (msg, sizeof (msg));
+	send_console_output (msg);
+    }
+    else if (strcmp (cmd, "rtt_setup") == 0) {
+	// rtt_setup symbol|addr [len]
+	char     where [WORD_MAX], len_s [WORD_MAX];
+	size_t   n1 = n + find_token (where, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	uint64_t addr, len = 0;
+	char    *end;
+	len_s [0] = 0;
+	find_token (len_s, WORD_MAX - 1, & (buf [n1]), buf_len - n1);
+	if (gdbstub_be_elf_symbol (where, & addr) != status_ok) {
+	    addr = strtoull (where, & end, 0);
+	    if ((end == where) || (*end != 0))
+		status = status_err;
+	}
+	if (len_s [0] != 0) {
+	    len = strtoull (len_s, & end, 0);
+	    if ((*end != 0) || (len == 0))
+		status = status_err;
+	}
+	if (status == status_ok)
+	    status = gdbstub_rtt_set_location (addr, len);
+    }
+    else if (strcmp (cmd, "rtt_output") == 0) {
+	// rtt_output channel none|gdb|file filename|tcp port
+	char     chan_s [WORD_MAX], kind [WORD_MAX], arg [GDB_RSP_PKT_BUF_MAX];
+	size_t   n1 = n + find_token (chan_s, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	size_t   n2 = n1 + find_token (kind, WORD_MAX - 1, & (buf [n1]), buf_len - n1);
+	char    *end;
+	uint32_t channel = (uint32_t) strtoul (chan_s, & end, 0);
+	arg [0] = 0;
+	find_token (arg, GDB_RSP_PKT_BUF_MAX - 1, & (buf [n2]), buf_len - n2);
+	if ((end == chan_s) || (*end != 0))
+	    status = status_err;
+	else if (strcmp (kind, "none") == 0)
+	    status = gdbstub_rtt_set_output (channel, RTT_OUT_NONE, NULL);
+	else if (strcmp (kind, "gdb") == 0)
+	    status = gdbstub_rtt_set_output (channel, RTT_OUT_GDB, NULL);
+	else if (strcmp (kind, "file") == 0)
+	    status = gdbstub_rtt_set_output (channel, RTT_OUT_FILE, arg);
+	else if (strcmp (kind, "tcp") == 0)
+	    status = gdbstub_rtt_set_output (channel, RTT_OUT_SOCKET, arg);
+	else
+	    status = status_err;
+    }
+    else if (strcmp (cmd, "rtt_poll") == 0) {
+	uint64_t min_usecs, max_usecs;
+	if (2 != sscanf (& (buf [n]), "%" SCNu64 " %" SCNu64, & min_usecs, & max_usecs))
+	    status = status_err;
+	else
+	    status = gdbstub_rtt_set_period (min_usecs, max_usecs);
+    }
+    else if (strcmp (cmd, "rtt_start") == 0) {
+	status = gdbstub_rtt_start (gdbstub_be_xlen ());
+    }
+    else if (strcmp (cmd, "rtt_stop") == 0) {
+	status = gdbstub_rtt_stop ();
+    }
+    else if (strcmp (cmd, "rtt_write") == 0) {
+	// rtt_write channel text (a newline is appended)
+	char     chan_s [WORD_MAX], text [GDB_RSP_PKT_BUF_MAX];
+	size_t   n1 = n + find_token (chan_s, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	char    *end;
+	uint32_t channel = (uint32_t) strtoul (chan_s, & end, 0);
+	while ((n1 < buf_len) && (buf [n1] == ' '))
+	    n1++;
+	size_t len = buf_len - n1;
+	memcpy (text, & (buf [n1]), len);
+	text [len++] = '\n';
+	if ((end == chan_s) || (*end != 0))
+	    status = status_err;
+	else
+	    status = gdbstub_rtt_write (gdbstub_be_xlen (), channel, text, len);
+    }
+    else if (strcmp (cmd, "dm_info") == 0) {
+	char msg [GDB_RSP_PKT_BUF_MAX / 2];
+	gdbstub_be_dm_info (msg, sizeof (msg));
+	send_console_output (msg);
+    }
+    else if (strcmp (cmd, "abstract_optimistic") == 0) {
+	char opt [WORD_MAX] = "";
+	find_token (opt, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	if (strcmp (opt, "on") == 0)
+	    gdbstub_be_abstract_optimistic (true);
+	else if (strcmp (opt, "off") == 0)
+	    gdbstub_be_abstract_optimistic (false);
+	else
+	    status = status_err;
+    }
+    else if (strcmp (cmd, "write_combine") == 0) {
+	char opt [WORD_MAX] = "";
+	find_token (opt, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	if (strcmp (opt, "on") == 0)
+	    write_combine = true;
+	else if (strcmp (opt, "off") == 0)
+	    write_combine = false;
+	else
+	    status = status_err;
+    }
+    else if (strcmp (cmd, "dm_health") == 0) {
+	char msg [GDB_RSP_PKT_BUF_MAX / 2];
+	gdbstub_be_dm_health (msg, sizeof (msg));
+	send_console_output (msg);
+    }
+    else if (strcmp (cmd, "dm_recover") == 0) {
+	status = gdbstub_be_dm_recover ();
+    }
+    else if (strcmp (cmd, "dm_recover_ndmreset") == 0) {
+	char opt [WORD_MAX];
+	find_token (opt, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	if (strcmp (opt, "on") == 0)
+	    gdbstub_be_dm_recover_ndmreset (true);
+	else if (strcmp (opt, "off") == 0)
+	    gdbstub_be_dm_recover_ndmreset (false);
+	else
+	    status = status_err;
+    }
+    else if (strcmp (cmd, "record") == 0) {
+	char msg [GDB_RSP_PKT_BUF_MAX / 2];
+	gdbstub_record_status (msg, sizeof (msg));
+	send_console_output (msg);
+    }
+    else if (strcmp (cmd, "record_start") == 0) {
+	// record_start [log_bytes]
+	uint64_t log_size = 0;
+	int m = sscanf (& (buf [n]), "%" SCNi64, & log_size);
+	if ((m == 0) || gdbstub_trace_running ())
+	    status = status_err;
+	else
+	    status = gdbstub_record_start (gdbstub_be_xlen (), log_size);
+    }
+    else if (strcmp (cmd, "record_stop") == 0) {
+	status = gdbstub_record_stop ();
+    }
+    else if (strcmp (cmd, "etrace") == 0) {
+	char msg [GDB_RSP_PKT_BUF_MAX / 2];
+	gdbstub_etrace_status (msg, sizeof (msg));
+	send_console_output (msg);
+    }
+    else if (strcmp (cmd, "etrace_buffer") == 0) {
+	// etrace_buffer symbol|addr size
+	char     where [WORD_MAX];
+	size_t   n1 = n + find_token (where, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	uint64_t addr, size;
+	char    *end;
+	if (gdbstub_be_elf_symbol (where, & addr) != status_ok) {
+	    addr = strtoull (where, & end, 0);
+	    if ((end == where) || (*end != 0))
+		status = status_err;
+	}
+	if (1 != sscanf (& (buf [n1]), "%" SCNi64, & size))
+	    status = status_err;
+	if (status == status_ok)
+	    status = gdbstub_etrace_set_buffer (addr, size);
+    }
+    else if (strcmp (cmd, "etrace_control") == 0) {
+	// etrace_control addr start_value stop_value
+	uint64_t addr, start_value, stop_value;
+	if (3 != sscanf (& (buf [n]), "%" SCNi64 " %" SCNi64 " %" SCNi64, & addr, & start_value, & stop_value))
+	    status = status_err;
+	else
+	    status = gdbstub_etrace_set_control (addr, (uint32_t) start_value, (uint32_t) stop_value);
+    }
+    else if (strcmp (cmd, "etrace_wp") == 0) {
+	// etrace_wp addr [wrap_mask]
+	uint64_t addr, wrap_mask = 0;
+	if (1 > sscanf (& (buf [n]), "%" SCNi64 " %" SCNi64, & addr, & wrap_mask))
+	    status = status_err;
+	else
+	    status = gdbstub_etrace_set_wp (addr, wrap_mask);
+    }
+    else if (strcmp (cmd, "etrace_param") == 0) {
+	// etrace_param name value
+	char     name [WORD_MAX];
+	size_t   n1 = n + find_token (name, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	uint64_t value;
+	if (1 != sscanf (& (buf [n1]), "%" SCNi64, & value))
+	    status = status_err;
+	else
+	    status = gdbstub_etrace_set_param (name, value);
+    }
+    else if (strcmp (cmd, "etrace_start") == 0) {
+	status = gdbstub_etrace_start (gdbstub_be_xlen ());
+    }
+    else if (strcmp (cmd, "etrace_stop") == 0) {
+	status = gdbstub_etrace_stop (gdbstub_be_xlen ());
+    }
+    else if ((strcmp (cmd, "etrace_download") == 0) || (strcmp (cmd, "etrace_decode") == 0)) {
+	// etrace_download [filename], etrace_decode [filename]
+	char filename [GDB_RSP_PKT_BUF_MAX];
+	filename [0] = 0;
+	find_token (filename, GDB_RSP_PKT_BUF_MAX - 1, & (buf [n]), buf_len - n);
+	const char *f = ((filename [0] == 0) ? NULL : filename);
+	if (strcmp (cmd, "etrace_download") == 0)
+	    status = gdbstub_etrace_download (gdbstub_be_xlen (), f);
+	else
+	    status = gdbstub_etrace_decode (gdbstub_be_xlen (), f);
+    }
+    else if (strcmp (cmd, "etrace_clear") == 0) {
+	status = gdbstub_etrace_clear ();
+    }
+    else if (strcmp (cmd, "etrace_hist") == 0) {
+	// etrace_hist filename [max_lines]
+	char     filename [GDB_RSP_PKT_BUF_MAX];
+	size_t   n1 = n + find_token (filename, GDB_RSP_PKT_BUF_MAX - 1, & (buf [n]), buf_len - n);
+	uint64_t max_lines = 0;
+	sscanf (& (buf [n1]), "%" SCNi64, & max_lines);
+	if (n1 == n)
+	    status = status_err;
+	else
+	    status = gdbstub_etrace_write_histogram (filename, max_lines);
+    }
+    else if (strcmp (cmd, "etrace_coverage") == 0) {
+	char filename [GDB_RSP_PKT_BUF_MAX];
+	if (0 == find_token (filename, GDB_RSP_PKT_BUF_MAX - 1, & (buf [n]), buf_len - n))
+	    status = status_err;
+	else
+	    status = gdbstub_etrace_write_coverage (filename);
+    }
+    else if (strcmp (cmd, "stepie") == 0) {
+	char opt [WORD_MAX];
+	opt [0] = 0;
+	find_token (opt, WORD_MAX - 1, & (buf [n]), buf_len - n);
+	if (opt [0] == 0) {
+	    char msg [GDB_RSP_PKT_BUF_MAX / 2];
+	    gdbstub_be_stepie_status (msg, sizeof (msg));
+	    send_console_output (msg);
+	}
+	else if (strcmp (opt, "keep") == 0)
+	    gdbstub_be_set_stepie (BE_STEPIE_KEEP);
+	else if (strcmp (opt, "off") == 0)
+	    gdbstub_be_set_stepie (BE_STEPIE_OFF);
+	else if (strcmp (opt, "on") == 0)
+	    gdbstub_be_set_stepie (BE_STEPIE_ON);
+	else
+	    status = status_err;
+    }
+    else if (strcmp (cmd, "wait_mem") == 0) {
+	// wait_mem addr mask value timeout_ms [halt]
+	uint64_t    addr, mask, value, timeout_ms;
+	char        opt [WORD_MAX] = "";
+	const char *args = & (buf [n]);
+	if ((! find_number (& args, UINT64_MAX, & addr))
+	    || (! find_number (& args, UINT64_MAX, & mask))
+	    || (! find_number (& args, UINT64_MAX, & value))
+	    || (! find_number (& args, UINT32_MAX, & timeout_ms)))
+	    status = status_err;
+	else {
+	    find_token (opt, sizeof (opt) - 1, args, strlen (args));
+	    if ((opt [0] != 0) && (strcmp (opt, "halt") != 0))
+		status = status_err;
+	    else
+		status = monitor_wait_mem (addr, mask, value, timeout_ms, (opt [0] != 0));
+	}
+    }
+    else if (strcmp (cmd, "mem_gather") == 0) {
+	status = monitor_mem_gather (& (buf [n]), buf_len - n);
+    }
+    else if (strcmp (cmd, "walk") == 0) {
+	status = monitor_walk (& (buf [n]));
+    }
+    else if (strcmp (cmd, "run_to") == 0) {
+	char where [GDB_RSP_PKT_BUF_MAX];
+	if (find_token (where, GDB_RSP_PKT_BUF_MAX - 1, & (buf [n]), buf_len - n) == 0)
+	    status = status_err;
+	else
+	    status = monitor_run_to (where);
     }
     else if (strcmp (cmd, "elf_load") == 0) {
-	status = gdbstub_be_elf_load (& (buf [n]));
+	char filename [GDB_RSP_PKT_BUF_MAX];
+	if (find_token (filename, GDB_RSP_PKT_BUF_MAX - 1, & (buf [n]), buf_len - n) == 0)
+	    status = status_err;
+	else {
+	    target_state_changed (true);
+	    gdbstub_record_forget_code ();
+	    status = gdbstub_be_elf_load (filename);
+	}
+    }
+    else if (strcmp (cmd, "dmi_read") == 0) {
+	uint64_t    dmi_addr;
+	uint32_t    data;
+	const char *args = & (buf [n]);
+	if (! find_number (& args, UINT16_MAX, & dmi_addr))
+	    status = status_err;
+	else {
+	    status = gdbstub_be_dmi_read ((uint16_t) dmi_addr, & data);
+	    if (status == status_ok) {
+		char msg [64];
+		snprintf (msg, sizeof (msg), "dmi [0x%02" PRIx64 "] = 0x%08" PRIx32 "\n", dmi_addr, data);
+		send_console_output (msg);
+	    }
+	}
+    }
+    else if (strcmp (cmd, "dmi_write") == 0) {
+	uint64_t    dmi_addr, data;
+	const char *args = & (buf [n]);
+	if ((! find_number (& args, UINT16_MAX, & dmi_addr))
+	    || (! find_number (& args, UINT32_MAX, & data)))
+	    status = status_err;
+	else
+	    status = gdbstub_be_dmi_write ((uint16_t) dmi_addr, (uint32_t) data);
+    }
+    else if (strcmp (cmd, "source") == 0) {
+	char filename [GDB_RSP_PKT_BUF_MAX];
+	if (find_token (filename, GDB_RSP_PKT_BUF_MAX - 1, & (buf [n]), buf_len - n) == 0)
+	    status = status_err;
+	else
+	    status = monitor_source (filename);
+    }
+    else if (strcmp (cmd, "batch") == 0) {
+	status = monitor_batch (& (buf [n]), buf_len - n);
     }
 
     else {
@@ -1378,6 +3861,26 @@ handle_RSP_qRcmd (const char *buf, const size_t buf_len)
 	// if (logfile) {
 	//     fprintf (logfile, "Monitor command not recognized\n");
 	// }
+	*p_known = false;
+	status   = status_err;
+    }
+
+    return status;
+}
+
+static void
+handle_RSP_qRcmd (const char *buf, const size_t buf_len)
+{
+    bool known;
+
+    // Console output of the command is sent in as few 'O' packets as possible
+    console_batch_depth++;
+    uint32_t status = monitor_command (buf, buf_len, & known);
+    hart_reset_notify ();
+    console_batch_depth--;
+    console_batch_flush ();
+
+    if (! known) {
 	send_RSP_packet_to_GDB ("", 0);
 	return;
     }
@@ -1403,11 +3906,65 @@ handle_RSP_q (const char *buf, const size_t buf_len)
     }
 
     else if (strncmp ("qSupported", buf, strlen("qSupported")) == 0) {
-	char response [32];
-	snprintf (response, 32, "PacketSize=%x", GDB_RSP_PKT_BUF_MAX);
+	char response [256];
+	snprintf (response, 256,
+		  "PacketSize=%x"
+		  ";qXfer:traceframe-info:read+;EnableDisableTracepoints+;QTBuffer:size+"
+		  ";ReverseStep+;ReverseContinue+;QStartNoAckMode+",
+		  GDB_RSP_PKT_BUF_MAX);
 	send_RSP_packet_to_GDB (response, strlen (response));
     }
 
+    else if ((strncmp ("qRegisterInfo", buf, strlen ("qRegisterInfo")) == 0)
+	     || (strcmp (buf, "qHostInfo") == 0)
+	     || (strcmp (buf, "qProcessInfo") == 0)
+	     || (strncmp ("qMemoryRegionInfo:", buf, strlen ("qMemoryRegionInfo:")) == 0)
+	     || (strncmp ("qThreadStopInfo", buf, strlen ("qThreadStopInfo")) == 0)) {
+	handle_RSP_q_lldb (buf, buf_len);
+    }
+
+    else if (strncmp ("qThreadExtraInfo,", buf, strlen ("qThreadExtraInfo,")) == 0) {
+	handle_RSP_q_thread (buf, buf_len);
+    }
+
+    else if (strncmp ("qT", buf, strlen ("qT")) == 0) {
+	handle_RSP_qT (buf, buf_len);
+    }
+
+    else if ((strcmp (buf, "qfThreadInfo") == 0)
+	     || (strcmp (buf, "qsThreadInfo") == 0)
+	     || (strcmp (buf, "qC") == 0)
+	     || (strncmp ("qSymbol:", buf, strlen ("qSymbol:")) == 0)) {
+	handle_RSP_q_thread (buf, buf_len);
+    }
+
+    else if (strncmp ("qXfer:traceframe-info:read::", buf, strlen ("qXfer:traceframe-info:read::")) == 0) {
+	// Format: qXfer:traceframe-info:read::offset,length
+	size_t offset, length;
+	if (2 != sscanf (buf, "qXfer:traceframe-info:read::%zx,%zx", & offset, & length)) {
+	    send_OK_or_error_response (status_err);
+	    return;
+	}
+	char xml [GDB_RSP_PKT_BUF_MAX];
+	gdbstub_trace_frame_info (xml, GDB_RSP_PKT_BUF_MAX);
+	size_t xml_len = strlen (xml);
+
+	// Leave room for the 'm'/'l' prefix and for escaping
+	if (length > (GDB_RSP_PKT_BUF_MAX / 2))
+	    length = GDB_RSP_PKT_BUF_MAX / 2;
+	char response [GDB_RSP_PKT_BUF_MAX];
+	if (offset >= xml_len) {
+	    response [0] = 'l';
+	    send_RSP_packet_to_GDB (response, 1);
+	}
+	else {
+	    size_t n = (((xml_len - offset) < length) ? (xml_len - offset) : length);
+	    response [0] = (((offset + n) < xml_len) ? 'm' : 'l');
+	    memcpy (& (response [1]), & (xml [offset]), n);
+	    send_RSP_packet_to_GDB (response, n + 1);
+	}
+    }
+
     else if (strncmp ("qRcmd,", buf, strlen ("qRcmd,")) == 0) {
 	// This is the RSP packet for 'monitor' commands
 	// Convert from hex data digits to binary data
@@ -1457,7 +4014,7 @@ void handle_RSP_s_step (const char *buf, const size_t buf_len)
     }
     // "s addr": parse the PC value
     else if (1 == sscanf (buf, "s%" SCNx64 "", & PC_val)) {
-	gdbstub_be_PC_write (gdbstub_be_xlen, PC_val);
+	gdbstub_be_PC_write (gdbstub_be_xlen (), PC_val);
     }
     else {
 	// Neither "s" nor "s addr"
@@ -1465,8 +4022,14 @@ void handle_RSP_s_step (const char *buf, const size_t buf_len)
 	return;
     }
 
+    if (gdbstub_record_active ()) {
+	record_run (RECORD_RUN_STEP, 0, 0);
+	return;
+    }
+
     // Send 'step' command to HW side
-    status = gdbstub_be_step (gdbstub_be_xlen);
+    target_state_changed (true);
+    status = gdbstub_be_step (gdbstub_be_xlen ());
     if (status != status_ok) {
 	send_OK_or_error_response (status);
 	return;
@@ -1516,8 +4079,78 @@ handle_RSP_X_write_mem_bin_data (const char *buf, const size_t buf_len)
 	return;
     }
 
-    // Write the data to the HW side
-    uint32_t status = gdbstub_be_mem_write (gdbstub_be_xlen, addr, (p + 1), length);
+    // Write the data to the HW side, straight from the packet
+    BE_Byte_Src src;
+    gdbstub_be_byte_src_bin (& src, (p + 1));
+    target_state_changed (false);
+    gdbstub_record_forget_code ();
+    uint32_t status;
+    if (write_combine)
+	status = gdbstub_be_mem_write_stream (gdbstub_be_xlen (), addr, & src, length);
+    else
+	status = gdbstub_be_mem_write_src (gdbstub_be_xlen (), addr, & src, length);
+    send_OK_or_error_response (status);
+}
+
+// ================================================================
+// Flush the write stream of combined 'X' packets, remembering any error
+
+static
+void write_combine_sync (void)
+{
+    if (gdbstub_be_mem_write_flush (gdbstub_be_xlen ()) != status_ok)
+	write_error_pending = true;
+}
+
+// A pending write error is the reply to the next packet that accesses
+// memory, runs or restarts the hart, or detaches (which is then not
+// executed), so that 'load' fails and a partly written program is not
+// run.  Queries and register accesses are answered as usual.  'R' has
+// no reply, so the error waits for the packet after it.
+
+static
+bool deferred_write_error (const char *buf)
+{
+    if (! write_error_pending)
+	return false;
+    if ((strchr ("XMmcCsSZzbD", buf [0]) == NULL)
+	&& (strncmp (buf, "vCont;", strlen ("vCont;")) != 0)
+	&& (strncmp (buf, "vRun", strlen ("vRun")) != 0)
+	&& (strncmp (buf, "qRcmd,", strlen ("qRcmd,")) != 0))
+	return false;
+
+    if (logfile) {
+	fprintf (logfile, "gdbstub_fe: reporting deferred memory write error\n");
+	fflush (logfile);
+    }
+    write_error_pending = false;
+    return true;
+}
+
+// ================================================================
+// 'Z'/'z': respond to '$Ztype,addr,kind' and '$ztype,addr,kind' packets
+// received from GDB (insert/remove breakpoint or watchpoint).
+// Software breakpoints (Z0) are left to GDB, which writes ebreaks with 'M'/'X'.
+
+static
+void handle_RSP_Z (const char *buf, const size_t buf_len)
+{
+    uint32_t type;
+    uint64_t addr, kind;
+    if (3 != sscanf (buf + 1, "%" SCNu32 ",%" SCNx64 ",%" SCNx64, & type, & addr, & kind)) {
+	send_OK_or_error_response (status_err);
+	return;
+    }
+    if ((type < WATCH_Z_HW_BREAK) || (type > WATCH_Z_ACCESS)) {
+	send_RSP_packet_to_GDB ("", 0);
+	return;
+    }
+
+    uint32_t status;
+    if (buf [0] == 'Z')
+	status = gdbstub_watch_insert (gdbstub_be_xlen (), type, addr, kind);
+    else
+	status = gdbstub_watch_remove (gdbstub_be_xlen (), type, addr, kind);
     send_OK_or_error_response (status);
 }
 
@@ -1535,9 +4168,9 @@ void *main_gdbstub (void *arg)
     stop_fd = params->stop_fd;
 
     if (logfile) {
-	fprintf (logfile, "main_gdbstub: for RV%0d\n", gdbstub_be_xlen);
+	fprintf (logfile, "main_gdbstub: for RV%0d\n", gdbstub_be_xlen ());
     }
-    if ((gdbstub_be_xlen != 32) && (gdbstub_be_xlen != 64)) {
+    if ((gdbstub_be_xlen () != 32) && (gdbstub_be_xlen () != 64)) {
 	if (logfile) {
 	    fprintf (logfile, "ERROR: gdbstub_fe.main_gdbstub: invalid RVnn; nn should be 32 or 64 only\n");
 	}
@@ -1560,6 +4193,21 @@ void *main_gdbstub (void *arg)
 	goto done;
     }
 
+    gdbstub_trace_init (logfile);
+    gdbstub_rtos_init (logfile);
+    gdbstub_watch_init (logfile);
+    gdbstub_sample_init (logfile, send_console_output);
+    gdbstub_rtt_init (logfile, send_console_output);
+    gdbstub_record_init (logfile, record_preempted);
+    gdbstub_etrace_init (logfile);
+    gdbstub_be_register_invalidate (target_state_invalidate);
+    hart_reset_notice   = false;
+    write_error_pending = false;
+
+    rx_len      = 0;
+    no_ack_mode = false;
+    ack_pending = 0;
+
     // Receive initial '+' from GDB
     char ch = recv_ack_nak ();
     if (ch != '+') {
@@ -1577,15 +4225,23 @@ void *main_gdbstub (void *arg)
             // give enough time for the continue command to start the CPU
             usleep (10);
 	    uint8_t stop_reason;
-	    int sr = gdbstub_be_get_stop_reason (gdbstub_be_xlen, & stop_reason, true);
+	    int sr = gdbstub_be_get_stop_reason (gdbstub_be_xlen (), & stop_reason, true);
 	    if (sr == 0) {
-		send_stop_reason (stop_reason);
-		waiting_for_stop_reason = false;
+		// Tracepoint hits are handled (and the hart resumed) without GDB,
+		// and so are steps that stay within a range being stepped
+		if (! ((gdbstub_trace_running () && gdbstub_trace_on_halt (gdbstub_be_xlen ()))
+		       || range_step_continue ())) {
+		    if (note_watch_hit ())
+			stop_reason = 0x05;
+		    hart_reset_notify ();
+		    send_stop_reason (stop_reason);
+		    waiting_for_stop_reason = false;
+		}
 	    }
 	    else if (sr == -1) {
                 // Timeout - interrupt the CPU. Send a "stop" command to the
                 // CPU.
-                uint32_t status = gdbstub_be_stop (gdbstub_be_xlen);
+		uint32_t status = gdbstub_be_stop (gdbstub_be_xlen ());
                 if (status != status_ok) {
                     send_OK_or_error_response (status_err);
 		    waiting_for_stop_reason = false;
@@ -1596,6 +4252,9 @@ void *main_gdbstub (void *arg)
 	    else {
 		// HW has not stopped yet
 		assert (sr == -2);
+		// Halt it if an emulated watchpoint was hit
+		if (gdbstub_watch_emulating () && gdbstub_watch_poll (gdbstub_be_xlen ()))
+		    gdbstub_be_stop (gdbstub_be_xlen ());
 		// if (logfile) {
 		//     fprintf (logfile, "main_gdbstub: HW has not stopped yet.\n");
 		// }
@@ -1621,6 +4280,10 @@ void *main_gdbstub (void *arg)
 	    // if (logfile) {
 	    //     fprintf (logfile, "Complete packet not yet arrived from GDB\n");
 	    // }
+	    if (gdbstub_sample_running () || gdbstub_rtt_running ())
+		write_combine_sync ();
+	    gdbstub_sample_tick (gdbstub_be_xlen (), waiting_for_stop_reason);
+	    gdbstub_rtt_tick (gdbstub_be_xlen (), waiting_for_stop_reason);
 	    usleep (10);
 	    continue;
 	} else {
@@ -1628,9 +4291,20 @@ void *main_gdbstub (void *arg)
 	    // if (logfile) {
 	    //     fprint_bytes (logfile, "RX from GDB: '", gdb_rsp_pkt_buf, n - 1, "'\n");
 	    // }
-	    if (gdb_rsp_pkt_buf [0] == control_C) {
+	    if (gdb_rsp_pkt_buf [0] != 'X')
+		write_combine_sync ();
+	    if (deferred_write_error (gdb_rsp_pkt_buf)) {
+		send_OK_or_error_response (status_err);
+	    }
+	    else if (gdb_rsp_pkt_buf [0] == control_C) {
                 handle_RSP_control_C (gdb_rsp_pkt_buf, n);
             }
+	    else if (gdb_rsp_pkt_buf [0] == '!') {
+		handle_RSP_extended_mode (gdb_rsp_pkt_buf, n);
+	    }
+	    else if (gdb_rsp_pkt_buf [0] == 'b') {
+		handle_RSP_b_reverse (gdb_rsp_pkt_buf, n);
+	    }
             else if (gdb_rsp_pkt_buf [0] == '?') {
                 handle_RSP_stop_reason (gdb_rsp_pkt_buf, n);
             }
@@ -1646,6 +4320,12 @@ void *main_gdbstub (void *arg)
             else if (gdb_rsp_pkt_buf [0] == 'G') {
                 handle_RSP_G_write_all_registers (gdb_rsp_pkt_buf, n);
             }
+	    else if ((gdb_rsp_pkt_buf [0] == 'H') && (n > 2)) {
+		handle_RSP_H_set_thread (gdb_rsp_pkt_buf, n);
+	    }
+	    else if (gdb_rsp_pkt_buf [0] == 'j') {
+		handle_RSP_j (gdb_rsp_pkt_buf, n);
+	    }
             else if (gdb_rsp_pkt_buf [0] == 'm') {
                 handle_RSP_m_read_mem (gdb_rsp_pkt_buf, n);
             }
@@ -1661,9 +4341,24 @@ void *main_gdbstub (void *arg)
             else if (gdb_rsp_pkt_buf [0] == 'q') {
                 handle_RSP_q (gdb_rsp_pkt_buf, n);
             }
+	    else if (gdb_rsp_pkt_buf [0] == 'Q') {
+		handle_RSP_Q (gdb_rsp_pkt_buf, n);
+	    }
+	    else if (gdb_rsp_pkt_buf [0] == 'R') {
+		handle_RSP_R_restart (gdb_rsp_pkt_buf, n);
+	    }
             else if (gdb_rsp_pkt_buf [0] == 's') {
                 handle_RSP_s_step (gdb_rsp_pkt_buf, n);
             }
+	    else if (gdb_rsp_pkt_buf [0] == 'T') {
+		handle_RSP_T_thread_alive (gdb_rsp_pkt_buf, n);
+	    }
+	    else if (gdb_rsp_pkt_buf [0] == 'v') {
+		handle_RSP_v (gdb_rsp_pkt_buf, n);
+	    }
+	    else if ((gdb_rsp_pkt_buf [0] == 'Z') || (gdb_rsp_pkt_buf [0] == 'z')) {
+		handle_RSP_Z (gdb_rsp_pkt_buf, n);
+	    }
             else if (gdb_rsp_pkt_buf [0] == 'X') {
                 handle_RSP_X_write_mem_bin_data (gdb_rsp_pkt_buf, n);
             }
@@ -1675,10 +4370,17 @@ void *main_gdbstub (void *arg)
 
                 send_RSP_packet_to_GDB ("", 0);
             }
+	    flush_ack ();
         }
     }
 
 done:
+    write_combine_sync ();
+    if (gdbstub_sample_running ())
+	gdbstub_sample_stop ();
+    if (gdbstub_rtt_running ())
+	gdbstub_rtt_stop ();
+
     if (params->autoclose_logfile_stop_fd) {
 	if (logfile) {
 	    fclose (logfile);
@@ -1696,6 +4398,17 @@ bool gdbstub_be_poll_preempt (bool include_commands)
     struct pollfd fds[2];
     nfds_t nfds = 0;
 
+    // While waiting for the hart to halt (GDB is waiting for a stop
+    // reply), take samples, drain RTT buffers and poll emulated watchpoints
+    if (include_commands) {
+	gdbstub_sample_tick (gdbstub_be_xlen (), true);
+	gdbstub_rtt_tick (gdbstub_be_xlen (), true);
+	if (gdbstub_watch_emulating () && gdbstub_watch_poll (gdbstub_be_xlen ()))
+	    return true;
+	if (control_C_pending || (rx_len != 0))
+	    return true;
+    }
+
     if (include_commands) {
 	fds[nfds].fd = gdb_fd;
 	fds[nfds].events = POLLIN | POLLHUP;
@@ -0,0 +1,763 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Execution recording, for reverse execution (see gdbstub_record.h)
+
+// ================================================================
+// C lib includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+// ----------------
+// Local includes
+
+#include "gdbstub_be.h"
+#include "gdbstub_watch.h"
+#include "gdbstub_record.h"
+
+// ****************************************************************
+// Private definitions
+
+// Default and max size of the log, in bytes
+#define RECORD_LOG_SIZE_DEFAULT   (4 * 1024 * 1024)
+#define RECORD_LOG_SIZE_MAX       (256 * 1024 * 1024)
+
+#define CSR_ADDR_MISA             0x301
+
+// Instructions cached, by PC (a power of 2)
+#define RECORD_ICACHE_SIZE        4096
+
+// Instructions run (forward or backward) between checks for a ^C
+#define RECORD_POLL_INTERVAL      256
+
+// RISC-V ebreak and c.ebreak encodings
+#define INSTR_EBREAK    0x00100073
+#define INSTR_C_EBREAK  0x9002
+
+static FILE *logfile_fp = NULL;
+static bool (*preempted) (void) = NULL;
+
+// ================================================================
+// What an instruction writes (decode ())
+
+typedef struct {
+    bool      known;         // all its effects are the ones below
+    uint8_t   len;           // 2 or 4 bytes
+    uint8_t   gpr;           // 0 if none
+    int8_t    fpr;           // -1 if none
+    int32_t   csr;           // -1 if none
+    uint8_t   mem_len;       // bytes stored, 0 if none
+    uint8_t   mem_base;      // the store address is x[mem_base] + mem_offset
+    int64_t   mem_offset;
+} Decoded;
+
+// ================================================================
+// The log
+
+// Each entry is:
+//     uint8_t  length of the entry, in bytes
+//     uint8_t  flags (REC_...)
+//     REC_GPR: uint8_t regnum, old value (XLEN/8 bytes)
+//     REC_FPR: uint8_t regnum, old value (8 bytes)
+//     REC_CSR: uint16_t csr, old value (XLEN/8 bytes)
+//     REC_MEM: address (XLEN/8 bytes), uint8_t len, old bytes
+//     PC of the instruction (XLEN/8 bytes), unless REC_SEQ2 or REC_SEQ4
+//     uint8_t  length of the entry, again (to pop it from the end)
+// Multi-byte fields are little-endian.  The log is a ring of bytes;
+// entries can wrap around its end.
+
+#define REC_GPR    0x01
+#define REC_FPR    0x02
+#define REC_CSR    0x04
+#define REC_MEM    0x08
+#define REC_SEQ2   0x10    // the next PC was PC + 2 (PC is not stored)
+#define REC_SEQ4   0x20    // the next PC was PC + 4 (PC is not stored)
+
+#define REC_ENTRY_MAX   64
+
+static bool      recording = false;
+static uint32_t  rec_hart;
+static uint8_t  *rlog      = NULL;
+static uint64_t  rlog_size = 0;
+static uint64_t  rlog_head;         // offset just past the newest entry (not wrapped)
+static uint64_t  rlog_tail;         // offset of the oldest entry (not wrapped)
+static uint64_t  n_entries;
+
+// Statistics
+static uint64_t  n_recorded;
+static uint64_t  n_dropped;         // oldest entries, when the log was full
+static uint64_t  n_undone;
+static uint64_t  n_fetches;         // instruction cache misses
+static uint64_t  n_unknown;         // instructions not decoded
+static uint64_t  n_forgotten;       // entries before them
+
+// The hart's GPRs and PC, as far as we know them (see sync_regs ())
+static uint64_t  gprs [32];
+static uint64_t  pc;
+
+// misa.F and misa.D: c.flw/c.fsw and c.fld/c.fsd exist (without them,
+// Zcmp/Zcmt and other extensions reuse those encodings)
+static bool      misa_f;
+static bool      misa_d;
+
+// ================================================================
+// Instruction cache
+
+typedef struct {
+    bool      valid;
+    uint64_t  pc;
+    uint32_t  instr;
+} ICache_Entry;
+
+static ICache_Entry icache [RECORD_ICACHE_SIZE];
+
+static
+uint32_t fetch (const uint8_t xlen, uint64_t addr, uint32_t *p_instr)
+{
+    ICache_Entry *p_e = & (icache [(addr >> 1) & (RECORD_ICACHE_SIZE - 1)]);
+    if (p_e->valid && (p_e->pc == addr)) {
+	*p_instr = p_e->instr;
+	return status_ok;
+    }
+
+    // Read 2 bytes first: a compressed instruction may end a memory region
+    uint8_t bytes [4];
+    if (gdbstub_be_mem_read (xlen, addr, (char *) bytes, 2) != status_ok)
+	return status_err;
+    uint32_t instr = (((uint32_t) bytes [1]) << 8) | bytes [0];
+    if ((instr & 0x3) == 0x3) {
+	if (gdbstub_be_mem_read (xlen, addr + 2, (char *) & (bytes [2]), 2) != status_ok)
+	    return status_err;
+	instr |= (((uint32_t) bytes [3]) << 24) | (((uint32_t) bytes [2]) << 16);
+    }
+    n_fetches++;
+
+    p_e->valid = true;
+    p_e->pc    = addr;
+    p_e->instr = instr;
+    *p_instr   = instr;
+    return status_ok;
+}
+
+// ================================================================
+
+static
+int64_t sign_extend (uint64_t x, uint32_t bits)
+{
+    uint64_t m = ((uint64_t) 1) << (bits - 1);
+    return (int64_t) ((x ^ m) - m);
+}
+
+static
+uint64_t xlen_mask (const uint8_t xlen)
+{
+    return ((xlen == 32) ? 0xFFFFFFFFULL : 0xFFFFFFFFFFFFFFFFULL);
+}
+
+// ================================================================
+// Decode what an instruction writes.  Encodings not listed here (vector,
+// custom, Zcb stores, Zcmp, ...) are left with known = false: record_one
+// cannot undo them, and re-reads all the registers after them.
+
+static
+void decode (const uint8_t xlen, uint32_t instr, Decoded *p_d)
+{
+    memset (p_d, 0, sizeof (Decoded));
+    p_d->known = true;
+    p_d->fpr   = -1;
+    p_d->csr   = -1;
+
+    if ((instr & 0x3) == 0x3) {
+	uint32_t opcode = instr & 0x7F;
+	uint8_t  rd     = (instr >> 7) & 0x1F;
+	uint32_t funct3 = (instr >> 12) & 0x7;
+	uint32_t funct5 = instr >> 27;
+	uint8_t  rs1    = (instr >> 15) & 0x1F;
+
+	p_d->len = 4;
+	switch (opcode) {
+	case 0x37: case 0x17: case 0x6F: case 0x67:    // LUI, AUIPC, JAL, JALR
+	case 0x03: case 0x13: case 0x1B:               // LOAD, OP-IMM, OP-IMM-32
+	case 0x33: case 0x3B:                          // OP, OP-32
+	    p_d->gpr = rd;
+	    break;
+
+	case 0x07:                                     // LOAD-FP (funct3 0, 4..7: vector, flq)
+	    if ((funct3 >= 1) && (funct3 <= 3))
+		p_d->fpr = (int8_t) rd;
+	    else
+		p_d->known = false;
+	    break;
+
+	case 0x43: case 0x47: case 0x4B: case 0x4F:    // FMADD, FMSUB, FNMSUB, FNMADD
+	    p_d->fpr = (int8_t) rd;
+	    break;
+
+	case 0x53:                                     // OP-FP
+	    // Compares, conversions to integer, fmv.x and fclass write a GPR
+	    if ((funct5 == 0x14) || (funct5 == 0x18) || (funct5 == 0x1C))
+		p_d->gpr = rd;
+	    else
+		p_d->fpr = (int8_t) rd;
+	    break;
+
+	case 0x23:                                     // STORE
+	case 0x27:                                     // STORE-FP (funct3 0, 4..7: vector, fsq)
+	    if ((funct3 <= 3) && ((opcode == 0x23) || (funct3 != 0))) {
+		p_d->mem_len    = (uint8_t) (1 << funct3);
+		p_d->mem_base   = rs1;
+		p_d->mem_offset = sign_extend (((instr >> 25) << 5) | ((instr >> 7) & 0x1F), 12);
+	    }
+	    else
+		p_d->known = false;
+	    break;
+
+	case 0x2F:                                     // AMOs, LR, SC
+	    p_d->gpr = rd;
+	    if (funct3 > 3)
+		p_d->known = false;
+	    else if (funct5 != 0x02) {                 // LR does not store
+		p_d->mem_len  = (uint8_t) (1 << funct3);
+		p_d->mem_base = rs1;
+	    }
+	    break;
+
+	case 0x63:                                     // BRANCH
+	    break;
+
+	case 0x0F:                                     // MISC-MEM (funct3 2: cbo.*)
+	    p_d->known = (funct3 != 2);
+	    break;
+
+	case 0x73:                                     // SYSTEM (funct3 4: hypervisor loads/stores)
+	    if (funct3 == 4)
+		p_d->known = false;
+	    else if (funct3 != 0) {
+		p_d->gpr = rd;
+		// csrrw[i] always write the CSR; csrrs[i], csrrc[i] unless rs1/uimm is 0
+		if (((funct3 & 0x3) == 1) || (rs1 != 0))
+		    p_d->csr = (int32_t) (instr >> 20);
+	    }
+	    break;
+
+	default:
+	    // OP-V, custom-0..3, ...
+	    p_d->known = false;
+	    break;
+	}
+    }
+    else {
+	uint32_t quadrant = instr & 0x3;
+	uint32_t funct3   = (instr >> 13) & 0x7;
+	uint8_t  rd       = (instr >> 7) & 0x1F;          // rd/rs1 (CI, CR)
+	uint8_t  rd_c     = 8 + ((instr >> 2) & 0x7);     // rd' (CIW, CL)
+	uint8_t  rs1_c    = 8 + ((instr >> 7) & 0x7);     // rs1' (CL, CS, CB, CA)
+	uint8_t  rs2      = (instr >> 2) & 0x1F;
+	bool     rv32     = (xlen == 32);
+
+	p_d->len = 2;
+	if (quadrant == 0) {
+	    // Store offsets: 4 bytes (c.sw, c.fsw) and 8 bytes (c.sd, c.fsd)
+	    uint32_t off_w = (((instr >> 10) & 0x7) << 3) | (((instr >> 6) & 0x1) << 2) | (((instr >> 5) & 0x1) << 6);
+	    uint32_t off_d = (((instr >> 10) & 0x7) << 3) | (((instr >> 5) & 0x3) << 6);
+	    switch (funct3) {
+	    case 0: case 2: p_d->gpr = rd_c; break;                              // c.addi4spn, c.lw
+	    case 1:         p_d->fpr = (int8_t) rd_c; break;                     // c.fld
+	    case 3:         if (rv32) p_d->fpr = (int8_t) rd_c;                  // c.flw
+			    else      p_d->gpr = rd_c;                           // c.ld
+			    break;
+	    case 5:         p_d->mem_len = 8; p_d->mem_offset = off_d; break;    // c.fsd
+	    case 6:         p_d->mem_len = 4; p_d->mem_offset = off_w; break;    // c.sw
+	    case 7:         if (rv32) { p_d->mem_len = 4; p_d->mem_offset = off_w; }    // c.fsw
+			    else      { p_d->mem_len = 8; p_d->mem_offset = off_d; }    // c.sd
+			    break;
+	    default:        p_d->known = false; break;                           // Zcb
+	    }
+	    if ((instr == 0)
+		|| (((funct3 == 1) || (funct3 == 5)) && (! misa_d))
+		|| (((funct3 == 3) || (funct3 == 7)) && rv32 && (! misa_f)))
+		p_d->known = false;
+	    p_d->mem_base = rs1_c;
+	}
+	else if (quadrant == 1) {
+	    switch (funct3) {
+	    case 0: case 2: case 3: p_d->gpr = rd; break;               // c.addi, c.li, c.lui/c.addi16sp
+	    case 1:                 p_d->gpr = (rv32 ? 1 : rd); break;  // c.jal / c.addiw
+	    case 4:                 p_d->gpr = rs1_c; break;            // c.srli ... c.and
+	    default:                break;                              // c.j, c.beqz, c.bnez
+	    }
+	}
+	else {
+	    // sp-relative store offsets: 4 bytes (c.swsp, c.fswsp) and 8 bytes (c.sdsp, c.fsdsp)
+	    uint32_t off_w = (((instr >> 9) & 0xF) << 2) | (((instr >> 7) & 0x3) << 6);
+	    uint32_t off_d = (((instr >> 10) & 0x7) << 3) | (((instr >> 7) & 0x7) << 6);
+	    switch (funct3) {
+	    case 0: case 2: p_d->gpr = rd; break;                                // c.slli, c.lwsp
+	    case 1:         p_d->fpr = (int8_t) rd; break;                       // c.fldsp
+	    case 3:         if (rv32) p_d->fpr = (int8_t) rd;                    // c.flwsp
+			    else      p_d->gpr = rd;                             // c.ldsp
+			    break;
+	    case 4:         if (rs2 != 0)
+				p_d->gpr = rd;                                   // c.mv, c.add
+			    else if ((((instr >> 12) & 0x1) != 0) && (rd != 0))
+				p_d->gpr = 1;                                    // c.jalr
+			    break;                                               // c.jr, c.ebreak
+	    case 5:         p_d->mem_len = 8; p_d->mem_offset = off_d; break;    // c.fsdsp
+	    case 6:         p_d->mem_len = 4; p_d->mem_offset = off_w; break;    // c.swsp
+	    case 7:         if (rv32) { p_d->mem_len = 4; p_d->mem_offset = off_w; }    // c.fswsp
+			    else      { p_d->mem_len = 8; p_d->mem_offset = off_d; }    // c.sdsp
+			    break;
+	    }
+	    p_d->mem_base = 2;
+	    // Without D, funct3 1 and 5 may be Zcmp (cm.push, cm.pop, ...) or Zcmt
+	    if ((((funct3 == 1) || (funct3 == 5)) && (! misa_d))
+		|| (((funct3 == 3) || (funct3 == 7)) && rv32 && (! misa_f)))
+		p_d->known = false;
+	}
+    }
+}
+
+// ================================================================
+// Entry fields
+
+static
+void put_field (uint8_t *rec, size_t *p_n, uint64_t val, size_t n_bytes)
+{
+    for (size_t j = 0; j < n_bytes; j++)
+	rec [(*p_n)++] = (uint8_t) (val >> (8 * j));
+}
+
+static
+uint64_t get_field (const uint8_t *rec, size_t *p_n, size_t n_bytes)
+{
+    uint64_t val = 0;
+    for (size_t j = 0; j < n_bytes; j++)
+	val |= ((uint64_t) rec [(*p_n)++]) << (8 * j);
+    return val;
+}
+
+// ================================================================
+// Append an entry to the log, dropping the oldest ones if it is full
+
+static
+void log_push (const uint8_t *rec, size_t len)
+{
+    while ((rlog_head - rlog_tail + len) > rlog_size) {
+	rlog_tail += rlog [rlog_tail % rlog_size];
+	n_entries--;
+	n_dropped++;
+    }
+    for (size_t j = 0; j < len; j++)
+	rlog [(rlog_head + j) % rlog_size] = rec [j];
+    rlog_head += len;
+    n_entries++;
+}
+
+// Remove the newest entry from the log, into rec.  Returns its length
+// (0 if the log is empty).
+
+static
+size_t log_pop (uint8_t *rec)
+{
+    if (rlog_head == rlog_tail)
+	return 0;
+    size_t len = rlog [(rlog_head - 1) % rlog_size];
+    rlog_head -= len;
+    for (size_t j = 0; j < len; j++)
+	rec [j] = rlog [(rlog_head + j) % rlog_size];
+    n_entries--;
+    return len;
+}
+
+// ================================================================
+// Refresh our copy of the GPRs and the PC (GDB may have written them)
+
+static
+uint32_t sync_regs (const uint8_t xlen)
+{
+    if ((gdbstub_be_GPRs_read (xlen, gprs) != status_ok)
+	|| (gdbstub_be_PC_read (xlen, & pc) != status_ok))
+	return status_err;
+    gprs [0] = 0;
+    return status_ok;
+}
+
+// ================================================================
+// Wait for the hart to halt after a step; a ^C from GDB halts it
+
+static
+uint32_t wait_for_halt (const uint8_t xlen, uint8_t *p_stop_reason)
+{
+    while (true) {
+	int32_t sr = gdbstub_be_get_stop_reason (xlen, p_stop_reason, false);
+	if (sr == 0)
+	    return status_ok;
+	if ((sr == -1) || ((preempted != NULL) && preempted ()))
+	    if (gdbstub_be_stop (xlen) != status_ok)
+		return status_err;
+    }
+}
+
+// ================================================================
+// Step the hart over one instruction, recording it.
+// *p_stop is RECORD_STOP_STEP if it was executed, RECORD_STOP_WATCH if
+// it also hit a write watchpoint, and RECORD_STOP_HALT if the hart
+// halted for another reason instead (and nothing was recorded).
+
+static
+uint32_t record_one (const uint8_t xlen, Record_Stop *p_stop, uint8_t *p_stop_reason, uint64_t *p_watch_addr)
+{
+    const size_t xb = xlen / 8;
+    uint8_t      rec [REC_ENTRY_MAX];
+    size_t       n = 2;
+    uint8_t      flags = 0;
+    uint32_t     instr;
+    Decoded      d;
+    uint64_t     val;
+    uint64_t     mem_addr = 0;
+
+    if (fetch (xlen, pc, & instr) != status_ok)
+	return status_err;
+    decode (xlen, instr, & d);
+
+    // An instruction we do not fully decode may write anything: step
+    // it, re-read all the registers, and forget the history before it
+    // (which could no longer be undone correctly)
+    if (! d.known) {
+	if ((gdbstub_be_step (xlen) != status_ok)
+	    || (wait_for_halt (xlen, p_stop_reason) != status_ok))
+	    return status_err;
+	if (! gdbstub_be_stopped_by_step ()) {
+	    *p_stop = RECORD_STOP_HALT;
+	    return status_ok;
+	}
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp,
+		     "WARNING: gdbstub_record: instruction 0x%0x at 0x%0" PRIx64 " not decoded;"
+		     " forgetting %0" PRId64 " recorded instructions\n",
+		     instr, pc, n_entries);
+	    fflush (logfile_fp);
+	}
+	n_forgotten += n_entries;
+	n_entries    = 0;
+	rlog_tail    = rlog_head;
+	n_unknown++;
+	*p_stop = RECORD_STOP_STEP;
+	return sync_regs (xlen);
+    }
+
+    // The old values of whatever the instruction writes
+    if (d.gpr != 0) {
+	flags |= REC_GPR;
+	put_field (rec, & n, d.gpr, 1);
+	put_field (rec, & n, gprs [d.gpr], xb);
+    }
+    if ((d.fpr >= 0) && (gdbstub_be_FPR_read (xlen, (uint8_t) d.fpr, & val) == status_ok)) {
+	flags |= REC_FPR;
+	put_field (rec, & n, (uint64_t) d.fpr, 1);
+	put_field (rec, & n, val, 8);
+    }
+    if ((d.csr >= 0) && (gdbstub_be_CSR_read (xlen, (uint16_t) d.csr, & val) == status_ok)) {
+	flags |= REC_CSR;
+	put_field (rec, & n, (uint64_t) d.csr, 2);
+	put_field (rec, & n, val, xb);
+    }
+    if (d.mem_len != 0) {
+	mem_addr = (gprs [d.mem_base] + (uint64_t) d.mem_offset) & xlen_mask (xlen);
+	if (gdbstub_be_mem_read (xlen, mem_addr, (char *) & (rec [n + xb + 1]), d.mem_len) == status_ok) {
+	    flags |= REC_MEM;
+	    put_field (rec, & n, mem_addr, xb);
+	    put_field (rec, & n, d.mem_len, 1);
+	    n += d.mem_len;
+	}
+    }
+
+    // Step
+    if ((gdbstub_be_step (xlen) != status_ok)
+	|| (wait_for_halt (xlen, p_stop_reason) != status_ok))
+	return status_err;
+    if (! gdbstub_be_stopped_by_step ()) {
+	*p_stop = RECORD_STOP_HALT;
+	return status_ok;
+    }
+
+    // The new PC and destination register
+    uint64_t instr_pc = pc;
+    if (gdbstub_be_PC_read (xlen, & pc) != status_ok)
+	return status_err;
+    if ((d.gpr != 0) && (gdbstub_be_GPR_read (xlen, d.gpr, & (gprs [d.gpr])) != status_ok))
+	return status_err;
+
+    if (pc == ((instr_pc + d.len) & xlen_mask (xlen)))
+	flags |= ((d.len == 2) ? REC_SEQ2 : REC_SEQ4);
+    else
+	put_field (rec, & n, instr_pc, xb);
+    rec [0] = (uint8_t) (n + 1);
+    rec [1] = flags;
+    rec [n] = (uint8_t) (n + 1);
+    log_push (rec, n + 1);
+    n_recorded++;
+
+    *p_stop = RECORD_STOP_STEP;
+    if (((flags & REC_MEM) != 0) && gdbstub_watch_store_hits (mem_addr, d.mem_len, p_watch_addr))
+	*p_stop = RECORD_STOP_WATCH;
+    return status_ok;
+}
+
+// ================================================================
+// Undo the newest entry of the log (which must not be empty).
+// GPRs are only changed in gprs [] (and marked in *p_dirty);
+// everything else is written back to the hart.
+
+static
+uint32_t undo_one (const uint8_t xlen, uint32_t *p_dirty, Record_Stop *p_stop, uint64_t *p_watch_addr)
+{
+    const size_t xb = xlen / 8;
+    uint8_t      rec [REC_ENTRY_MAX];
+    size_t       n = 1;
+
+    log_pop (rec);
+    uint8_t flags = rec [n++];
+
+    if ((flags & REC_GPR) != 0) {
+	uint8_t r = (uint8_t) get_field (rec, & n, 1);
+	gprs [r]  = get_field (rec, & n, xb);
+	*p_dirty |= (1u << r);
+    }
+    if ((flags & REC_FPR) != 0) {
+	uint8_t  r   = (uint8_t) get_field (rec, & n, 1);
+	uint64_t val = get_field (rec, & n, 8);
+	if (gdbstub_be_FPR_write (xlen, r, val) != status_ok)
+	    return status_err;
+    }
+    if ((flags & REC_CSR) != 0) {
+	uint16_t csr = (uint16_t) get_field (rec, & n, 2);
+	uint64_t val = get_field (rec, & n, xb);
+	// Some CSRs, or some of their bits, may not be writable by the debugger
+	if ((gdbstub_be_CSR_write (xlen, csr, val) != status_ok) && (logfile_fp != NULL)) {
+	    fprintf (logfile_fp, "WARNING: gdbstub_record: could not restore CSR 0x%0x\n", csr);
+	    fflush (logfile_fp);
+	}
+    }
+    if ((flags & REC_MEM) != 0) {
+	uint64_t addr = get_field (rec, & n, xb);
+	uint8_t  len  = (uint8_t) get_field (rec, & n, 1);
+	if (gdbstub_be_mem_write (xlen, addr, (const char *) & (rec [n]), len) != status_ok)
+	    return status_err;
+	n += len;
+	if (gdbstub_watch_store_hits (addr, len, p_watch_addr))
+	    *p_stop = RECORD_STOP_WATCH;
+    }
+
+    if ((flags & REC_SEQ2) != 0)
+	pc = (pc - 2) & xlen_mask (xlen);
+    else if ((flags & REC_SEQ4) != 0)
+	pc = (pc - 4) & xlen_mask (xlen);
+    else
+	pc = get_field (rec, & n, xb);
+
+    n_undone++;
+    return status_ok;
+}
+
+// True if GDB has a breakpoint at addr (a trigger, or an ebreak it wrote)
+
+static
+bool breakpoint_at (const uint8_t xlen, uint64_t addr)
+{
+    uint32_t instr;
+    if (gdbstub_watch_break_at (addr))
+	return true;
+    if (fetch (xlen, addr, & instr) != status_ok)
+	return false;
+    return ((instr == INSTR_EBREAK) || (instr == INSTR_C_EBREAK));
+}
+
+// ****************************************************************
+// Public API
+
+// Invalidation hook (see gdbstub_be_register_invalidate): after a hart
+// reset the log cannot take the hart back to where it was
+static
+void record_invalidate (const uint8_t xlen, const bool hart_reset)
+{
+    if ((! recording) || (! hart_reset))
+	return;
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_record: hart reset; forgetting %0" PRId64 " recorded instructions\n",
+		 n_entries);
+	fflush (logfile_fp);
+    }
+    n_forgotten += n_entries;
+    n_entries    = 0;
+    rlog_tail    = rlog_head;
+    gdbstub_record_forget_code ();
+}
+
+void gdbstub_record_init (FILE *logfile, bool (*preempted_fn) (void))
+{
+    logfile_fp = logfile;
+    preempted  = preempted_fn;
+    if (recording)
+	gdbstub_record_stop ();
+    gdbstub_be_register_invalidate (record_invalidate);
+}
+
+// ================================================================
+
+uint32_t gdbstub_record_start (const uint8_t xlen, uint64_t log_size)
+{
+    if (log_size == 0)
+	log_size = RECORD_LOG_SIZE_DEFAULT;
+    if (recording || (log_size < 1024) || (log_size > RECORD_LOG_SIZE_MAX))
+	return status_err;
+
+    rlog = (uint8_t *) malloc (log_size);
+    if (rlog == NULL)
+	return status_err;
+
+    rlog_size   = log_size;
+    rlog_head   = 0;
+    rlog_tail   = 0;
+    n_entries   = 0;
+    n_recorded  = 0;
+    n_dropped   = 0;
+    n_undone    = 0;
+    n_fetches   = 0;
+    n_unknown   = 0;
+    n_forgotten = 0;
+    rec_hart    = gdbstub_be_selected_hart ();
+
+    uint64_t misa = 0;
+    gdbstub_be_CSR_read (xlen, CSR_ADDR_MISA, & misa);    // 0 (unknown) if it fails
+    misa_f = (((misa >> 5) & 1) != 0);
+    misa_d = (((misa >> 3) & 1) != 0);
+    gdbstub_record_forget_code ();
+    recording  = true;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_record_start: hart %0d, RV%0d, log of %0" PRId64 " bytes\n",
+		 rec_hart, xlen, log_size);
+	fflush (logfile_fp);
+    }
+    return status_ok;
+}
+
+uint32_t gdbstub_record_stop (void)
+{
+    if (! recording)
+	return status_err;
+    free (rlog);
+    rlog      = NULL;
+    recording = false;
+    return status_ok;
+}
+
+bool gdbstub_record_active (void)
+{
+    return recording;
+}
+
+void gdbstub_record_status (char *buf, const size_t buf_size)
+{
+    if (! recording) {
+	snprintf (buf, buf_size, "Not recording\n");
+	return;
+    }
+    snprintf (buf, buf_size,
+	      "Recording hart %0d: %0" PRId64 " instructions in the log (%0" PRId64 " of %0" PRId64 " bytes)\n"
+	      "    %0" PRId64 " recorded, %0" PRId64 " undone, %0" PRId64 " dropped (log full);"
+	      " %0" PRId64 " instruction fetches\n"
+	      "    %0" PRId64 " instructions not decoded (%0" PRId64 " recorded before them forgotten)\n",
+	      rec_hart, n_entries, rlog_head - rlog_tail, rlog_size,
+	      n_recorded, n_undone, n_dropped, n_fetches, n_unknown, n_forgotten);
+}
+
+void gdbstub_record_forget_code (void)
+{
+    memset (icache, 0, sizeof (icache));
+}
+
+// ================================================================
+// Forward
+
+uint32_t gdbstub_record_run (const uint8_t xlen, Record_Run run, uint64_t start, uint64_t end,
+			     Record_Stop *p_stop, uint8_t *p_stop_reason, uint64_t *p_watch_addr)
+{
+    if ((! recording) || (gdbstub_be_selected_hart () != rec_hart))
+	return status_err;
+    if (sync_regs (xlen) != status_ok)
+	return status_err;
+
+    *p_stop_reason = 0x05;
+    for (uint64_t j = 1; true; j++) {
+	uint32_t status = record_one (xlen, p_stop, p_stop_reason, p_watch_addr);
+	if (status != status_ok)
+	    return status;
+	if ((*p_stop != RECORD_STOP_STEP)
+	    || (run == RECORD_RUN_STEP)
+	    || ((run == RECORD_RUN_RANGE) && ((pc < start) || (pc >= end))))
+	    break;
+	if (((j % RECORD_POLL_INTERVAL) == 0) && (preempted != NULL) && preempted ()) {
+	    *p_stop        = RECORD_STOP_INTERRUPT;
+	    *p_stop_reason = 0x02;
+	    break;
+	}
+    }
+    return status_ok;
+}
+
+// ================================================================
+// Backward
+
+uint32_t gdbstub_record_reverse (const uint8_t xlen, bool cont,
+				 Record_Stop *p_stop, uint64_t *p_watch_addr)
+{
+    *p_stop = RECORD_STOP_BEGIN;
+    if (! recording)
+	return status_ok;
+    if (gdbstub_be_selected_hart () != rec_hart)
+	return status_err;
+    if (sync_regs (xlen) != status_ok)
+	return status_err;
+
+    uint32_t status = status_ok;
+    uint32_t dirty  = 0;
+    for (uint64_t j = 1; rlog_head != rlog_tail; j++) {
+	*p_stop = RECORD_STOP_STEP;
+	status  = undo_one (xlen, & dirty, p_stop, p_watch_addr);
+	if ((status != status_ok) || (! cont) || (*p_stop != RECORD_STOP_STEP))
+	    break;
+	if (breakpoint_at (xlen, pc)) {
+	    *p_stop = RECORD_STOP_BREAK;
+	    break;
+	}
+	if (((j % RECORD_POLL_INTERVAL) == 0) && (preempted != NULL) && preempted ()) {
+	    *p_stop = RECORD_STOP_INTERRUPT;
+	    break;
+	}
+	*p_stop = RECORD_STOP_BEGIN;
+    }
+
+    // Write back the GPRs and the PC
+    for (uint8_t r = 1; r < 32; r++)
+	if (((dirty >> r) & 1) && (gdbstub_be_GPR_write (xlen, r, gprs [r]) != status_ok))
+	    status = status_err;
+    if (gdbstub_be_PC_write (xlen, pc) != status_ok)
+	status = status_err;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_record_reverse: %s => stop %0d at 0x%0" PRIx64 ", %0" PRId64 " entries left\n",
+		 (cont ? "bc" : "bs"), *p_stop, pc, n_entries);
+	fflush (logfile_fp);
+    }
+    return status;
+}
+
+// ================================================================
@@ -0,0 +1,98 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Execution recording, for reverse execution (GDB's 'bs' and 'bc').
+
+// While recording is on, the front end runs the selected hart forward
+// ('s', 'c', vCont) through this module, which single-steps it in a
+// loop here in the stub.  Before each instruction it decodes the
+// instruction (fetched once per PC, then cached) to find what it will
+// write: a GPR, an FPR, a CSR (CSR instructions) or memory (stores and
+// AMOs), and appends their old values to a delta log.  The stub keeps
+// its own copy of the GPRs, so a typical step costs the step itself,
+// a PC read and a read of the destination register.
+
+// Reverse execution pops entries off the log and writes the old values
+// back into the hart (GPRs and the PC only once, at the end), so that
+// it really is back at an earlier state.  Running forward again after
+// that re-executes (and re-records) on the hart.
+
+// The log is a ring buffer: when it is full, the oldest entries are
+// dropped.  A typical entry is 8 bytes (RV32) or 12 bytes (RV64).
+
+// Not recorded: CSR side effects other than those of CSR instructions
+// (e.g., trap entry, fflags, counters), writes by devices or other
+// harts, and vector registers.
+
+// ================================================================
+
+#pragma once
+
+// ================================================================
+// How the hart is to run forward
+
+typedef enum { RECORD_RUN_STEP,        // one instruction
+	       RECORD_RUN_CONTINUE,    // until a breakpoint, watchpoint or ^C
+	       RECORD_RUN_RANGE        // while the PC is in [start, end)
+} Record_Run;
+
+// Why a forward or reverse run stopped
+
+typedef enum { RECORD_STOP_HALT,       // the hart halted by itself (ebreak, trigger, ...)
+	       RECORD_STOP_STEP,       // end of a step, or of a range
+	       RECORD_STOP_BREAK,      // reverse: at a breakpoint
+	       RECORD_STOP_WATCH,      // a store hit a write watchpoint
+	       RECORD_STOP_BEGIN,      // reverse: no more history
+	       RECORD_STOP_INTERRUPT   // ^C from GDB
+} Record_Stop;
+
+// ================================================================
+// Initialize (called once per GDB session).
+// preempted () is called now and then during long runs; it returns
+// true if GDB has sent a ^C (which it consumes).
+
+extern
+void gdbstub_record_init (FILE *logfile, bool (*preempted) (void));
+
+// ================================================================
+// Start recording the selected hart, with a log of log_size bytes
+// (0 for the default); stop recording and discard the log.
+// Both return status_ok or status_err.
+
+extern
+uint32_t gdbstub_record_start (const uint8_t xlen, uint64_t log_size);
+
+extern
+uint32_t gdbstub_record_stop (void);
+
+extern
+bool gdbstub_record_active (void);
+
+// Status and statistics (NUL-terminated, into buf)
+extern
+void gdbstub_record_status (char *buf, const size_t buf_size);
+
+// Target memory was written (by GDB): forget cached instructions
+extern
+void gdbstub_record_forget_code (void);
+
+// ================================================================
+// Run forward, recording.  Returns when the hart has stopped, with why
+// in *p_stop; *p_stop_reason is the signal (as for
+// gdbstub_be_get_stop_reason) and *p_watch_addr the watchpoint, for
+// RECORD_STOP_WATCH.
+
+extern
+uint32_t gdbstub_record_run (const uint8_t xlen, Record_Run run, uint64_t start, uint64_t end,
+			     Record_Stop *p_stop, uint8_t *p_stop_reason, uint64_t *p_watch_addr);
+
+// ================================================================
+// Run backward, one instruction (bs) or until a breakpoint, watchpoint,
+// ^C or the start of the log (bc).  Arguments as for gdbstub_record_run.
+
+extern
+uint32_t gdbstub_record_reverse (const uint8_t xlen, bool cont,
+				 Record_Stop *p_stop, uint64_t *p_watch_addr);
+
+// ================================================================
@@ -0,0 +1,679 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// RTOS thread awareness (see gdbstub_rtos.h)
+
+// ================================================================
+// C lib includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+// ----------------
+// Local includes
+
+#include "gdbstub_be.h"
+#include "gdbstub_rtos.h"
+
+// ****************************************************************
+// Private definitions
+
+#define min(x,y)  (((x)<(y)) ? (x) : (y))
+#define max(x,y)  (((x)>(y)) ? (x) : (y))
+
+#define RTOS_MAX_THREADS          1024
+#define RTOS_MAX_NAME             32
+#define RTOS_THREAD_SPAN_MAX      4096    // bytes of a Zephyr k_thread that we read
+
+static FILE *logfile_fp = NULL;
+
+typedef enum { RTOS_NONE, RTOS_FREERTOS, RTOS_ZEPHYR } RTOS_Kind;
+
+// ================================================================
+// Symbols looked up via qSymbol
+
+typedef enum {
+    SYM_pxCurrentTCB,
+    SYM_pxReadyTasksLists,
+    SYM_xDelayedTaskList1,
+    SYM_xDelayedTaskList2,
+    SYM_xPendingReadyList,
+    SYM_xSuspendedTaskList,
+    SYM_xTasksWaitingTermination,
+    SYM_uxTopUsedPriority,
+    SYM_uxTopReadyPriority,
+
+    SYM__kernel,
+    SYM__kernel_thread_info_offsets,
+    SYM__kernel_thread_info_size_t_size,
+    SYM__kernel_thread_info_num_offsets,
+
+    NUM_SYMS
+} RTOS_Sym;
+
+typedef struct {
+    const char *name;
+    bool        asked;
+    bool        found;
+    uint64_t    value;
+} RTOS_Symbol;
+
+static RTOS_Symbol syms [NUM_SYMS] = {
+    [SYM_pxCurrentTCB]                    = { .name = "pxCurrentTCB" },
+    [SYM_pxReadyTasksLists]               = { .name = "pxReadyTasksLists" },
+    [SYM_xDelayedTaskList1]               = { .name = "xDelayedTaskList1" },
+    [SYM_xDelayedTaskList2]               = { .name = "xDelayedTaskList2" },
+    [SYM_xPendingReadyList]               = { .name = "xPendingReadyList" },
+    [SYM_xSuspendedTaskList]              = { .name = "xSuspendedTaskList" },
+    [SYM_xTasksWaitingTermination]        = { .name = "xTasksWaitingTermination" },
+    [SYM_uxTopUsedPriority]               = { .name = "uxTopUsedPriority" },
+    [SYM_uxTopReadyPriority]              = { .name = "uxTopReadyPriority" },
+
+    [SYM__kernel]                         = { .name = "_kernel" },
+    [SYM__kernel_thread_info_offsets]     = { .name = "_kernel_thread_info_offsets" },
+    [SYM__kernel_thread_info_size_t_size] = { .name = "_kernel_thread_info_size_t_size" },
+    [SYM__kernel_thread_info_num_offsets] = { .name = "_kernel_thread_info_num_offsets" }
+};
+
+static
+bool sym_found (RTOS_Sym sym)
+{
+    return (syms [sym].found && (syms [sym].value != 0));
+}
+
+static
+RTOS_Kind rtos_kind (void)
+{
+    if (sym_found (SYM_pxCurrentTCB)
+	&& sym_found (SYM_pxReadyTasksLists)
+	&& sym_found (SYM_xDelayedTaskList1)
+	&& sym_found (SYM_xDelayedTaskList2)
+	&& sym_found (SYM_xPendingReadyList)
+	&& (sym_found (SYM_uxTopUsedPriority) || sym_found (SYM_uxTopReadyPriority)))
+	return RTOS_FREERTOS;
+
+    // Zephyr exports these with CONFIG_DEBUG_THREAD_INFO
+    if (sym_found (SYM__kernel)
+	&& sym_found (SYM__kernel_thread_info_offsets)
+	&& sym_found (SYM__kernel_thread_info_size_t_size))
+	return RTOS_ZEPHYR;
+
+    return RTOS_NONE;
+}
+
+// ================================================================
+// Cached threads, valid for one halt epoch
+
+typedef struct {
+    uint64_t  id;                   // TCB/k_thread address
+    char      name [RTOS_MAX_NAME];
+    char      state [16];
+    int32_t   prio;
+    uint64_t  stack_ptr;            // FreeRTOS: pxTopOfStack
+    uint64_t  regs [33];            // x0..x31, PC
+    uint64_t  regs_saved;           // bit j set if regs [j] is known
+} RTOS_Thread;
+
+static bool         cache_valid = false;
+static uint64_t     halt_epoch  = 0;
+
+static bool         active      = false;
+static uint64_t     current_id  = 0;
+static RTOS_Thread  threads [RTOS_MAX_THREADS];
+static uint32_t     n_threads   = 0;
+
+// ================================================================
+// Batched memory reads.
+// Reads are queued with batch_add; batch_flush reads them all with one
+// gdbstub_be_mem_read_sg, which merges neighbors into SBA bursts.
+
+static BE_Mem_Item reqs [2 * RTOS_MAX_THREADS];
+static uint32_t    n_reqs   = 0;
+static uint32_t    n_bursts = 0;    // per epoch, for the log
+static bool        batch_err = false;
+
+static
+void batch_add (uint64_t addr, uint32_t len, uint8_t *dst)
+{
+    if (n_reqs == (sizeof (reqs) / sizeof (reqs [0]))) {
+	batch_err = true;
+	return;
+    }
+    reqs [n_reqs].addr = addr;
+    reqs [n_reqs].len  = len;
+    reqs [n_reqs].dst  = dst;
+    n_reqs++;
+}
+
+static
+uint32_t batch_flush (const uint8_t xlen)
+{
+    uint32_t n = 0;
+    if ((! batch_err)
+	&& (gdbstub_be_mem_read_sg (xlen, reqs, n_reqs, true, & n) != status_ok))
+	batch_err = true;
+    n_bursts += n;
+    n_reqs = 0;
+    return (batch_err ? status_err : status_ok);
+}
+
+// ----------------
+// Little-endian target words
+
+static
+uint64_t get_word (const uint8_t *p, uint32_t nbytes)
+{
+    uint64_t x = 0;
+    for (uint32_t j = 0; j < nbytes; j++)
+	x |= (((uint64_t) p [j]) << (8 * j));
+    return x;
+}
+
+// ----------------
+
+static
+RTOS_Thread *new_thread (uint64_t id, const char *state)
+{
+    if ((id == 0) || (n_threads == RTOS_MAX_THREADS))
+	return NULL;
+    for (uint32_t j = 0; j < n_threads; j++)
+	if (threads [j].id == id)
+	    return NULL;
+
+    RTOS_Thread *p_t = & (threads [n_threads]);
+    memset (p_t, 0, sizeof (*p_t));
+    p_t->id = id;
+    snprintf (p_t->state, sizeof (p_t->state), "%s", state);
+    n_threads++;
+    return p_t;
+}
+
+static
+RTOS_Thread *find_thread (uint64_t id)
+{
+    for (uint32_t j = 0; j < n_threads; j++)
+	if (threads [j].id == id)
+	    return & (threads [j]);
+    return NULL;
+}
+
+// ================================================================
+// FreeRTOS
+
+// Assumes the RISC-V port: UBaseType_t, TickType_t and pointers are
+// all XLEN bits wide, and list data integrity checks are disabled.
+//     List_t:     uxNumberOfItems, pxIndex, xListEnd {xItemValue, pxNext, pxPrevious}
+//     ListItem_t: xItemValue, pxNext, pxPrevious, pvOwner, pvContainer
+//     TCB_t:      pxTopOfStack, xStateListItem, xEventListItem, uxPriority,
+//                 pxStack, pcTaskName [configMAX_TASK_NAME_LEN]
+
+#define FREERTOS_LIST_WORDS         5
+#define FREERTOS_MAX_PRIORITIES     32
+#define FREERTOS_TCB_PRIO_WORD      11
+#define FREERTOS_TCB_NAME_WORD      13
+#define FREERTOS_TASK_NAME_LEN      16
+
+// Context saved on the task's stack by the RISC-V port (portContext.h):
+//     word 0: mepc, word 1: x1, words 2..28: x5..x31, word 29: mstatus
+// The task's sp is just above the context.
+#define FREERTOS_CONTEXT_WORDS      30
+
+#define FREERTOS_TCB_BYTES_MAX      ((FREERTOS_TCB_NAME_WORD * 8) + FREERTOS_TASK_NAME_LEN)
+
+typedef struct {
+    uint64_t     addr;
+    const char  *state;
+    uint8_t      hdr  [FREERTOS_LIST_WORDS * 8];
+    uint8_t      tcb  [FREERTOS_TCB_BYTES_MAX];    // around the current item
+    uint64_t     next_item;
+    uint64_t     n_left;
+} FreeRTOS_List;
+
+static
+uint32_t freertos_update (const uint8_t xlen)
+{
+    const uint32_t w         = xlen / 8;
+    const uint32_t tcb_bytes = (FREERTOS_TCB_NAME_WORD * w) + FREERTOS_TASK_NAME_LEN;
+    uint8_t        buf [2][8];
+
+    static uint8_t tcbs [RTOS_MAX_THREADS][FREERTOS_TCB_BYTES_MAX];
+    static bool    tcb_read [RTOS_MAX_THREADS];
+
+    // Current task and number of priorities
+    RTOS_Sym prio_sym = (sym_found (SYM_uxTopUsedPriority) ? SYM_uxTopUsedPriority : SYM_uxTopReadyPriority);
+    batch_add (syms [SYM_pxCurrentTCB].value, w, buf [0]);
+    batch_add (syms [prio_sym].value, w, buf [1]);
+    if (batch_flush (xlen) != status_ok)
+	return status_err;
+
+    current_id = get_word (buf [0], w);
+    active     = (current_id != 0);
+    if (! active)
+	return status_ok;
+
+    uint64_t n_prios = get_word (buf [1], w) + 1;
+    if (n_prios > FREERTOS_MAX_PRIORITIES)
+	n_prios = FREERTOS_MAX_PRIORITIES;
+
+    // All list headers, in one batch
+    static FreeRTOS_List lists [FREERTOS_MAX_PRIORITIES + 5];
+    uint32_t n_lists = 0;
+    for (uint64_t p = 0; p < n_prios; p++) {
+	lists [n_lists].addr  = syms [SYM_pxReadyTasksLists].value + (p * FREERTOS_LIST_WORDS * w);
+	lists [n_lists].state = "Ready";
+	n_lists++;
+    }
+    const struct { RTOS_Sym sym; const char *state; } others [] = {
+	{ SYM_xDelayedTaskList1,        "Blocked" },
+	{ SYM_xDelayedTaskList2,        "Blocked" },
+	{ SYM_xPendingReadyList,        "Ready" },
+	{ SYM_xSuspendedTaskList,       "Suspended" },
+	{ SYM_xTasksWaitingTermination, "Deleted" } };
+    for (uint32_t j = 0; j < (sizeof (others) / sizeof (others [0])); j++)
+	if (sym_found (others [j].sym)) {
+	    lists [n_lists].addr  = syms [others [j].sym].value;
+	    lists [n_lists].state = others [j].state;
+	    n_lists++;
+	}
+
+    for (uint32_t j = 0; j < n_lists; j++)
+	batch_add (lists [j].addr, FREERTOS_LIST_WORDS * w, lists [j].hdr);
+    if (batch_flush (xlen) != status_ok)
+	return status_err;
+
+    for (uint32_t j = 0; j < n_lists; j++) {
+	lists [j].n_left    = min (get_word (& (lists [j].hdr [0]), w), RTOS_MAX_THREADS);
+	lists [j].next_item = get_word (& (lists [j].hdr [3 * w]), w);    // xListEnd.pxNext
+    }
+
+    // Walk all lists in step: each round reads the next item of every list in one batch.
+    // Task lists link the TCBs' xStateListItem (word 1 of the TCB), so
+    // each read covers the whole TCB around the item.
+    while (true) {
+	uint32_t n_walking = 0;
+	for (uint32_t j = 0; j < n_lists; j++) {
+	    uint64_t list_end = lists [j].addr + (2 * w);
+	    if ((lists [j].n_left == 0) || (lists [j].next_item == list_end) || (lists [j].next_item == 0))
+		lists [j].n_left = 0;
+	    else {
+		batch_add (lists [j].next_item - w, tcb_bytes, lists [j].tcb);
+		n_walking++;
+	    }
+	}
+	if (n_walking == 0)
+	    break;
+	if (batch_flush (xlen) != status_ok)
+	    return status_err;
+
+	for (uint32_t j = 0; j < n_lists; j++) {
+	    if (lists [j].n_left == 0)
+		continue;
+	    const uint8_t *item  = & (lists [j].tcb [w]);
+	    uint64_t       owner = get_word (& (item [3 * w]), w);
+	    const char    *state = ((owner == current_id) ? "Running" : lists [j].state);
+	    if (new_thread (owner, state) != NULL) {
+		tcb_read [n_threads - 1] = (owner == (lists [j].next_item - w));
+		if (tcb_read [n_threads - 1])
+		    memcpy (tcbs [n_threads - 1], lists [j].tcb, tcb_bytes);
+	    }
+	    lists [j].next_item = get_word (& (item [1 * w]), w);
+	    lists [j].n_left--;
+	}
+    }
+
+    // The running task may have been removed from its list already (e.g., when blocking)
+    if (new_thread (current_id, "Running") != NULL)
+	tcb_read [n_threads - 1] = false;
+
+    // Remaining TCBs, in one batch
+    for (uint32_t j = 0; j < n_threads; j++)
+	if (! tcb_read [j])
+	    batch_add (threads [j].id, tcb_bytes, tcbs [j]);
+    if (batch_flush (xlen) != status_ok)
+	return status_err;
+
+    for (uint32_t j = 0; j < n_threads; j++) {
+	RTOS_Thread *p_t = & (threads [j]);
+	p_t->stack_ptr = get_word (& (tcbs [j][0]), w);
+	p_t->prio      = (int32_t) get_word (& (tcbs [j][FREERTOS_TCB_PRIO_WORD * w]), w);
+	memcpy (p_t->name, & (tcbs [j][FREERTOS_TCB_NAME_WORD * w]), FREERTOS_TASK_NAME_LEN);
+	p_t->name [FREERTOS_TASK_NAME_LEN] = 0;
+    }
+
+    // Saved contexts of all tasks not running on the hart, in one batch
+    static uint8_t frames [RTOS_MAX_THREADS][FREERTOS_CONTEXT_WORDS * 8];
+    for (uint32_t j = 0; j < n_threads; j++)
+	if (threads [j].id != current_id)
+	    batch_add (threads [j].stack_ptr, FREERTOS_CONTEXT_WORDS * w, frames [j]);
+    if (batch_flush (xlen) != status_ok)
+	return status_err;
+
+    for (uint32_t j = 0; j < n_threads; j++) {
+	RTOS_Thread *p_t = & (threads [j]);
+	if (p_t->id == current_id)
+	    continue;
+	p_t->regs [0]  = 0;
+	p_t->regs [1]  = get_word (& (frames [j][1 * w]), w);
+	p_t->regs [2]  = p_t->stack_ptr + (FREERTOS_CONTEXT_WORDS * w);
+	for (uint32_t r = 5; r < 32; r++)
+	    p_t->regs [r] = get_word (& (frames [j][(r - 3) * w]), w);
+	p_t->regs [32] = get_word (& (frames [j][0]), w);
+	// gp (x3) and tp (x4) are not saved
+	p_t->regs_saved = (((1ULL << 33) - 1) & (~ 0x18ULL));
+    }
+    return status_ok;
+}
+
+// ================================================================
+// Zephyr
+
+// Offsets into the kernel's structures are read from the
+// _kernel_thread_info_offsets array (CONFIG_DEBUG_THREAD_INFO).
+// Indexes into that array:
+
+#define ZEPHYR_K_CURR_THREAD        1
+#define ZEPHYR_K_THREADS            2
+#define ZEPHYR_T_NEXT_THREAD        4
+#define ZEPHYR_T_STATE              5
+#define ZEPHYR_T_PRIO               7
+#define ZEPHYR_T_STACK_PTR          8
+#define ZEPHYR_T_NAME               9
+#define ZEPHYR_NUM_OFFSETS          16
+
+// On RISC-V, T_STACK_PTR is the offset of thread->callee_saved:
+//     sp, ra, s0, s1, s2..s11
+// A switched-out thread resumes at ra.
+#define ZEPHYR_CALLEE_SAVED_WORDS   14
+
+// State bits (thread_state)
+#define ZEPHYR_THREAD_PENDING       0x02
+#define ZEPHYR_THREAD_PRESTART      0x04
+#define ZEPHYR_THREAD_DEAD          0x08
+#define ZEPHYR_THREAD_SUSPENDED     0x10
+
+static
+uint32_t zephyr_update (const uint8_t xlen)
+{
+    const uint32_t w = xlen / 8;
+    uint8_t        buf [2][8];
+
+    // Size of size_t, and number of offsets
+    memset (buf, 0, sizeof (buf));
+    batch_add (syms [SYM__kernel_thread_info_size_t_size].value, 4, buf [0]);
+    if (sym_found (SYM__kernel_thread_info_num_offsets))
+	batch_add (syms [SYM__kernel_thread_info_num_offsets].value, 4, buf [1]);
+    if (batch_flush (xlen) != status_ok)
+	return status_err;
+
+    uint32_t size_t_size = (uint32_t) get_word (buf [0], 4);
+    uint32_t n_offsets   = (sym_found (SYM__kernel_thread_info_num_offsets)
+			    ? (uint32_t) get_word (buf [1], 4)
+			    : (ZEPHYR_T_NAME + 1));
+    if (((size_t_size != 4) && (size_t_size != 8)) || (n_offsets <= ZEPHYR_T_STACK_PTR)) {
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp, "ERROR: gdbstub_rtos: unexpected Zephyr thread info (size_t %0d, %0d offsets)\n",
+		     size_t_size, n_offsets);
+	return status_err;
+    }
+    n_offsets = min (n_offsets, ZEPHYR_NUM_OFFSETS);
+
+    uint8_t  offsets_buf [ZEPHYR_NUM_OFFSETS * 8];
+    uint64_t offsets [ZEPHYR_NUM_OFFSETS];
+    batch_add (syms [SYM__kernel_thread_info_offsets].value, n_offsets * size_t_size, offsets_buf);
+    if (batch_flush (xlen) != status_ok)
+	return status_err;
+
+    // Unimplemented offsets are SIZE_MAX
+    const uint64_t unimplemented = ((size_t_size == 8) ? UINT64_MAX : UINT32_MAX);
+    for (uint32_t j = 0; j < ZEPHYR_NUM_OFFSETS; j++)
+	offsets [j] = ((j < n_offsets) ? get_word (& (offsets_buf [j * size_t_size]), size_t_size) : unimplemented);
+    bool have_name = (offsets [ZEPHYR_T_NAME] != unimplemented);
+
+    // Current thread and head of the thread list
+    batch_add (syms [SYM__kernel].value + offsets [ZEPHYR_K_CURR_THREAD], w, buf [0]);
+    batch_add (syms [SYM__kernel].value + offsets [ZEPHYR_K_THREADS], w, buf [1]);
+    if (batch_flush (xlen) != status_ok)
+	return status_err;
+
+    current_id = get_word (buf [0], w);
+    active     = (current_id != 0);
+    if (! active)
+	return status_ok;
+
+    // Each k_thread is read in one burst covering all the fields we need
+    uint64_t span = 0;
+    span = max (span, offsets [ZEPHYR_T_NEXT_THREAD] + w);
+    span = max (span, offsets [ZEPHYR_T_STATE] + 1);
+    span = max (span, offsets [ZEPHYR_T_PRIO] + 1);
+    span = max (span, offsets [ZEPHYR_T_STACK_PTR] + (ZEPHYR_CALLEE_SAVED_WORDS * w));
+    if (have_name)
+	span = max (span, offsets [ZEPHYR_T_NAME] + RTOS_MAX_NAME);
+    if (span > RTOS_THREAD_SPAN_MAX) {
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp, "ERROR: gdbstub_rtos: unexpected Zephyr k_thread offsets\n");
+	return status_err;
+    }
+
+    static uint8_t thread_buf [RTOS_THREAD_SPAN_MAX];
+    uint64_t       thread = get_word (buf [1], w);
+    while ((thread != 0) && (n_threads < RTOS_MAX_THREADS)) {
+	batch_add (thread, (uint32_t) span, thread_buf);
+	if (batch_flush (xlen) != status_ok)
+	    return status_err;
+
+	uint8_t     state_bits = thread_buf [offsets [ZEPHYR_T_STATE]];
+	const char *state;
+	if (thread == current_id)                       state = "Running";
+	else if (state_bits & ZEPHYR_THREAD_DEAD)       state = "Dead";
+	else if (state_bits & ZEPHYR_THREAD_SUSPENDED)  state = "Suspended";
+	else if (state_bits & ZEPHYR_THREAD_PRESTART)   state = "Prestart";
+	else if (state_bits & ZEPHYR_THREAD_PENDING)    state = "Pending";
+	else                                            state = "Ready";
+
+	RTOS_Thread *p_t = new_thread (thread, state);
+	if (p_t == NULL)
+	    break;    // cycle in the list
+	p_t->prio = (int8_t) thread_buf [offsets [ZEPHYR_T_PRIO]];
+	if (have_name) {
+	    memcpy (p_t->name, & (thread_buf [offsets [ZEPHYR_T_NAME]]), RTOS_MAX_NAME);
+	    p_t->name [RTOS_MAX_NAME - 1] = 0;
+	}
+
+	const uint8_t *cs = & (thread_buf [offsets [ZEPHYR_T_STACK_PTR]]);
+	p_t->stack_ptr = get_word (& (cs [0]), w);
+	p_t->regs [0]  = 0;
+	p_t->regs [2]  = p_t->stack_ptr;
+	p_t->regs [1]  = get_word (& (cs [1 * w]), w);
+	p_t->regs [32] = p_t->regs [1];
+	p_t->regs [8]  = get_word (& (cs [2 * w]), w);
+	p_t->regs [9]  = get_word (& (cs [3 * w]), w);
+	for (uint32_t r = 18; r < 28; r++)
+	    p_t->regs [r] = get_word (& (cs [(r - 14) * w]), w);
+	p_t->regs_saved = ((1ULL << 0) | (1ULL << 1) | (1ULL << 2) | (1ULL << 8) | (1ULL << 9)
+			   | (0x3FFULL << 18) | (1ULL << 32));
+
+	thread = get_word (& (thread_buf [offsets [ZEPHYR_T_NEXT_THREAD]]), w);
+    }
+    return status_ok;
+}
+
+// ================================================================
+// Parse the task lists, once per halt epoch
+
+static
+void rtos_update (const uint8_t xlen)
+{
+    if (cache_valid)
+	return;
+
+    cache_valid = true;
+    active      = false;
+    current_id  = 0;
+    n_threads   = 0;
+    n_reqs      = 0;
+    n_bursts    = 0;
+    batch_err   = false;
+
+    RTOS_Kind kind = rtos_kind ();
+    uint32_t  status;
+    if (kind == RTOS_FREERTOS)
+	status = freertos_update (xlen);
+    else if (kind == RTOS_ZEPHYR)
+	status = zephyr_update (xlen);
+    else
+	return;
+
+    if (status != status_ok) {
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "ERROR: gdbstub_rtos: could not read %s task lists\n",
+		     ((kind == RTOS_FREERTOS) ? "FreeRTOS" : "Zephyr"));
+	    fflush (logfile_fp);
+	}
+	active    = false;
+	n_threads = 0;
+	return;
+    }
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_rtos: epoch %0" PRId64 ": %s, %0d threads, current 0x%0" PRIx64
+		 ", %0d SBA bursts\n",
+		 halt_epoch, ((kind == RTOS_FREERTOS) ? "FreeRTOS" : "Zephyr"),
+		 n_threads, current_id, n_bursts);
+	fflush (logfile_fp);
+    }
+}
+
+// ****************************************************************
+// Public definitions
+
+void gdbstub_rtos_init (FILE *logfile)
+{
+    logfile_fp = logfile;
+    gdbstub_rtos_lookup_start ();
+}
+
+void gdbstub_rtos_invalidate (void)
+{
+    if (cache_valid)
+	halt_epoch++;
+    cache_valid = false;
+}
+
+// ================================================================
+// qSymbol protocol
+
+void gdbstub_rtos_lookup_start (void)
+{
+    for (size_t j = 0; j < NUM_SYMS; j++) {
+	syms [j].asked = false;
+	syms [j].found = false;
+	syms [j].value = 0;
+    }
+    gdbstub_rtos_invalidate ();
+}
+
+const char *gdbstub_rtos_next_symbol (void)
+{
+    for (size_t j = 0; j < NUM_SYMS; j++)
+	if (! syms [j].asked)
+	    return syms [j].name;
+    return NULL;
+}
+
+void gdbstub_rtos_set_symbol (const char *name, bool found, uint64_t value)
+{
+    for (size_t j = 0; j < NUM_SYMS; j++)
+	if (strcmp (syms [j].name, name) == 0) {
+	    syms [j].asked = true;
+	    syms [j].found = found;
+	    syms [j].value = value;
+	    if (found && (logfile_fp != NULL))
+		fprintf (logfile_fp, "gdbstub_rtos: symbol %s = 0x%0" PRIx64 "\n", name, value);
+	}
+    gdbstub_rtos_invalidate ();
+}
+
+// ================================================================
+
+bool gdbstub_rtos_active (const uint8_t xlen)
+{
+    rtos_update (xlen);
+    return active;
+}
+
+uint32_t gdbstub_rtos_thread_ids (const uint8_t xlen, uint64_t *p_ids, uint32_t max_ids, uint32_t *p_n)
+{
+    rtos_update (xlen);
+    if (! active) {
+	*p_n = min (gdbstub_be_num_harts (), max_ids);
+	for (uint32_t j = 0; j < *p_n; j++)
+	    p_ids [j] = RTOS_THREAD_ID_HART + j;
+	return status_ok;
+    }
+    *p_n = min (n_threads, max_ids);
+    for (uint32_t j = 0; j < *p_n; j++)
+	p_ids [j] = threads [j].id;
+    return status_ok;
+}
+
+uint64_t gdbstub_rtos_current_thread (const uint8_t xlen)
+{
+    rtos_update (xlen);
+    return (active ? current_id : (RTOS_THREAD_ID_HART + gdbstub_be_selected_hart ()));
+}
+
+bool gdbstub_rtos_thread_alive (const uint8_t xlen, uint64_t id)
+{
+    rtos_update (xlen);
+    if (! active)
+	return ((id >= RTOS_THREAD_ID_HART) && (id < (RTOS_THREAD_ID_HART + gdbstub_be_num_harts ())));
+    return (find_thread (id) != NULL);
+}
+
+uint32_t gdbstub_rtos_thread_name (const uint8_t xlen, uint64_t id,
+				   char *buf, const size_t buf_size)
+{
+    rtos_update (xlen);
+    if (! active) {
+	snprintf (buf, buf_size, "hart %0" PRId64, id - RTOS_THREAD_ID_HART);
+	return (gdbstub_rtos_thread_alive (xlen, id) ? status_ok : status_err);
+    }
+    RTOS_Thread *p_t = find_thread (id);
+    if (p_t == NULL)
+	return status_err;
+    snprintf (buf, buf_size, "%s", p_t->name);
+    return status_ok;
+}
+
+uint32_t gdbstub_rtos_thread_extra_info (const uint8_t xlen, uint64_t id,
+					 char *buf, const size_t buf_size)
+{
+    rtos_update (xlen);
+    if (! active) {
+	snprintf (buf, buf_size, "hart %0" PRId64, id - RTOS_THREAD_ID_HART);
+	return (gdbstub_rtos_thread_alive (xlen, id) ? status_ok : status_err);
+    }
+    RTOS_Thread *p_t = find_thread (id);
+    if (p_t == NULL)
+	return status_err;
+    snprintf (buf, buf_size, "%s, %s, prio %0d", p_t->name, p_t->state, p_t->prio);
+    return status_ok;
+}
+
+uint32_t gdbstub_rtos_thread_reg_read (const uint8_t xlen, uint64_t id,
+				       uint32_t regnum, uint64_t *p_val)
+{
+    rtos_update (xlen);
+    RTOS_Thread *p_t = (active ? find_thread (id) : NULL);
+    if ((p_t == NULL) || (regnum > 32) || (! ((p_t->regs_saved >> regnum) & 1)))
+	return status_err;
+    *p_val = p_t->regs [regnum];
+    return status_ok;
+}
+
+// ================================================================
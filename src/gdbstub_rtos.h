@@ -0,0 +1,100 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// RTOS thread awareness.
+
+// When the program being debugged runs FreeRTOS or Zephyr, each RTOS
+// task is presented to GDB as a thread.  The RTOS is recognized from
+// the symbols GDB looks up for us (qSymbol).  Task lists are walked
+// through the debug module's System Bus Access; the running task's
+// registers are the hart's registers, and the registers of other
+// tasks are reconstructed from the context they saved when they were
+// switched out.
+
+// The parsed task list is cached until the next "halt epoch", i.e.,
+// until the hart is resumed or target state is written.
+
+// ================================================================
+
+#pragma once
+
+// ================================================================
+// Thread id of hart 0 when no RTOS is detected (each hart is a thread,
+// hart h being RTOS_THREAD_ID_HART + h)
+
+#define RTOS_THREAD_ID_HART  1
+
+// ================================================================
+// Initialize (called once per GDB session).
+
+extern
+void gdbstub_rtos_init (FILE *logfile);
+
+// ================================================================
+// Discard cached task lists and saved contexts (called whenever the
+// hart is resumed, or memory or registers are written).
+
+extern
+void gdbstub_rtos_invalidate (void);
+
+// ================================================================
+// qSymbol protocol.
+// gdbstub_rtos_lookup_start is called on 'qSymbol::', i.e., whenever
+// GDB has loaded new symbols; all symbols are then looked up again.
+// gdbstub_rtos_next_symbol returns the next symbol we'd like GDB to
+// look up, or NULL if there are none left.
+// gdbstub_rtos_set_symbol records GDB's answer for a symbol.
+
+extern
+void gdbstub_rtos_lookup_start (void);
+
+extern
+const char *gdbstub_rtos_next_symbol (void);
+
+extern
+void gdbstub_rtos_set_symbol (const char *name, bool found, uint64_t value);
+
+// ================================================================
+// True if an RTOS was detected and its scheduler has started.
+
+extern
+bool gdbstub_rtos_active (const uint8_t xlen);
+
+// ================================================================
+// Thread list (qfThreadInfo/qsThreadInfo).
+// Fills p_ids [0 .. *p_n - 1], at most max_ids entries.
+
+extern
+uint32_t gdbstub_rtos_thread_ids (const uint8_t xlen, uint64_t *p_ids, uint32_t max_ids, uint32_t *p_n);
+
+// The thread running on the hart (qC and stop replies)
+
+extern
+uint64_t gdbstub_rtos_current_thread (const uint8_t xlen);
+
+extern
+bool gdbstub_rtos_thread_alive (const uint8_t xlen, uint64_t id);
+
+// Thread name (NUL-terminated, into buf; empty if unknown)
+
+extern
+uint32_t gdbstub_rtos_thread_name (const uint8_t xlen, uint64_t id,
+				   char *buf, const size_t buf_size);
+
+// qThreadExtraInfo: NUL-terminated description of the thread, into buf
+
+extern
+uint32_t gdbstub_rtos_thread_extra_info (const uint8_t xlen, uint64_t id,
+					 char *buf, const size_t buf_size);
+
+// ================================================================
+// Read a register of a thread that is not running on the hart.
+// Register numbers are GDB's: 0..31 GPRs, 0x20 PC.
+// Returns status_err if the register was not saved by the RTOS.
+
+extern
+uint32_t gdbstub_rtos_thread_reg_read (const uint8_t xlen, uint64_t id,
+				       uint32_t regnum, uint64_t *p_val);
+
+// ================================================================
@@ -0,0 +1,652 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// RTT channels (see gdbstub_rtt.h)
+
+// ================================================================
+// C lib includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// ----------------
+// Local includes
+
+#include "gdbstub_be.h"
+#include "gdbstub_rtt.h"
+
+// ****************************************************************
+// Private definitions
+
+#define RTT_ID                "SEGGER RTT"
+#define RTT_ID_LEN            10
+#define RTT_HEADER_SIZE       24        // id [16], max_num_up/down_buffers
+#define RTT_MAX_CHANNELS      16
+#define RTT_DEFAULT_SYMBOL    "_SEGGER_RTT"
+
+// Bytes moved per channel per poll, and per SBA read while scanning
+#define RTT_CHUNK             4096
+
+#define RTT_PERIOD_MIN_DEFAULT      100      // usecs
+#define RTT_PERIOD_MAX_DEFAULT    20000      // usecs
+
+static FILE *logfile_fp = NULL;
+static void (*console_output) (const char *msg) = NULL;
+
+// Where to find the control block
+static uint64_t loc_addr = 0;
+static uint64_t loc_len  = 0;
+static bool     loc_set  = false;
+
+static uint64_t period_min = RTT_PERIOD_MIN_DEFAULT;
+static uint64_t period_max = RTT_PERIOD_MAX_DEFAULT;
+
+typedef struct {
+    RTT_Out   out;
+    char      filename [1024];
+    FILE     *fp;
+    uint16_t  port;
+    int       listen_fd;
+    int       client_fd;
+    uint64_t  n_bytes;                 // up: bytes drained
+    uint64_t  n_down_bytes;            // bytes written to the down-buffer
+    char      pending [256];           // from client, not yet in the down-buffer
+    size_t    n_pending;
+} Channel;
+
+static Channel channels [RTT_MAX_CHANNELS];
+
+// Current run
+static bool     running = false;
+static uint64_t cb_addr;
+static uint32_t n_up;
+static uint32_t n_down;
+static uint64_t period;
+static uint64_t t_next;
+static uint64_t n_polls;
+static uint64_t n_busy_polls;
+static uint64_t n_read_errors;
+static bool     cb_stale;              // re-read the header before using cb_addr
+
+// ================================================================
+
+static
+uint64_t get_le (const uint8_t *p, uint32_t n_bytes)
+{
+    uint64_t v = 0;
+    for (uint32_t j = 0; j < n_bytes; j++)
+	v |= ((uint64_t) p [j]) << (8 * j);
+    return v;
+}
+
+// ----------------
+// Buffer descriptors
+
+typedef struct {
+    uint64_t  addr;                    // of the descriptor itself
+    uint64_t  p_buffer;
+    uint32_t  size;
+    uint32_t  wr_off;
+    uint32_t  rd_off;
+} Buffer;
+
+static
+uint32_t desc_size (const uint8_t xlen)
+{
+    return (2 * (xlen / 8)) + 16;
+}
+
+static
+uint64_t desc_addr (const uint8_t xlen, bool up, uint32_t channel)
+{
+    uint32_t index = (up ? channel : (n_up + channel));
+    return cb_addr + RTT_HEADER_SIZE + (index * desc_size (xlen));
+}
+
+static
+void desc_decode (const uint8_t xlen, const uint8_t *p, uint64_t addr, Buffer *p_b)
+{
+    uint32_t ptr = xlen / 8;
+    p_b->addr     = addr;
+    p_b->p_buffer = get_le (& (p [ptr]), ptr);
+    p_b->size     = (uint32_t) get_le (& (p [2 * ptr]), 4);
+    p_b->wr_off   = (uint32_t) get_le (& (p [(2 * ptr) + 4]), 4);
+    p_b->rd_off   = (uint32_t) get_le (& (p [(2 * ptr) + 8]), 4);
+}
+
+// The target has not set the buffer up yet, or it is corrupt
+static
+bool desc_valid (const Buffer *p_b)
+{
+    return ((p_b->p_buffer != 0)
+	    && (p_b->size != 0)
+	    && (p_b->wr_off < p_b->size)
+	    && (p_b->rd_off < p_b->size));
+}
+
+static
+uint32_t desc_read (const uint8_t xlen, bool up, uint32_t channel, Buffer *p_b)
+{
+    uint8_t  bytes [32];
+    uint64_t addr = desc_addr (xlen, up, channel);
+    if (gdbstub_be_mem_read (xlen, addr, (char *) bytes, desc_size (xlen)) != status_ok)
+	return status_err;
+    desc_decode (xlen, bytes, addr, p_b);
+    return status_ok;
+}
+
+// Offset of wr_off (rd_off is 4 bytes further on) within a descriptor
+static
+uint64_t wr_off_offset (const uint8_t xlen)
+{
+    return (2 * (xlen / 8)) + 4;
+}
+
+// ----------------
+// Finding the control block
+
+static
+bool header_valid (const uint8_t *p)
+{
+    if (memcmp (p, RTT_ID, RTT_ID_LEN) != 0)
+	return false;
+    int32_t up   = (int32_t) get_le (& (p [16]), 4);
+    int32_t down = (int32_t) get_le (& (p [20]), 4);
+    return ((up >= 1) && (up <= RTT_MAX_CHANNELS) && (down >= 0) && (down <= RTT_MAX_CHANNELS));
+}
+
+static
+uint32_t header_read (const uint8_t xlen, uint64_t addr)
+{
+    uint8_t hdr [RTT_HEADER_SIZE];
+    if (gdbstub_be_mem_read (xlen, addr, (char *) hdr, RTT_HEADER_SIZE) != status_ok)
+	return status_err;
+    if (! header_valid (hdr))
+	return status_err;
+    cb_addr = addr;
+    n_up    = (uint32_t) get_le (& (hdr [16]), 4);
+    n_down  = (uint32_t) get_le (& (hdr [20]), 4);
+    return status_ok;
+}
+
+// Scan [addr, addr + len) for the id, one SBA read per chunk.
+// Chunks overlap by one header so that none is missed at a boundary.
+static
+uint32_t scan (const uint8_t xlen, uint64_t addr, uint64_t len)
+{
+    static uint8_t buf [RTT_CHUNK];
+    uint64_t end = addr + len;
+    for (uint64_t a = addr; a < end; a += (RTT_CHUNK - RTT_HEADER_SIZE)) {
+	size_t n = (size_t) (((end - a) < RTT_CHUNK) ? (end - a) : RTT_CHUNK);
+	if (n < RTT_HEADER_SIZE)
+	    break;
+	if (gdbstub_be_mem_read (xlen, a, (char *) buf, n) != status_ok)
+	    return status_err;
+	// The control block is word-aligned
+	for (size_t j = 0; (j + RTT_HEADER_SIZE) <= n; j += 4)
+	    if (header_valid (& (buf [j])))
+		return header_read (xlen, a + j);
+	if (n < RTT_CHUNK)
+	    break;
+    }
+    return status_err;
+}
+
+// ----------------
+// TCP ports
+
+static
+int set_nonblocking (int fd)
+{
+    int flags = fcntl (fd, F_GETFL, 0);
+    return fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static
+int open_listener (uint16_t port)
+{
+    int fd = socket (PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+	return fd;
+
+    int yes = 1;
+    struct sockaddr_in sa;
+    memset (& sa, 0, sizeof (sa));
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons (port);
+    sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if ((setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, & yes, sizeof (yes)) < 0)
+	|| (bind (fd, (struct sockaddr *) (& sa), sizeof (sa)) < 0)
+	|| (listen (fd, 1) < 0)
+	|| (set_nonblocking (fd) < 0)) {
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp, "gdbstub_rtt: port %0d: %s\n", port, strerror (errno));
+	close (fd);
+	return -1;
+    }
+    return fd;
+}
+
+// Accept a client if there is none; read its input for the down-buffer
+static
+void service_socket (Channel *p_ch)
+{
+    if (p_ch->listen_fd < 0)
+	return;
+
+    if (p_ch->client_fd < 0) {
+	int fd = accept (p_ch->listen_fd, NULL, NULL);
+	if (fd < 0)
+	    return;
+	set_nonblocking (fd);
+	p_ch->client_fd = fd;
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "gdbstub_rtt: client connected on port %0d\n", p_ch->port);
+	    fflush (logfile_fp);
+	}
+    }
+
+    if (p_ch->n_pending == 0) {
+	ssize_t n = read (p_ch->client_fd, p_ch->pending, sizeof (p_ch->pending));
+	if (n > 0)
+	    p_ch->n_pending = (size_t) n;
+	else if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+	    close (p_ch->client_fd);
+	    p_ch->client_fd = -1;
+	}
+    }
+}
+
+static
+void close_outputs (Channel *p_ch)
+{
+    if (p_ch->fp != NULL) {
+	fclose (p_ch->fp);
+	p_ch->fp = NULL;
+    }
+    if (p_ch->client_fd >= 0) {
+	close (p_ch->client_fd);
+	p_ch->client_fd = -1;
+    }
+    if (p_ch->listen_fd >= 0) {
+	close (p_ch->listen_fd);
+	p_ch->listen_fd = -1;
+    }
+    p_ch->n_pending = 0;
+}
+
+// ----------------
+// Moving data
+
+// Send up-buffer bytes to their destination.
+// Returns how many were taken (the rest stay in the target).
+static
+size_t deliver (Channel *p_ch, const uint8_t *data, size_t len, bool may_stream)
+{
+    switch (p_ch->out) {
+    case RTT_OUT_GDB: {
+	if (! may_stream)
+	    return 0;
+	char text [RTT_CHUNK + 1];
+	size_t k = 0;
+	for (size_t j = 0; j < len; j++)
+	    if (data [j] != 0)
+		text [k++] = (char) data [j];
+	text [k] = 0;
+	console_output (text);
+	return len;
+    }
+    case RTT_OUT_FILE:
+	fwrite (data, 1, len, p_ch->fp);
+	fflush (p_ch->fp);
+	return len;
+    case RTT_OUT_SOCKET: {
+	if (p_ch->client_fd < 0)
+	    return 0;
+	ssize_t n = send (p_ch->client_fd, data, len, MSG_NOSIGNAL);
+	if (n < 0) {
+	    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		close (p_ch->client_fd);
+		p_ch->client_fd = -1;
+	    }
+	    return 0;
+	}
+	return (size_t) n;
+    }
+    default:
+	return 0;
+    }
+}
+
+// Drain one up-buffer; returns the number of bytes moved
+static
+size_t drain (const uint8_t xlen, uint32_t channel, const Buffer *p_b, bool may_stream)
+{
+    Channel *p_ch = & (channels [channel]);
+    static uint8_t data [RTT_CHUNK];
+
+    if ((! desc_valid (p_b)) || (p_b->wr_off == p_b->rd_off))
+	return 0;
+
+    // Bytes are contiguous up to wr_off, or to the end of the buffer if wrapped
+    uint32_t rd  = p_b->rd_off;
+    uint32_t end = ((p_b->wr_off > rd) ? p_b->wr_off : p_b->size);
+    size_t   len = end - rd;
+    if (len > RTT_CHUNK)
+	len = RTT_CHUNK;
+
+    if (gdbstub_be_mem_read (xlen, p_b->p_buffer + rd, (char *) data, len) != status_ok) {
+	n_read_errors++;
+	return 0;
+    }
+    size_t n = deliver (p_ch, data, len, may_stream);
+    if (n == 0)
+	return 0;
+
+    rd = (uint32_t) ((rd + n) % p_b->size);
+    uint64_t rd_addr = p_b->addr + wr_off_offset (xlen) + 4;
+    if (gdbstub_be_mem_write_subword (xlen, rd_addr, rd, 4) != status_ok) {
+	n_read_errors++;
+	return 0;
+    }
+    p_ch->n_bytes += n;
+    return n;
+}
+
+// Write as much of data as fits into a down-buffer; returns the number written
+static
+size_t fill (const uint8_t xlen, uint32_t channel, const char *data, size_t len)
+{
+    Buffer b;
+    if ((desc_read (xlen, false, channel, & b) != status_ok) || (! desc_valid (& b)))
+	return 0;
+
+    // One slot is always left empty, so that full and empty differ
+    uint32_t wr    = b.wr_off;
+    uint32_t space = (b.rd_off + b.size - wr - 1) % b.size;
+    size_t   n     = ((len < space) ? len : space);
+    size_t   done  = 0;
+    while (done < n) {
+	size_t piece = b.size - wr;
+	if (piece > (n - done))
+	    piece = n - done;
+	if (gdbstub_be_mem_write (xlen, b.p_buffer + wr, & (data [done]), piece) != status_ok)
+	    break;
+	done += piece;
+	wr    = (uint32_t) ((wr + piece) % b.size);
+    }
+    if ((done != 0)
+	&& (gdbstub_be_mem_write_subword (xlen, b.addr + wr_off_offset (xlen), wr, 4) != status_ok))
+	return 0;
+    channels [channel].n_down_bytes += done;
+    return done;
+}
+
+// ****************************************************************
+// Public API
+
+// Invalidation hook (see gdbstub_be_register_invalidate)
+static
+void rtt_invalidate (const uint8_t xlen, const bool hart_reset)
+{
+    cb_stale = true;
+}
+
+void gdbstub_rtt_init (FILE *logfile, void (*console_output_fn) (const char *msg))
+{
+    logfile_fp     = logfile;
+    console_output = console_output_fn;
+    for (uint32_t j = 0; j < RTT_MAX_CHANNELS; j++) {
+	channels [j].listen_fd = -1;
+	channels [j].client_fd = -1;
+    }
+    gdbstub_be_register_invalidate (rtt_invalidate);
+}
+
+// ================================================================
+// Configuration
+
+uint32_t gdbstub_rtt_set_location (uint64_t addr, uint64_t len)
+{
+    if (running)
+	return status_err;
+    loc_addr = addr;
+    loc_len  = len;
+    loc_set  = true;
+    return status_ok;
+}
+
+uint32_t gdbstub_rtt_set_output (uint32_t channel, RTT_Out out, const char *arg)
+{
+    if (running || (channel >= RTT_MAX_CHANNELS))
+	return status_err;
+
+    Channel *p_ch = & (channels [channel]);
+    if (out == RTT_OUT_FILE) {
+	if ((arg == NULL) || (arg [0] == 0) || (strlen (arg) >= sizeof (p_ch->filename)))
+	    return status_err;
+	strcpy (p_ch->filename, arg);
+    }
+    else if (out == RTT_OUT_SOCKET) {
+	char *end;
+	unsigned long port = ((arg == NULL) ? 0 : strtoul (arg, & end, 0));
+	if ((arg == NULL) || (end == arg) || (*end != 0) || (port == 0) || (port > 0xFFFF))
+	    return status_err;
+	p_ch->port = (uint16_t) port;
+    }
+    else if ((out == RTT_OUT_GDB) && (console_output == NULL))
+	return status_err;
+
+    p_ch->out = out;
+    return status_ok;
+}
+
+uint32_t gdbstub_rtt_set_period (uint64_t min_usecs, uint64_t max_usecs)
+{
+    if ((min_usecs == 0) || (max_usecs < min_usecs))
+	return status_err;
+    period_min = min_usecs;
+    period_max = max_usecs;
+    return status_ok;
+}
+
+// ================================================================
+
+uint32_t gdbstub_rtt_start (const uint8_t xlen)
+{
+    if (running)
+	return status_err;
+
+    uint64_t addr;
+    uint32_t status;
+    if (! loc_set) {
+	if (gdbstub_be_elf_symbol (RTT_DEFAULT_SYMBOL, & addr) != status_ok) {
+	    if (logfile_fp != NULL)
+		fprintf (logfile_fp, "gdbstub_rtt_start: no location, and no symbol %s\n", RTT_DEFAULT_SYMBOL);
+	    return status_err;
+	}
+	status = header_read (xlen, addr);
+    }
+    else if (loc_len == 0)
+	status = header_read (xlen, loc_addr);
+    else
+	status = scan (xlen, loc_addr, loc_len);
+
+    if (status != status_ok) {
+	if (logfile_fp != NULL) {
+	    fprintf (logfile_fp, "gdbstub_rtt_start: control block not found\n");
+	    fflush (logfile_fp);
+	}
+	return status_err;
+    }
+
+    for (uint32_t j = 0; j < RTT_MAX_CHANNELS; j++) {
+	Channel *p_ch = & (channels [j]);
+	p_ch->n_bytes      = 0;
+	p_ch->n_down_bytes = 0;
+	p_ch->n_pending    = 0;
+	if ((j >= n_up) || (p_ch->out == RTT_OUT_NONE) || (p_ch->out == RTT_OUT_GDB))
+	    continue;
+	if (p_ch->out == RTT_OUT_FILE)
+	    p_ch->fp = fopen (p_ch->filename, "wb");
+	else
+	    p_ch->listen_fd = open_listener (p_ch->port);
+	if ((p_ch->fp == NULL) && (p_ch->listen_fd < 0)) {
+	    if (logfile_fp != NULL)
+		fprintf (logfile_fp, "gdbstub_rtt_start: could not open output of channel %0d\n", j);
+	    for (uint32_t k = 0; k <= j; k++)
+		close_outputs (& (channels [k]));
+	    return status_err;
+	}
+    }
+
+    period        = period_min;
+    t_next        = 0;
+    n_polls       = 0;
+    n_busy_polls  = 0;
+    n_read_errors = 0;
+    cb_stale      = false;
+    running       = true;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_rtt_start: control block at 0x%0" PRIx64 ", %0d up, %0d down buffers\n",
+		 cb_addr, n_up, n_down);
+	fflush (logfile_fp);
+    }
+    return status_ok;
+}
+
+uint32_t gdbstub_rtt_stop (void)
+{
+    if (! running)
+	return status_err;
+    running = false;
+    for (uint32_t j = 0; j < RTT_MAX_CHANNELS; j++)
+	close_outputs (& (channels [j]));
+    return status_ok;
+}
+
+bool gdbstub_rtt_running (void)
+{
+    return running;
+}
+
+void gdbstub_rtt_status (char *buf, const size_t buf_size)
+{
+    static const char *out_names [] = { "none", "gdb", "file", "tcp" };
+    size_t n;
+
+    if (running)
+	n = (size_t) snprintf (buf, buf_size,
+			       "RTT running: control block at 0x%0" PRIx64 ", %0d up, %0d down buffers\n"
+			       "    poll period %0" PRId64 " usecs (%0" PRId64 "..%0" PRId64 "),"
+			       " %0" PRId64 " polls (%0" PRId64 " with data), %0" PRId64 " errors\n",
+			       cb_addr, n_up, n_down, period, period_min, period_max,
+			       n_polls, n_busy_polls, n_read_errors);
+    else
+	n = (size_t) snprintf (buf, buf_size, "RTT stopped\n");
+
+    for (uint32_t j = 0; (j < RTT_MAX_CHANNELS) && (n < buf_size); j++) {
+	Channel *p_ch = & (channels [j]);
+	if (p_ch->out == RTT_OUT_NONE)
+	    continue;
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "    up %0d -> %s", j, out_names [p_ch->out]);
+	if ((n < buf_size) && (p_ch->out == RTT_OUT_FILE))
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, " %s", p_ch->filename);
+	else if ((n < buf_size) && (p_ch->out == RTT_OUT_SOCKET))
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, " port %0d%s", p_ch->port,
+				    ((p_ch->client_fd >= 0) ? " (connected)" : ""));
+	if (n < buf_size)
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, ": %0" PRId64 " bytes up, %0" PRId64 " down\n",
+				    p_ch->n_bytes, p_ch->n_down_bytes);
+    }
+}
+
+// ================================================================
+
+uint32_t gdbstub_rtt_write (const uint8_t xlen, uint32_t channel, const char *data, size_t len)
+{
+    if ((! running) || (channel >= n_down))
+	return status_err;
+    size_t n = fill (xlen, channel, data, len);
+    return ((n == len) ? status_ok : status_err);
+}
+
+// ================================================================
+
+void gdbstub_rtt_tick (const uint8_t xlen, bool may_stream)
+{
+    if (! running)
+	return;
+
+    for (uint32_t j = 0; j < n_up; j++)
+	service_socket (& (channels [j]));
+
+    uint64_t now = usecs_now ();
+    if (now < t_next)
+	return;
+    n_polls++;
+
+    // After a Debug Module recovery the target may be setting the
+    // control block up again; wait until it is valid
+    if (cb_stale) {
+	if (header_read (xlen, cb_addr) != status_ok) {
+	    t_next = now + period_max;
+	    return;
+	}
+	cb_stale = false;
+    }
+
+    // All up-buffer descriptors in one SBA read
+    static uint8_t descs [RTT_MAX_CHANNELS * 32];
+    uint32_t d_size = desc_size (xlen);
+    bool     busy   = false;
+    if (gdbstub_be_mem_read (xlen, desc_addr (xlen, true, 0), (char *) descs, n_up * d_size) != status_ok)
+	n_read_errors++;
+    else {
+	for (uint32_t j = 0; j < n_up; j++) {
+	    if (channels [j].out == RTT_OUT_NONE)
+		continue;
+	    Buffer b;
+	    desc_decode (xlen, & (descs [j * d_size]), desc_addr (xlen, true, j), & b);
+	    if (drain (xlen, j, & b, may_stream) != 0)
+		busy = true;
+	}
+    }
+
+    // Input from TCP clients
+    for (uint32_t j = 0; (j < n_up) && (j < n_down); j++) {
+	Channel *p_ch = & (channels [j]);
+	if (p_ch->n_pending == 0)
+	    continue;
+	size_t n = fill (xlen, j, p_ch->pending, p_ch->n_pending);
+	if (n != 0) {
+	    memmove (p_ch->pending, & (p_ch->pending [n]), p_ch->n_pending - n);
+	    p_ch->n_pending -= n;
+	    busy = true;
+	}
+    }
+
+    // Adapt the polling period
+    if (busy) {
+	n_busy_polls++;
+	period = period_min;
+    }
+    else if (period < period_max) {
+	period = (((2 * period) < period_max) ? (2 * period) : period_max);
+    }
+    t_next = now + period;
+}
+
+// ================================================================
@@ -0,0 +1,105 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// RTT ("Real Time Transfer") channels.
+
+// The target keeps a control block in RAM, laid out like SEGGER's RTT:
+//     char     id [16];              "SEGGER RTT"
+//     int32_t  max_num_up_buffers;
+//     int32_t  max_num_down_buffers;
+//     Buffer   up   [max_num_up_buffers];      target -> host
+//     Buffer   down [max_num_down_buffers];    host -> target
+// where each Buffer is
+//     char    *name;
+//     char    *p_buffer;
+//     uint32_t size;
+//     uint32_t wr_off;
+//     uint32_t rd_off;
+//     uint32_t flags;
+// (pointers are XLEN bits).  The target writes into up-buffers and
+// advances wr_off; while the hart runs, the stub reads the new bytes
+// through System Bus Access and advances rd_off.  For down-buffers the
+// roles are reversed.
+
+// The control block is found by symbol (default "_SEGGER_RTT"), at a
+// given address, or by scanning a memory region for the id string.
+
+// Each up-buffer can be forwarded to GDB's console ('O' packets, only
+// while GDB is waiting for the hart to stop), to a file, or to a local
+// TCP port.  Bytes received on the TCP port are written into the
+// down-buffer of the same index.  Data is left in the target's buffer
+// while its destination cannot take it (GDB not waiting, no TCP client).
+
+// Polling is adaptive: the period drops to the minimum as soon as data
+// flows, and doubles on each idle poll up to the maximum.
+
+// ================================================================
+
+#pragma once
+
+// ================================================================
+// Where an up-buffer's data goes
+
+typedef enum { RTT_OUT_NONE,
+	       RTT_OUT_GDB,
+	       RTT_OUT_FILE,
+	       RTT_OUT_SOCKET
+} RTT_Out;
+
+// ================================================================
+// Initialize (called once per GDB session).
+// console_output is used for RTT_OUT_GDB.
+
+extern
+void gdbstub_rtt_init (FILE *logfile, void (*console_output) (const char *msg));
+
+// ================================================================
+// Configuration ('monitor' commands).  All return status_ok or status_err.
+
+// Where to look for the control block: at 'addr' if len == 0,
+// otherwise anywhere in [addr, addr + len).
+extern
+uint32_t gdbstub_rtt_set_location (uint64_t addr, uint64_t len);
+
+// Destination of up-buffer 'channel'.
+// arg is the filename for RTT_OUT_FILE, the TCP port for RTT_OUT_SOCKET.
+extern
+uint32_t gdbstub_rtt_set_output (uint32_t channel, RTT_Out out, const char *arg);
+
+// Polling period bounds
+extern
+uint32_t gdbstub_rtt_set_period (uint64_t min_usecs, uint64_t max_usecs);
+
+// ================================================================
+// Locate the control block and start polling; stop polling.
+
+extern
+uint32_t gdbstub_rtt_start (const uint8_t xlen);
+
+extern
+uint32_t gdbstub_rtt_stop (void);
+
+extern
+bool gdbstub_rtt_running (void);
+
+// Status and statistics (NUL-terminated, into buf)
+extern
+void gdbstub_rtt_status (char *buf, const size_t buf_size);
+
+// ================================================================
+// Write bytes into down-buffer 'channel'.
+// Returns status_err if the channel does not exist or has no room for
+// all of them (as many as fit are written).
+
+extern
+uint32_t gdbstub_rtt_write (const uint8_t xlen, uint32_t channel, const char *data, size_t len);
+
+// ================================================================
+// Drain up-buffers and fill down-buffers if a poll is due.
+// may_stream: GDB is waiting for a stop reply, so 'O' packets may be sent.
+
+extern
+void gdbstub_rtt_tick (const uint8_t xlen, bool may_stream);
+
+// ================================================================
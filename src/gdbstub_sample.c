@@ -0,0 +1,325 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Live variable sampling (see gdbstub_sample.h)
+
+// ================================================================
+// C lib includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+// ----------------
+// Local includes
+
+#include "gdbstub_be.h"
+#include "gdbstub_sample.h"
+
+// ****************************************************************
+// Private definitions
+
+#define SAMPLE_MAX_CHANNELS   64
+#define SAMPLE_MAX_NAME       32
+#define SAMPLE_RATE_DEFAULT   100       // Hz
+
+static FILE *logfile_fp = NULL;
+static void (*console_output) (const char *msg) = NULL;
+
+typedef struct {
+    uint64_t  addr;
+    uint32_t  width;                     // 1, 2, 4 or 8 bytes
+    char      name [SAMPLE_MAX_NAME];
+    uint8_t   bytes [8];                 // memory channel: the last sample
+    int32_t   csr;                       // CSR channel: the CSR (else -1)
+    uint64_t  csr_value;                 // CSR channel: the last sample
+} Channel;
+
+static Channel  channels [SAMPLE_MAX_CHANNELS];
+static uint32_t n_channels = 0;
+
+// The memory channels, read with gdbstub_be_mem_read_sg; with merge,
+// nearby ones share an SBA burst, else each is read at its own width
+// (for device registers)
+static BE_Mem_Item items [SAMPLE_MAX_CHANNELS];
+static uint32_t    n_items  = 0;
+static bool        merge    = true;
+static uint32_t    n_bursts = 0;    // SBA reads/bursts per sample
+
+static uint64_t   rate_hz = SAMPLE_RATE_DEFAULT;
+static Sample_Out out     = SAMPLE_OUT_NONE;
+static char       out_filename [1024];
+static FILE      *out_fp  = NULL;
+
+// Current run
+static bool     running = false;
+static uint64_t t_start;           // usecs
+static uint64_t t_next;            // usecs since t_start
+static uint64_t period;            // usecs
+static uint64_t n_samples;
+static uint64_t n_dropped;         // due while we were busy
+static uint64_t n_not_streamed;    // GDB not waiting, so not sent
+static uint64_t n_read_errors;
+static uint64_t t_last;            // usecs since t_start, of last sample
+
+// ================================================================
+
+// The memory channels, as items for gdbstub_be_mem_read_sg
+static
+void plan_items (void)
+{
+    n_items = 0;
+    for (uint32_t j = 0; j < n_channels; j++)
+	if (channels [j].csr < 0) {
+	    items [n_items].addr = channels [j].addr;
+	    items [n_items].len  = channels [j].width;
+	    items [n_items].dst  = channels [j].bytes;
+	    n_items++;
+	}
+    n_bursts = 0;
+}
+
+static
+uint64_t channel_value (const Channel *p_ch)
+{
+    if (p_ch->csr >= 0)
+	return p_ch->csr_value;
+
+    uint64_t v = 0;
+    for (uint32_t j = 0; j < p_ch->width; j++)
+	v |= ((uint64_t) p_ch->bytes [j]) << (8 * j);
+    return v;
+}
+
+// ****************************************************************
+// Public API
+
+void gdbstub_sample_init (FILE *logfile, void (*console_output_fn) (const char *msg))
+{
+    logfile_fp     = logfile;
+    console_output = console_output_fn;
+}
+
+// ================================================================
+// Configuration
+
+uint32_t gdbstub_sample_add (uint64_t addr, uint32_t width, const char *name)
+{
+    if (running || (n_channels == SAMPLE_MAX_CHANNELS))
+	return status_err;
+    if ((width != 1) && (width != 2) && (width != 4) && (width != 8))
+	return status_err;
+
+    Channel *p_ch = & (channels [n_channels]);
+    p_ch->addr  = addr;
+    p_ch->width = width;
+    p_ch->csr   = -1;
+    if ((name != NULL) && (name [0] != 0))
+	snprintf (p_ch->name, SAMPLE_MAX_NAME, "%s", name);
+    else
+	snprintf (p_ch->name, SAMPLE_MAX_NAME, "0x%0" PRIx64, addr);
+    n_channels++;
+    return status_ok;
+}
+
+uint32_t gdbstub_sample_add_csr (uint16_t csr, const char *name)
+{
+    if (running || (n_channels == SAMPLE_MAX_CHANNELS) || (csr > 0xFFF))
+	return status_err;
+
+    Channel *p_ch = & (channels [n_channels]);
+    p_ch->addr      = 0;
+    p_ch->width     = 8;
+    p_ch->csr       = csr;
+    p_ch->csr_value = 0;
+    if ((name != NULL) && (name [0] != 0))
+	snprintf (p_ch->name, SAMPLE_MAX_NAME, "%s", name);
+    else
+	snprintf (p_ch->name, SAMPLE_MAX_NAME, "csr_0x%03x", csr);
+    n_channels++;
+    return status_ok;
+}
+
+uint32_t gdbstub_sample_clear (void)
+{
+    if (running)
+	return status_err;
+    n_channels = 0;
+    return status_ok;
+}
+
+uint32_t gdbstub_sample_set_rate (uint64_t hz)
+{
+    if ((hz == 0) || (hz > 1000000) || running)
+	return status_err;
+    rate_hz = hz;
+    return status_ok;
+}
+
+uint32_t gdbstub_sample_set_merge (bool m)
+{
+    if (running)
+	return status_err;
+    merge = m;
+    return status_ok;
+}
+
+uint32_t gdbstub_sample_set_output (Sample_Out o, const char *filename)
+{
+    if (running)
+	return status_err;
+    if ((o == SAMPLE_OUT_CSV) || (o == SAMPLE_OUT_BIN)) {
+	if ((filename == NULL) || (filename [0] == 0) || (strlen (filename) >= sizeof (out_filename)))
+	    return status_err;
+	strcpy (out_filename, filename);
+    }
+    out = o;
+    return status_ok;
+}
+
+// ================================================================
+
+uint32_t gdbstub_sample_start (void)
+{
+    if (running || (n_channels == 0) || (out == SAMPLE_OUT_NONE))
+	return status_err;
+    if ((out == SAMPLE_OUT_GDB) && (console_output == NULL))
+	return status_err;
+
+    if ((out == SAMPLE_OUT_CSV) || (out == SAMPLE_OUT_BIN)) {
+	out_fp = fopen (out_filename, ((out == SAMPLE_OUT_CSV) ? "w" : "wb"));
+	if (out_fp == NULL) {
+	    if (logfile_fp != NULL)
+		fprintf (logfile_fp, "gdbstub_sample_start: could not open '%s'\n", out_filename);
+	    return status_err;
+	}
+	if (out == SAMPLE_OUT_CSV) {
+	    fprintf (out_fp, "time_us");
+	    for (uint32_t j = 0; j < n_channels; j++)
+		fprintf (out_fp, ",%s", channels [j].name);
+	    fprintf (out_fp, "\n");
+	}
+    }
+
+    plan_items ();
+
+    period         = 1000000 / rate_hz;
+    t_start        = usecs_now ();
+    t_next         = 0;
+    t_last         = 0;
+    n_samples      = 0;
+    n_dropped      = 0;
+    n_not_streamed = 0;
+    n_read_errors  = 0;
+    running        = true;
+
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_sample_start: %0d channels (%0d in memory, merge %s), %0" PRId64 " Hz\n",
+		 n_channels, n_items, (merge ? "on" : "off"), rate_hz);
+	fflush (logfile_fp);
+    }
+    return status_ok;
+}
+
+uint32_t gdbstub_sample_stop (void)
+{
+    if (! running)
+	return status_err;
+    running = false;
+    if (out_fp != NULL) {
+	fclose (out_fp);
+	out_fp = NULL;
+    }
+    return status_ok;
+}
+
+bool gdbstub_sample_running (void)
+{
+    return running;
+}
+
+void gdbstub_sample_status (char *buf, const size_t buf_size)
+{
+    uint64_t elapsed  = (running ? (usecs_now () - t_start) : t_last);
+    uint64_t achieved = ((elapsed == 0) ? 0 : ((n_samples * 1000000) / elapsed));
+
+    size_t n = (size_t) snprintf (buf, buf_size,
+				  "Sampling %s: %0d channels in %0d SBA reads/bursts (merge %s), rate %0" PRId64 " Hz"
+				  " (achieved %0" PRId64 " Hz)\n"
+				  "    %0" PRId64 " samples, %0" PRId64 " dropped, %0" PRId64 " not streamed,"
+				  " %0" PRId64 " read errors\n",
+				  (running ? "running" : "stopped"), n_channels, n_bursts, (merge ? "on" : "off"),
+				  rate_hz, achieved,
+				  n_samples, n_dropped, n_not_streamed, n_read_errors);
+    for (uint32_t j = 0; (j < n_channels) && (n < buf_size); j++) {
+	if (channels [j].csr >= 0)
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, "    %-16s CSR 0x%03x\n",
+				    channels [j].name, channels [j].csr);
+	else
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, "    %-16s 0x%0" PRIx64 " (%0d bytes)\n",
+				    channels [j].name, channels [j].addr, channels [j].width);
+    }
+}
+
+// ================================================================
+// Take a sample if one is due
+
+void gdbstub_sample_tick (const uint8_t xlen, bool may_stream)
+{
+    if (! running)
+	return;
+
+    uint64_t now = usecs_now () - t_start;
+    if (now < t_next)
+	return;
+
+    // Samples that fell due while we were busy elsewhere are lost
+    uint64_t missed = (now - t_next) / period;
+    n_dropped += missed;
+    t_next    += (missed + 1) * period;
+
+    // Read the memory channels
+    if (gdbstub_be_mem_read_sg (xlen, items, n_items, merge, & n_bursts) != status_ok) {
+	n_read_errors++;
+	return;
+    }
+    for (uint32_t j = 0; j < n_channels; j++) {
+	Channel *p_ch = & (channels [j]);
+	if ((p_ch->csr >= 0)
+	    && (gdbstub_be_csr_sample (xlen, (uint16_t) p_ch->csr, & (p_ch->csr_value)) != status_ok)) {
+	    n_read_errors++;
+	    return;
+	}
+    }
+    n_samples++;
+    t_last = now;
+
+    if (out == SAMPLE_OUT_BIN) {
+	uint64_t rec [1 + SAMPLE_MAX_CHANNELS];
+	rec [0] = now;
+	for (uint32_t j = 0; j < n_channels; j++)
+	    rec [1 + j] = channel_value (& (channels [j]));
+	fwrite (rec, sizeof (uint64_t), 1 + n_channels, out_fp);
+    }
+    else {
+	char   line [32 + (SAMPLE_MAX_CHANNELS * 24)];
+	size_t n = (size_t) snprintf (line, sizeof (line), "%0" PRId64, now);
+	for (uint32_t j = 0; j < n_channels; j++)
+	    n += (size_t) snprintf (& (line [n]), sizeof (line) - n, ",0x%0" PRIx64,
+				    channel_value (& (channels [j])));
+	snprintf (& (line [n]), sizeof (line) - n, "\n");
+
+	if (out == SAMPLE_OUT_CSV)
+	    fputs (line, out_fp);
+	else if (may_stream)
+	    console_output (line);
+	else
+	    n_not_streamed++;
+    }
+}
+
+// ================================================================
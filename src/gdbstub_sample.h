@@ -0,0 +1,95 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Live variable sampling.
+
+// A set of (address, width) channels is read through System Bus Access
+// at a fixed rate, without halting the hart, with gdbstub_be_mem_read_sg.
+// Channels at nearby addresses are read together, in one SBA burst,
+// unless merging is turned off (for device registers, which must be
+// read each at its own width).  Each sample is
+// timestamped (microseconds since sampling started) and written to a
+// CSV or binary file on the host, or streamed to GDB's console ('O'
+// packets, only while GDB is waiting for the hart to stop).
+
+// CSR channels (e.g., dpc for PC sampling, or the cycle and instret
+// counters) are read from the selected hart with gdbstub_be_csr_sample,
+// which uses the DM's Quick Access command if it has one, so that the
+// hart is stopped only for a few instructions per sample.
+
+// Binary file format: for each sample, a uint64_t timestamp followed
+// by one uint64_t per channel, in the order the channels were added
+// (in the host's byte order).
+
+// Sampling is driven by gdbstub_sample_tick (), which the front end
+// calls from its idle loop and while waiting for the hart to halt.
+// Samples that fall due while the stub is busy elsewhere are counted
+// as dropped.
+
+// ================================================================
+
+#pragma once
+
+// ================================================================
+// Where samples go
+
+typedef enum { SAMPLE_OUT_NONE,
+	       SAMPLE_OUT_CSV,
+	       SAMPLE_OUT_BIN,
+	       SAMPLE_OUT_GDB
+} Sample_Out;
+
+// ================================================================
+// Initialize (called once per GDB session).
+// console_output is used for SAMPLE_OUT_GDB.
+
+extern
+void gdbstub_sample_init (FILE *logfile, void (*console_output) (const char *msg));
+
+// ================================================================
+// Configuration ('monitor' commands).  Channels and output cannot be
+// changed while sampling.  All return status_ok or status_err.
+
+extern
+uint32_t gdbstub_sample_add (uint64_t addr, uint32_t width, const char *name);
+
+// A CSR channel (csr_addr_dpc for the PC); its samples are XLEN bits
+extern
+uint32_t gdbstub_sample_add_csr (uint16_t csr, const char *name);
+
+extern
+uint32_t gdbstub_sample_clear (void);
+
+extern
+uint32_t gdbstub_sample_set_rate (uint64_t hz);
+
+// Merge nearby memory channels into SBA bursts (the default), or not
+extern
+uint32_t gdbstub_sample_set_merge (bool merge);
+
+// filename is ignored for SAMPLE_OUT_GDB
+extern
+uint32_t gdbstub_sample_set_output (Sample_Out out, const char *filename);
+
+extern
+uint32_t gdbstub_sample_start (void);
+
+extern
+uint32_t gdbstub_sample_stop (void);
+
+extern
+bool gdbstub_sample_running (void);
+
+// Status and statistics (NUL-terminated, into buf)
+extern
+void gdbstub_sample_status (char *buf, const size_t buf_size);
+
+// ================================================================
+// Take a sample if one is due.
+// may_stream: GDB is waiting for a stop reply, so 'O' packets may be sent.
+
+extern
+void gdbstub_sample_tick (const uint8_t xlen, bool may_stream);
+
+// ================================================================
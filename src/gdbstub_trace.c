@@ -0,0 +1,787 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Tracepoints and the stub-side trace buffer (see gdbstub_trace.h)
+
+// ================================================================
+// C lib includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+// ----------------
+// Local includes
+
+#include "RVDM.h"
+#include "gdbstub_be.h"
+#include "gdbstub_trace.h"
+
+// ****************************************************************
+// Private definitions
+
+#define min(x,y)  (((x)<(y)) ? (x) : (y))
+
+#define TRACE_MAX_TRACEPOINTS    64
+#define TRACE_MAX_MEM_ACTIONS    16
+
+// Default and max size of trace buffer, in bytes
+#define TRACE_BUF_SIZE_DEFAULT   (1024 * 1024)
+#define TRACE_BUF_SIZE_MAX       (64 * 1024 * 1024)
+
+// Max bytes collected by one 'M' action
+#define TRACE_MEM_ACTION_MAX     4096
+
+// RISC-V ebreak and c.ebreak encodings
+#define INSTR_EBREAK    0x00100073
+#define INSTR_C_EBREAK  0x9002
+
+static FILE *logfile_fp = NULL;
+
+// ================================================================
+// Tracepoint definitions
+
+typedef struct {
+    int32_t   basereg;     // -1 for absolute address
+    uint64_t  offset;
+    uint32_t  len;
+} Trace_Mem_Action;
+
+typedef struct {
+    bool              valid;
+    uint32_t          tpnum;
+    uint64_t          addr;
+    bool              enabled;
+    uint64_t          pass_count;    // 0 => no limit
+    uint64_t          hit_count;
+    uint64_t          bytes_collected;
+
+    bool              collect_regs;
+    uint32_t          n_mem_actions;
+    Trace_Mem_Action  mem_actions [TRACE_MAX_MEM_ACTIONS];
+
+    // While installed: original instruction bytes at addr
+    bool              installed;
+    uint8_t           orig_instr_len;    // 2 or 4
+    uint8_t           orig_instr [4];
+} Tracepoint;
+
+static Tracepoint tracepoints [TRACE_MAX_TRACEPOINTS];
+
+// ================================================================
+// Trace buffer
+
+// Each frame in the buffer is:
+//     Trace_Frame_Hdr
+//     optional register block: 'R', then 33 x uint64_t (GPRs, PC)
+//     zero or more memory blocks: 'M', uint64_t addr, uint32_t len, data bytes
+// Multi-byte fields are stored with memcpy (no alignment in the buffer).
+
+typedef struct {
+    uint32_t  tpnum;
+    uint32_t  size;    // bytes, including this header
+    uint64_t  pc;
+} Trace_Frame_Hdr;
+
+#define TRACE_BLOCK_REGS  'R'
+#define TRACE_BLOCK_MEM   'M'
+
+static uint8_t  *trace_buf      = NULL;
+static size_t    trace_buf_size = TRACE_BUF_SIZE_DEFAULT;
+static size_t    trace_buf_used = 0;
+
+// Offsets of frames in trace_buf
+static size_t   *frame_offsets  = NULL;
+static uint32_t  frame_offsets_size = 0;
+static uint32_t  n_frames = 0;
+
+static int32_t   selected_frame = -1;
+
+// ----------------
+// Tracing status (for qTStatus)
+
+typedef enum { TRACE_NOT_RUN, TRACE_RUNNING, TRACE_STOPPED_USER,
+	       TRACE_STOPPED_PASSCOUNT, TRACE_STOPPED_FULL, TRACE_STOPPED_ERROR
+} Trace_Run_State;
+
+static Trace_Run_State run_state      = TRACE_NOT_RUN;
+static uint32_t        stop_tpnum     = 0;
+static uint64_t        n_frames_created = 0;
+
+// ================================================================
+
+static
+Tracepoint *find_tracepoint (uint32_t tpnum, uint64_t addr)
+{
+    for (size_t j = 0; j < TRACE_MAX_TRACEPOINTS; j++)
+	if (tracepoints [j].valid
+	    && (tracepoints [j].tpnum == tpnum)
+	    && (tracepoints [j].addr == addr))
+	    return & (tracepoints [j]);
+    return NULL;
+}
+
+static
+Tracepoint *find_installed_tracepoint_at (uint64_t addr)
+{
+    for (size_t j = 0; j < TRACE_MAX_TRACEPOINTS; j++)
+	if (tracepoints [j].valid
+	    && tracepoints [j].installed
+	    && (tracepoints [j].addr == addr))
+	    return & (tracepoints [j]);
+    return NULL;
+}
+
+// ================================================================
+// Write the ebreak (or the original instruction) at a tracepoint
+
+static
+uint32_t write_instr (const uint8_t xlen, Tracepoint *p_tp, bool ebreak)
+{
+    uint8_t bytes [4];
+
+    if (! ebreak)
+	memcpy (bytes, p_tp->orig_instr, p_tp->orig_instr_len);
+    else if (p_tp->orig_instr_len == 2) {
+	bytes [0] = (uint8_t) (INSTR_C_EBREAK & 0xFF);
+	bytes [1] = (uint8_t) ((INSTR_C_EBREAK >> 8) & 0xFF);
+    }
+    else {
+	bytes [0] = (uint8_t) ((INSTR_EBREAK >>  0) & 0xFF);
+	bytes [1] = (uint8_t) ((INSTR_EBREAK >>  8) & 0xFF);
+	bytes [2] = (uint8_t) ((INSTR_EBREAK >> 16) & 0xFF);
+	bytes [3] = (uint8_t) ((INSTR_EBREAK >> 24) & 0xFF);
+    }
+    return gdbstub_be_mem_write (xlen, p_tp->addr, (char *) bytes, p_tp->orig_instr_len);
+}
+
+// ================================================================
+// Append bytes to the frame being collected.
+// Returns false if the trace buffer is full.
+
+static
+bool frame_append (size_t *p_used, const void *src, size_t len)
+{
+    if ((*p_used + len) > trace_buf_size)
+	return false;
+    memcpy (& (trace_buf [*p_used]), src, len);
+    *p_used += len;
+    return true;
+}
+
+// ================================================================
+// Collect a trace frame for tracepoint p_tp (hart is halted at its addr)
+// Returns false if the frame did not fit in the trace buffer.
+
+static
+bool collect_frame (const uint8_t xlen, Tracepoint *p_tp, uint64_t pc)
+{
+    if (n_frames == frame_offsets_size) {
+	uint32_t new_size = ((frame_offsets_size == 0) ? 1024 : (2 * frame_offsets_size));
+	size_t *p = realloc (frame_offsets, new_size * sizeof (size_t));
+	if (p == NULL) return false;
+	frame_offsets      = p;
+	frame_offsets_size = new_size;
+    }
+
+    size_t           used = trace_buf_used;
+    Trace_Frame_Hdr  hdr  = { .tpnum = p_tp->tpnum, .size = 0, .pc = pc };
+    if (! frame_append (& used, & hdr, sizeof (hdr)))
+	return false;
+
+    // Registers are needed for register-relative memory actions too
+    uint64_t regs [33];
+    bool     have_regs = false;
+    bool     need_regs = p_tp->collect_regs;
+    for (uint32_t j = 0; j < p_tp->n_mem_actions; j++)
+	if (p_tp->mem_actions [j].basereg >= 0)
+	    need_regs = true;
+
+    if (need_regs) {
+	uint32_t status = gdbstub_be_GPRs_read (xlen, regs);
+	if (status != status_ok) {
+	    if (logfile_fp != NULL)
+		fprintf (logfile_fp, "ERROR: gdbstub_trace: reading registers for tracepoint %0d\n",
+			 p_tp->tpnum);
+	}
+	else {
+	    regs [32] = pc;
+	    have_regs = true;
+	}
+    }
+
+    if (p_tp->collect_regs && have_regs) {
+	uint8_t tag = TRACE_BLOCK_REGS;
+	if (! frame_append (& used, & tag, 1))           return false;
+	if (! frame_append (& used, regs, sizeof (regs))) return false;
+    }
+
+    for (uint32_t j = 0; j < p_tp->n_mem_actions; j++) {
+	Trace_Mem_Action *p_ma = & (p_tp->mem_actions [j]);
+	uint64_t addr = p_ma->offset;
+	if (p_ma->basereg >= 0) {
+	    if ((! have_regs) || (p_ma->basereg > 32))
+		continue;
+	    addr += regs [p_ma->basereg];
+	}
+	if (xlen == 32)
+	    addr = (uint32_t) addr;
+
+	uint8_t  tag = TRACE_BLOCK_MEM;
+	uint32_t len = p_ma->len;
+	if (! frame_append (& used, & tag, 1))          return false;
+	if (! frame_append (& used, & addr, sizeof (addr))) return false;
+	if (! frame_append (& used, & len, sizeof (len)))   return false;
+	if ((used + len) > trace_buf_size)
+	    return false;
+
+	// Memory is read over SBA, then un-shadowed (the range may include tracepoints)
+	char *data = (char *) & (trace_buf [used]);
+	uint32_t status = gdbstub_be_mem_read (xlen, addr, data, len);
+	if (status != status_ok) {
+	    if (logfile_fp != NULL)
+		fprintf (logfile_fp,
+			 "ERROR: gdbstub_trace: reading mem [0x%0" PRIx64 "..+%0d] for tracepoint %0d\n",
+			 addr, len, p_tp->tpnum);
+	    memset (data, 0, len);
+	}
+	gdbstub_trace_shadow_mem (addr, data, len);
+	used += len;
+    }
+
+    // Commit the frame
+    hdr.size = (uint32_t) (used - trace_buf_used);
+    memcpy (& (trace_buf [trace_buf_used]), & hdr, sizeof (hdr));
+    frame_offsets [n_frames] = trace_buf_used;
+    n_frames++;
+    n_frames_created++;
+    p_tp->bytes_collected += hdr.size;
+    trace_buf_used = used;
+    return true;
+}
+
+// ================================================================
+// Accessors for the selected frame
+
+static
+bool frame_get (uint32_t frame, Trace_Frame_Hdr *p_hdr, size_t *p_off, size_t *p_lim)
+{
+    if (frame >= n_frames)
+	return false;
+    size_t off = frame_offsets [frame];
+    memcpy (p_hdr, & (trace_buf [off]), sizeof (*p_hdr));
+    *p_off = off + sizeof (*p_hdr);
+    *p_lim = off + p_hdr->size;
+    return true;
+}
+
+// Iterate over blocks in a frame.
+// Returns the tag, or 0 at the end; *p_off advances past the block.
+// For 'R' blocks, *p_data points at the registers.
+// For 'M' blocks, *p_addr/*p_len describe the range and *p_data the bytes.
+
+static
+uint8_t frame_next_block (size_t *p_off, size_t lim,
+			  uint64_t *p_addr, uint32_t *p_len, const uint8_t **p_data)
+{
+    if (*p_off >= lim)
+	return 0;
+    uint8_t tag = trace_buf [*p_off];
+    *p_off += 1;
+    if (tag == TRACE_BLOCK_REGS) {
+	*p_data = & (trace_buf [*p_off]);
+	*p_off += 33 * sizeof (uint64_t);
+    }
+    else {
+	memcpy (p_addr, & (trace_buf [*p_off]), sizeof (*p_addr));
+	*p_off += sizeof (*p_addr);
+	memcpy (p_len, & (trace_buf [*p_off]), sizeof (*p_len));
+	*p_off += sizeof (*p_len);
+	*p_data = & (trace_buf [*p_off]);
+	*p_off += *p_len;
+    }
+    return tag;
+}
+
+// ****************************************************************
+// Public definitions
+
+// ================================================================
+// Initialize (called once per GDB session).
+
+void gdbstub_trace_init (FILE *logfile)
+{
+    logfile_fp = logfile;
+    gdbstub_trace_clear ();
+}
+
+// ================================================================
+// QTinit: discard all tracepoints and trace frames.
+
+void gdbstub_trace_clear (void)
+{
+    memset (tracepoints, 0, sizeof (tracepoints));
+    trace_buf_used   = 0;
+    n_frames         = 0;
+    n_frames_created = 0;
+    selected_frame   = -1;
+    run_state        = TRACE_NOT_RUN;
+}
+
+// ================================================================
+// QTDP: define a tracepoint
+
+uint32_t gdbstub_trace_define (uint32_t tpnum, uint64_t addr, bool enabled,
+			       uint64_t step_count, uint64_t pass_count)
+{
+    if (run_state == TRACE_RUNNING)
+	return status_err;
+
+    if (step_count != 0) {
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp, "ERROR: gdbstub_trace_define: while-stepping is not supported\n");
+	return status_err;
+    }
+
+    Tracepoint *p_tp = find_tracepoint (tpnum, addr);
+    if (p_tp == NULL) {
+	for (size_t j = 0; j < TRACE_MAX_TRACEPOINTS; j++)
+	    if (! tracepoints [j].valid) {
+		p_tp = & (tracepoints [j]);
+		break;
+	    }
+    }
+    if (p_tp == NULL) {
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp, "ERROR: gdbstub_trace_define: more than %0d tracepoints\n",
+		     TRACE_MAX_TRACEPOINTS);
+	return status_err;
+    }
+
+    memset (p_tp, 0, sizeof (*p_tp));
+    p_tp->valid      = true;
+    p_tp->tpnum      = tpnum;
+    p_tp->addr       = addr;
+    p_tp->enabled    = enabled;
+    p_tp->pass_count = pass_count;
+
+    if (logfile_fp != NULL)
+	fprintf (logfile_fp, "gdbstub_trace_define: tp %0d addr 0x%0" PRIx64 " %s pass %0" PRId64 "\n",
+		 tpnum, addr, (enabled ? "enabled" : "disabled"), pass_count);
+    return status_ok;
+}
+
+uint32_t gdbstub_trace_add_regs (uint32_t tpnum, uint64_t addr)
+{
+    Tracepoint *p_tp = find_tracepoint (tpnum, addr);
+    if (p_tp == NULL)
+	return status_err;
+    p_tp->collect_regs = true;
+    return status_ok;
+}
+
+uint32_t gdbstub_trace_add_mem (uint32_t tpnum, uint64_t addr,
+				int32_t basereg, uint64_t offset, uint32_t len)
+{
+    Tracepoint *p_tp = find_tracepoint (tpnum, addr);
+    if ((p_tp == NULL)
+	|| (p_tp->n_mem_actions == TRACE_MAX_MEM_ACTIONS)
+	|| (len == 0)
+	|| (len > TRACE_MEM_ACTION_MAX))
+	return status_err;
+
+    Trace_Mem_Action *p_ma = & (p_tp->mem_actions [p_tp->n_mem_actions]);
+    p_ma->basereg = basereg;
+    p_ma->offset  = offset;
+    p_ma->len     = len;
+    p_tp->n_mem_actions++;
+    return status_ok;
+}
+
+// ================================================================
+// QTEnable/QTDisable
+
+uint32_t gdbstub_trace_enable (uint32_t tpnum, uint64_t addr, bool enabled)
+{
+    Tracepoint *p_tp = find_tracepoint (tpnum, addr);
+    if ((p_tp == NULL) || (run_state == TRACE_RUNNING))
+	return status_err;
+    p_tp->enabled = enabled;
+    return status_ok;
+}
+
+// ================================================================
+// QTBuffer:size
+
+uint32_t gdbstub_trace_set_buffer_size (uint64_t size)
+{
+    if ((run_state == TRACE_RUNNING) || (size < 1024) || (size > TRACE_BUF_SIZE_MAX))
+	return status_err;
+
+    trace_buf_size = (size_t) size;
+    free (trace_buf);
+    trace_buf      = NULL;
+    trace_buf_used = 0;
+    n_frames       = 0;
+    selected_frame = -1;
+    return status_ok;
+}
+
+// ================================================================
+// QTStart: install the tracepoints in target memory
+
+uint32_t gdbstub_trace_start (const uint8_t xlen)
+{
+    if (run_state == TRACE_RUNNING)
+	return status_err;
+
+    if (trace_buf == NULL) {
+	trace_buf = malloc (trace_buf_size);
+	if (trace_buf == NULL)
+	    return status_err;
+    }
+    trace_buf_used   = 0;
+    n_frames         = 0;
+    n_frames_created = 0;
+    selected_frame   = -1;
+
+    for (size_t j = 0; j < TRACE_MAX_TRACEPOINTS; j++) {
+	Tracepoint *p_tp = & (tracepoints [j]);
+	if ((! p_tp->valid) || (! p_tp->enabled))
+	    continue;
+	p_tp->hit_count       = 0;
+	p_tp->bytes_collected = 0;
+
+	// Two tracepoints (e.g., for different source locations) may share an addr
+	if (find_installed_tracepoint_at (p_tp->addr) != NULL)
+	    continue;
+
+	// Save original instruction; its low two bits tell us if it's compressed
+	uint32_t status = gdbstub_be_mem_read (xlen, p_tp->addr, (char *) p_tp->orig_instr, 4);
+	if (status != status_ok)
+	    goto err;
+	p_tp->orig_instr_len = (((p_tp->orig_instr [0] & 0x3) == 0x3) ? 4 : 2);
+
+	status = write_instr (xlen, p_tp, true);
+	if (status != status_ok)
+	    goto err;
+	p_tp->installed = true;
+
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp, "gdbstub_trace_start: installed tp %0d at 0x%0" PRIx64 " (%0d-byte instr)\n",
+		     p_tp->tpnum, p_tp->addr, p_tp->orig_instr_len);
+    }
+
+    run_state = TRACE_RUNNING;
+    return status_ok;
+
+ err:
+    if (logfile_fp != NULL)
+	fprintf (logfile_fp, "ERROR: gdbstub_trace_start: could not install tracepoints\n");
+    run_state = TRACE_RUNNING;
+    gdbstub_trace_stop (xlen);
+    run_state = TRACE_STOPPED_ERROR;
+    return status_err;
+}
+
+// ================================================================
+// QTStop: remove the tracepoints from target memory
+
+static
+uint32_t trace_uninstall (const uint8_t xlen)
+{
+    uint32_t status = status_ok;
+    for (size_t j = 0; j < TRACE_MAX_TRACEPOINTS; j++) {
+	Tracepoint *p_tp = & (tracepoints [j]);
+	if (p_tp->valid && p_tp->installed) {
+	    if (write_instr (xlen, p_tp, false) != status_ok)
+		status = status_err;
+	    p_tp->installed = false;
+	}
+    }
+    return status;
+}
+
+uint32_t gdbstub_trace_stop (const uint8_t xlen)
+{
+    if (run_state != TRACE_RUNNING)
+	return status_ok;
+
+    uint32_t status = trace_uninstall (xlen);
+    run_state = TRACE_STOPPED_USER;
+    return status;
+}
+
+bool gdbstub_trace_running (void)
+{
+    return (run_state == TRACE_RUNNING);
+}
+
+// ================================================================
+// Called by the front end when the hart has halted while tracing.
+
+bool gdbstub_trace_on_halt (const uint8_t xlen)
+{
+    if (run_state != TRACE_RUNNING)
+	return false;
+
+    // Only an ebreak at an installed tracepoint is ours
+    uint64_t dcsr, pc;
+    if (gdbstub_be_CSR_read (xlen, csr_addr_dcsr, & dcsr) != status_ok)
+	return false;
+    if (fn_dcsr_cause ((uint32_t) dcsr) != DM_DCSR_CAUSE_EBREAK)
+	return false;
+    if (gdbstub_be_PC_read (xlen, & pc) != status_ok)
+	return false;
+
+    Tracepoint *p_tp = find_installed_tracepoint_at (pc);
+    if (p_tp == NULL)
+	return false;
+
+    // Collect a frame for every enabled tracepoint at this address
+    bool stop_tracing = false;
+    for (size_t j = 0; j < TRACE_MAX_TRACEPOINTS; j++) {
+	Tracepoint *p_tpj = & (tracepoints [j]);
+	if ((! p_tpj->valid) || (! p_tpj->enabled) || (p_tpj->addr != pc))
+	    continue;
+
+	p_tpj->hit_count++;
+	if (! collect_frame (xlen, p_tpj, pc)) {
+	    if (logfile_fp != NULL)
+		fprintf (logfile_fp, "gdbstub_trace_on_halt: trace buffer full\n");
+	    run_state    = TRACE_STOPPED_FULL;
+	    stop_tracing = true;
+	    break;
+	}
+	if ((p_tpj->pass_count != 0) && (p_tpj->hit_count >= p_tpj->pass_count)) {
+	    run_state    = TRACE_STOPPED_PASSCOUNT;
+	    stop_tpnum   = p_tpj->tpnum;
+	    stop_tracing = true;
+	}
+    }
+
+    uint32_t status;
+    if (stop_tracing) {
+	// Remove all tracepoints; the hart just continues
+	status = trace_uninstall (xlen);
+    }
+    else {
+	// Step over the original instruction, and re-install the ebreak
+	status = write_instr (xlen, p_tp, false);
+	if (status == status_ok)
+	    status = gdbstub_be_step (xlen);
+	if (status == status_ok)
+	    status = write_instr (xlen, p_tp, true);
+    }
+
+    if (status == status_ok)
+	status = gdbstub_be_continue (xlen);
+
+    if (status != status_ok) {
+	if (logfile_fp != NULL)
+	    fprintf (logfile_fp, "ERROR: gdbstub_trace_on_halt: could not resume past tp %0d\n",
+		     p_tp->tpnum);
+	trace_uninstall (xlen);
+	run_state = TRACE_STOPPED_ERROR;
+	return false;
+    }
+    return true;
+}
+
+// ================================================================
+// qTStatus response
+
+void gdbstub_trace_status (char *buf, const size_t buf_size)
+{
+    const char *state;
+    char        state_buf [32];
+
+    switch (run_state) {
+    case TRACE_NOT_RUN:           state = "tnotrun:0"; break;
+    case TRACE_RUNNING:           state = "";          break;
+    case TRACE_STOPPED_USER:      state = "tstop::0";  break;
+    case TRACE_STOPPED_FULL:      state = "tfull:0";   break;
+    case TRACE_STOPPED_ERROR:     state = "terror:" "696e7374616c6c:0"; break;    // hex "install"
+    case TRACE_STOPPED_PASSCOUNT:
+	snprintf (state_buf, sizeof (state_buf), "tpasscount:%x", stop_tpnum);
+	state = state_buf;
+	break;
+    default:                      state = "tnotrun:0";
+    }
+
+    snprintf (buf, buf_size,
+	      "T%d%s%s;tframes:%x;tcreated:%" PRIx64 ";tfree:%zx;tsize:%zx;circular:0;disconn:0",
+	      (run_state == TRACE_RUNNING) ? 1 : 0,
+	      (state [0] != 0) ? ";" : "",
+	      state,
+	      n_frames, n_frames_created,
+	      trace_buf_size - trace_buf_used, trace_buf_size);
+}
+
+// ================================================================
+// qTP response: hit count and bytes collected for a tracepoint
+
+uint32_t gdbstub_trace_tp_status (uint32_t tpnum, uint64_t addr, char *buf, const size_t buf_size)
+{
+    Tracepoint *p_tp = find_tracepoint (tpnum, addr);
+    if (p_tp == NULL)
+	return status_err;
+    snprintf (buf, buf_size, "V%" PRIx64 ":%" PRIx64, p_tp->hit_count, p_tp->bytes_collected);
+    return status_ok;
+}
+
+// ================================================================
+// Trace frame selection (QTFrame)
+
+int32_t gdbstub_trace_find_frame (Trace_Find_Kind kind, uint64_t a, uint64_t b,
+				  uint32_t *p_tpnum)
+{
+    // Searches (other than by number) start after the current frame
+    uint32_t start = ((kind == TRACE_FIND_NUMBER) ? 0 : (uint32_t) (selected_frame + 1));
+
+    for (uint32_t f = start; f < n_frames; f++) {
+	Trace_Frame_Hdr hdr;
+	size_t          off, lim;
+	frame_get (f, & hdr, & off, & lim);
+
+	bool match;
+	switch (kind) {
+	case TRACE_FIND_NUMBER:  match = (f == a);                             break;
+	case TRACE_FIND_PC:      match = (hdr.pc == a);                        break;
+	case TRACE_FIND_TDP:     match = (hdr.tpnum == a);                     break;
+	case TRACE_FIND_RANGE:   match = ((a <= hdr.pc) && (hdr.pc <= b));     break;
+	case TRACE_FIND_OUTSIDE: match = ((hdr.pc < a) || (b < hdr.pc));       break;
+	default:                 match = false;
+	}
+	if (match) {
+	    selected_frame = (int32_t) f;
+	    *p_tpnum = hdr.tpnum;
+	    return selected_frame;
+	}
+    }
+    selected_frame = -1;
+    return -1;
+}
+
+void gdbstub_trace_unselect_frame (void)
+{
+    selected_frame = -1;
+}
+
+int32_t gdbstub_trace_selected_frame (void)
+{
+    return selected_frame;
+}
+
+// ================================================================
+// Reads from the selected trace frame
+
+uint32_t gdbstub_trace_frame_reg_read (uint32_t regnum, uint64_t *p_val)
+{
+    Trace_Frame_Hdr hdr;
+    size_t          off, lim;
+
+    if ((selected_frame < 0) || (! frame_get ((uint32_t) selected_frame, & hdr, & off, & lim)))
+	return status_err;
+
+    // The PC is always known
+    if (regnum == 0x20) {
+	*p_val = hdr.pc;
+	return status_ok;
+    }
+    if (regnum > 0x20)
+	return status_err;
+
+    uint64_t       addr;
+    uint32_t       len;
+    const uint8_t *data;
+    uint8_t        tag;
+    while ((tag = frame_next_block (& off, lim, & addr, & len, & data)) != 0) {
+	if (tag == TRACE_BLOCK_REGS) {
+	    memcpy (p_val, & (data [regnum * sizeof (uint64_t)]), sizeof (uint64_t));
+	    return status_ok;
+	}
+    }
+    return status_err;
+}
+
+uint32_t gdbstub_trace_frame_mem_read (uint64_t addr, char *data, const size_t len)
+{
+    Trace_Frame_Hdr hdr;
+    size_t          off, lim;
+
+    if ((selected_frame < 0) || (! frame_get ((uint32_t) selected_frame, & hdr, & off, & lim)))
+	return status_err;
+
+    // Every byte in [addr, addr + len) must have been collected
+    // (possibly by several memory blocks)
+    size_t n_filled = 0;
+    bool   progress = true;
+    while ((n_filled < len) && progress) {
+	progress = false;
+	size_t         boff = off;
+	uint64_t       baddr;
+	uint32_t       blen;
+	const uint8_t *bdata;
+	uint8_t        tag;
+	uint64_t       want = addr + n_filled;
+	while ((tag = frame_next_block (& boff, lim, & baddr, & blen, & bdata)) != 0) {
+	    if ((tag == TRACE_BLOCK_MEM) && (baddr <= want) && (want < (baddr + blen))) {
+		size_t n = min ((size_t) (baddr + blen - want), len - n_filled);
+		memcpy (& (data [n_filled]), & (bdata [want - baddr]), n);
+		n_filled += n;
+		progress  = true;
+		break;
+	    }
+	}
+    }
+    return ((n_filled == len) ? status_ok : status_err);
+}
+
+void gdbstub_trace_frame_info (char *buf, const size_t buf_size)
+{
+    Trace_Frame_Hdr hdr;
+    size_t          off, lim;
+    size_t          n = 0;
+
+    n += (size_t) snprintf (& (buf [n]), buf_size - n, "<traceframe-info>\n");
+
+    if ((selected_frame >= 0) && frame_get ((uint32_t) selected_frame, & hdr, & off, & lim)) {
+	uint64_t       addr;
+	uint32_t       len;
+	const uint8_t *data;
+	uint8_t        tag;
+	while (((tag = frame_next_block (& off, lim, & addr, & len, & data)) != 0)
+	       && (n < buf_size)) {
+	    if (tag == TRACE_BLOCK_MEM)
+		n += (size_t) snprintf (& (buf [n]), buf_size - n,
+					"<memory start=\"0x%" PRIx64 "\" length=\"0x%x\"/>\n",
+					addr, len);
+	}
+    }
+    if (n < buf_size)
+	snprintf (& (buf [n]), buf_size - n, "</traceframe-info>\n");
+}
+
+// ================================================================
+// Patch original instruction bytes over our ebreaks in memory read back
+
+void gdbstub_trace_shadow_mem (const uint64_t addr, char *data, const size_t len)
+{
+    for (size_t j = 0; j < TRACE_MAX_TRACEPOINTS; j++) {
+	Tracepoint *p_tp = & (tracepoints [j]);
+	if ((! p_tp->valid) || (! p_tp->installed))
+	    continue;
+	for (uint8_t k = 0; k < p_tp->orig_instr_len; k++) {
+	    uint64_t a = p_tp->addr + k;
+	    if ((addr <= a) && (a < (addr + len)))
+		data [a - addr] = (char) p_tp->orig_instr [k];
+	}
+    }
+}
+
+// ================================================================
@@ -0,0 +1,142 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Tracepoints and the stub-side trace buffer.
+
+// GDB downloads tracepoint definitions (QTDP), starts tracing
+// (QTStart) and continues the target.  Each tracepoint is installed
+// as an ebreak; when the hart halts on one, the registers and memory
+// ranges requested by its actions are collected into the trace
+// buffer here in the stub, the original instruction is stepped over,
+// and the hart is resumed, all without involving GDB.  After tracing
+// stops, GDB selects trace frames (QTFrame) and reads them with the
+// usual 'g', 'p' and 'm' packets, which are then served from the
+// trace buffer.
+
+// ================================================================
+
+#pragma once
+
+// ================================================================
+// Kinds of frame searches (QTFrame variants)
+
+typedef enum { TRACE_FIND_NUMBER,     // QTFrame:n
+	       TRACE_FIND_PC,         // QTFrame:pc:addr
+	       TRACE_FIND_TDP,        // QTFrame:tdp:t
+	       TRACE_FIND_RANGE,      // QTFrame:range:start:end
+	       TRACE_FIND_OUTSIDE     // QTFrame:outside:start:end
+} Trace_Find_Kind;
+
+// ================================================================
+// Initialize (called once per GDB session).
+
+extern
+void gdbstub_trace_init (FILE *logfile);
+
+// ================================================================
+// QTinit: discard all tracepoints and trace frames.
+
+extern
+void gdbstub_trace_clear (void);
+
+// ================================================================
+// QTDP: define a tracepoint, and add actions to it.
+// All return status_ok or status_err.
+
+extern
+uint32_t gdbstub_trace_define (uint32_t tpnum, uint64_t addr, bool enabled,
+			       uint64_t step_count, uint64_t pass_count);
+
+extern
+uint32_t gdbstub_trace_add_regs (uint32_t tpnum, uint64_t addr);
+
+extern
+uint32_t gdbstub_trace_add_mem (uint32_t tpnum, uint64_t addr,
+				int32_t basereg, uint64_t offset, uint32_t len);
+
+// ================================================================
+// QTEnable/QTDisable
+
+extern
+uint32_t gdbstub_trace_enable (uint32_t tpnum, uint64_t addr, bool enabled);
+
+// ================================================================
+// QTBuffer:size
+
+extern
+uint32_t gdbstub_trace_set_buffer_size (uint64_t size);
+
+// ================================================================
+// QTStart/QTStop: install/remove the tracepoints in target memory.
+
+extern
+uint32_t gdbstub_trace_start (const uint8_t xlen);
+
+extern
+uint32_t gdbstub_trace_stop (const uint8_t xlen);
+
+extern
+bool gdbstub_trace_running (void);
+
+// ================================================================
+// Called by the front end when the hart has halted while tracing.
+// If the halt was a tracepoint hit, the frame is collected and the
+// hart is resumed; returns true in that case, i.e., GDB is not told
+// about the halt.
+
+extern
+bool gdbstub_trace_on_halt (const uint8_t xlen);
+
+// ================================================================
+// qTStatus and qTP responses (NUL-terminated, into buf)
+
+extern
+void gdbstub_trace_status (char *buf, const size_t buf_size);
+
+extern
+uint32_t gdbstub_trace_tp_status (uint32_t tpnum, uint64_t addr, char *buf, const size_t buf_size);
+
+// ================================================================
+// Trace frame selection (QTFrame).
+// Returns the selected frame number, or -1 if none was found
+// (in which case no frame is selected).
+// On success, *p_tpnum is the tracepoint which created the frame.
+
+extern
+int32_t gdbstub_trace_find_frame (Trace_Find_Kind kind, uint64_t a, uint64_t b,
+				  uint32_t *p_tpnum);
+
+// Stop looking at trace frames (QTFrame:-1)
+extern
+void gdbstub_trace_unselect_frame (void);
+
+// Frame currently selected, -1 if none
+extern
+int32_t gdbstub_trace_selected_frame (void);
+
+// ================================================================
+// Reads from the selected trace frame.
+// Register numbers are GDB's: 0..31 GPRs, 0x20 PC.
+// Return status_err if the value was not collected.
+
+extern
+uint32_t gdbstub_trace_frame_reg_read (uint32_t regnum, uint64_t *p_val);
+
+extern
+uint32_t gdbstub_trace_frame_mem_read (uint64_t addr, char *data, const size_t len);
+
+// qXfer:traceframe-info:read contents of the selected frame
+// (NUL-terminated XML, into buf)
+extern
+void gdbstub_trace_frame_info (char *buf, const size_t buf_size);
+
+// ================================================================
+// While tracepoints are installed, memory read back from the target
+// contains our ebreaks.  Patch the original instruction bytes back
+// into 'data' (which was read from 'addr').
+
+extern
+void gdbstub_trace_shadow_mem (const uint64_t addr, char *data, const size_t len);
+
+// ================================================================
@@ -0,0 +1,419 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Hardware breakpoints and watchpoints (see gdbstub_watch.h)
+
+// ================================================================
+// C lib includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+// ----------------
+// Local includes
+
+#include "RVDM.h"
+#include "gdbstub_be.h"
+#include "gdbstub_watch.h"
+
+// ****************************************************************
+// Private definitions
+
+#define WATCH_MAX              16
+
+// Emulated watchpoints are read in one SBA access each
+#define WATCH_EMU_LEN_MAX      64
+
+#define WATCH_PERIOD_DEFAULT   1000    // usecs
+
+// mcontrol.hit
+#define MCONTROL_HIT           (((uint64_t) 1) << 20)
+
+static FILE *logfile_fp = NULL;
+
+typedef struct {
+    bool      valid;
+    uint32_t  type;         // WATCH_Z_...
+    uint64_t  addr;
+    uint64_t  len;
+
+    bool      hw;           // else emulated
+    uint32_t  trigger;      // if hw
+
+    // Emulated only
+    uint8_t   value [WATCH_EMU_LEN_MAX];    // as of the last poll
+    bool      value_valid;
+    bool      has_match;
+    uint64_t  match;
+} Watchpoint;
+
+static Watchpoint watchpoints [WATCH_MAX];
+
+static Watch_Mode mode   = WATCH_MODE_AUTO;
+static uint64_t   period = WATCH_PERIOD_DEFAULT;
+
+static uint64_t   last_poll_usecs = 0;
+static uint64_t   n_polls         = 0;
+
+// Emulated watchpoint hit by the last poll, -1 if none
+static int32_t    emu_hit = -1;
+
+// ================================================================
+
+static
+Watchpoint *find_watchpoint (uint32_t type, uint64_t addr, uint64_t len)
+{
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (p_wp->valid && (p_wp->type == type) && (p_wp->addr == addr) && (p_wp->len == len))
+	    return p_wp;
+    }
+    return NULL;
+}
+
+static
+Watchpoint *alloc_watchpoint (void)
+{
+    for (size_t j = 0; j < WATCH_MAX; j++)
+	if (! watchpoints [j].valid)
+	    return & (watchpoints [j]);
+    return NULL;
+}
+
+static
+uint64_t value_of (const uint8_t *bytes, uint64_t len)
+{
+    uint64_t v = 0;
+    for (uint64_t j = 0; (j < len) && (j < 8); j++)
+	v |= ((uint64_t) bytes [j]) << (8 * j);
+    return v;
+}
+
+// Read the current value of an emulated watchpoint
+static
+bool read_value (const uint8_t xlen, Watchpoint *p_wp, uint8_t *bytes)
+{
+    return (gdbstub_be_mem_read (xlen, p_wp->addr, (char *) bytes, p_wp->len) == status_ok);
+}
+
+// BE_TRIGGER_... kind for a watchpoint type
+static
+uint32_t trigger_kind (uint32_t type)
+{
+    return ((type == WATCH_Z_HW_BREAK) ? BE_TRIGGER_EXECUTE
+	    : ((type == WATCH_Z_WRITE) ? BE_TRIGGER_STORE
+	       : ((type == WATCH_Z_READ) ? BE_TRIGGER_LOAD
+		  : (BE_TRIGGER_LOAD | BE_TRIGGER_STORE))));
+}
+
+// Invalidation hook (see gdbstub_be_register_invalidate).
+// A hart reset clears the trigger module: triggers are set up again,
+// and watchpoints that no longer get one are dropped.  Emulated
+// watchpoints take a fresh value at the next poll.
+static
+void watch_invalidate (const uint8_t xlen, const bool hart_reset)
+{
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (! p_wp->valid)
+	    continue;
+	if (! p_wp->hw) {
+	    p_wp->value_valid = false;
+	    continue;
+	}
+	if (hart_reset
+	    && (gdbstub_be_trigger_insert (xlen, trigger_kind (p_wp->type), p_wp->addr, & (p_wp->trigger))
+		!= status_ok)) {
+	    p_wp->valid = false;
+	    if (logfile_fp != NULL)
+		fprintf (logfile_fp, "watch_invalidate: Z%0d at 0x%0" PRIx64 " lost its trigger; dropped\n",
+			 p_wp->type, p_wp->addr);
+	}
+    }
+    if (hart_reset)
+	emu_hit = -1;
+    if (logfile_fp != NULL)
+	fflush (logfile_fp);
+}
+
+// ****************************************************************
+// Public API
+
+void gdbstub_watch_init (FILE *logfile)
+{
+    logfile_fp = logfile;
+    memset (watchpoints, 0, sizeof (watchpoints));
+    emu_hit = -1;
+    gdbstub_be_register_invalidate (watch_invalidate);
+}
+
+// ================================================================
+// Z1..Z4
+
+uint32_t gdbstub_watch_insert (const uint8_t xlen, uint32_t type, uint64_t addr, uint64_t len)
+{
+    if ((type < WATCH_Z_HW_BREAK) || (type > WATCH_Z_ACCESS))
+	return status_err;
+
+    // GDB re-inserts breakpoints that are already in
+    if (find_watchpoint (type, addr, len) != NULL)
+	return status_ok;
+
+    Watchpoint *p_wp = alloc_watchpoint ();
+    if (p_wp == NULL)
+	return status_err;
+
+    memset (p_wp, 0, sizeof (Watchpoint));
+    p_wp->type = type;
+    p_wp->addr = addr;
+    p_wp->len  = len;
+
+    // Triggers
+    if ((type == WATCH_Z_HW_BREAK) || (mode != WATCH_MODE_EMULATED)) {
+	if (gdbstub_be_trigger_insert (xlen, trigger_kind (type), addr, & (p_wp->trigger)) == status_ok) {
+	    p_wp->hw    = true;
+	    p_wp->valid = true;
+	    return status_ok;
+	}
+	if ((type == WATCH_Z_HW_BREAK) || (mode == WATCH_MODE_HW))
+	    return status_err;
+    }
+
+    // Emulation: changes can be seen, reads cannot
+    if ((type == WATCH_Z_READ) || (len == 0) || (len > WATCH_EMU_LEN_MAX))
+	return status_err;
+
+    p_wp->hw          = false;
+    p_wp->value_valid = read_value (xlen, p_wp, p_wp->value);
+    p_wp->valid       = true;
+    if (logfile_fp != NULL) {
+	fprintf (logfile_fp, "gdbstub_watch_insert: emulating Z%0d at 0x%0" PRIx64 ", len %0" PRId64 "\n",
+		 type, addr, len);
+	fflush (logfile_fp);
+    }
+    return status_ok;
+}
+
+uint32_t gdbstub_watch_remove (const uint8_t xlen, uint32_t type, uint64_t addr, uint64_t len)
+{
+    Watchpoint *p_wp = find_watchpoint (type, addr, len);
+    if (p_wp == NULL)
+	return status_err;
+
+    uint32_t status = status_ok;
+    if (p_wp->hw)
+	status = gdbstub_be_trigger_remove (xlen, p_wp->trigger);
+    if ((emu_hit >= 0) && (& (watchpoints [emu_hit]) == p_wp))
+	emu_hit = -1;
+    p_wp->valid = false;
+    return status;
+}
+
+// ================================================================
+// Configuration
+
+void gdbstub_watch_set_mode (Watch_Mode m)
+{
+    mode = m;
+}
+
+void gdbstub_watch_set_period (uint64_t usecs)
+{
+    period = usecs;
+}
+
+uint32_t gdbstub_watch_set_match (uint64_t addr, bool has_value, uint64_t value)
+{
+    uint32_t status = status_err;
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (p_wp->valid && (! p_wp->hw) && (p_wp->addr == addr)) {
+	    p_wp->has_match = has_value;
+	    p_wp->match     = value;
+	    status = status_ok;
+	}
+    }
+    return status;
+}
+
+void gdbstub_watch_status (char *buf, const size_t buf_size)
+{
+    size_t n = (size_t) snprintf (buf, buf_size, "Watch mode %s, emulation period %0" PRId64 " usecs, %0" PRId64 " polls\n",
+				  ((mode == WATCH_MODE_AUTO) ? "auto" : ((mode == WATCH_MODE_HW) ? "hw" : "emulated")),
+				  period, n_polls);
+    for (size_t j = 0; (j < WATCH_MAX) && (n < buf_size); j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (! p_wp->valid)
+	    continue;
+	n += (size_t) snprintf (& (buf [n]), buf_size - n, "    Z%0d 0x%0" PRIx64 " len %0" PRId64 ": ",
+				p_wp->type, p_wp->addr, p_wp->len);
+	if (n >= buf_size) break;
+	if (p_wp->hw)
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, "trigger %0d\n", p_wp->trigger);
+	else if (p_wp->has_match)
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, "emulated, halt when == 0x%0" PRIx64 "\n", p_wp->match);
+	else
+	    n += (size_t) snprintf (& (buf [n]), buf_size - n, "emulated, halt on change\n");
+    }
+}
+
+// ================================================================
+// Emulated watchpoints
+
+bool gdbstub_watch_emulating (void)
+{
+    for (size_t j = 0; j < WATCH_MAX; j++)
+	if (watchpoints [j].valid && (! watchpoints [j].hw))
+	    return true;
+    return false;
+}
+
+void gdbstub_watch_arm (const uint8_t xlen)
+{
+    emu_hit = -1;
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (p_wp->valid && (! p_wp->hw))
+	    p_wp->value_valid = read_value (xlen, p_wp, p_wp->value);
+    }
+    last_poll_usecs = usecs_now ();
+}
+
+bool gdbstub_watch_poll (const uint8_t xlen)
+{
+    if (emu_hit >= 0)
+	return true;
+
+    uint64_t now = usecs_now ();
+    if ((now - last_poll_usecs) < period)
+	return false;
+    last_poll_usecs = now;
+    n_polls++;
+
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if ((! p_wp->valid) || p_wp->hw)
+	    continue;
+
+	uint8_t bytes [WATCH_EMU_LEN_MAX];
+	if (! read_value (xlen, p_wp, bytes))
+	    continue;
+
+	bool changed = ((! p_wp->value_valid) || (memcmp (bytes, p_wp->value, p_wp->len) != 0));
+	memcpy (p_wp->value, bytes, p_wp->len);
+	p_wp->value_valid = true;
+
+	bool hit = (p_wp->has_match
+		    ? (value_of (bytes, p_wp->len) == p_wp->match)
+		    : changed);
+	if (hit) {
+	    if (logfile_fp != NULL) {
+		fprintf (logfile_fp, "gdbstub_watch_poll: hit at 0x%0" PRIx64 ", value 0x%0" PRIx64 "\n",
+			 p_wp->addr, value_of (bytes, p_wp->len));
+		fflush (logfile_fp);
+	    }
+	    emu_hit = (int32_t) j;
+	    return true;
+	}
+    }
+    return false;
+}
+
+// ================================================================
+
+bool gdbstub_watch_hit (const uint8_t xlen, uint32_t *p_type, uint64_t *p_addr)
+{
+    if (emu_hit >= 0) {
+	*p_type = watchpoints [emu_hit].type;
+	*p_addr = watchpoints [emu_hit].addr;
+	emu_hit = -1;
+	return true;
+    }
+
+    // Hardware watchpoints: find the trigger that fired
+    Watchpoint *p_hw = NULL;
+    uint32_t    n_hw = 0;
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (p_wp->valid && p_wp->hw && (p_wp->type != WATCH_Z_HW_BREAK)) {
+	    p_hw = p_wp;
+	    n_hw++;
+	}
+    }
+    if (n_hw == 0)
+	return false;
+
+    uint64_t dcsr, pc;
+    if (gdbstub_be_CSR_read (xlen, csr_addr_dcsr, & dcsr) != status_ok)
+	return false;
+    if (fn_dcsr_cause ((uint32_t) dcsr) != DM_DCSR_CAUSE_TRIGGER)
+	return false;
+
+    // A hardware breakpoint here takes precedence
+    if (gdbstub_be_PC_read (xlen, & pc) != status_ok)
+	return false;
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (p_wp->valid && (p_wp->type == WATCH_Z_HW_BREAK) && (p_wp->addr == pc))
+	    return false;
+    }
+
+    // mcontrol.hit is optional; if no trigger reports it, and there is
+    // just one watchpoint, it must have been that one.
+    Watchpoint *p_found = ((n_hw == 1) ? p_hw : NULL);
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if ((! p_wp->valid) || (! p_wp->hw) || (p_wp->type == WATCH_Z_HW_BREAK))
+	    continue;
+	uint64_t tdata1;
+	if ((gdbstub_be_CSR_write (xlen, csr_addr_tselect, p_wp->trigger) != status_ok)
+	    || (gdbstub_be_CSR_read (xlen, csr_addr_tdata1, & tdata1) != status_ok))
+	    continue;
+	if ((tdata1 & MCONTROL_HIT) != 0) {
+	    gdbstub_be_CSR_write (xlen, csr_addr_tdata1, tdata1 & (~ MCONTROL_HIT));
+	    p_found = p_wp;
+	    break;
+	}
+    }
+    if (p_found == NULL)
+	return false;
+
+    *p_type = p_found->type;
+    *p_addr = p_found->addr;
+    return true;
+}
+
+// ================================================================
+// For recorded execution
+
+bool gdbstub_watch_break_at (uint64_t pc)
+{
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (p_wp->valid && (p_wp->type == WATCH_Z_HW_BREAK) && (p_wp->addr == pc))
+	    return true;
+    }
+    return false;
+}
+
+bool gdbstub_watch_store_hits (uint64_t addr, uint64_t len, uint64_t *p_addr)
+{
+    for (size_t j = 0; j < WATCH_MAX; j++) {
+	Watchpoint *p_wp = & (watchpoints [j]);
+	if (p_wp->valid
+	    && ((p_wp->type == WATCH_Z_WRITE) || (p_wp->type == WATCH_Z_ACCESS))
+	    && (addr < (p_wp->addr + p_wp->len))
+	    && (p_wp->addr < (addr + len))) {
+	    *p_addr = p_wp->addr;
+	    return true;
+	}
+    }
+    return false;
+}
+
+// ================================================================
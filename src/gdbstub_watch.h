@@ -0,0 +1,107 @@
+// Copyright (c) 2020-2024 Bluespec, Inc. All Rights Reserved
+// Author: Rishiyur Nikhil
+//
+// ================================================================
+// Hardware breakpoints and watchpoints (GDB's Z1..Z4 packets).
+
+// Breakpoints and watchpoints are set with the hart's triggers when
+// it has them.  A watchpoint can also be emulated: while the hart
+// runs, the stub reads the watched bytes through System Bus Access
+// every 'period' microseconds, and halts the hart when the value
+// changes (or, optionally, becomes equal to a given value).  This is
+// approximate (the hart will have run on a little by the time it is
+// halted, and reads cannot be detected at all), but it is orders of
+// magnitude cheaper than GDB's fallback of single-stepping the whole
+// program.
+
+// ================================================================
+
+#pragma once
+
+// ================================================================
+// Z packet types
+
+#define WATCH_Z_HW_BREAK    1
+#define WATCH_Z_WRITE       2
+#define WATCH_Z_READ        3
+#define WATCH_Z_ACCESS      4
+
+// How watchpoints are implemented
+typedef enum { WATCH_MODE_AUTO,        // triggers if available, else emulated
+	       WATCH_MODE_HW,          // triggers only
+	       WATCH_MODE_EMULATED     // emulated only
+} Watch_Mode;
+
+// ================================================================
+// Initialize (called once per GDB session).
+
+extern
+void gdbstub_watch_init (FILE *logfile);
+
+// ================================================================
+// Z1..Z4 and z1..z4.  All return status_ok or status_err.
+
+extern
+uint32_t gdbstub_watch_insert (const uint8_t xlen, uint32_t type, uint64_t addr, uint64_t len);
+
+extern
+uint32_t gdbstub_watch_remove (const uint8_t xlen, uint32_t type, uint64_t addr, uint64_t len);
+
+// ================================================================
+// Configuration ('monitor' commands)
+
+extern
+void gdbstub_watch_set_mode (Watch_Mode mode);
+
+// Polling period for emulated watchpoints
+extern
+void gdbstub_watch_set_period (uint64_t usecs);
+
+// Halt only when the emulated watchpoint at addr becomes equal to
+// 'value' (if has_value), instead of on any change.
+extern
+uint32_t gdbstub_watch_set_match (uint64_t addr, bool has_value, uint64_t value);
+
+// Status text for 'monitor watch' (NUL-terminated, into buf)
+extern
+void gdbstub_watch_status (char *buf, const size_t buf_size);
+
+// ================================================================
+// Emulated watchpoints, while the hart runs.
+
+// True if there are emulated watchpoints
+extern
+bool gdbstub_watch_emulating (void);
+
+// Called just before the hart is resumed: record the current values
+extern
+void gdbstub_watch_arm (const uint8_t xlen);
+
+// Called repeatedly while waiting for the hart to halt.
+// Reads the watched values if 'period' has elapsed since the last
+// poll; returns true on a hit.
+extern
+bool gdbstub_watch_poll (const uint8_t xlen);
+
+// ================================================================
+// Which watchpoint, if any, caused the last halt.
+// Called after the hart has halted; returns true (with the Z type and
+// address of the watchpoint) if it was a watchpoint.  Clears the hit.
+
+extern
+bool gdbstub_watch_hit (const uint8_t xlen, uint32_t *p_type, uint64_t *p_addr);
+
+// ================================================================
+// For execution recorded in the stub (gdbstub_record.h), where every
+// PC and store is known.
+
+// True if there is a hardware breakpoint (Z1) at pc
+extern
+bool gdbstub_watch_break_at (uint64_t pc);
+
+// True if a store to [addr, addr + len) overlaps a write or access
+// watchpoint (whose address is returned in *p_addr)
+extern
+bool gdbstub_watch_store_hits (uint64_t addr, uint64_t len, uint64_t *p_addr);
+
+// ================================================================